@@ -0,0 +1,165 @@
+#include "lod_chain.h"
+#include "vertex_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// simplification stops around this many triangles
+static size_t const MIN_TRIANGLES = 64;
+// or once a level comes out this close to the one before
+static float const MIN_REDUCTION = 0.9f;
+
+// file layout: magic, version, source hash, counts, vertices, indices, levels, meshlets
+static char const CACHE_MAGIC[4] = { 'L', 'O', 'D', 'C' };
+static uint32_t const CACHE_VERSION = 3;
+
+uint64_t file_hash(string const& path) {
+    ifstream in(path.c_str(), std::ios::binary);
+    if (!in.good()) {
+        return 0;
+    }
+    uint64_t hash = 14695981039346656037ULL;
+    char buffer[4096];
+    while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+        for (std::streamsize i = 0; i < in.gcount(); ++i) {
+            hash ^= (unsigned char)buffer[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+LodChain::LodChain() {}
+
+void LodChain::build(IndexedMesh const& mesh) {
+    mesh_ = mesh;
+    indices_ = mesh.indices;
+    levels_.clear();
+    meshlets_.clear();
+    LodLevel const full = { 0, indices_.size(), 0, 0, 0 };
+    levels_.push_back(full);
+
+    vector<uint32_t> previous = mesh.indices;
+    vector<uint32_t> simplified;
+    float error = 0;
+    while (previous.size() / 3 > MIN_TRIANGLES) {
+        size_t const target = std::max(MIN_TRIANGLES, previous.size() / 6);
+        error = std::max(error, simplify(mesh_, previous, target, simplified));
+        if (simplified.size() > previous.size() * MIN_REDUCTION) {
+            break;
+        }
+        LodLevel const level = { indices_.size(), simplified.size(), error, 0, 0 };
+        levels_.push_back(level);
+        indices_.insert(indices_.end(), simplified.begin(), simplified.end());
+        previous.swap(simplified);
+    }
+
+    // The split decides the order of a level's triangles, so the cache
+    // order is made inside every meshlet afterwards; ordering the level
+    // before it only changes the seeds, and gives more meshlets.
+    for (size_t i = 0; i < levels_.size(); ++i) {
+        LodLevel& level = levels_[i];
+        level.first_meshlet = meshlets_.size();
+        build_meshlets(mesh_, indices_, level.first_index, level.index_count, meshlets_);
+        level.meshlet_count = meshlets_.size() - level.first_meshlet;
+        for (size_t m = level.first_meshlet; m < meshlets_.size(); ++m) {
+            optimize_vertex_cache(indices_, meshlets_[m].first_index, meshlets_[m].index_count);
+        }
+    }
+    optimize_vertex_fetch(mesh_, indices_);
+}
+
+template<typename T>
+static void write_vector(std::ofstream& out, vector<T> const& v) {
+    uint32_t const size = uint32_t(v.size());
+    out.write((char const*)&size, sizeof(size));
+    if (size != 0) {
+        out.write((char const*)&v[0], size * sizeof(T));
+    }
+}
+
+template<typename T>
+static bool read_vector(ifstream& in, vector<T>& v) {
+    uint32_t size = 0;
+    in.read((char*)&size, sizeof(size));
+    if (!in.good()) {
+        return false;
+    }
+    v.resize(size);
+    if (size != 0) {
+        in.read((char*)&v[0], size * sizeof(T));
+    }
+    return in.good();
+}
+
+bool LodChain::load(string const& path, uint64_t source_hash) {
+    ifstream in(path.c_str(), std::ios::binary);
+    if (!in.good()) {
+        return false;
+    }
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t hash = 0;
+    in.read(magic, sizeof(magic));
+    in.read((char*)&version, sizeof(version));
+    in.read((char*)&hash, sizeof(hash));
+    if (!in.good() || memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 || version != CACHE_VERSION
+        || hash != source_hash) {
+        return false;
+    }
+    IndexedMesh mesh;
+    vector<uint32_t> indices;
+    vector<LodLevel> levels;
+    vector<Meshlet> meshlets;
+    if (!read_vector(in, mesh.positions) || !read_vector(in, mesh.textures) || !read_vector(in, mesh.normals)
+        || !read_vector(in, mesh.indices) || !read_vector(in, indices) || !read_vector(in, levels)
+        || !read_vector(in, meshlets)) {
+        return false;
+    }
+    mesh_.positions.swap(mesh.positions);
+    mesh_.textures.swap(mesh.textures);
+    mesh_.normals.swap(mesh.normals);
+    mesh_.indices.swap(mesh.indices);
+    indices_.swap(indices);
+    levels_.swap(levels);
+    meshlets_.swap(meshlets);
+    return true;
+}
+
+void LodChain::save(string const& path, uint64_t source_hash) const {
+    // written under another name and renamed, a crash never leaves half a file
+    string const tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path.c_str(), std::ios::binary);
+        out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        out.write((char const*)&CACHE_VERSION, sizeof(CACHE_VERSION));
+        out.write((char const*)&source_hash, sizeof(source_hash));
+        write_vector(out, mesh_.positions);
+        write_vector(out, mesh_.textures);
+        write_vector(out, mesh_.normals);
+        write_vector(out, mesh_.indices);
+        write_vector(out, indices_);
+        write_vector(out, levels_);
+        write_vector(out, meshlets_);
+        if (!out.good()) {
+            out.close();
+            std::remove(tmp_path.c_str());
+            return;
+        }
+    }
+    std::remove(path.c_str());
+    std::rename(tmp_path.c_str(), path.c_str());
+}
+
+size_t LodChain::select(float distance, float fovy_degrees, float viewport_height, float max_pixel_error) const {
+    if (distance <= 0) {
+        return 0;
+    }
+    // pixels per model unit at that distance
+    float const scale = viewport_height * 0.5f / (distance * std::tan(radians(fovy_degrees) * 0.5f));
+    size_t level = 0;
+    while (level + 1 < levels_.size() && levels_[level + 1].error * scale <= max_pixel_error) {
+        ++level;
+    }
+    return level;
+}
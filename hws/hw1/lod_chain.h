@@ -0,0 +1,58 @@
+#ifndef LOD_CHAIN_H
+#define LOD_CHAIN_H
+
+#include "common.h"
+#include "simplifier.h"
+#include "meshlets.h"
+
+#include <cstdint>
+
+struct LodLevel {
+    // range in LodChain::indices
+    size_t first_index;
+    size_t index_count;
+    // furthest the level strays from the full mesh, in model units
+    float error;
+    // range in LodChain::meshlets, together they cover the level's indices
+    size_t first_meshlet;
+    size_t meshlet_count;
+};
+
+// Levels of detail of one mesh, each simplified from the one before to
+// about half its triangles. All levels index the same vertices, so one
+// vertex buffer and one index buffer hold the whole chain. Each level is
+// split into meshlets for cluster culling, its triangles are ordered for
+// the vertex cache and the vertices for fetch, and the cooked file keeps
+// that order.
+class LodChain {
+public:
+    LodChain();
+
+    void build(IndexedMesh const& mesh);
+
+    // cooked chains are stored next to their source, keyed by a hash of it
+    bool load(string const& path, uint64_t source_hash);
+    void save(string const& path, uint64_t source_hash) const;
+
+    IndexedMesh const& mesh() const { return mesh_; }
+    vector<uint32_t> const& indices() const { return indices_; }
+    vector<LodLevel> const& levels() const { return levels_; }
+    vector<Meshlet> const& meshlets() const { return meshlets_; }
+    size_t triangles_count(size_t level) const { return levels_[level].index_count / 3; }
+
+    // Coarsest level whose error covers at most max_pixel_error pixels when
+    // the mesh is distance away from a camera with the given vertical
+    // field of view (degrees, as perspective() takes it) and viewport height.
+    size_t select(float distance, float fovy_degrees, float viewport_height, float max_pixel_error) const;
+
+private:
+    IndexedMesh mesh_;
+    vector<uint32_t> indices_;
+    vector<LodLevel> levels_;
+    vector<Meshlet> meshlets_;
+};
+
+// FNV-1a of the file's bytes, 0 if it can't be read
+uint64_t file_hash(string const& path);
+
+#endif // LOD_CHAIN_H
@@ -52,6 +52,17 @@ void APIENTRY gl_debug_proc(GLenum         //source
 //#include <sstream>
 
 int main( int argc, char ** argv ) {
+    // simplifies the model into its levels of detail ahead of time, no window
+    if (argc > 1 && string(argv[1]) == "--cook-lods") {
+        cook_model_lods();
+        return 0;
+    }
+    // triangles cluster culling drops as the model turns, no window
+    if (argc > 1 && string(argv[1]) == "--meshlet-culling") {
+        report_meshlet_culling();
+        return 0;
+    }
+
     // Размеры окна по-умолчанию
     size_t const default_width  = 800;
     size_t const default_height = 800;
@@ -0,0 +1,246 @@
+#include "meshlets.h"
+
+#include <algorithm>
+#include <map>
+
+// normals closer than this to perpendicular leave the cone too wide to cull
+static float const MIN_CONE_DOT = 0.1f;
+// a triangle at right angles to the meshlet's average normal scores as
+// badly as one adding this many vertices, so the cones stay narrow first
+static float const CONE_WEIGHT = 32.0f;
+
+static void finish_meshlet(IndexedMesh const& mesh, vector<vec3> const& face_normals,
+                           vector<uint32_t> const& triangles, vector<uint32_t> const& vertices, Meshlet& meshlet)
+{
+    vec3 lo = mesh.positions[vertices[0]];
+    vec3 hi = lo;
+    for (size_t i = 1; i < vertices.size(); ++i) {
+        lo = min(lo, mesh.positions[vertices[i]]);
+        hi = max(hi, mesh.positions[vertices[i]]);
+    }
+    meshlet.center = (lo + hi) * 0.5f;
+    meshlet.radius = 0;
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        meshlet.radius = std::max(meshlet.radius, length(mesh.positions[vertices[i]] - meshlet.center));
+    }
+
+    vec3 normals_sum(0);
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        normals_sum += face_normals[triangles[i]];
+    }
+    meshlet.cone_axis = vec3(0, 0, 1);
+    meshlet.cone_cutoff = 1;
+    if (length(normals_sum) < 1e-6f) {
+        return;
+    }
+    meshlet.cone_axis = normalize(normals_sum);
+    float min_dot = 1;
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        vec3 const& normal = face_normals[triangles[i]];
+        if (normal != vec3(0)) {
+            min_dot = std::min(min_dot, dot(normal, meshlet.cone_axis));
+        }
+    }
+    if (min_dot > MIN_CONE_DOT) {
+        meshlet.cone_cutoff = std::sqrt(1 - min_dot * min_dot);
+    }
+}
+
+void build_meshlets(IndexedMesh const& mesh, vector<uint32_t>& indices, size_t first_index, size_t index_count,
+                    vector<Meshlet>& meshlets)
+{
+    size_t const triangles_count = index_count / 3;
+    if (triangles_count == 0) {
+        return;
+    }
+    vector<uint32_t> const source(indices.begin() + first_index, indices.begin() + first_index + index_count);
+
+    // Neighbours are found through shared positions: hard edges and seams
+    // give the triangles on either side vertices of their own.
+    struct position_less {
+        bool operator()(vec3 const& a, vec3 const& b) const {
+            return memcmp(&a, &b, sizeof(vec3)) < 0;
+        }
+    };
+    std::map<vec3, uint32_t, position_less> positions;
+    size_t const vertices_count = mesh.vertices_count();
+    vector<uint32_t> position_of(vertices_count);
+    for (size_t v = 0; v < vertices_count; ++v) {
+        position_of[v] = positions.insert(std::make_pair(mesh.positions[v], uint32_t(positions.size()))).first->second;
+    }
+
+    // triangles around every position
+    size_t const positions_count = positions.size();
+    vector<uint32_t> first_triangle(positions_count + 1, 0);
+    for (size_t i = 0; i < source.size(); ++i) {
+        ++first_triangle[position_of[source[i]] + 1];
+    }
+    for (size_t p = 0; p < positions_count; ++p) {
+        first_triangle[p + 1] += first_triangle[p];
+    }
+    vector<uint32_t> position_triangles(source.size());
+    vector<uint32_t> filled(first_triangle.begin(), first_triangle.end() - 1);
+    for (size_t i = 0; i < source.size(); ++i) {
+        position_triangles[filled[position_of[source[i]]]++] = uint32_t(i / 3);
+    }
+
+    vector<vec3> face_normals(triangles_count);
+    for (size_t t = 0; t < triangles_count; ++t) {
+        vec3 const& a = mesh.positions[source[3 * t]];
+        vec3 const n = cross(mesh.positions[source[3 * t + 1]] - a, mesh.positions[source[3 * t + 2]] - a);
+        float const n_length = length(n);
+        face_normals[t] = n_length > 0 ? n / n_length : vec3(0);
+    }
+
+    vector<bool> taken(triangles_count, false);
+    vector<bool> in_meshlet(vertices_count, false);
+    vector<bool> position_in_meshlet(positions_count, false);
+    vector<uint32_t> triangles;
+    vector<uint32_t> vertices;
+    vector<uint32_t> meshlet_positions;
+    size_t out = first_index;
+    for (size_t seed = 0; seed < triangles_count; ++seed) {
+        if (taken[seed]) {
+            continue;
+        }
+        triangles.clear();
+        vertices.clear();
+        meshlet_positions.clear();
+        vec3 normals_sum(0);
+        uint32_t next = uint32_t(seed);
+        for (;;) {
+            taken[next] = true;
+            triangles.push_back(next);
+            normals_sum += face_normals[next];
+            for (int corner = 0; corner < 3; ++corner) {
+                uint32_t const v = source[3 * next + corner];
+                if (!in_meshlet[v]) {
+                    in_meshlet[v] = true;
+                    vertices.push_back(v);
+                }
+                if (!position_in_meshlet[position_of[v]]) {
+                    position_in_meshlet[position_of[v]] = true;
+                    meshlet_positions.push_back(position_of[v]);
+                }
+            }
+            if (triangles.size() == MESHLET_MAX_TRIANGLES) {
+                break;
+            }
+
+            // the neighbour adding the fewest vertices and keeping the normal
+            // cone narrow, sharing the most corners on a tie
+            vec3 const axis = length(normals_sum) > 0 ? normalize(normals_sum) : normals_sum;
+            float best_score = 0;
+            int best_shared = 0;
+            uint32_t best = uint32_t(-1);
+            for (size_t i = 0; i < meshlet_positions.size(); ++i) {
+                uint32_t const p = meshlet_positions[i];
+                for (uint32_t j = first_triangle[p]; j < first_triangle[p + 1]; ++j) {
+                    uint32_t const t = position_triangles[j];
+                    if (taken[t]) {
+                        continue;
+                    }
+                    int new_vertices = 0;
+                    int shared = 0;
+                    for (int corner = 0; corner < 3; ++corner) {
+                        new_vertices += !in_meshlet[source[3 * t + corner]];
+                        shared += position_in_meshlet[position_of[source[3 * t + corner]]];
+                    }
+                    if (vertices.size() + new_vertices > MESHLET_MAX_VERTICES) {
+                        continue;
+                    }
+                    // past a right angle the meshlet could never be culled
+                    float const d = dot(face_normals[t], axis);
+                    if (d < 0) {
+                        continue;
+                    }
+                    float const score = new_vertices + CONE_WEIGHT * (1 - d);
+                    if (best == uint32_t(-1) || score < best_score || (score == best_score && shared > best_shared)) {
+                        best_score = score;
+                        best_shared = shared;
+                        best = t;
+                    }
+                }
+            }
+            if (best == uint32_t(-1)) {
+                break;
+            }
+            next = best;
+        }
+
+        Meshlet meshlet;
+        meshlet.first_index = uint32_t(out);
+        meshlet.index_count = uint32_t(3 * triangles.size());
+        finish_meshlet(mesh, face_normals, triangles, vertices, meshlet);
+        meshlets.push_back(meshlet);
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            for (int corner = 0; corner < 3; ++corner) {
+                indices[out++] = source[3 * triangles[i] + corner];
+            }
+        }
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            in_meshlet[vertices[i]] = false;
+        }
+        for (size_t i = 0; i < meshlet_positions.size(); ++i) {
+            position_in_meshlet[meshlet_positions[i]] = false;
+        }
+    }
+}
+
+// The cone apex is taken anywhere inside the bounding sphere, so the test
+// holds for every point of the meshlet.
+bool meshlet_backfacing(Meshlet const& meshlet, vec3 const& camera_position) {
+    vec3 const to_center = meshlet.center - camera_position;
+    return dot(to_center, meshlet.cone_axis) >= meshlet.cone_cutoff * length(to_center) + meshlet.radius;
+}
+
+// Gribb-Hartmann planes of mvp, normals pointing inside
+static void frustum_planes(mat4 const& mvp, vec4 planes[6]) {
+    vec4 const row_x(mvp[0][0], mvp[1][0], mvp[2][0], mvp[3][0]);
+    vec4 const row_y(mvp[0][1], mvp[1][1], mvp[2][1], mvp[3][1]);
+    vec4 const row_z(mvp[0][2], mvp[1][2], mvp[2][2], mvp[3][2]);
+    vec4 const row_w(mvp[0][3], mvp[1][3], mvp[2][3], mvp[3][3]);
+    planes[0] = row_w + row_x;
+    planes[1] = row_w - row_x;
+    planes[2] = row_w + row_y;
+    planes[3] = row_w - row_y;
+    planes[4] = row_w + row_z;
+    planes[5] = row_w - row_z;
+}
+
+static bool outside_frustum(Meshlet const& meshlet, vec4 const planes[6]) {
+    for (int i = 0; i < 6; ++i) {
+        vec3 const normal(planes[i]);
+        if (dot(normal, meshlet.center) + planes[i].w < -meshlet.radius * length(normal)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t cull_meshlets(vector<Meshlet> const& meshlets, size_t first, size_t count, mat4 const& mvp,
+                     vec3 const& camera_position, vector<GLsizei>& counts, vector<GLvoid*>& offsets)
+{
+    vec4 planes[6];
+    frustum_planes(mvp, planes);
+    counts.clear();
+    offsets.clear();
+    size_t culled = 0;
+    // end of the last range drawn, in indices
+    size_t range_end = 0;
+    for (size_t i = first; i < first + count; ++i) {
+        Meshlet const& meshlet = meshlets[i];
+        if (meshlet_backfacing(meshlet, camera_position) || outside_frustum(meshlet, planes)) {
+            culled += meshlet.index_count / 3;
+            continue;
+        }
+        if (!counts.empty() && range_end == meshlet.first_index) {
+            counts.back() += GLsizei(meshlet.index_count);
+        } else {
+            counts.push_back(GLsizei(meshlet.index_count));
+            offsets.push_back((GLvoid*)(meshlet.first_index * sizeof(uint32_t)));
+        }
+        range_end = meshlet.first_index + meshlet.index_count;
+    }
+    return culled;
+}
@@ -0,0 +1,44 @@
+#ifndef MESHLETS_H
+#define MESHLETS_H
+
+#include "common.h"
+#include "simplifier.h"
+
+#include <cstdint>
+
+static size_t const MESHLET_MAX_VERTICES = 64;
+static size_t const MESHLET_MAX_TRIANGLES = 124;
+
+// A small patch of connected triangles with the bounds cluster culling
+// tests. All triangles of the patch face within the normal cone: the
+// angle between cone_axis and any of their normals is at most
+// asin(cone_cutoff); cone_cutoff is 1 for patches too curved to cull.
+struct Meshlet {
+    // range in the index buffer
+    uint32_t first_index;
+    uint32_t index_count;
+    vec3     center;
+    float    radius;
+    vec3     cone_axis;
+    float    cone_cutoff;
+};
+
+// Splits the triangles indices[first_index, first_index + index_count)
+// into meshlets of at most MESHLET_MAX_VERTICES vertices and
+// MESHLET_MAX_TRIANGLES triangles, growing each one over the neighbours
+// that add the fewest vertices, and reorders that range so every meshlet
+// is contiguous in it.
+void build_meshlets(IndexedMesh const& mesh, vector<uint32_t>& indices, size_t first_index, size_t index_count,
+                    vector<Meshlet>& meshlets);
+
+// every triangle of the meshlet faces away from camera_position
+bool meshlet_backfacing(Meshlet const& meshlet, vec3 const& camera_position);
+
+// Index ranges of meshlets[first, first + count) left after backface and
+// frustum culling against mvp, with neighbouring ranges merged, ready for
+// glMultiDrawElements. camera_position is in the model space of mvp.
+// Returns the number of triangles culled.
+size_t cull_meshlets(vector<Meshlet> const& meshlets, size_t first, size_t count, mat4 const& mvp,
+                     vec3 const& camera_position, vector<GLsizei>& counts, vector<GLvoid*>& offsets);
+
+#endif // MESHLETS_H
@@ -1,9 +1,69 @@
 #include "prog_state.h"
-#include "shader.h"
+#include "vertex_cache.h"
+
+#include <cstdio>
 
 static const string MODEL_FILE         = "..//input//model.obj";
 static const string VERTEX_SHADER      = "..//shaders//0.glslvs";
 static const string FRAGMENT_SHADER    = "..//shaders//0.glslfs";
+// cooked levels of detail of MODEL_FILE
+static const string LOD_FILE           = MODEL_FILE + ".lod";
+
+static float const FOVY_DEGREES = 45.0f;
+
+// the cooked chain if it matches the model file, otherwise a new one
+static void load_lods(Model const& model, LodChain& lods) {
+    uint64_t const hash = file_hash(MODEL_FILE);
+    if (lods.load(LOD_FILE, hash)) {
+        return;
+    }
+    lods.build(weld(model));
+    lods.save(LOD_FILE, hash);
+}
+
+// the model turning in front of the hw1 camera, about two axes in turn
+void report_meshlet_culling() {
+    Model model;
+    model.load(MODEL_FILE);
+    LodChain lods;
+    load_lods(model, lods);
+    LodLevel const& level = lods.levels()[0];
+    std::cout << level.meshlet_count << " meshlets for " << lods.triangles_count(0) << " triangles" << endl;
+
+    mat4 const proj = perspective(FOVY_DEGREES, 4.0f / 3.0f, 0.1f, 130.0f);
+    mat4 const view = lookAt(vec3(0, 0, 30), vec3(0, 0, 0), vec3(0, 1, 0));
+    vec3 const axes[2] = { vec3(0, 1, 0), vec3(1, 0, 0) };
+    char const* const axis_names[2] = { "y", "x" };
+    vector<GLsizei> counts;
+    vector<GLvoid*> offsets;
+    for (int axis = 0; axis < 2; ++axis) {
+        for (int degrees = 0; degrees < 360; degrees += 30) {
+            quat const rotation = angleAxis(float(degrees), axes[axis]);
+            mat4 const modelview = view * mat4_cast(rotation);
+            vec3 const camera_position = vec3(inverse(modelview) * vec4(0, 0, 0, 1));
+            size_t const culled = cull_meshlets(lods.meshlets(), level.first_meshlet, level.meshlet_count,
+                                                proj * modelview, camera_position, counts, offsets);
+            char line[128];
+            std::snprintf(line, sizeof(line), "%s %3d deg: %5.1f%% of triangles culled, %zu draws", axis_names[axis],
+                          degrees, 100.0f * culled / lods.triangles_count(0), counts.size());
+            std::cout << line << endl;
+        }
+    }
+}
+
+void cook_model_lods() {
+    Model model;
+    model.load(MODEL_FILE);
+    LodChain lods;
+    lods.build(weld(model));
+    lods.save(LOD_FILE, file_hash(MODEL_FILE));
+    for (size_t i = 0; i < lods.levels().size(); ++i) {
+        LodLevel const& level = lods.levels()[i];
+        std::cout << "LOD " << i << ": " << lods.triangles_count(i) << " triangles, " << level.meshlet_count
+                  << " meshlets, error " << level.error << ", ACMR "
+                  << cache_miss_ratio(lods.indices(), level.first_index, level.index_count) << endl;
+    }
+}
 
 void switch_colors_callback(void * sample) {
     static_cast<ProgState*>(sample)->change_mode();
@@ -22,25 +82,36 @@ ProgState::ProgState()
     , k_(1)
     , center_(vec3(0, 0, 0))
     , max_(0)
+    , camera_distance_(30)
+    , lod_pixel_error_(1)
+    , lod_(0)
+    , lod_triangles_(0)
+    , lod_savings_(0)
+    , cluster_culling_(true)
+    , lod_meshlets_(0)
+    , triangles_culled_(0)
 {
     create_tw_bar();
 
     model_.load(MODEL_FILE);
-    for (size_t i = 0; i < model_.vertices_count(); ++i) {
-        data_.push_back(model_.vertices[i]);
-        data_.push_back(model_.normals[i]);
+    load_lods(model_, lods_);
+    IndexedMesh const& mesh = lods_.mesh();
+    for (size_t i = 0; i < mesh.vertices_count(); ++i) {
+        data_.push_back(mesh.positions[i]);
+        data_.push_back(mesh.normals[i]);
     }
 
-    init_shaders(VERTEX_SHADER, FRAGMENT_SHADER);
+    // both permutations of the current mode are ready before the first frame
+    color_program(false);
+    color_program(true);
     init_buffer();
 }
 
 ProgState::~ProgState() {
     // Удаление ресурсов OpenGL
-    glDeleteProgram(program_);
-    glDeleteShader(vs_);
-    glDeleteShader(fs_);
     glDeleteBuffers(1, &vx_buf_);
+    glDeleteBuffers(1, &ix_buf_);
+    glDeleteBuffers(1, &wire_buf_);
 
     TwDeleteAllBars();
     TwTerminate();
@@ -51,7 +122,7 @@ void ProgState::create_tw_bar() {
 
     // Определение "контролов" GUI
     TwBar *bar = TwNewBar("Parameters");
-    TwDefine(" Parameters size='500 200' color='70 100 120' valueswidth=220 iconpos=topleft");
+    TwDefine(" Parameters size='500 360' color='70 100 120' valueswidth=220 iconpos=topleft");
     TwAddVarRW(bar, "v", TW_TYPE_FLOAT, &v_, " min=-100 max=100 step=1 label='V' keyincr=p keydecr=o");
     TwAddVarRW(bar, "k", TW_TYPE_FLOAT, &k_, " min=-100 max=100 step=1 label='K' keyincr=l keydecr=k");
     TwAddVarRW(bar, "Wireframe", TW_TYPE_BOOLCPP, &wireframe_, " true='ON' false='OFF' key=w");
@@ -61,13 +132,24 @@ void ProgState::create_tw_bar() {
                 " label='Toggle fullscreen mode' key=f");
     TwAddVarRW(bar, "ObjRotation", TW_TYPE_QUAT4F, &rotation_by_control_,
                " label='Object orientation' opened=true help='Change the object orientation.' ");
+    TwAddVarRW(bar, "Distance", TW_TYPE_FLOAT, &camera_distance_, " min=5 max=1000 step=5 label='Camera distance' ");
+    TwAddVarRW(bar, "LodError", TW_TYPE_FLOAT, &lod_pixel_error_,
+               " min=0 max=20 step=0.25 label='LOD pixel error' help='Largest error of the drawn level of detail, in pixels.' ");
+    TwAddVarRO(bar, "Lod", TW_TYPE_INT32, &lod_, " label='LOD' ");
+    TwAddVarRO(bar, "LodTriangles", TW_TYPE_INT32, &lod_triangles_, " label='Triangles' ");
+    TwAddVarRO(bar, "LodSavings", TW_TYPE_FLOAT, &lod_savings_, " label='Triangles saved, %' precision=1 ");
+    TwAddVarRW(bar, "ClusterCulling", TW_TYPE_BOOLCPP, &cluster_culling_,
+               " label='Cluster culling' help='Skip meshlets facing away or out of view.' ");
+    TwAddVarRO(bar, "Meshlets", TW_TYPE_INT32, &lod_meshlets_, " label='Meshlets' ");
+    TwAddVarRO(bar, "TrianglesCulled", TW_TYPE_FLOAT, &triangles_culled_, " label='Triangles culled, %' precision=1 ");
 }
 
-void ProgState::init_shaders(string const& vs_file, string const& fs_file) {
-    vs_ = create_shader(GL_VERTEX_SHADER  , vs_file.c_str());
-    fs_ = create_shader(GL_FRAGMENT_SHADER, fs_file.c_str());
-
-    program_ = create_program(vs_, fs_);
+// color mode and wireframe overlay are compiled in instead of branched on
+GLuint ProgState::color_program(bool wireframe) {
+    shader_defines defines;
+    defines["FUNC_MODE"] = mode_ == FUNC ? "true" : "false";
+    defines["IS_WIREFRAME"] = wireframe ? "true" : "false";
+    return programs_.program(VERTEX_SHADER.c_str(), FRAGMENT_SHADER.c_str(), defines);
 }
 
 void ProgState::init_buffer() {
@@ -81,14 +163,41 @@ void ProgState::init_buffer() {
 
     // Сбрасываем текущий активный буфер
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // every level of detail, one after another
+    vector<uint32_t> const& indices = lods_.indices();
+    glGenBuffers(1, &ix_buf_);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ix_buf_);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * indices.size(), &indices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    // unindexed, so the wireframe tells the corners of a triangle apart by
+    // gl_VertexID and draws the edges in the same pass as the surface
+    vvec3 corners;
+    corners.reserve(2 * indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        corners.push_back(data_[2 * indices[i]]);
+        corners.push_back(data_[2 * indices[i] + 1]);
+    }
+    glGenBuffers(1, &wire_buf_);
+    glBindBuffer(GL_ARRAY_BUFFER, wire_buf_);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * corners.size(), &corners[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// the object sits at the origin, camera_distance_ away from the camera
+void ProgState::select_lod(float viewport_height) {
+    lod_ = int(lods_.select(camera_distance_, FOVY_DEGREES, viewport_height, lod_pixel_error_));
+    lod_triangles_ = int(lods_.triangles_count(lod_));
+    lod_savings_ = 100.0f * (1 - float(lod_triangles_) / lods_.triangles_count(0));
 }
 
 void ProgState::draw_frame( float time_from_start ) {
     float const w = (float)glutGet(GLUT_WINDOW_WIDTH);
     float const h = (float)glutGet(GLUT_WINDOW_HEIGHT);
 
-    mat4 const proj             = perspective(45.0f, w / h, 0.1f, 100.0f);
-    mat4 const view             = lookAt(vec3(0, 0, 30), vec3(0, 0, 0), vec3(0, 1, 0));
+    mat4 const proj             = perspective(FOVY_DEGREES, w / h, 0.1f, camera_distance_ + 100.0f);
+    mat4 const view             = lookAt(vec3(0, 0, camera_distance_), vec3(0, 0, 0), vec3(0, 1, 0));
     mat4 const full_rotate      = mat4_cast(rotation_by_control_);
 
     mat4 const modelview        = view * full_rotate;
@@ -104,69 +213,81 @@ void ProgState::draw_frame( float time_from_start ) {
 
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-    glUseProgram(program_);
-
-    GLuint const mvp_location = glGetUniformLocation(program_, "mvp");
-    glUniformMatrix4fv(mvp_location, 1, GL_FALSE, &mvp[0][0]);
-
-    GLuint const mv_location = glGetUniformLocation(program_, "mv");
-    glUniformMatrix4fv(mv_location, 1, GL_FALSE, &modelview[0][0]);
-
-    GLuint const is_wireframe_location = glGetUniformLocation(program_, "is_wireframe");
-    glUniform1i(is_wireframe_location, false);
-
-    GLuint const T_location = glGetUniformLocation(program_, "T");
-    glUniform1f(T_location, time_from_start);
-
-    GLuint const k_location = glGetUniformLocation(program_, "k");
-    glUniform1f(k_location, k_);
-
-    GLuint const v_location = glGetUniformLocation(program_, "v");
-    glUniform1f(v_location, v_);
-
-    GLuint const center_location = glGetUniformLocation(program_, "center");
-    glUniform3f(center_location, center_[0], center_[1], center_[2]);
-
-    GLuint const max_location = glGetUniformLocation(program_, "max");
-    glUniform1f(max_location, max_);
-
-    GLuint const func_mode_location = glGetUniformLocation(program_, "func_mode");
-    if (mode_ == NORMALS) {
-        glUniform1i(func_mode_location, false);
+    GLuint const program = color_program(wireframe_);
+    set_uniforms(program, mvp, modelview, time_from_start);
+
+    select_lod(h);
+    LodLevel const& lod = lods_.levels()[lod_];
+    lod_meshlets_ = int(lod.meshlet_count);
+    if (cluster_culling_) {
+        vec3 const camera_position = vec3(inverse(modelview) * vec4(0, 0, 0, 1));
+        size_t const culled = cull_meshlets(lods_.meshlets(), lod.first_meshlet, lod.meshlet_count, mvp,
+                                            camera_position, draw_counts_, draw_offsets_);
+        triangles_culled_ = 100.0f * culled / lod_triangles_;
     } else {
-        glUniform1i(func_mode_location, true);
+        draw_counts_.assign(1, GLsizei(lod.index_count));
+        draw_offsets_.assign(1, (GLvoid*)(lod.first_index * sizeof(uint32_t)));
+        triangles_culled_ = 0;
     }
+    GLsizei const draws = GLsizei(draw_counts_.size());
 
-    glBindBuffer(GL_ARRAY_BUFFER, vx_buf_);
+    if (wireframe_) {
+        glBindBuffer(GL_ARRAY_BUFFER, wire_buf_);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, vx_buf_);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ix_buf_);
+    }
 
-    GLuint const pos_location = glGetAttribLocation(program_, "in_pos");
+    GLuint const pos_location = glGetAttribLocation(program, "in_pos");
     glEnableVertexAttribArray(pos_location);
     glVertexAttribPointer(pos_location, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(vec3), 0);
 
-    GLuint const color_location = glGetAttribLocation(program_, "in_color");
+    GLuint const color_location = glGetAttribLocation(program, "in_color");
     glEnableVertexAttribArray(color_location);
     glVertexAttribPointer(color_location, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(vec3), (GLvoid*)(sizeof(vec3)));
 
-    glDrawArrays(GL_TRIANGLES, 0, data_.size() / 2);
-
-    if (wireframe_) {
-        glPolygonOffset(-1, -1);
-        glEnable(GL_POLYGON_OFFSET_FILL);
-
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-
-        GLboolean const is_wireframe_location = glGetUniformLocation(program_, "is_wireframe");
-        glUniform1i(is_wireframe_location, true);
-
-        glDrawArrays(GL_TRIANGLES, 0, data_.size() / 2);
-        glDisable(GL_POLYGON_OFFSET_FILL);
+    if (draws != 0 && wireframe_) {
+        // index byte offsets become first corners
+        draw_firsts_.resize(draws);
+        for (GLsizei i = 0; i < draws; ++i) {
+            draw_firsts_[i] = GLint(reinterpret_cast<uintptr_t>(draw_offsets_[i]) / sizeof(uint32_t));
+        }
+        glMultiDrawArrays(GL_TRIANGLES, &draw_firsts_[0], &draw_counts_[0], draws);
+    } else if (draws != 0) {
+        glMultiDrawElements(GL_TRIANGLES, &draw_counts_[0], GL_UNSIGNED_INT, &draw_offsets_[0], draws);
     }
 
     glDisableVertexAttribArray(pos_location);
     glDisableVertexAttribArray(color_location);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+void ProgState::set_uniforms(GLuint program, mat4 const& mvp, mat4 const& modelview, float time_from_start) {
+    glUseProgram(program);
+
+    GLuint const mvp_location = glGetUniformLocation(program, "mvp");
+    glUniformMatrix4fv(mvp_location, 1, GL_FALSE, &mvp[0][0]);
+
+    GLuint const mv_location = glGetUniformLocation(program, "mv");
+    glUniformMatrix4fv(mv_location, 1, GL_FALSE, &modelview[0][0]);
+
+    GLuint const T_location = glGetUniformLocation(program, "T");
+    glUniform1f(T_location, time_from_start);
+
+    GLuint const k_location = glGetUniformLocation(program, "k");
+    glUniform1f(k_location, k_);
+
+    GLuint const v_location = glGetUniformLocation(program, "v");
+    glUniform1f(v_location, v_);
+
+    GLuint const center_location = glGetUniformLocation(program, "center");
+    glUniform3f(center_location, center_[0], center_[1], center_[2]);
+
+    GLuint const max_location = glGetUniformLocation(program, "max");
+    glUniform1f(max_location, max_);
+}
+
 void ProgState::update_color_params(mat4 m) {
     for (size_t i = 0; i < model_.vertices_count(); ++i) {
         center_ += model_.vertices[i];
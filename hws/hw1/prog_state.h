@@ -3,6 +3,8 @@
 
 #include "common.h"
 #include "model.h"
+#include "shader.h"
+#include "lod_chain.h"
 
 struct triangle {
     const vec2 v1;
@@ -22,6 +24,11 @@ struct triangle {
 
 enum ColorMode { NORMALS, FUNC };
 
+// rebuilds the level of detail cache of the model and prints the chain
+void cook_model_lods();
+// prints the share of the model's triangles cluster culling drops while it turns
+void report_meshlet_culling();
+
 class ProgState {
 public:
     ProgState();
@@ -45,7 +52,9 @@ private:
     void draw_frame(float time_from_start);
     void create_tw_bar();
     void init_buffer();
-    void init_shaders(string const& vs_file, string const& fs_file);
+    void select_lod(float viewport_height);
+    GLuint color_program(bool wireframe);
+    void set_uniforms(GLuint program, mat4 const& mvp, mat4 const& modelview, float time_from_start);
     void update_color_params(mat4 m);
 
     bool      wireframe_;
@@ -53,19 +62,37 @@ private:
     float     cell_size_;
     ColorMode mode_;
 
-    GLuint vs_;
-    GLuint fs_;
-    GLuint program_;
+    program_cache programs_;
     GLuint vx_buf_;
+    GLuint ix_buf_;
+    // the vertices of LodChain::indices one by one, for the wireframe
+    GLuint wire_buf_;
     quat   rotation_by_control_;
 
     vvec3 data_;
     Model model_;
+    LodChain lods_;
 
     float v_;
     float k_;
     vec3 center_;
     float max_;
+
+    float camera_distance_;
+    // largest error a level may show on screen
+    float lod_pixel_error_;
+    int   lod_;
+    int   lod_triangles_;
+    float lod_savings_;
+
+    bool  cluster_culling_;
+    int   lod_meshlets_;
+    float triangles_culled_;
+    // ranges of the visible meshlets for glMultiDrawElements
+    vector<GLsizei> draw_counts_;
+    vector<GLvoid*> draw_offsets_;
+    // the same ranges in wire_buf_
+    vector<GLint>   draw_firsts_;
 };
 
 #endif // PROG_STATE_H
@@ -1,6 +1,8 @@
 #include "shader.h"
 
-GLuint create_shader( GLenum shader_type, char const * file_name )
+#include <cstdlib>
+
+static string read_source( char const * file_name )
 {
    ifstream f_in(file_name, std::ios::binary);
 
@@ -10,11 +12,24 @@ GLuint create_shader( GLenum shader_type, char const * file_name )
    f_in.seekg(0, std::ios_base::end);
    size_t const size = (size_t)f_in.tellg();
    f_in.seekg(0, std::ios_base::beg);
-   unique_ptr<char[]> text(new char[size + 1]);
-   f_in.read(text.get(), size);
+   string text(size, 0);
+   f_in.read(&text[0], size);
+   return text;
+}
 
-   text[size] = 0;
-   GLchar const * gl_text = text.get();
+GLuint create_shader( GLenum shader_type, char const * file_name )
+{
+   return create_shader_from_source(shader_type, read_source(file_name));
+}
+
+GLuint create_shader( GLenum shader_type, char const * file_name, shader_defines const & defines )
+{
+   return create_shader_from_source(shader_type, add_defines(read_source(file_name), defines));
+}
+
+GLuint create_shader_from_source( GLenum shader_type, string const & source )
+{
+   GLchar const * gl_text = source.c_str();
    GLuint const shader = glCreateShader(shader_type);
 
    glShaderSource(shader, 1, &gl_text, NULL);
@@ -61,3 +76,72 @@ GLuint create_program( GLuint vs, GLuint fs )
    }
    return program;
 }
+
+static string defines_block( shader_defines const & defines )
+{
+   string block;
+   for (shader_defines::const_iterator it = defines.begin(); it != defines.end(); ++it)
+      block += "#define " + it->first + " " + it->second + "\n";
+   return block;
+}
+
+string add_defines( string const & source, shader_defines const & defines )
+{
+   if (defines.empty())
+      return source;
+
+   // #version has to stay the first statement
+   size_t insert_at = 0;
+   size_t line = 1;
+   // a shader without #version is GLSL 1.10
+   long glsl_version = 110;
+   size_t const version = source.find("#version");
+   if (version != string::npos)
+   {
+      size_t const eol = source.find('\n', version);
+      insert_at = eol == string::npos ? source.size() : eol + 1;
+      line = 2;
+      glsl_version = std::strtol(source.c_str() + version + 8, NULL, 10);
+   }
+   // compile errors keep pointing at the lines of the file; before GLSL
+   // 3.30 #line N numbers the line after it N + 1
+   if (glsl_version < 330)
+      --line;
+   string block = defines_block(defines) + "#line " + std::to_string(line) + "\n";
+   if (insert_at == source.size() && insert_at != 0 && source[insert_at - 1] != '\n')
+      block = "\n" + block;
+   return source.substr(0, insert_at) + block + source.substr(insert_at);
+}
+
+program_cache::~program_cache()
+{
+   for (std::map<string, GLuint>::const_iterator it = programs_.begin(); it != programs_.end(); ++it)
+      glDeleteProgram(it->second);
+   for (std::map<string, GLuint>::const_iterator it = shaders_.begin(); it != shaders_.end(); ++it)
+      glDeleteShader(it->second);
+}
+
+GLuint program_cache::shader( GLenum shader_type, char const * file_name, shader_defines const & defines )
+{
+   string const key = std::to_string(shader_type) + " " + file_name + "\n" + defines_block(defines);
+   std::map<string, GLuint>::const_iterator const it = shaders_.find(key);
+   if (it != shaders_.end())
+      return it->second;
+
+   GLuint const shader = create_shader(shader_type, file_name, defines);
+   shaders_[key] = shader;
+   return shader;
+}
+
+GLuint program_cache::program( char const * vs_file, char const * fs_file, shader_defines const & defines )
+{
+   string const key = string(vs_file) + "\n" + fs_file + "\n" + defines_block(defines);
+   std::map<string, GLuint>::const_iterator const it = programs_.find(key);
+   if (it != programs_.end())
+      return it->second;
+
+   GLuint const program = create_program(shader(GL_VERTEX_SHADER, vs_file, defines),
+                                         shader(GL_FRAGMENT_SHADER, fs_file, defines));
+   programs_[key] = program;
+   return program;
+}
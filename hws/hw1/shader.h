@@ -2,5 +2,34 @@
 
 #include "common.h"
 
+#include <map>
+
+// name -> value, every pair becomes "#define name value" right after the
+// #version line of the source
+typedef std::map<string, string> shader_defines;
+
 GLuint create_shader( GLenum shader_type, char const * file_name );
+GLuint create_shader( GLenum shader_type, char const * file_name, shader_defines const & defines );
+GLuint create_shader_from_source( GLenum shader_type, string const & source );
 GLuint create_program( GLuint vs, GLuint fs );
+
+string add_defines( string const & source, shader_defines const & defines );
+
+// Shader permutations: a program is compiled the first time its files and
+// defines are asked for and lives as long as the cache. Defines are kept
+// sorted, so the same set always maps to the same program.
+class program_cache {
+public:
+   ~program_cache();
+
+   GLuint program( char const * vs_file, char const * fs_file,
+                   shader_defines const & defines = shader_defines() );
+   GLuint shader( GLenum shader_type, char const * file_name,
+                  shader_defines const & defines = shader_defines() );
+
+   size_t programs_count() const { return programs_.size(); }
+
+private:
+   std::map<string, GLuint> shaders_;
+   std::map<string, GLuint> programs_;
+};
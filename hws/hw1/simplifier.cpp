@@ -0,0 +1,407 @@
+#include "simplifier.h"
+
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <map>
+#include <queue>
+#include <utility>
+
+// seam and border edges count this much more than the faces along them
+static double const EDGE_WEIGHT = 10;
+
+IndexedMesh weld(Model const& model) {
+    IndexedMesh mesh;
+    std::map<std::array<float, 8>, uint32_t> known;
+    for (size_t i = 0; i < model.vertices_count(); ++i) {
+        vec3 const& p = model.vertices[i];
+        vec2 const& t = model.textures[i];
+        vec3 const& n = model.normals[i];
+        std::array<float, 8> const key = {{ p.x, p.y, p.z, t.x, t.y, n.x, n.y, n.z }};
+        std::map<std::array<float, 8>, uint32_t>::iterator it = known.find(key);
+        if (it == known.end()) {
+            it = known.insert(std::make_pair(key, uint32_t(mesh.positions.size()))).first;
+            mesh.positions.push_back(p);
+            mesh.textures.push_back(t);
+            mesh.normals.push_back(n);
+        }
+        mesh.indices.push_back(it->second);
+    }
+    return mesh;
+}
+
+// sum of squared distances to planes, weighted by the area they stand for
+struct Quadric {
+    double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+    double weight;
+
+    Quadric()
+        : a00(0), a01(0), a02(0), a03(0), a11(0), a12(0), a13(0), a22(0), a23(0), a33(0)
+        , weight(0)
+    {}
+
+    // n has unit length, the plane is dot(n, x) + d = 0
+    Quadric(vec3 const& n, float d, double w)
+        : a00(w * n.x * n.x), a01(w * n.x * n.y), a02(w * n.x * n.z), a03(w * n.x * d)
+        , a11(w * n.y * n.y), a12(w * n.y * n.z), a13(w * n.y * d)
+        , a22(w * n.z * n.z), a23(w * n.z * d)
+        , a33(w * d * d)
+        , weight(w)
+    {}
+
+    void add(Quadric const& q) {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+        a11 += q.a11; a12 += q.a12; a13 += q.a13;
+        a22 += q.a22; a23 += q.a23;
+        a33 += q.a33;
+        weight += q.weight;
+    }
+
+    double error(vec3 const& p) const {
+        double const x = p.x, y = p.y, z = p.z;
+        return a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+             + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+             + a22 * z * z + 2 * a23 * z
+             + a33;
+    }
+};
+
+struct Collapse {
+    double cost;
+    uint32_t from;
+    uint32_t to;
+    uint32_t from_version;
+    uint32_t to_version;
+
+    bool operator<(Collapse const& other) const {
+        // std::priority_queue pops the largest
+        return cost > other.cost;
+    }
+};
+
+struct EdgeInfo {
+    int triangles;
+    bool seam;
+    uint32_t triangle;
+    uint32_t wedge_a;
+    uint32_t wedge_b;
+};
+
+// works on positions: the vertices of the mesh sharing one are a single
+// point here, the triangles keep which of them each corner uses
+class Simplifier {
+public:
+    Simplifier(IndexedMesh const& mesh, vector<uint32_t> const& indices);
+
+    float run(size_t target_triangles);
+    void result(vector<uint32_t>& indices) const;
+
+private:
+    vector<uint32_t> point_of_;
+    vvec3 points_;
+    vector<uint32_t> corners_;
+    vector<uint8_t> dead_triangle_;
+    size_t live_triangles_;
+
+    vector<vector<uint32_t> > point_triangles_;
+    vector<Quadric> quadrics_;
+    vector<uint8_t> border_;
+    vector<uint8_t> removed_;
+    vector<uint32_t> version_;
+    std::priority_queue<Collapse> queue_;
+
+    // wedge of from -> wedge of to, filled by can_collapse()
+    vector<std::pair<uint32_t, uint32_t> > wedge_map_;
+
+    uint32_t point(uint32_t triangle, int corner) const { return point_of_[corners_[3 * triangle + corner]]; }
+    int corner_of(uint32_t triangle, uint32_t p) const;
+    vec3 normal(uint32_t triangle, uint32_t moved, vec3 const& to) const;
+    void neighbors(uint32_t p, vector<uint32_t>& out) const;
+    void push(uint32_t from, uint32_t to);
+    bool can_collapse(uint32_t from, uint32_t to);
+    void collapse(uint32_t from, uint32_t to);
+};
+
+Simplifier::Simplifier(IndexedMesh const& mesh, vector<uint32_t> const& indices)
+    : point_of_(mesh.vertices_count())
+    , corners_(indices)
+    , dead_triangle_(indices.size() / 3, 0)
+    , live_triangles_(0)
+{
+    std::map<std::array<float, 3>, uint32_t> known;
+    for (size_t i = 0; i < mesh.vertices_count(); ++i) {
+        vec3 const& p = mesh.positions[i];
+        std::array<float, 3> const key = {{ p.x, p.y, p.z }};
+        std::map<std::array<float, 3>, uint32_t>::iterator it = known.find(key);
+        if (it == known.end()) {
+            it = known.insert(std::make_pair(key, uint32_t(points_.size()))).first;
+            points_.push_back(p);
+        }
+        point_of_[i] = it->second;
+    }
+
+    size_t const points_count = points_.size();
+    point_triangles_.resize(points_count);
+    quadrics_.resize(points_count);
+    border_.assign(points_count, 0);
+    removed_.assign(points_count, 0);
+    version_.assign(points_count, 0);
+
+    std::map<std::pair<uint32_t, uint32_t>, EdgeInfo> edges;
+    for (uint32_t t = 0; t < dead_triangle_.size(); ++t) {
+        uint32_t const p[3] = { point(t, 0), point(t, 1), point(t, 2) };
+        if (p[0] == p[1] || p[1] == p[2] || p[0] == p[2]) {
+            dead_triangle_[t] = 1;
+            continue;
+        }
+        ++live_triangles_;
+        vec3 n = cross(points_[p[1]] - points_[p[0]], points_[p[2]] - points_[p[0]]);
+        float const area2 = length(n);
+        if (area2 > 0) {
+            n = n / area2;
+            Quadric const q(n, -dot(n, points_[p[0]]), 0.5 * area2);
+            for (int c = 0; c < 3; ++c) {
+                quadrics_[p[c]].add(q);
+            }
+        }
+        for (int c = 0; c < 3; ++c) {
+            point_triangles_[p[c]].push_back(t);
+
+            uint32_t const wa = corners_[3 * t + c];
+            uint32_t const wb = corners_[3 * t + (c + 1) % 3];
+            bool const forward = p[c] < p[(c + 1) % 3];
+            std::pair<uint32_t, uint32_t> const key = forward ? std::make_pair(p[c], p[(c + 1) % 3])
+                                                              : std::make_pair(p[(c + 1) % 3], p[c]);
+            std::map<std::pair<uint32_t, uint32_t>, EdgeInfo>::iterator it = edges.find(key);
+            if (it == edges.end()) {
+                EdgeInfo const info = { 1, false, t, forward ? wa : wb, forward ? wb : wa };
+                edges.insert(std::make_pair(key, info));
+            } else {
+                ++it->second.triangles;
+                it->second.seam |= it->second.wedge_a != (forward ? wa : wb) || it->second.wedge_b != (forward ? wb : wa);
+            }
+        }
+    }
+
+    for (std::map<std::pair<uint32_t, uint32_t>, EdgeInfo>::const_iterator it = edges.begin(); it != edges.end(); ++it) {
+        uint32_t const a = it->first.first;
+        uint32_t const b = it->first.second;
+        EdgeInfo const& info = it->second;
+        // open or non-manifold
+        bool const border = info.triangles != 2;
+        if (border) {
+            border_[a] = border_[b] = 1;
+        }
+        if (border || info.seam) {
+            // a plane through the edge, upright on its triangle, keeps the
+            // line in place
+            vec3 const edge = points_[b] - points_[a];
+            vec3 const face = cross(points_[point(info.triangle, 1)] - points_[point(info.triangle, 0)],
+                                    points_[point(info.triangle, 2)] - points_[point(info.triangle, 0)]);
+            vec3 const n = cross(edge, face);
+            float const n_length = length(n);
+            if (n_length > 0) {
+                vec3 const unit = n / n_length;
+                Quadric const q(unit, -dot(unit, points_[a]), EDGE_WEIGHT * dot(edge, edge));
+                quadrics_[a].add(q);
+                quadrics_[b].add(q);
+            }
+        }
+        push(a, b);
+        push(b, a);
+    }
+}
+
+int Simplifier::corner_of(uint32_t triangle, uint32_t p) const {
+    for (int c = 0; c < 3; ++c) {
+        if (point(triangle, c) == p) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+// of the triangle with the point moved placed at to
+vec3 Simplifier::normal(uint32_t triangle, uint32_t moved, vec3 const& to) const {
+    vec3 p[3];
+    for (int c = 0; c < 3; ++c) {
+        uint32_t const q = point(triangle, c);
+        p[c] = q == moved ? to : points_[q];
+    }
+    return cross(p[1] - p[0], p[2] - p[0]);
+}
+
+void Simplifier::neighbors(uint32_t p, vector<uint32_t>& out) const {
+    out.clear();
+    vector<uint32_t> const& triangles = point_triangles_[p];
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        if (dead_triangle_[triangles[i]]) {
+            continue;
+        }
+        for (int c = 0; c < 3; ++c) {
+            uint32_t const q = point(triangles[i], c);
+            if (q != p) {
+                out.push_back(q);
+            }
+        }
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void Simplifier::push(uint32_t from, uint32_t to) {
+    vec3 const& target = points_[to];
+    Collapse const c = { quadrics_[from].error(target) + quadrics_[to].error(target), from, to,
+                         version_[from], version_[to] };
+    queue_.push(c);
+}
+
+bool Simplifier::can_collapse(uint32_t from, uint32_t to) {
+    wedge_map_.clear();
+    vector<uint32_t> const& triangles = point_triangles_[from];
+    int shared = 0;
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        uint32_t const t = triangles[i];
+        int const c_to = dead_triangle_[t] ? -1 : corner_of(t, to);
+        if (c_to < 0) {
+            continue;
+        }
+        ++shared;
+        uint32_t const w_from = corners_[3 * t + corner_of(t, from)];
+        uint32_t const w_to = corners_[3 * t + c_to];
+        bool found = false;
+        for (size_t k = 0; k < wedge_map_.size(); ++k) {
+            if (wedge_map_[k].first == w_from) {
+                // the two sides of the edge disagree: it crosses a seam
+                if (wedge_map_[k].second != w_to) {
+                    return false;
+                }
+                found = true;
+            }
+        }
+        if (!found) {
+            wedge_map_.push_back(std::make_pair(w_from, w_to));
+        }
+    }
+    if (shared == 0) {
+        return false;
+    }
+    // a border point only slides along the border
+    if (border_[from] && shared != 1) {
+        return false;
+    }
+
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        uint32_t const t = triangles[i];
+        if (dead_triangle_[t] || corner_of(t, to) >= 0) {
+            continue;
+        }
+        // every attribute of from needs a counterpart at to, or a seam
+        // would move off its line
+        uint32_t const w_from = corners_[3 * t + corner_of(t, from)];
+        bool mapped = false;
+        for (size_t k = 0; k < wedge_map_.size() && !mapped; ++k) {
+            mapped = wedge_map_[k].first == w_from;
+        }
+        if (!mapped) {
+            return false;
+        }
+        vec3 const before = normal(t, from, points_[from]);
+        vec3 const after = normal(t, from, points_[to]);
+        if (dot(before, after) <= 0) {
+            return false;
+        }
+    }
+
+    // link condition: the only common neighbours are the tips of the
+    // triangles on the edge, otherwise the surface would fold onto itself
+    vector<uint32_t> from_neighbors;
+    vector<uint32_t> to_neighbors;
+    neighbors(from, from_neighbors);
+    neighbors(to, to_neighbors);
+    vector<uint32_t> common;
+    std::set_intersection(from_neighbors.begin(), from_neighbors.end(), to_neighbors.begin(), to_neighbors.end(),
+                          std::back_inserter(common));
+    return int(common.size()) <= shared;
+}
+
+void Simplifier::collapse(uint32_t from, uint32_t to) {
+    vector<uint32_t>& triangles = point_triangles_[from];
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        uint32_t const t = triangles[i];
+        if (dead_triangle_[t]) {
+            continue;
+        }
+        if (corner_of(t, to) >= 0) {
+            dead_triangle_[t] = 1;
+            --live_triangles_;
+            continue;
+        }
+        uint32_t& w = corners_[3 * t + corner_of(t, from)];
+        for (size_t k = 0; k < wedge_map_.size(); ++k) {
+            if (wedge_map_[k].first == w) {
+                w = wedge_map_[k].second;
+                break;
+            }
+        }
+        point_triangles_[to].push_back(t);
+    }
+    triangles.clear();
+    removed_[from] = 1;
+    quadrics_[to].add(quadrics_[from]);
+    ++version_[to];
+
+    vector<uint32_t>& kept = point_triangles_[to];
+    size_t live = 0;
+    for (size_t i = 0; i < kept.size(); ++i) {
+        if (!dead_triangle_[kept[i]]) {
+            kept[live++] = kept[i];
+        }
+    }
+    kept.resize(live);
+    if (border_[from]) {
+        border_[to] = 1;
+    }
+
+    vector<uint32_t> around;
+    neighbors(to, around);
+    for (size_t i = 0; i < around.size(); ++i) {
+        push(to, around[i]);
+        push(around[i], to);
+    }
+}
+
+float Simplifier::run(size_t target_triangles) {
+    double max_error = 0;
+    while (live_triangles_ > target_triangles && !queue_.empty()) {
+        Collapse const c = queue_.top();
+        queue_.pop();
+        if (removed_[c.from] || removed_[c.to] || version_[c.from] != c.from_version
+            || version_[c.to] != c.to_version || !can_collapse(c.from, c.to)) {
+            continue;
+        }
+        double const weight = quadrics_[c.from].weight + quadrics_[c.to].weight;
+        if (weight > 0) {
+            max_error = std::max(max_error, std::sqrt(std::max(0.0, c.cost) / weight));
+        }
+        collapse(c.from, c.to);
+    }
+    return float(max_error);
+}
+
+void Simplifier::result(vector<uint32_t>& indices) const {
+    indices.clear();
+    for (size_t t = 0; t < dead_triangle_.size(); ++t) {
+        if (!dead_triangle_[t]) {
+            indices.insert(indices.end(), corners_.begin() + 3 * t, corners_.begin() + 3 * t + 3);
+        }
+    }
+}
+
+float simplify(IndexedMesh const& mesh, vector<uint32_t> const& indices, size_t target_triangles,
+               vector<uint32_t>& result) {
+    Simplifier simplifier(mesh, indices);
+    float const error = simplifier.run(target_triangles);
+    simplifier.result(result);
+    return error;
+}
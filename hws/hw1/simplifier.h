@@ -0,0 +1,39 @@
+#ifndef SIMPLIFIER_H
+#define SIMPLIFIER_H
+
+#include "common.h"
+#include "model.h"
+
+#include <cstdint>
+
+// Triangles over unique vertices. A position the model uses with several
+// texture coordinates or normals has one vertex per combination, the seams
+// of the mesh run along such positions.
+struct IndexedMesh {
+    vvec3 positions;
+    vvec2 textures;
+    vvec3 normals;
+    vector<uint32_t> indices;
+
+    size_t vertices_count() const { return positions.size(); }
+    size_t triangles_count() const { return indices.size() / 3; }
+};
+
+// merges the corners of model's triangles that are equal in every attribute
+IndexedMesh weld(Model const& model);
+
+// Garland-Heckbert simplification: removes edges of the triangles in
+// indices (over mesh's vertices) in the order of the quadric error they add
+// until target_triangles are left or no edge can go. Edges collapse into one
+// of their ends, so the result uses a subset of the same vertices.
+//
+// Seams are kept: a vertex on a seam only moves along it, into a vertex on
+// the same seam with matching attributes on both sides, and seam and border
+// edges weigh extra in the quadrics. Collapses that would flip a triangle or
+// make the surface non-manifold are skipped.
+//
+// Returns the largest distance from the original surface a collapse made.
+float simplify(IndexedMesh const& mesh, vector<uint32_t> const& indices, size_t target_triangles,
+               vector<uint32_t>& result);
+
+#endif // SIMPLIFIER_H
@@ -0,0 +1,192 @@
+#include "vertex_cache.h"
+
+#include <algorithm>
+#include <cmath>
+
+// cache model of Forsyth's scores, LRU
+static size_t const SCORED_CACHE_SIZE = 32;
+static float const CACHE_DECAY_POWER = 1.5f;
+static float const LAST_TRIANGLE_SCORE = 0.75f;
+static float const VALENCE_BOOST_SCALE = 2.0f;
+static float const VALENCE_BOOST_POWER = 0.5f;
+static uint32_t const NO_TRIANGLE = uint32_t(-1);
+
+static float vertex_score(int cache_position, unsigned triangles_left) {
+    if (triangles_left == 0) {
+        return -1;
+    }
+    float score = 0;
+    if (cache_position >= 0) {
+        // the triangle just drawn gets a fixed score, so its neighbours
+        // are not preferred over the rest of the cache too strongly
+        score = cache_position < 3
+              ? LAST_TRIANGLE_SCORE
+              : std::pow(1 - float(cache_position - 3) / (SCORED_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+    }
+    return score + VALENCE_BOOST_SCALE * std::pow(float(triangles_left), -VALENCE_BOOST_POWER);
+}
+
+void optimize_vertex_cache(vector<uint32_t>& indices, size_t first_index, size_t index_count) {
+    size_t const triangles_count = index_count / 3;
+    if (triangles_count < 2) {
+        return;
+    }
+    // vertices of the range renumbered from 0, the per-vertex state stays
+    // as small as the range even when it is one meshlet of a large mesh
+    vector<uint32_t> const source(indices.begin() + first_index, indices.begin() + first_index + 3 * triangles_count);
+    vector<uint32_t> sorted(source);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    size_t const vertices_count = sorted.size();
+    vector<uint32_t> local(source.size());
+    for (size_t i = 0; i < source.size(); ++i) {
+        local[i] = uint32_t(std::lower_bound(sorted.begin(), sorted.end(), source[i]) - sorted.begin());
+    }
+
+    // triangles of each vertex, the ones not emitted yet first
+    vector<unsigned> triangles_left(vertices_count, 0);
+    for (size_t i = 0; i < local.size(); ++i) {
+        ++triangles_left[local[i]];
+    }
+    vector<size_t> first_triangle(vertices_count + 1, 0);
+    for (size_t v = 0; v < vertices_count; ++v) {
+        first_triangle[v + 1] = first_triangle[v] + triangles_left[v];
+    }
+    vector<uint32_t> vertex_triangles(local.size());
+    vector<size_t> filled(first_triangle.begin(), first_triangle.end() - 1);
+    for (size_t i = 0; i < local.size(); ++i) {
+        vertex_triangles[filled[local[i]]++] = uint32_t(i / 3);
+    }
+
+    vector<int> cache_position(vertices_count, -1);
+    vector<float> scores(vertices_count);
+    for (size_t v = 0; v < vertices_count; ++v) {
+        scores[v] = vertex_score(-1, triangles_left[v]);
+    }
+    vector<float> triangle_scores(triangles_count);
+    for (size_t t = 0; t < triangles_count; ++t) {
+        triangle_scores[t] = scores[local[3 * t]] + scores[local[3 * t + 1]] + scores[local[3 * t + 2]];
+    }
+    vector<bool> emitted(triangles_count, false);
+
+    vector<uint32_t> cache;
+    vector<uint32_t> next_cache;
+    size_t out = first_index;
+    uint32_t best = NO_TRIANGLE;
+    for (size_t drawn = 0; drawn < triangles_count; ++drawn) {
+        if (best == NO_TRIANGLE) {
+            // nothing left around the cache, restart from the best triangle anywhere
+            float best_score = -1;
+            for (size_t t = 0; t < triangles_count; ++t) {
+                if (!emitted[t] && triangle_scores[t] > best_score) {
+                    best_score = triangle_scores[t];
+                    best = uint32_t(t);
+                }
+            }
+        }
+        emitted[best] = true;
+        next_cache.clear();
+        for (int corner = 0; corner < 3; ++corner) {
+            uint32_t const v = local[3 * best + corner];
+            indices[out++] = source[3 * best + corner];
+            next_cache.push_back(v);
+            // drop the triangle from the not emitted part of the vertex's list
+            size_t const first = first_triangle[v];
+            size_t const last = first + triangles_left[v] - 1;
+            for (size_t i = first; i <= last; ++i) {
+                if (vertex_triangles[i] == best) {
+                    std::swap(vertex_triangles[i], vertex_triangles[last]);
+                    break;
+                }
+            }
+            --triangles_left[v];
+        }
+        for (size_t i = 0; i < cache.size(); ++i) {
+            uint32_t const v = cache[i];
+            if (v != next_cache[0] && v != next_cache[1] && v != next_cache[2]) {
+                next_cache.push_back(v);
+            }
+        }
+
+        // vertices pushed out keep a score without the cache part
+        for (size_t i = 0; i < next_cache.size(); ++i) {
+            uint32_t const v = next_cache[i];
+            cache_position[v] = i < SCORED_CACHE_SIZE ? int(i) : -1;
+            scores[v] = vertex_score(cache_position[v], triangles_left[v]);
+        }
+        best = NO_TRIANGLE;
+        float best_score = -1;
+        for (size_t i = 0; i < next_cache.size(); ++i) {
+            uint32_t const v = next_cache[i];
+            for (size_t j = first_triangle[v]; j < first_triangle[v] + triangles_left[v]; ++j) {
+                uint32_t const t = vertex_triangles[j];
+                triangle_scores[t] = scores[local[3 * t]] + scores[local[3 * t + 1]] + scores[local[3 * t + 2]];
+                if (triangle_scores[t] > best_score) {
+                    best_score = triangle_scores[t];
+                    best = t;
+                }
+            }
+        }
+        if (next_cache.size() > SCORED_CACHE_SIZE) {
+            next_cache.resize(SCORED_CACHE_SIZE);
+        }
+        cache.swap(next_cache);
+    }
+}
+
+float cache_miss_ratio(vector<uint32_t> const& indices, size_t first_index, size_t index_count) {
+    if (index_count < 3) {
+        return 0;
+    }
+    // a vertex is cached while fewer than cache size misses happened since its own
+    uint32_t const max_index = *std::max_element(indices.begin() + first_index,
+                                                 indices.begin() + first_index + index_count);
+    vector<size_t> stamps(size_t(max_index) + 1, 0);
+    size_t time = VERTEX_CACHE_SIZE + 1;
+    size_t misses = 0;
+    for (size_t i = first_index; i < first_index + index_count; ++i) {
+        if (time - stamps[indices[i]] > VERTEX_CACHE_SIZE) {
+            stamps[indices[i]] = time++;
+            ++misses;
+        }
+    }
+    return float(misses) / (index_count / 3);
+}
+
+void optimize_vertex_fetch(IndexedMesh& mesh, vector<uint32_t>& indices) {
+    uint32_t const UNUSED = uint32_t(-1);
+    size_t const vertices_count = mesh.vertices_count();
+    vector<uint32_t> remap(vertices_count, UNUSED);
+    vector<uint32_t> order;
+    order.reserve(vertices_count);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        uint32_t& index = indices[i];
+        if (remap[index] == UNUSED) {
+            remap[index] = uint32_t(order.size());
+            order.push_back(index);
+        }
+        index = remap[index];
+    }
+    // vertices no level uses stay, at the end
+    for (size_t v = 0; v < vertices_count; ++v) {
+        if (remap[v] == UNUSED) {
+            remap[v] = uint32_t(order.size());
+            order.push_back(uint32_t(v));
+        }
+    }
+    for (size_t i = 0; i < mesh.indices.size(); ++i) {
+        mesh.indices[i] = remap[mesh.indices[i]];
+    }
+    IndexedMesh reordered;
+    reordered.positions.resize(vertices_count);
+    reordered.textures.resize(vertices_count);
+    reordered.normals.resize(vertices_count);
+    for (size_t v = 0; v < vertices_count; ++v) {
+        reordered.positions[v] = mesh.positions[order[v]];
+        reordered.textures[v] = mesh.textures[order[v]];
+        reordered.normals[v] = mesh.normals[order[v]];
+    }
+    mesh.positions.swap(reordered.positions);
+    mesh.textures.swap(reordered.textures);
+    mesh.normals.swap(reordered.normals);
+}
@@ -0,0 +1,26 @@
+#ifndef VERTEX_CACHE_H
+#define VERTEX_CACHE_H
+
+#include "common.h"
+#include "simplifier.h"
+
+#include <cstdint>
+
+// FIFO post-transform cache the miss ratio is measured with
+static size_t const VERTEX_CACHE_SIZE = 16;
+
+// Forsyth's linear-speed reorder of the triangles
+// indices[first_index, first_index + index_count): greedily emits the
+// triangle whose vertices score highest, favouring vertices recently used
+// and ones with few triangles left, so the range is walked in cache-sized
+// patches. Only the order of the range changes, not its triangles.
+void optimize_vertex_cache(vector<uint32_t>& indices, size_t first_index, size_t index_count);
+
+// vertex shader runs per triangle of the range, starting from an empty cache
+float cache_miss_ratio(vector<uint32_t> const& indices, size_t first_index, size_t index_count);
+
+// Renumbers mesh's vertices in the order indices first use them, so vertex
+// fetch walks the buffer forward; mesh.indices are renumbered with them.
+void optimize_vertex_fetch(IndexedMesh& mesh, vector<uint32_t>& indices);
+
+#endif // VERTEX_CACHE_H
@@ -53,7 +53,7 @@ struct program_state {
         set_draw_configs();
         init_textures();
         set_texture_filtration();
-        set_data_buffer();
+        set_data_buffers();
     }
 
     void on_display_event() {
@@ -68,7 +68,6 @@ struct program_state {
         case CYLINDER: cur_obj = SPHERE; break;
         case SPHERE: cur_obj = QUAD; break;
         }
-        set_data_buffer();
     }
 
     void switch_polygon_mode() {
@@ -93,7 +92,9 @@ struct program_state {
         glDeleteProgram(program);
         glDeleteShader(vx_shader);
         glDeleteShader(frag_shader);
-        glDeleteBuffers(1, &vx_buffer);
+        glDeleteBuffers(3, vx_buffers);
+        glDeleteBuffers(3, tex_buffers);
+        glDeleteBuffers(3, norms_buffers);
     }
 
 private:
@@ -105,9 +106,10 @@ private:
     GLuint frag_shader;
     GLuint program;
 
-    GLuint vx_buffer;
-    GLuint tex_buffer;
-    GLuint norms_buffer;
+    // by geom_obj, filled once, so switching figures allocates nothing
+    GLuint vx_buffers[3];
+    GLuint tex_buffers[3];
+    GLuint norms_buffers[3];
 
     GLuint texture_sampler;
     GLuint texture_id;
@@ -149,9 +151,6 @@ private:
         glClearColor(0.0f, 0.0f, 0.4f, 0.0f);
         glEnable(GL_DEPTH_TEST);
         glDepthFunc(GL_LESS);
-
-        int mode = wireframe_mode ? GL_LINE : GL_FILL;
-        glPolygonMode(GL_FRONT_AND_BACK, mode);
     }
 
     void init_textures() {
@@ -183,22 +182,26 @@ private:
         }
     }
 
-    void set_data_buffer() {
-        draw_data& data = cur_draw_data();
-        glGenBuffers(1, &vx_buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, vx_buffer);
-        glBufferData(GL_ARRAY_BUFFER, data.vertices_data_size(),
-                     data.vertices_data(), GL_STATIC_DRAW);
-
-        glGenBuffers(1, &tex_buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, tex_buffer);
-        glBufferData(GL_ARRAY_BUFFER, data.tex_mapping_data_size(),
-                     data.tex_mapping_data(), GL_STATIC_DRAW);
-
-        glGenBuffers(1, &norms_buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, norms_buffer);
-        glBufferData(GL_ARRAY_BUFFER, data.normals_data_size(),
-                     data.normals_data(), GL_STATIC_DRAW);
+    void set_data_buffers() {
+        glGenBuffers(3, vx_buffers);
+        glGenBuffers(3, tex_buffers);
+        glGenBuffers(3, norms_buffers);
+        draw_data* const figures[3] = { &quad, &cylinder, &sphere };
+        for(int obj = QUAD; obj <= SPHERE; ++obj) {
+            draw_data& data = *figures[obj];
+            glBindBuffer(GL_ARRAY_BUFFER, vx_buffers[obj]);
+            glBufferData(GL_ARRAY_BUFFER, data.vertices_data_size(),
+                         data.vertices_data(), GL_STATIC_DRAW);
+
+            glBindBuffer(GL_ARRAY_BUFFER, tex_buffers[obj]);
+            glBufferData(GL_ARRAY_BUFFER, data.tex_mapping_data_size(),
+                         data.tex_mapping_data(), GL_STATIC_DRAW);
+
+            glBindBuffer(GL_ARRAY_BUFFER, norms_buffers[obj]);
+            glBufferData(GL_ARRAY_BUFFER, data.normals_data_size(),
+                         data.normals_data(), GL_STATIC_DRAW);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 
     void draw() {
@@ -227,12 +230,13 @@ private:
         glUniform1f(glGetUniformLocation(program, "light_power"), light_power);
         glUniform3f(glGetUniformLocation(program, "ambient"), ambient, ambient, ambient);
         glUniform3f(glGetUniformLocation(program, "specular"), specular, specular, specular);
+        glUniform1i(glGetUniformLocation(program, "wireframe"), wireframe_mode);
 
-        glBindBuffer(GL_ARRAY_BUFFER, vx_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, vx_buffers[cur_obj]);
         utils::set_vertex_attr_ptr(program, IN_POS);
-        glBindBuffer(GL_ARRAY_BUFFER, tex_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, tex_buffers[cur_obj]);
         utils::set_vertex_attr_ptr(program, VERTEX_UV);
-        glBindBuffer(GL_ARRAY_BUFFER, norms_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, norms_buffers[cur_obj]);
         utils::set_vertex_attr_ptr(program, IN_NORM);
 
         glActiveTexture(GL_TEXTURE0);
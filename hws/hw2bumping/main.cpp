@@ -1,6 +1,7 @@
 #include "common.h"
 #include "shader.h"
 #include "utils.h"
+#include "light_clusters.h"
 
 using namespace std;
 
@@ -18,12 +19,22 @@ public:
     float ambient[3];
     float specular[3];
 
+    // point lights wandering around the object, binned into clusters of
+    // the view frustum every frame for main.fs; none by default
+    int light_count;
+    float cluster_bin_ms;
+    int cluster_max_lights;
+
     program_state()
         : wireframe_mode(false)
         , cur_obj(SPHERE)
         , tex_filtration(NEAREST)
         , light_power(1.0)
         , specular_power(5)
+        , light_count(0)
+        , cluster_bin_ms(0)
+        , cluster_max_lights(0)
+        , start_time(chrono::system_clock::now())
     {
         light_src_direction[0] = -13;
         light_src_direction[1] = -13;
@@ -51,6 +62,9 @@ public:
         utils::compute_tangent_basis(sphere);
 
         set_shaders();
+        if (light_clusters::supported()) {
+            clusters.reset(new light_clusters(worker_pool::hardware_workers()));
+        }
         set_draw_configs();
         init_texture();
         set_data_buffer();
@@ -115,6 +129,10 @@ public:
     GLuint normals_map_id;
     GLuint normals_map_sampler;
 
+    unique_ptr<light_clusters> clusters;
+    point_light_set point_lights;
+    chrono::system_clock::time_point start_time;
+
     const char* QUAD_MODEL_PATH = "..//res//quad.obj";
     draw_data quad;
 
@@ -130,6 +148,10 @@ public:
     const char* VERTEX_SHADER_PATH = "..//shaders//main.vs";
     const char* FRAGMENT_SHADER_PATH = "..//shaders//main.fs";
 
+    // depth range of the projection
+    float const NEAR_PLANE = 0.1f;
+    float const FAR_PLANE = 100.0f;
+
     draw_data& cur_draw_data() {
         switch(cur_obj) {
         case QUAD: return quad;
@@ -150,9 +172,6 @@ public:
         glClearDepth(1);
         glEnable(GL_DEPTH_TEST);
         glDepthFunc(GL_LESS);
-
-        int mode = wireframe_mode ? GL_LINE : GL_FILL;
-        glPolygonMode(GL_FRONT_AND_BACK, mode);
     }
 
     void init_texture() {
@@ -228,7 +247,7 @@ public:
         float const w = (float)glutGet(GLUT_WINDOW_WIDTH);
         float const h = (float)glutGet(GLUT_WINDOW_HEIGHT);
 
-        mat4 const proj = perspective(45.0f, w / h, 0.1f, 100.0f);
+        mat4 const proj = perspective(45.0f, w / h, NEAR_PLANE, FAR_PLANE);
         mat4 const view = lookAt(vec3(-2, 3, 6), vec3(0, 0, 0), vec3(0, 1, 0));
         mat4 const model = mat4_cast(rotation_by_control);
         mat4 modelview = view * model;
@@ -246,6 +265,7 @@ public:
         glUniform3f(glGetUniformLocation(program, "specular"), specular[0], specular[1], specular[2]);
         glUniform1f(glGetUniformLocation(program, "power"), (GLfloat)light_power);
         glUniform1f(glGetUniformLocation(program, "specular_power"), (GLfloat)specular_power);
+        glUniform1i(glGetUniformLocation(program, "wireframe"), wireframe_mode);
 
         pass_vertex_data();
 
@@ -259,9 +279,30 @@ public:
         set_texture_filtration();
         glUniform1i(normals_map_sampler, 1);
 
+        bool const point_lights_on = clusters && light_count > 0;
+        if (point_lights_on) {
+            update_point_lights(proj, view);
+            clusters->bind(program, 2, vec2(w, h));
+        } else {
+            cluster_bin_ms = 0;
+            cluster_max_lights = 0;
+        }
+        glUniform1i(glGetUniformLocation(program, "point_lights"), point_lights_on);
+
         glDrawArrays(GL_TRIANGLES, 0, cur_draw_data().vertices_num());
     }
 
+    void update_point_lights(mat4 const& proj, mat4 const& view) {
+        aabb area;
+        area.min = vec3(-4, -4, -4);
+        area.max = vec3(4, 4, 4);
+        point_lights.set(size_t(light_count), area);
+        point_lights.update(chrono::duration<float>(chrono::system_clock::now() - start_time).count());
+        clusters->update(point_lights, proj, view, NEAR_PLANE, FAR_PLANE);
+        cluster_bin_ms = clusters->binner().bin_ms();
+        cluster_max_lights = int(clusters->binner().max_cluster_lights());
+    }
+
 
     void pass_vertex_data() {
         glBindBuffer(GL_ARRAY_BUFFER, vx_buffer);
@@ -351,6 +392,10 @@ void basic_init(int argc, char ** argv) {
        cerr << "OpenGL 3.0 not supported" << endl;
        exit(1);
     }
+    // the clustered point lights need texture buffers, core from 3.1
+    if (!light_clusters::supported()) {
+       cerr << "OpenGL 3.1 not supported, point lights are off" << endl;
+    }
 }
 
 void register_callbacks() {
@@ -390,7 +435,7 @@ void create_controls(program_state& prog_state) {
     TwInit(TW_OPENGL, NULL);
 
     TwBar* bar = TwNewBar("Parameters");
-    TwDefine("Parameters size='400 550' color='70 100 120' valueswidth=220 iconpos=topleft");
+    TwDefine("Parameters size='400 620' color='70 100 120' valueswidth=220 iconpos=topleft");
     TwAddButton(bar, "Fullscreen toggle", toggle_fullscreen_callback, NULL,
                 "label='Toggle fullscreen mode' key=f");
     TwAddVarRW(bar, "ObjRotation", TW_TYPE_QUAT4F, &prog_state.rotation_by_control,
@@ -407,6 +452,9 @@ void create_controls(program_state& prog_state) {
     TwAddVarRW(bar, "Ambient ", TW_TYPE_COLOR3F, &prog_state.ambient, " colormode=hls ");
     TwAddVarRW(bar, "Specular ", TW_TYPE_COLOR3F, &prog_state.specular, " colormode=rgb ");
     TwAddVarRW(bar, "SpecularPower ", TW_TYPE_FLOAT, &prog_state.specular_power, "min=1 max=100 step=0.1");
+    TwAddVarRW(bar, "Point lights", TW_TYPE_INT32, &prog_state.light_count, "min=0 max=16384 step=64");
+    TwAddVarRO(bar, "Light binning, ms", TW_TYPE_FLOAT, &prog_state.cluster_bin_ms, "");
+    TwAddVarRO(bar, "Max lights in a cluster", TW_TYPE_INT32, &prog_state.cluster_max_lights, "");
 }
 
 void remove_controls() {
@@ -0,0 +1,46 @@
+#include "point_lights.h"
+
+#include <cmath>
+#include <random>
+
+static float const MIN_LIGHT_RADIUS = 1.0f;
+static float const MAX_LIGHT_RADIUS = 2.5f;
+static float const LIGHT_INTENSITY = 1.5f;
+
+point_light_set::point_light_set() {
+    area.min = area.max = vec3(0);
+}
+
+void point_light_set::set(size_t count, aabb const& new_area) {
+    if(count == lights.size() && new_area.min == area.min && new_area.max == area.max) {
+        return;
+    }
+    area = new_area;
+    lights.resize(count);
+    paths.resize(count);
+    // the same lights for the same count, so runs compare
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0, 1);
+    for(size_t i = 0; i != count; ++i) {
+        vec3 const t(unit(random), unit(random), unit(random));
+        paths[i].center = area.min + t * (area.max - area.min);
+        paths[i].orbit = 0.25f + 0.75f * unit(random);
+        paths[i].speed = 0.5f + unit(random);
+        paths[i].phase = 6.2831853f * unit(random);
+        lights[i].sphere.w = MIN_LIGHT_RADIUS + (MAX_LIGHT_RADIUS - MIN_LIGHT_RADIUS) * unit(random);
+        // saturated hues, one channel kept low
+        vec3 color(unit(random), unit(random), unit(random));
+        color[i % 3] *= 0.25f;
+        lights[i].color = vec4(LIGHT_INTENSITY * color / std::max(color.x, std::max(color.y, color.z)), 0);
+    }
+    update(0);
+}
+
+void point_light_set::update(float seconds) {
+    for(size_t i = 0; i != lights.size(); ++i) {
+        light_path const& path = paths[i];
+        float const angle = path.phase + path.speed * seconds;
+        vec3 const position = path.center + path.orbit * vec3(std::cos(angle), std::sin(angle), 0.5f * std::sin(2 * angle));
+        lights[i].sphere = vec4(position, lights[i].sphere.w);
+    }
+}
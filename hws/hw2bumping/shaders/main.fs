@@ -1,8 +1,14 @@
 #version 130
+// texture buffers are core from GLSL 1.40, a 1.30 shader has them through
+// the extension; without it the clustered lights are left out
+#extension GL_ARB_texture_buffer_object : enable
 
 in vec2 UV;
 in vec3 LightDirection_tangentspace;
 in vec3 EyeDirection_tangentspace;
+in vec3 Position_cameraspace;
+in mat3 TBN;
+in vec3 Barycentric;
 
 out vec3 color;
 
@@ -16,6 +22,68 @@ uniform float specular_power;
 uniform sampler2D texture_sampler;
 uniform sampler2D normals_map_sampler;
 
+// wireframe is drawn over the surface in the same pass
+uniform bool wireframe;
+
+const vec3 WIRE_COLOR = vec3(1);
+// in pixels, the same at any distance
+const float WIRE_WIDTH = 1.5;
+
+// 1 on the edges of the triangle, fading out over a pixel for anti-aliasing
+float wire_coverage() {
+    vec3 pixels = Barycentric / fwidth(Barycentric);
+    float distance = min(pixels.x, min(pixels.y, pixels.z));
+    return 1 - smoothstep(0.5 * WIRE_WIDTH - 0.5, 0.5 * WIRE_WIDTH + 0.5, distance);
+}
+
+// false when there are no point lights and the buffers are not bound
+uniform bool point_lights;
+
+#ifdef GL_ARB_texture_buffer_object
+// point lights binned into clusters of the view frustum, see light_clusters.h:
+// two texels a light, camera space position and radius, then color
+uniform samplerBuffer cluster_lights;
+// first index and count of the lights of every cluster
+uniform usamplerBuffer cluster_ranges;
+uniform usamplerBuffer cluster_light_indices;
+uniform ivec3 cluster_grid;
+uniform vec2 cluster_tile_size;
+// slice of a depth is log(depth) * x + y
+uniform vec2 cluster_depth_scale_bias;
+
+vec3 clustered_lights(vec3 albedo, vec3 n, vec3 E) {
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / cluster_tile_size), ivec2(0), cluster_grid.xy - 1);
+    int slice = int(floor(log(-Position_cameraspace.z) * cluster_depth_scale_bias.x + cluster_depth_scale_bias.y));
+    slice = clamp(slice, 0, cluster_grid.z - 1);
+    uvec2 range = texelFetch(cluster_ranges, (slice * cluster_grid.y + tile.y) * cluster_grid.x + tile.x).xy;
+
+    vec3 sum = vec3(0);
+    for(uint i = range.x; i != range.x + range.y; ++i) {
+        int light = int(texelFetch(cluster_light_indices, int(i)).x);
+        vec4 sphere = texelFetch(cluster_lights, 2 * light);
+        vec3 to_light = sphere.xyz - Position_cameraspace;
+        float distance = length(to_light);
+        if(distance >= sphere.w) {
+            continue;
+        }
+        // inverse square, brought smoothly to 0 at the radius
+        float window = clamp(1 - pow(distance / sphere.w, 4), 0, 1);
+        float attenuation = window * window / (distance * distance + 1);
+
+        vec3 l = TBN * (to_light / distance);
+        float cosTheta = clamp(dot(n, l), 0, 1);
+        float cosAlpha = clamp(dot(E, reflect(-l, n)), 0, 1);
+        vec3 point_color = texelFetch(cluster_lights, 2 * light + 1).rgb;
+        sum += (albedo * cosTheta + specular * pow(cosAlpha, specular_power)) * point_color * attenuation;
+    }
+    return sum;
+}
+#else
+vec3 clustered_lights(vec3 albedo, vec3 n, vec3 E) {
+    return vec3(0);
+}
+#endif
+
 void main() {
     vec3 texture_color = texture(texture_sampler, UV).rgb;
 
@@ -31,4 +99,10 @@ void main() {
     vec3 specular_part = specular * pow(cosAlpha, specular_power);
 
     color = ambient_part + diffuse_part + specular_part;
+    if (point_lights) {
+        color += clustered_lights(texture_color, n, E);
+    }
+    if (wireframe) {
+        color = mix(color, WIRE_COLOR, wire_coverage());
+    }
 }
@@ -9,6 +9,10 @@ in vec3 vert_bitangent;
 out vec2 UV;
 out vec3 EyeDirection_tangentspace;
 out vec3 LightDirection_tangentspace;
+// for the point lights, found in camera space
+out vec3 Position_cameraspace;
+out mat3 TBN;
+out vec3 Barycentric;
 
 uniform mat4 mvp;
 uniform mat4 view;
@@ -24,8 +28,13 @@ void main() {
     vec3 vert_true_tangent = vert_tangent - dot(vert_tangent, vert_normal) * vert_normal;
     vec3 vert_tangent_cameraspace = model_view3 * normalize(vert_true_tangent);
     vec3 vert_bitangent_cameraspace = model_view3 * normalize(vert_bitangent);
-    mat3 TBN = transpose(mat3(vert_tangent_cameraspace, vert_bitangent_cameraspace, vert_normal_cameraspace));
+    TBN = transpose(mat3(vert_tangent_cameraspace, vert_bitangent_cameraspace, vert_normal_cameraspace));
 
+    Position_cameraspace = (view * model * vec4(vert_pos, 1)).xyz;
     LightDirection_tangentspace = TBN * (-light_pos);
-    EyeDirection_tangentspace = TBN * (-(view * model * vec4(vert_pos, 1)).xyz);
+    EyeDirection_tangentspace = TBN * (-Position_cameraspace);
+
+    // the triangles are drawn unindexed, so the vertex number tells the corner
+    int corner = gl_VertexID % 3;
+    Barycentric = vec3(corner == 0, corner == 1, corner == 2);
 }
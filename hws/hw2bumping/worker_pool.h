@@ -0,0 +1,48 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running parallel loops. The calling thread is
+// worker 0 and takes part in every run(), a pool of one runs everything
+// inline. Tasks are handed out one at a time, so uneven ones balance.
+class worker_pool {
+public:
+    typedef std::function<void(size_t task, size_t worker)> task_function;
+
+    explicit worker_pool(size_t workers);
+    ~worker_pool();
+
+    size_t workers_count() const { return threads.size() + 1; }
+
+    // calls fn for every task in [0, tasks), returns when all are done
+    void run(size_t tasks, task_function const& fn);
+
+    // threads the hardware runs at once, at least 1
+    static size_t hardware_workers();
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+
+    // state of the current run, guarded by mutex
+    task_function const* job;
+    size_t tasks_count;
+    size_t next_task;
+    size_t busy;
+    size_t generation;
+    bool stopping;
+
+    void thread_main(size_t worker);
+    // runs tasks of the current job until there are none left
+    void drain(size_t worker, std::unique_lock<std::mutex>& lock);
+};
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,355 @@
+#include "batch_filter.h"
+#include "blocking_queue.h"
+#include "filter_fusion.h"
+#include "utils.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
+
+// decoded images waiting for the GPU and filtered ones waiting for encoding
+static size_t const QUEUE_CAPACITY = 4;
+
+struct image {
+    string name;
+    int width;
+    int height;
+    // BGR, bottom-up rows aligned to 4 bytes (FreeImage and GL default layout)
+    vector<BYTE> pixels;
+
+    size_t pitch() const { return (width * 3 + 3) & ~3; }
+};
+
+typedef unique_ptr<image> image_ptr;
+
+static std::mutex log_mutex;
+
+static void log_error(string const& msg) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    cout << "batch: " << msg << endl;
+}
+
+vector<filter> parse_filter_chain(string const& names) {
+    vector<filter> chain;
+    size_t begin = 0;
+    while(begin <= names.size()) {
+        size_t end = names.find(',', begin);
+        if(end == string::npos) {
+            end = names.size();
+        }
+        string const name = names.substr(begin, end - begin);
+        if(name == "box") {
+            chain.push_back(BOX_BLUR);
+        } else if(name == "gaussian") {
+            chain.push_back(GAUSSIAN_HORIZONTAL_BLUR);
+            chain.push_back(GAUSSIAN_VERTICAL_BLUR);
+        } else if(name == "gaussian_h") {
+            chain.push_back(GAUSSIAN_HORIZONTAL_BLUR);
+        } else if(name == "gaussian_v") {
+            chain.push_back(GAUSSIAN_VERTICAL_BLUR);
+        } else if(name == "sobel") {
+            chain.push_back(SOBEL_FILTER);
+        } else if(name == "gray") {
+            chain.push_back(GRAYSCALE);
+        } else if(name == "threshold") {
+            chain.push_back(THRESHOLD);
+        } else if(name == "tone") {
+            chain.push_back(TONE_ADJUST);
+        } else if(name != "none") {
+            throw msg_exception("unknown filter: '" + name + "'");
+        }
+        begin = end + 1;
+    }
+    return chain;
+}
+
+bool parse_filter_option(string const& key, char const* value, filter_params& params, size_t& fuse_taps) {
+    if(key == "--radius") {
+        params.gaussian_kernel_radius = std::atoi(value);
+    } else if(key == "--variance") {
+        params.gaussian_variance = std::atof(value);
+    } else if(key == "--sobel-threshold") {
+        params.sobel_threshold = std::atof(value);
+    } else if(key == "--threshold") {
+        params.threshold = std::atof(value);
+    } else if(key == "--exposure") {
+        params.tone_exposure = std::atof(value);
+    } else if(key == "--gamma") {
+        params.tone_gamma = std::atof(value);
+    } else if(key == "--fuse") {
+        fuse_taps = std::max(0, std::atoi(value));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+batch_options parse_batch_options(int argc, char** argv) {
+    if(argc < 3) {
+        throw msg_exception("usage: main --batch <input dir> <output dir> <filter,filter,...> "
+                            "[--radius n] [--variance v] [--sobel-threshold t] [--threshold t] "
+                            "[--exposure e] [--gamma g] [--fuse taps] [--decoders n] [--encoders n]");
+    }
+    batch_options options;
+    options.input_dir = argv[0];
+    options.output_dir = argv[1];
+    options.chain = parse_filter_chain(argv[2]);
+    for(int i = 3; i < argc; i += 2) {
+        string const key = argv[i];
+        if(i + 1 >= argc) {
+            throw msg_exception("missing value for " + key);
+        }
+        char const* value = argv[i + 1];
+        if(parse_filter_option(key, value, options.params, options.fuse_taps)) {
+            continue;
+        } else if(key == "--decoders") {
+            options.decode_threads = std::max(1, std::atoi(value));
+        } else if(key == "--encoders") {
+            options.encode_threads = std::max(1, std::atoi(value));
+        } else {
+            throw msg_exception("unknown option: " + key);
+        }
+    }
+    return options;
+}
+
+static bool is_readable_image(string const& path) {
+    FREE_IMAGE_FORMAT fif = FreeImage_GetFIFFromFilename(path.c_str());
+    return fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif);
+}
+
+static vector<string> list_images(string const& dir) {
+    vector<string> names;
+#ifdef _WIN32
+    _finddata_t entry;
+    intptr_t handle = _findfirst((dir + "/*").c_str(), &entry);
+    if(handle == -1) {
+        throw msg_exception("can't open directory " + dir);
+    }
+    do {
+        if(!(entry.attrib & _A_SUBDIR) && is_readable_image(entry.name)) {
+            names.push_back(entry.name);
+        }
+    } while(_findnext(handle, &entry) == 0);
+    _findclose(handle);
+#else
+    DIR* d = opendir(dir.c_str());
+    if(!d) {
+        throw msg_exception("can't open directory " + dir);
+    }
+    while(dirent* entry = readdir(d)) {
+        if(entry->d_name[0] != '.' && is_readable_image(entry->d_name)) {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(d);
+#endif
+    return names;
+}
+
+static image_ptr decode_image(string const& dir, string const& name) {
+    string const path = dir + "/" + name;
+    FREE_IMAGE_FORMAT fif = FreeImage_GetFileType(path.c_str(), 0);
+    if(fif == FIF_UNKNOWN) {
+        fif = FreeImage_GetFIFFromFilename(path.c_str());
+    }
+    FIBITMAP* dib = fif == FIF_UNKNOWN ? 0 : FreeImage_Load(fif, path.c_str());
+    if(!dib) {
+        throw msg_exception("can't read " + path);
+    }
+    FIBITMAP* bgr = FreeImage_ConvertTo24Bits(dib);
+    FreeImage_Unload(dib);
+    if(!bgr) {
+        throw msg_exception("can't convert " + path + " to 24 bits");
+    }
+
+    image_ptr img(new image);
+    img->name = name;
+    img->width = FreeImage_GetWidth(bgr);
+    img->height = FreeImage_GetHeight(bgr);
+    img->pixels.resize(img->pitch() * img->height);
+    for(int y = 0; y != img->height; ++y) {
+        std::memcpy(&img->pixels[y * img->pitch()], FreeImage_GetScanLine(bgr, y), img->width * 3);
+    }
+    FreeImage_Unload(bgr);
+    return img;
+}
+
+static void encode_image(string const& dir, image const& img) {
+    string const path = dir + "/" + img.name;
+    FREE_IMAGE_FORMAT fif = FreeImage_GetFIFFromFilename(path.c_str());
+    if(fif == FIF_UNKNOWN || !FreeImage_FIFSupportsWriting(fif)) {
+        throw msg_exception("no writing capabilities for " + path);
+    }
+    FIBITMAP* bgr = FreeImage_Allocate(img.width, img.height, 24);
+    for(int y = 0; y != img.height; ++y) {
+        std::memcpy(FreeImage_GetScanLine(bgr, y), &img.pixels[y * img.pitch()], img.width * 3);
+    }
+    bool saved = FreeImage_Save(fif, bgr, path.c_str());
+    FreeImage_Unload(bgr);
+    if(!saved) {
+        throw msg_exception("can't write " + path);
+    }
+}
+
+// Filtered images are read back through two pixel pack buffers: the copy
+// of image i is queued into one of them while image i - 1 is mapped from
+// the other, so mapping does not wait for the pass just submitted.
+class readback_ring {
+public:
+    explicit readback_ring(blocking_queue<image_ptr>& out)
+        : out(out)
+        , slot(0)
+    {
+        glGenBuffers(2, pbo);
+        size[0] = size[1] = 0;
+    }
+
+    ~readback_ring() { glDeleteBuffers(2, pbo); }
+
+    void submit(filter_pipeline& pipeline, image_ptr img) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[slot]);
+        if(size[slot] < img->pixels.size()) {
+            size[slot] = img->pixels.size();
+            glBufferData(GL_PIXEL_PACK_BUFFER, size[slot], NULL, GL_STREAM_READ);
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        pipeline.read_result(GL_BGR, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        pending[slot] = std::move(img);
+        slot ^= 1;
+        complete(slot);
+    }
+
+    void flush() {
+        complete(slot);
+        complete(slot ^ 1);
+    }
+
+private:
+    blocking_queue<image_ptr>& out;
+    GLuint pbo[2];
+    size_t size[2];
+    image_ptr pending[2];
+    size_t slot;
+
+    void complete(size_t s) {
+        if(!pending[s]) {
+            return;
+        }
+        vector<BYTE>& pixels = pending[s]->pixels;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[s]);
+        void const* mapped = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if(mapped) {
+            std::memcpy(pixels.data(), mapped, pixels.size());
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if(!mapped) {
+            log_error("can't map read back buffer for " + pending[s]->name);
+        } else {
+            out.push(std::move(pending[s]));
+        }
+        pending[s].reset();
+    }
+};
+
+void run_batch_filter(batch_options const& options, program_cache& programs) {
+    vector<string> const names = list_images(options.input_dir);
+    utils::debug("batch: " + std::to_string(names.size()) + " images in " + options.input_dir);
+
+    chrono::system_clock::time_point const start = chrono::system_clock::now();
+
+    blocking_queue<image_ptr> decoded(QUEUE_CAPACITY);
+    blocking_queue<image_ptr> filtered(QUEUE_CAPACITY);
+    std::atomic<size_t> next_name(0);
+    std::atomic<size_t> decoders_left(options.decode_threads);
+    std::atomic<size_t> written(0);
+
+    vector<std::thread> decoders;
+    for(size_t i = 0; i != options.decode_threads; ++i) {
+        decoders.push_back(std::thread([&] {
+            for(size_t n = next_name++; n < names.size(); n = next_name++) {
+                try {
+                    decoded.push(decode_image(options.input_dir, names[n]));
+                } catch(std::exception const& e) {
+                    log_error(e.what());
+                }
+            }
+            if(--decoders_left == 0) {
+                decoded.close();
+            }
+        }));
+    }
+
+    vector<std::thread> encoders;
+    for(size_t i = 0; i != options.encode_threads; ++i) {
+        encoders.push_back(std::thread([&] {
+            image_ptr img;
+            while(filtered.pop(img)) {
+                try {
+                    encode_image(options.output_dir, *img);
+                    ++written;
+                } catch(std::exception const& e) {
+                    log_error(e.what());
+                }
+            }
+        }));
+    }
+
+    auto join_all = [&] {
+        for(size_t i = 0; i != decoders.size(); ++i) {
+            decoders[i].join();
+        }
+        for(size_t i = 0; i != encoders.size(); ++i) {
+            encoders[i].join();
+        }
+    };
+
+    // GL work stays on the thread owning the context
+    try {
+        filter_pipeline pipeline(programs);
+        readback_ring readback(filtered);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        bool const fuse = options.fuse_taps != 0;
+        vector<fused_pass> const passes = fuse_filter_chain(options.chain, options.params, options.fuse_taps);
+        GLuint const vx_shader = programs.shader(GL_VERTEX_SHADER, FILTERED_VERTEX_SHADER_PATH);
+        unique_ptr<fused_programs> fused(fuse ? new fused_programs(passes, vx_shader) : 0);
+
+        image_ptr img;
+        while(decoded.pop(img)) {
+            if(fuse && (img->width != pipeline.width() || img->height != pipeline.height())) {
+                utils::debug(fusion_report(options.chain, passes, img->width, img->height));
+            }
+            pipeline.resize(img->width, img->height);
+            pipeline.load_source(GL_BGR, img->pixels.data());
+            if(fuse) {
+                pipeline.apply(fused->programs());
+            } else {
+                pipeline.apply(options.chain, options.params);
+            }
+            readback.submit(pipeline, std::move(img));
+        }
+        readback.flush();
+    } catch(...) {
+        decoded.close();
+        filtered.close();
+        join_all();
+        throw;
+    }
+    filtered.close();
+    join_all();
+
+    float const seconds = chrono::duration<float>(chrono::system_clock::now() - start).count();
+    cout << "batch: " << written << " of " << names.size() << " images in " << seconds << " s, "
+         << (seconds > 0 ? written / seconds : 0) << " images/s" << endl;
+}
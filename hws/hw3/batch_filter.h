@@ -0,0 +1,44 @@
+#ifndef BATCH_FILTER_H
+#define BATCH_FILTER_H
+
+#include "common.h"
+#include "filter_pipeline.h"
+
+// Headless mode: filters every image of a directory through the GL
+// filter pipeline and writes the results under the same names.
+//
+//   main --batch <input dir> <output dir> <filters> [options]
+//
+// filters is a comma separated chain of box, gaussian (horizontal and
+// vertical pass), gaussian_h, gaussian_v, sobel, gray, threshold, tone.
+// Options:
+//   --radius <n>  --variance <v>  --sobel-threshold <t>  --threshold <t>
+//   --exposure <e>  --gamma <g>
+//   --fuse <max taps of a fused stencil, 0 runs every filter as a pass>
+//   --decoders <n>  --encoders <n>
+struct batch_options {
+    string input_dir;
+    string output_dir;
+    vector<filter> chain;
+    filter_params params;
+    size_t fuse_taps;
+    size_t decode_threads;
+    size_t encode_threads;
+
+    batch_options()
+        : fuse_taps(49)
+        , decode_threads(2)
+        , encode_threads(2)
+    {}
+};
+
+vector<filter> parse_filter_chain(string const& names);
+// parses the filter options shared by batch and tiled modes,
+// returns false if key is not one of them
+bool parse_filter_option(string const& key, char const* value, filter_params& params, size_t& fuse_taps);
+batch_options parse_batch_options(int argc, char** argv);
+
+// needs a current GL context; decoding and encoding run on own threads
+void run_batch_filter(batch_options const& options, program_cache& programs);
+
+#endif // BATCH_FILTER_H
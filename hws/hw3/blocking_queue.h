@@ -0,0 +1,60 @@
+#ifndef BLOCKING_QUEUE_H
+#define BLOCKING_QUEUE_H
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+
+// Bounded multi-producer multi-consumer queue. push() blocks while the
+// queue is full, pop() blocks while it is empty. After close() pushes are
+// rejected and pop() fails once the remaining items are drained.
+template<typename T>
+class blocking_queue {
+public:
+    explicit blocking_queue(size_t capacity)
+        : capacity(capacity)
+        , closed(false)
+    {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+        if(closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return closed || !items.empty(); });
+        if(items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+private:
+    size_t const capacity;
+    bool closed;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+};
+
+#endif // BLOCKING_QUEUE_H
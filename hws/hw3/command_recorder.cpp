@@ -0,0 +1,109 @@
+#include "command_recorder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+command_recorder::command_recorder(size_t workers)
+    : culled(0)
+    , unsorted_changes(0)
+{
+    set_workers(workers);
+}
+
+void command_recorder::set_workers(size_t workers) {
+    // list indices have to fit the payload
+    workers = std::max<size_t>(1, std::min<size_t>(workers, size_t(1) << (32 - LIST_SHIFT)));
+    pool.reset();
+    pool.reset(new worker_pool(workers));
+    lists.resize(workers);
+}
+
+void command_recorder::record(vector<instance_data> const& objects, record_params const& params) {
+    if(objects.size() > INDEX_MASK) {
+        throw std::runtime_error("too many objects to record");
+    }
+    for(size_t i = 0; i != lists.size(); ++i) {
+        lists[i].items.clear();
+        lists[i].commands.clear();
+        lists[i].culled = 0;
+    }
+    mat4 const view_proj = params.proj * params.view;
+    frustum const clip(view_proj);
+    size_t const chunks = (objects.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    pool->run(chunks, [&](size_t chunk, size_t worker) {
+        command_list& list = lists[worker];
+        size_t const end = std::min(objects.size(), (chunk + 1) * CHUNK_SIZE);
+        for(size_t i = chunk * CHUNK_SIZE; i != end; ++i) {
+            unsigned const figure = unsigned((params.first_figure + i) % 3);
+            draw_command command;
+            command.model = objects[i].model * params.model;
+            if(params.cull && !clip.intersects(transform_bounds(params.bounds[figure], command.model))) {
+                ++list.culled;
+                continue;
+            }
+            command.mvp = view_proj * command.model;
+            command.object = uint32_t(i);
+            unsigned const material = (uint32_t(i) * 2654435761u) >> 30;
+            float const depth = -(params.view * command.model[3]).z / params.far_plane;
+            render_item const item = {
+                render_queue::make_key(0, material & 1, material >> 1, depth, params.meshes[figure]),
+                uint32_t(worker << LIST_SHIFT) | uint32_t(list.commands.size())
+            };
+            list.items.push_back(item);
+            list.commands.push_back(command);
+        }
+    });
+
+    merged.clear();
+    culled = 0;
+    for(size_t i = 0; i != lists.size(); ++i) {
+        merged.append(lists[i].items);
+        culled += lists[i].culled;
+    }
+    unsorted_changes = render_queue::state_changes(merged.items());
+    merged.sort();
+}
+
+void report_record_scaling(size_t objects, size_t max_workers) {
+    size_t const FRAMES = 30;
+    vector<instance_data> scene;
+    grid_instances(objects, scene);
+
+    record_params params;
+    params.proj = perspective(45.0f, 1.0f, 0.1f, 100.0f);
+    params.view = lookAt(vec3(0, 0, 6), vec3(0, 0, 0), vec3(0, 1, 0));
+    params.far_plane = 100;
+    params.cull = true;
+    for(unsigned i = 0; i != 3; ++i) {
+        params.meshes[i] = i;
+        params.bounds[i].min = vec3(-1);
+        params.bounds[i].max = vec3(1);
+    }
+    params.first_figure = 0;
+
+    cout << objects << " objects, CPU time per recorded frame:" << endl;
+    float single_ms = 0;
+    for(size_t workers = 1; workers <= max_workers; ++workers) {
+        command_recorder recorder(workers);
+        chrono::high_resolution_clock::duration total(0);
+        for(size_t frame = 0; frame != FRAMES + 1; ++frame) {
+            // the scene turns, so every frame recomputes every transform
+            params.model = mat4_cast(angleAxis(0.02f * frame, vec3(0, 1, 0)));
+            chrono::high_resolution_clock::time_point const start = chrono::high_resolution_clock::now();
+            recorder.record(scene, params);
+            // the first frame grows the lists
+            if(frame != 0) {
+                total += chrono::high_resolution_clock::now() - start;
+            }
+        }
+        float const ms = chrono::duration<float, std::milli>(total).count() / FRAMES;
+        if(workers == 1) {
+            single_ms = ms;
+        }
+        char line[128];
+        std::snprintf(line, sizeof(line), "%3zu threads: %8.3f ms, x%.2f, %zu drawn", workers, ms,
+                      single_ms / ms, recorder.queue().size());
+        cout << line << endl;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef COMMAND_RECORDER_H
+#define COMMAND_RECORDER_H
+
+#include "common.h"
+#include "instance_buffer.h"
+#include "render_queue.h"
+#include "scene_bvh.h"
+#include "worker_pool.h"
+
+#include <cstdint>
+
+// everything a queued draw needs besides program and texture state
+struct draw_command {
+    mat4 mvp;
+    mat4 model;
+    // index into the recorded objects
+    uint32_t object;
+};
+
+struct record_params {
+    mat4 proj;
+    mat4 view;
+    // shared by all objects, applied before the instance transform
+    mat4 model;
+    float far_plane;
+    bool cull;
+    // objects take the figures in turn, starting from the first one
+    unsigned meshes[3];
+    aabb bounds[3];
+    unsigned first_figure;
+};
+
+// Records one draw per object of a large scene. The objects are split into
+// chunks handed to a worker_pool; every worker composes transforms, culls
+// and packs the uniforms of its chunks into its own command list, so the
+// workers never share anything they write. The sort keys of all lists are
+// then merged into one render_queue and sorted, and the GL thread replays
+// it with command() as the only per-draw data.
+//
+// Every object gets one of four materials (lit or unlit program, two
+// textures) from a hash of its index, see render_queue's key layout.
+class command_recorder {
+public:
+    explicit command_recorder(size_t workers);
+
+    // restarts the pool with another number of threads
+    void set_workers(size_t workers);
+    size_t workers_count() const { return pool->workers_count(); }
+
+    void record(vector<instance_data> const& objects, record_params const& params);
+
+    render_queue const& queue() const { return merged; }
+    draw_command const& command(uint32_t payload) const {
+        return lists[payload >> LIST_SHIFT].commands[payload & INDEX_MASK];
+    }
+    size_t culled_count() const { return culled; }
+    // render_queue::state_changes of the lists before sorting
+    size_t unsorted_state_changes() const { return unsorted_changes; }
+
+private:
+    // payloads keep the list in the top bits and the command below
+    static unsigned const LIST_SHIFT = 24;
+    static uint32_t const INDEX_MASK = (1u << LIST_SHIFT) - 1;
+    static size_t const CHUNK_SIZE = 2048;
+
+    struct command_list {
+        vector<render_item> items;
+        vector<draw_command> commands;
+        size_t culled;
+        // keeps the vectors two workers append to off one cache line
+        char padding[64];
+    };
+
+    unique_ptr<worker_pool> pool;
+    vector<command_list> lists;
+    render_queue merged;
+    size_t culled;
+    size_t unsorted_changes;
+};
+
+// Records a scene of objects grid_instances() for every thread count from
+// 1 to max_workers and prints the CPU time per frame of each, no GL needed.
+void report_record_scaling(size_t objects, size_t max_workers);
+
+#endif // COMMAND_RECORDER_H
@@ -0,0 +1,278 @@
+#include "deferred_renderer.h"
+#include "gl_state_cache.h"
+#include "shader.h"
+#include "utils.h"
+
+#include <cmath>
+
+static char const* const COMPOSE_VERTEX_SHADER_PATH = "..//shaders//deferred_compose.vs";
+static char const* const COMPOSE_FRAGMENT_SHADER_PATH = "..//shaders//deferred_compose.fs";
+static char const* const LIGHT_VERTEX_SHADER_PATH = "..//shaders//deferred_light.vs";
+static char const* const LIGHT_FRAGMENT_SHADER_PATH = "..//shaders//deferred_light.fs";
+
+// octahedron faces split this many times, 8 * 4^n triangles
+static int const SPHERE_SUBDIVISIONS = 2;
+
+static void subdivide(vec3 const& a, vec3 const& b, vec3 const& c, int depth, vector<vec3>& triangles) {
+    if(depth == 0) {
+        triangles.push_back(a);
+        triangles.push_back(b);
+        triangles.push_back(c);
+        return;
+    }
+    vec3 const ab = normalize(a + b);
+    vec3 const bc = normalize(b + c);
+    vec3 const ca = normalize(c + a);
+    subdivide(a, ab, ca, depth - 1, triangles);
+    subdivide(ab, b, bc, depth - 1, triangles);
+    subdivide(ca, bc, c, depth - 1, triangles);
+    subdivide(ab, bc, ca, depth - 1, triangles);
+}
+
+// triangles around the unit sphere, counter-clockwise seen from outside;
+// scaled so that every face lies outside the sphere and the volume covers it
+static void bounding_sphere_mesh(vector<GLfloat>& vertices) {
+    vec3 const axes[6] = { vec3(1, 0, 0), vec3(0, 1, 0), vec3(-1, 0, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1) };
+    vector<vec3> triangles;
+    for(int i = 0; i != 4; ++i) {
+        vec3 const& a = axes[i];
+        vec3 const& b = axes[(i + 1) % 4];
+        subdivide(a, b, axes[4], SPHERE_SUBDIVISIONS, triangles);
+        subdivide(b, a, axes[5], SPHERE_SUBDIVISIONS, triangles);
+    }
+    float inradius = 1;
+    for(size_t i = 0; i != triangles.size(); i += 3) {
+        vec3 const normal = normalize(cross(triangles[i + 1] - triangles[i], triangles[i + 2] - triangles[i]));
+        inradius = std::min(inradius, std::abs(dot(normal, triangles[i])));
+    }
+    for(size_t i = 0; i != triangles.size(); ++i) {
+        vec3 const p = triangles[i] / inradius;
+        vertices.push_back(p.x);
+        vertices.push_back(p.y);
+        vertices.push_back(p.z);
+    }
+}
+
+static void set_divisor(GLint location, GLuint divisor) {
+    if(location >= 0) {
+        glVertexAttribDivisor(location, divisor);
+    }
+}
+
+deferred_renderer::deferred_renderer(GLsizei width, GLsizei height, GLuint target_texture)
+    : width(width)
+    , height(height)
+    , albedo_texture(0)
+    , normal_texture(0)
+    , depth_buffer(0)
+    , framebuffer(0)
+    , previous_framebuffer(0)
+    , compose_vs(create_shader(GL_VERTEX_SHADER, COMPOSE_VERTEX_SHADER_PATH))
+    , compose_fs(create_shader(GL_FRAGMENT_SHADER, COMPOSE_FRAGMENT_SHADER_PATH))
+    , compose_program(create_program(compose_vs, compose_fs))
+    , light_vs(create_shader(GL_VERTEX_SHADER, LIGHT_VERTEX_SHADER_PATH))
+    , light_fs(create_shader(GL_FRAGMENT_SHADER, LIGHT_FRAGMENT_SHADER_PATH))
+    , light_program(create_program(light_vs, light_fs))
+    , quad_buffer(0)
+    , sphere_buffer(0)
+    , sphere_vertices(0)
+    , light_buffer(0)
+    , frame(0)
+    , last_lighting_ms(0)
+{
+    // nearest filtering, the passes read texels at their own pixel
+    GLuint* const textures[2] = { &albedo_texture, &normal_texture };
+    GLint const formats[2] = { GL_RGBA8, GL_RGBA16F };
+    for(int i = 0; i != 2; ++i) {
+        glGenTextures(1, textures[i]);
+        gl_cache().bind_texture(GL_TEXTURE_2D, *textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, formats[i], width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    }
+    gl_cache().bind_texture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffersEXT(1, &depth_buffer);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, depth_buffer);
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &previous_framebuffer);
+    glGenFramebuffersEXT(1, &framebuffer);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, albedo_texture, 0);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT, GL_TEXTURE_2D, normal_texture, 0);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT2_EXT, GL_TEXTURE_2D, target_texture, 0);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, depth_buffer);
+    GLenum const status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, previous_framebuffer);
+    if(status != GL_FRAMEBUFFER_COMPLETE_EXT) {
+        throw msg_exception("G-buffer creation error");
+    }
+
+    GLfloat const corners[8] = { -1, -1, 1, -1, -1, 1, 1, 1 };
+    glGenBuffers(1, &quad_buffer);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, quad_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+
+    vector<GLfloat> sphere;
+    bounding_sphere_mesh(sphere);
+    sphere_vertices = GLsizei(sphere.size() / 3);
+    glGenBuffers(1, &sphere_buffer);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, sphere_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sphere.size() * sizeof(GLfloat), sphere.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &light_buffer);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+
+    glGenQueries(2, timers);
+    timer_pending[0] = timer_pending[1] = false;
+}
+
+deferred_renderer::~deferred_renderer() {
+    glDeleteQueries(2, timers);
+    glDeleteBuffers(1, &light_buffer);
+    glDeleteBuffers(1, &sphere_buffer);
+    glDeleteBuffers(1, &quad_buffer);
+    glDeleteProgram(light_program);
+    glDeleteShader(light_fs);
+    glDeleteShader(light_vs);
+    glDeleteProgram(compose_program);
+    glDeleteShader(compose_fs);
+    glDeleteShader(compose_vs);
+    glDeleteFramebuffersEXT(1, &framebuffer);
+    glDeleteRenderbuffersEXT(1, &depth_buffer);
+    glDeleteTextures(1, &normal_texture);
+    glDeleteTextures(1, &albedo_texture);
+}
+
+bool deferred_renderer::supported() {
+    return GLEW_VERSION_3_3 != 0;
+}
+
+void deferred_renderer::begin_geometry() {
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &previous_framebuffer);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+    GLenum const gbuffer[2] = { GL_COLOR_ATTACHMENT0_EXT, GL_COLOR_ATTACHMENT1_EXT };
+    glDrawBuffers(2, gbuffer);
+    gl_cache().clear_color(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void deferred_renderer::shade(mat4 const& proj, mat4 const& view, scene_light const& light,
+                              point_light_set const& lights) {
+    ++frame;
+    size_t const previous = (frame + 1) % 2;
+    if(timer_pending[previous]) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(timers[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(timers[previous], GL_QUERY_RESULT, &ns);
+            last_lighting_ms = float(ns) / 1e6f;
+            timer_pending[previous] = false;
+        }
+    }
+    glBeginQuery(GL_TIME_ELAPSED, timers[frame % 2]);
+
+    glDrawBuffer(GL_COLOR_ATTACHMENT2_EXT);
+    gl_cache().polygon_mode(GL_FILL);
+    draw_compose_pass(proj, view, light);
+    draw_light_volumes(proj, view, light.specular, lights);
+
+    glEndQuery(GL_TIME_ELAPSED);
+    timer_pending[frame % 2] = true;
+
+    glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, previous_framebuffer);
+}
+
+void deferred_renderer::set_gbuffer_samplers(GLuint program) {
+    gl_cache().active_texture(GL_TEXTURE1);
+    gl_cache().bind_texture(GL_TEXTURE_2D, albedo_texture);
+    gl_cache().active_texture(GL_TEXTURE2);
+    gl_cache().bind_texture(GL_TEXTURE_2D, normal_texture);
+    gl_cache().active_texture(GL_TEXTURE0);
+    glUniform1i(glGetUniformLocation(program, "albedo_sampler"), 1);
+    glUniform1i(glGetUniformLocation(program, "normal_sampler"), 2);
+    glUniform2f(glGetUniformLocation(program, "gbuffer_size"), GLfloat(width), GLfloat(height));
+}
+
+// ambient and the scene's light wherever something was drawn, the
+// background and the unlit stand-in copied as they are
+void deferred_renderer::draw_compose_pass(mat4 const& proj, mat4 const& view, scene_light const& light) {
+    gl_cache().use_program(compose_program);
+    set_gbuffer_samplers(compose_program);
+    glUniform2f(glGetUniformLocation(compose_program, "view_ray_scale"), 1 / proj[0][0], 1 / proj[1][1]);
+    vec3 const light_position = vec3(view * vec4(light.position_worldspace, 1));
+    glUniform3fv(glGetUniformLocation(compose_program, "lightpos_cameraspace"), 1, &light_position[0]);
+    glUniform3fv(glGetUniformLocation(compose_program, "light_color"), 1, &light.color[0]);
+    glUniform1f(glGetUniformLocation(compose_program, "light_power"), light.power);
+    glUniform3fv(glGetUniformLocation(compose_program, "ambient"), 1, &light.ambient[0]);
+    glUniform3fv(glGetUniformLocation(compose_program, "specular"), 1, &light.specular[0]);
+
+    gl_cache().disable(GL_DEPTH_TEST);
+    GLint const corner = glGetAttribLocation(compose_program, "corner");
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, quad_buffer);
+    gl_cache().enable_vertex_attrib_array(corner);
+    glVertexAttribPointer(corner, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    gl_cache().disable_vertex_attrib_array(corner);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+    gl_cache().enable(GL_DEPTH_TEST);
+}
+
+void deferred_renderer::draw_light_volumes(mat4 const& proj, mat4 const& view, vec3 const& specular,
+                                           point_light_set const& lights) {
+    if(lights.empty()) {
+        return;
+    }
+    // new storage every frame, the lights move
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, light_buffer);
+    glBufferData(GL_ARRAY_BUFFER, lights.size() * sizeof(point_light), lights.data().data(), GL_STREAM_DRAW);
+
+    gl_cache().use_program(light_program);
+    set_gbuffer_samplers(light_program);
+    glUniformMatrix4fv(glGetUniformLocation(light_program, "proj"), 1, GL_FALSE, &proj[0][0]);
+    glUniformMatrix4fv(glGetUniformLocation(light_program, "view"), 1, GL_FALSE, &view[0][0]);
+    glUniform2f(glGetUniformLocation(light_program, "view_ray_scale"), 1 / proj[0][0], 1 / proj[1][1]);
+    glUniform3fv(glGetUniformLocation(light_program, "specular"), 1, &specular[0]);
+
+    // the far side of the volume behind the surface, added up
+    gl_cache().enable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    gl_cache().enable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+    gl_cache().depth_func(GL_GEQUAL);
+    glDepthMask(GL_FALSE);
+
+    GLint const position = glGetAttribLocation(light_program, "sphere_pos");
+    GLint const sphere = glGetAttribLocation(light_program, "light_sphere");
+    GLint const color = glGetAttribLocation(light_program, "light_color");
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, sphere_buffer);
+    gl_cache().enable_vertex_attrib_array(position);
+    glVertexAttribPointer(position, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, light_buffer);
+    gl_cache().enable_vertex_attrib_array(sphere);
+    glVertexAttribPointer(sphere, 4, GL_FLOAT, GL_FALSE, sizeof(point_light), (GLvoid*)0);
+    set_divisor(sphere, 1);
+    gl_cache().enable_vertex_attrib_array(color);
+    glVertexAttribPointer(color, 3, GL_FLOAT, GL_FALSE, sizeof(point_light), (GLvoid*)sizeof(vec4));
+    set_divisor(color, 1);
+
+    glDrawArraysInstanced(GL_TRIANGLES, 0, sphere_vertices, GLsizei(lights.size()));
+
+    // the divisors stay with the attribute indices, other programs reuse them
+    set_divisor(sphere, 0);
+    set_divisor(color, 0);
+    gl_cache().disable_vertex_attrib_array(color);
+    gl_cache().disable_vertex_attrib_array(sphere);
+    gl_cache().disable_vertex_attrib_array(position);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+
+    glDepthMask(GL_TRUE);
+    gl_cache().depth_func(GL_LESS);
+    glCullFace(GL_BACK);
+    gl_cache().disable(GL_CULL_FACE);
+    gl_cache().disable(GL_BLEND);
+}
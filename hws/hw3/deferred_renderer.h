@@ -0,0 +1,79 @@
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include "common.h"
+#include "point_lights.h"
+
+// Deferred shading of many point lights over the scene.
+//
+// The geometry pass draws the scene with for_scene.fs compiled with
+// GBUFFER into a G-buffer of three color targets and a depth buffer:
+// albedo, camera space normal with the linear depth in w (w is 0 where
+// nothing lit was drawn) and the lit image, which is the target texture
+// given to the constructor. Shading then fills the lit image with the
+// ambient term and the scene's own light in one fullscreen pass and adds
+// every point light by drawing its bounding sphere, instanced over the
+// lights. The spheres are drawn with front faces culled and the depth test
+// at GL_GEQUAL against the geometry, depth writes off, so a light only
+// shades the pixels in front of its far side, and still does with the
+// camera inside it.
+class deferred_renderer {
+public:
+    // the G-buffer is width x height, target_texture has to be that size
+    deferred_renderer(GLsizei width, GLsizei height, GLuint target_texture);
+    ~deferred_renderer();
+
+    // instanced arrays, flat varyings and timer queries (GL 3.3)
+    static bool supported();
+
+    // binds the G-buffer and clears it, the scene is drawn next
+    void begin_geometry();
+
+    // the scene's light, as for_scene.fs takes it
+    struct scene_light {
+        vec3 position_worldspace;
+        vec3 color;
+        float power;
+        vec3 ambient;
+        vec3 specular;
+    };
+    // fills the target texture and binds back the framebuffer bound before
+    // begin_geometry()
+    void shade(mat4 const& proj, mat4 const& view, scene_light const& light, point_light_set const& lights);
+
+    // GPU time of the shading passes, a frame or two late
+    float lighting_ms() const { return last_lighting_ms; }
+
+private:
+    GLsizei width;
+    GLsizei height;
+    GLuint albedo_texture;
+    GLuint normal_texture;
+    GLuint depth_buffer;
+    GLuint framebuffer;
+    GLint previous_framebuffer;
+
+    GLuint compose_vs;
+    GLuint compose_fs;
+    GLuint compose_program;
+    GLuint light_vs;
+    GLuint light_fs;
+    GLuint light_program;
+
+    GLuint quad_buffer;
+    GLuint sphere_buffer;
+    GLsizei sphere_vertices;
+    GLuint light_buffer;
+
+    GLuint timers[2];
+    bool timer_pending[2];
+    size_t frame;
+    float last_lighting_ms;
+
+    void set_gbuffer_samplers(GLuint program);
+    void draw_compose_pass(mat4 const& proj, mat4 const& view, scene_light const& light);
+    void draw_light_volumes(mat4 const& proj, mat4 const& view, vec3 const& specular,
+                            point_light_set const& lights);
+};
+
+#endif // DEFERRED_RENDERER_H
@@ -0,0 +1,98 @@
+#include "depth_prepass.h"
+#include "gl_state_cache.h"
+
+// the prepass goes on above ENABLE_OVERDRAW and off below DISABLE_OVERDRAW,
+// the gap keeps it from flipping every frame
+static float const ENABLE_OVERDRAW = 1.5f;
+static float const DISABLE_OVERDRAW = 1.2f;
+
+depth_prepass::depth_prepass()
+    : frame(0)
+    , prepass(false)
+    , worth_it(false)
+    , since_probe(0)
+    , covered_pixels(0)
+    , last_overdraw(0)
+    , last_shaded(0)
+{
+    glGenQueries(2, depth_queries);
+    glGenQueries(2, shading_queries);
+    pending[0] = pending[1] = false;
+    had_prepass[0] = had_prepass[1] = false;
+}
+
+depth_prepass::~depth_prepass() {
+    glDeleteQueries(2, shading_queries);
+    glDeleteQueries(2, depth_queries);
+}
+
+void depth_prepass::read_counts(size_t slot) {
+    if(!pending[slot]) {
+        return;
+    }
+    GLuint available = 0;
+    glGetQueryObjectuiv(shading_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available) {
+        return;
+    }
+    pending[slot] = false;
+    GLuint shaded = 0;
+    glGetQueryObjectuiv(shading_queries[slot], GL_QUERY_RESULT, &shaded);
+    GLuint tested = shaded;
+    if(had_prepass[slot]) {
+        // the depth query ended before the shading one, so it is ready too
+        glGetQueryObjectuiv(depth_queries[slot], GL_QUERY_RESULT, &tested);
+        covered_pixels = shaded;
+    }
+    if(covered_pixels == 0) {
+        return;
+    }
+    last_overdraw = float(tested) / covered_pixels;
+    last_shaded = float(shaded) / covered_pixels;
+    worth_it = last_overdraw > (worth_it ? DISABLE_OVERDRAW : ENABLE_OVERDRAW);
+}
+
+bool depth_prepass::begin_frame(mode m) {
+    ++frame;
+    read_counts((frame + 1) % 2);
+    switch(m) {
+    case OFF: prepass = false; break;
+    case ON: prepass = true; break;
+    case AUTO:
+        ++since_probe;
+        prepass = worth_it || covered_pixels == 0 || since_probe >= PROBE_INTERVAL;
+        break;
+    }
+    if(prepass) {
+        since_probe = 0;
+    }
+    return prepass;
+}
+
+void depth_prepass::begin_depth() {
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glBeginQuery(GL_SAMPLES_PASSED, depth_queries[frame % 2]);
+}
+
+void depth_prepass::end_depth() {
+    glEndQuery(GL_SAMPLES_PASSED);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void depth_prepass::begin_shading() {
+    if(prepass) {
+        gl_cache().depth_func(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    glBeginQuery(GL_SAMPLES_PASSED, shading_queries[frame % 2]);
+}
+
+void depth_prepass::end_shading() {
+    glEndQuery(GL_SAMPLES_PASSED);
+    if(prepass) {
+        glDepthMask(GL_TRUE);
+        gl_cache().depth_func(GL_LESS);
+    }
+    pending[frame % 2] = true;
+    had_prepass[frame % 2] = prepass;
+}
@@ -0,0 +1,66 @@
+#ifndef DEPTH_PREPASS_H
+#define DEPTH_PREPASS_H
+
+#include "common.h"
+
+// Depth-only prepass in front of the lit scene pass. The scene is drawn
+// once with color writes off and a fragment shader that does nothing, then
+// lit with the depth test at GL_EQUAL and depth writes off, so each covered
+// pixel runs the lit fragment shader exactly once. Both passes run
+// for_scene.vs, whose gl_Position is invariant, so their depths match.
+//
+// The lit pass always counts the samples passing the depth test. With the
+// prepass on that is the number of covered pixels, and the prepass counts
+// what the lit pass would have shaded without it; the ratio is the
+// overdraw. Without the prepass the lit samples are compared to the pixels
+// covered when it last ran. In AUTO mode the prepass goes on once the
+// overdraw pays for drawing the geometry twice, and while it is off it
+// still runs every PROBE_INTERVAL frames to keep the count of covered
+// pixels fresh. Counts are read a frame late and never waited for.
+class depth_prepass {
+public:
+    enum mode { OFF, ON, AUTO };
+
+    depth_prepass();
+    ~depth_prepass();
+
+    // reads the counts of the last frame that are ready, true if this
+    // frame draws the prepass
+    bool begin_frame(mode m);
+    // color writes off
+    void begin_depth();
+    void end_depth();
+    // with the prepass GL_EQUAL and no depth writes, otherwise the depth
+    // state stays as it is
+    void begin_shading();
+    void end_shading();
+
+    bool active() const { return prepass; }
+    // fragments passing the depth test per covered pixel, before the
+    // prepass takes them out; 0 until measured
+    float overdraw() const { return last_overdraw; }
+    // lit fragments per covered pixel, 1 with the prepass
+    float shaded_per_pixel() const { return last_shaded; }
+
+private:
+    static size_t const PROBE_INTERVAL = 60;
+
+    // [frame % 2], the frame being drawn and the one before
+    GLuint depth_queries[2];
+    GLuint shading_queries[2];
+    bool pending[2];
+    bool had_prepass[2];
+    size_t frame;
+
+    bool prepass;
+    // AUTO: the last overdraw measured was worth a prepass
+    bool worth_it;
+    size_t since_probe;
+    GLuint covered_pixels;
+    float last_overdraw;
+    float last_shaded;
+
+    void read_counts(size_t slot);
+};
+
+#endif // DEPTH_PREPASS_H
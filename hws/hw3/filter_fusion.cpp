@@ -0,0 +1,295 @@
+#include "filter_fusion.h"
+#include "shader.h"
+
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+using std::ostringstream;
+
+static int const SOBEL_X[9] = {
+    -1, 0, 1,
+    -2, 0, 2,
+    -1, 0, 1
+};
+
+static int const SOBEL_Y[9] = {
+    -1, -2, -1,
+     0,  0,  0,
+     1,  2,  1
+};
+
+// for_filtered.fs indexes the Sobel tables by (x offset, y offset),
+// the stencil rows go by y offset
+static stencil sobel_stencil() {
+    stencil s;
+    s.radius_x = s.radius_y = 1;
+    s.sobel = true;
+    s.weights.resize(9);
+    s.weights_y.resize(9);
+    for(int dy = -1; dy <= 1; ++dy) {
+        for(int dx = -1; dx <= 1; ++dx) {
+            int const table_index = (dx + 1) * 3 + (dy + 1);
+            s.weights[(dy + 1) * 3 + dx + 1] = SOBEL_X[table_index];
+            s.weights_y[(dy + 1) * 3 + dx + 1] = SOBEL_Y[table_index];
+        }
+    }
+    return s;
+}
+
+static vector<float> gaussian_weights(filter_params const& params) {
+    int const r = params.gaussian_kernel_radius;
+    float const variance = params.gaussian_variance;
+    vector<float> weights(2 * r + 1);
+    float sum = 0;
+    for(int i = -r; i <= r; ++i) {
+        weights[i + r] = std::exp(-float(i * i) / (2 * variance * variance));
+        sum += weights[i + r];
+    }
+    for(size_t i = 0; i != weights.size(); ++i) {
+        weights[i] /= sum;
+    }
+    return weights;
+}
+
+static stencil linear_stencil(filter f, filter_params const& params) {
+    stencil s;
+    s.sobel = false;
+    switch(f) {
+    case BOX_BLUR:
+        s.radius_x = s.radius_y = 1;
+        s.weights.assign(9, 1.0f / 9);
+        break;
+    case GAUSSIAN_HORIZONTAL_BLUR:
+        s.radius_x = params.gaussian_kernel_radius;
+        s.radius_y = 0;
+        s.weights = gaussian_weights(params);
+        break;
+    case GAUSSIAN_VERTICAL_BLUR:
+        s.radius_x = 0;
+        s.radius_y = params.gaussian_kernel_radius;
+        s.weights = gaussian_weights(params);
+        break;
+    default:
+        throw std::logic_error("linear_stencil(): not a linear filter");
+    }
+    return s;
+}
+
+// sample c of the result reads every a + b = c, a from first, b from second
+static vector<float> combine(stencil const& first, vector<float> const& first_weights,
+                             stencil const& second, vector<float> const& second_weights,
+                             int radius_x, int radius_y)
+{
+    int const width = 2 * radius_x + 1;
+    vector<double> sum(width * (2 * radius_y + 1), 0.0);
+    for(int ay = -first.radius_y; ay <= first.radius_y; ++ay) {
+        for(int ax = -first.radius_x; ax <= first.radius_x; ++ax) {
+            float const wa = first_weights[(ay + first.radius_y) * first.width() + ax + first.radius_x];
+            for(int by = -second.radius_y; by <= second.radius_y; ++by) {
+                for(int bx = -second.radius_x; bx <= second.radius_x; ++bx) {
+                    float const wb = second_weights[(by + second.radius_y) * second.width() + bx + second.radius_x];
+                    sum[(ay + by + radius_y) * width + ax + bx + radius_x] += double(wa) * wb;
+                }
+            }
+        }
+    }
+    // cancelled weights (the middle row of a blurred Sobel) become exact
+    // zeroes, so no taps are spent on them
+    vector<float> result(sum.size());
+    for(size_t i = 0; i != sum.size(); ++i) {
+        result[i] = std::fabs(sum[i]) < 1e-6 ? 0.0f : float(sum[i]);
+    }
+    return result;
+}
+
+// first is linear, so applying second to its output is one stencil
+static stencil compose(stencil const& first, stencil const& second) {
+    stencil s;
+    s.radius_x = first.radius_x + second.radius_x;
+    s.radius_y = first.radius_y + second.radius_y;
+    s.sobel = second.sobel;
+    s.weights = combine(first, first.weights, second, second.weights, s.radius_x, s.radius_y);
+    if(second.sobel) {
+        s.weights_y = combine(first, first.weights, second, second.weights_y, s.radius_x, s.radius_y);
+    }
+    return s;
+}
+
+static size_t composed_taps(stencil const& first, stencil const& second) {
+    return size_t(first.width() + second.width() - 1) * (first.height() + second.height() - 1);
+}
+
+static pointwise_op make_op(filter type, float value, float gamma = 0) {
+    pointwise_op op = { type, value, gamma };
+    return op;
+}
+
+static void add_sobel_epilogue(fused_pass& pass, filter_params const& params) {
+    // sobel_filter() thresholds the brightness of the gradient
+    pass.post.push_back(make_op(GRAYSCALE, 0));
+    pass.post.push_back(make_op(THRESHOLD, params.sobel_threshold));
+}
+
+vector<fused_pass> fuse_filter_chain(vector<filter> const& chain, filter_params const& params,
+                                     size_t max_taps)
+{
+    vector<fused_pass> passes;
+    fused_pass cur;
+    for(size_t i = 0; i != chain.size(); ++i) {
+        filter const f = chain[i];
+        if(f == NO_FILTER) {
+            continue;
+        }
+        if(is_pointwise(f)) {
+            // the values are baked into the source, the fused programs have
+            // no filter uniforms
+            pointwise_op const op = f == TONE_ADJUST ? make_op(f, params.tone_exposure, params.tone_gamma)
+                                                     : make_op(f, params.threshold);
+            if(cur.has_stencil) {
+                cur.post.push_back(op);
+            } else {
+                cur.pre.push_back(op);
+            }
+            cur.stages.push_back(f);
+            continue;
+        }
+
+        stencil const s = f == SOBEL_FILTER ? sobel_stencil() : linear_stencil(f, params);
+        if(!cur.has_stencil) {
+            cur.has_stencil = true;
+            cur.kernel = s;
+        } else if(cur.post.empty() && !cur.kernel.sobel && composed_taps(cur.kernel, s) <= max_taps) {
+            cur.kernel = compose(cur.kernel, s);
+        } else {
+            passes.push_back(cur);
+            cur = fused_pass();
+            cur.has_stencil = true;
+            cur.kernel = s;
+        }
+        if(s.sobel) {
+            add_sobel_epilogue(cur, params);
+        }
+        cur.stages.push_back(f);
+    }
+    if(!cur.stages.empty() || passes.empty()) {
+        passes.push_back(cur);
+    }
+    return passes;
+}
+
+static string glsl_float(float value) {
+    ostringstream out;
+    out << std::showpoint << std::setprecision(9) << value;
+    return out.str();
+}
+
+static void write_ops(ostringstream& out, vector<pointwise_op> const& ops) {
+    for(size_t i = 0; i != ops.size(); ++i) {
+        switch(ops[i].type) {
+        case GRAYSCALE:
+            out << "    c = vec3(rgb_to_brightness(c));\n";
+            break;
+        case THRESHOLD:
+            out << "    c = rgb_to_brightness(c) < " << glsl_float(ops[i].value) << " ? vec3(0) : c;\n";
+            break;
+        case TONE_ADJUST:
+            out << "    c = pow(clamp(c * " << glsl_float(ops[i].value) << ", 0.0, 1.0), vec3("
+                << glsl_float(1 / ops[i].gamma) << "));\n";
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// every sample is fetched once, even when both Sobel sums use it
+static void write_taps(ostringstream& out, stencil const& s) {
+    for(int dy = -s.radius_y; dy <= s.radius_y; ++dy) {
+        for(int dx = -s.radius_x; dx <= s.radius_x; ++dx) {
+            size_t const k = (dy + s.radius_y) * s.width() + dx + s.radius_x;
+            float const wx = s.weights[k];
+            float const wy = s.sobel ? s.weights_y[k] : 0;
+            if(wx == 0 && wy == 0) {
+                continue;
+            }
+            out << "    t = tap(" << dx << ", " << dy << ");\n";
+            if(wx != 0) {
+                out << "    sum_x += " << glsl_float(wx) << " * t;\n";
+            }
+            if(wy != 0) {
+                out << "    sum_y += " << glsl_float(wy) << " * t;\n";
+            }
+        }
+    }
+}
+
+string fused_pass::fragment_source() const {
+    ostringstream out;
+    out << "#version 130\n"
+           "\n"
+           "in vec2 UV;\n"
+           "\n"
+           "out vec3 color;\n"
+           "\n"
+           "uniform sampler2D texture_sampler;\n"
+           "uniform vec2 texel_size;\n"
+           "\n"
+           "float rgb_to_brightness(vec3 rgb) {\n"
+           "    return min(1, rgb[0] * 0.2989 + rgb[1] * 0.5870 + rgb[2] * 0.1140);\n"
+           "}\n"
+           "\n"
+           "vec3 tap(int dx, int dy) {\n"
+           "    vec3 c = texture2D(texture_sampler, UV + vec2(dx, dy) * texel_size).rgb;\n";
+    write_ops(out, pre);
+    out << "    return c;\n"
+           "}\n"
+           "\n"
+           "void main() {\n";
+    if(!has_stencil) {
+        out << "    vec3 c = tap(0, 0);\n";
+    } else {
+        out << "    vec3 t;\n"
+               "    vec3 sum_x = vec3(0);\n"
+               "    vec3 sum_y = vec3(0);\n";
+        write_taps(out, kernel);
+        out << (kernel.sobel ? "    vec3 c = abs(sum_x) + abs(sum_y);\n" : "    vec3 c = sum_x;\n");
+    }
+    write_ops(out, post);
+    out << "    color = c;\n"
+           "}\n";
+    return out.str();
+}
+
+string fusion_report(vector<filter> const& chain, vector<fused_pass> const& passes,
+                     int width, int height)
+{
+    size_t unfused = 0;
+    for(size_t i = 0; i != chain.size(); ++i) {
+        if(chain[i] != NO_FILTER) {
+            ++unfused;
+        }
+    }
+    unfused = std::max<size_t>(unfused, 1);
+    // every pass reads its input and writes its target once, 4 bytes a pixel
+    double const pass_mb = 2.0 * 4 * width * height / (1 << 20);
+    ostringstream out;
+    out << std::setprecision(3) << "fusion: " << unfused << " passes, " << unfused * pass_mb << " MB -> "
+        << passes.size() << " passes, " << passes.size() * pass_mb << " MB per "
+        << width << "x" << height << " image";
+    return out.str();
+}
+
+fused_programs::fused_programs(vector<fused_pass> const& passes, GLuint filtered_vx_shader) {
+    for(size_t i = 0; i != passes.size(); ++i) {
+        frag_shaders.push_back(create_shader_from_source(GL_FRAGMENT_SHADER, passes[i].fragment_source()));
+        pass_programs.push_back(create_program(filtered_vx_shader, frag_shaders.back()));
+    }
+}
+
+fused_programs::~fused_programs() {
+    for(size_t i = 0; i != pass_programs.size(); ++i) {
+        glDeleteProgram(pass_programs[i]);
+        glDeleteShader(frag_shaders[i]);
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef FILTER_FUSION_H
+#define FILTER_FUSION_H
+
+#include "common.h"
+#include "filter_pipeline.h"
+
+struct pointwise_op {
+    filter type;
+    float value; // threshold for THRESHOLD, exposure for TONE_ADJUST
+    float gamma; // TONE_ADJUST
+};
+
+// Weights of a stencil over a (2 * radius_x + 1) x (2 * radius_y + 1)
+// neighbourhood, row by row. Sobel keeps a second kernel and combines
+// both as abs(x) + abs(y), everything else is a plain weighted sum.
+struct stencil {
+    int radius_x;
+    int radius_y;
+    vector<float> weights;
+    bool sobel;
+    vector<float> weights_y;
+
+    int width() const { return 2 * radius_x + 1; }
+    int height() const { return 2 * radius_y + 1; }
+    size_t taps() const { return weights.size(); }
+};
+
+// One full-screen pass of a fused chain: point-wise ops applied to every
+// sample, an optional stencil, then point-wise ops applied to its result.
+struct fused_pass {
+    vector<pointwise_op> pre;
+    bool has_stencil;
+    stencil kernel;
+    vector<pointwise_op> post;
+    // chain entries covered by this pass
+    vector<filter> stages;
+
+    fused_pass()
+        : has_stencil(false)
+    {}
+
+    string fragment_source() const;
+};
+
+// Point-wise stages are folded into the neighbouring stencil pass. A
+// linear stencil (box, Gaussian) is folded into the next stencil by
+// convolving the kernels, as long as the fused footprint has no more
+// than max_taps samples. Fused results equal the unfused ones away from
+// image borders, up to the 8 bit rounding the unfused targets add.
+vector<fused_pass> fuse_filter_chain(vector<filter> const& chain, filter_params const& params,
+                                     size_t max_taps = 49);
+
+// passes and bytes read and written through RGBA8 targets, before and after
+string fusion_report(vector<filter> const& chain, vector<fused_pass> const& passes,
+                     int width, int height);
+
+// Compiles one program per pass with for_filtered.vs as the vertex stage
+class fused_programs {
+public:
+    fused_programs(vector<fused_pass> const& passes, GLuint filtered_vx_shader);
+    ~fused_programs();
+
+    vector<GLuint> const& programs() const { return pass_programs; }
+
+private:
+    vector<GLuint> frag_shaders;
+    vector<GLuint> pass_programs;
+};
+
+#endif // FILTER_FUSION_H
@@ -0,0 +1,212 @@
+#include "filter_pipeline.h"
+#include "utils.h"
+
+static vertex_attr const IN_POS = { "vert_pos_modelspace", 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0 };
+static vertex_attr const VERTEX_UV = { "vert_uv", 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), 0 };
+
+filter_support chain_support(vector<filter> const& chain, filter_params const& params) {
+    // supports add up, every pass reads the neighbourhood of the previous one
+    filter_support support = { 0, 0 };
+    for(size_t i = 0; i != chain.size(); ++i) {
+        switch(chain[i]) {
+        case BOX_BLUR:
+        case SOBEL_FILTER:
+            support.x += 1;
+            support.y += 1;
+            break;
+        case GAUSSIAN_HORIZONTAL_BLUR:
+            support.x += params.gaussian_kernel_radius;
+            break;
+        case GAUSSIAN_VERTICAL_BLUR:
+            support.y += params.gaussian_kernel_radius;
+            break;
+        default:
+            break;
+        }
+    }
+    return support;
+}
+
+shader_defines filter_defines(filter f, filter_params const& params) {
+    shader_defines defines;
+    defines["FILTER_TYPE"] = std::to_string(int(f));
+    if(f == GAUSSIAN_HORIZONTAL_BLUR || f == GAUSSIAN_VERTICAL_BLUR) {
+        defines["GAUS_RADIUS"] = std::to_string(params.gaussian_kernel_radius);
+    }
+    return defines;
+}
+
+filter_pipeline::filter_pipeline(program_cache& programs)
+    : programs(programs)
+    , cur_width(0)
+    , cur_height(0)
+    , src_texture(0)
+    , result_fbo(0)
+{
+    fbo[0] = fbo[1] = 0;
+    target_texture[0] = target_texture[1] = 0;
+
+    // full-screen quad, for_filtered.vs gets identity mvp
+    GLfloat const vertices[] = {
+        -1, -1, 0,
+         1, -1, 0,
+         1,  1, 0,
+        -1,  1, 0
+    };
+    GLfloat const tex_mapping[] = {
+        0, 0,
+        1, 0,
+        1, 1,
+        0, 1
+    };
+    glGenBuffers(1, &vx_buffer);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, vx_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glGenBuffers(1, &tex_buffer);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, tex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(tex_mapping), tex_mapping, GL_STATIC_DRAW);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+filter_pipeline::~filter_pipeline() {
+    release_targets();
+    glDeleteBuffers(1, &vx_buffer);
+    glDeleteBuffers(1, &tex_buffer);
+}
+
+static void create_image_texture(GLuint& texture_id, int width, int height) {
+    glGenTextures(1, &texture_id);
+    gl_cache().bind_texture(GL_TEXTURE_2D, texture_id);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    // filters address neighbours by whole texels, so no interpolation,
+    // and the border is replicated instead of wrapping around
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl_cache().bind_texture(GL_TEXTURE_2D, 0);
+}
+
+void filter_pipeline::resize(int width, int height) {
+    if(width == cur_width && height == cur_height) {
+        return;
+    }
+    release_targets();
+    cur_width = width;
+    cur_height = height;
+
+    create_image_texture(src_texture, width, height);
+    for(int i = 0; i != 2; ++i) {
+        create_image_texture(target_texture[i], width, height);
+        glGenFramebuffersEXT(1, &fbo[i]);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo[i]);
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+                                  GL_TEXTURE_2D, target_texture[i], 0);
+        GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+        if (status != GL_FRAMEBUFFER_COMPLETE_EXT) {
+            throw msg_exception("filter_pipeline: frame buffer creation error");
+        }
+    }
+}
+
+void filter_pipeline::release_targets() {
+    glDeleteTextures(1, &src_texture);
+    glDeleteFramebuffersEXT(2, fbo);
+    glDeleteTextures(2, target_texture);
+    src_texture = 0;
+    fbo[0] = fbo[1] = 0;
+    target_texture[0] = target_texture[1] = 0;
+    result_fbo = 0;
+    cur_width = cur_height = 0;
+}
+
+void filter_pipeline::load_source(GLenum format, void const* pixels) {
+    gl_cache().bind_texture(GL_TEXTURE_2D, src_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, cur_width, cur_height,
+                    format, GL_UNSIGNED_BYTE, pixels);
+    gl_cache().bind_texture(GL_TEXTURE_2D, 0);
+}
+
+GLuint filter_pipeline::apply(vector<filter> const& chain, filter_params const& params) {
+    begin_passes();
+    // an empty chain still copies the source, so the result is always in a target
+    size_t const passes = chain.empty() ? 1 : chain.size();
+    GLuint input = src_texture;
+    for(size_t i = 0; i != passes; ++i) {
+        filter const f = chain.empty() ? NO_FILTER : chain[i];
+        GLuint const program = programs.program(FILTERED_VERTEX_SHADER_PATH, FILTERED_FRAGMENT_SHADER_PATH,
+                                                filter_defines(f, params));
+        gl_cache().use_program(program);
+        glUniform1f(glGetUniformLocation(program, "gaus_variance"), params.gaussian_variance);
+        glUniform1f(glGetUniformLocation(program, "sobel_threshold"), params.sobel_threshold);
+        glUniform1f(glGetUniformLocation(program, "threshold"), params.threshold);
+        glUniform1f(glGetUniformLocation(program, "tone_exposure"), params.tone_exposure);
+        glUniform1f(glGetUniformLocation(program, "tone_gamma"), params.tone_gamma);
+        input = run_pass(program, i, input);
+    }
+    end_passes();
+    return input;
+}
+
+GLuint filter_pipeline::apply(vector<GLuint> const& pass_programs) {
+    begin_passes();
+    GLuint input = src_texture;
+    for(size_t i = 0; i != pass_programs.size(); ++i) {
+        input = run_pass(pass_programs[i], i, input);
+    }
+    end_passes();
+    return input;
+}
+
+void filter_pipeline::begin_passes() {
+    glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_POLYGON_BIT);
+    gl_cache().disable(GL_DEPTH_TEST);
+    gl_cache().disable(GL_SCISSOR_TEST);
+    gl_cache().polygon_mode(GL_FILL);
+    gl_cache().viewport(0, 0, cur_width, cur_height);
+}
+
+GLuint filter_pipeline::run_pass(GLuint pass_program, size_t index, GLuint input) {
+    gl_cache().use_program(pass_program);
+    mat4 const mvp;
+    glUniformMatrix4fv(glGetUniformLocation(pass_program, "mvp"), 1, GL_FALSE, &mvp[0][0]);
+    glUniform2f(glGetUniformLocation(pass_program, "texel_size"), 1.0f / cur_width, 1.0f / cur_height);
+
+    size_t const target = index % 2;
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo[target]);
+    gl_cache().bind_texture(GL_TEXTURE_2D, input);
+    draw_quad(pass_program);
+    result_fbo = fbo[target];
+    return target_texture[target];
+}
+
+void filter_pipeline::end_passes() {
+    gl_cache().bind_texture(GL_TEXTURE_2D, 0);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    glPopAttrib();
+    gl_cache().invalidate();
+}
+
+void filter_pipeline::read_result(GLenum format, void* dst) {
+    read_result(format, 0, 0, cur_width, cur_height, dst);
+}
+
+void filter_pipeline::read_result(GLenum format, int x, int y, int width, int height, void* dst) {
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, result_fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+    glReadPixels(x, y, width, height, format, GL_UNSIGNED_BYTE, dst);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+}
+
+void filter_pipeline::draw_quad(GLuint pass_program) {
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, vx_buffer);
+    utils::set_vertex_attr_ptr(pass_program, IN_POS);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, tex_buffer);
+    utils::set_vertex_attr_ptr(pass_program, VERTEX_UV);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    gl_cache().disable_vertex_attrib_array(glGetAttribLocation(pass_program, IN_POS.name));
+    gl_cache().disable_vertex_attrib_array(glGetAttribLocation(pass_program, VERTEX_UV.name));
+}
@@ -0,0 +1,92 @@
+#ifndef FILTER_PIPELINE_H
+#define FILTER_PIPELINE_H
+
+#include "common.h"
+#include "program_cache.h"
+
+char const* const FILTERED_VERTEX_SHADER_PATH = "..//shaders//for_filtered.vs";
+char const* const FILTERED_FRAGMENT_SHADER_PATH = "..//shaders//for_filtered.fs";
+
+enum filter { NO_FILTER = 0, BOX_BLUR, GAUSSIAN_HORIZONTAL_BLUR, GAUSSIAN_VERTICAL_BLUR, SOBEL_FILTER,
+              GRAYSCALE, THRESHOLD, TONE_ADJUST };
+
+// stages that only look at the pixel itself
+inline bool is_pointwise(filter f) { return f == GRAYSCALE || f == THRESHOLD || f == TONE_ADJUST; }
+
+struct filter_params {
+    int gaussian_kernel_radius;
+    float gaussian_variance;
+    float sobel_threshold;
+    float threshold;
+    float tone_exposure;
+    float tone_gamma;
+
+    filter_params()
+        : gaussian_kernel_radius(4)
+        , gaussian_variance(4)
+        , sobel_threshold(0.25)
+        , threshold(0.5)
+        , tone_exposure(1)
+        , tone_gamma(1)
+    {}
+};
+
+// how many texels around a pixel the chain reads, per axis
+struct filter_support {
+    int x;
+    int y;
+};
+
+filter_support chain_support(vector<filter> const& chain, filter_params const& params);
+
+// defines of the for_filtered.fs permutation that runs f alone
+shader_defines filter_defines(filter f, filter_params const& params);
+
+// Runs a chain of for_filtered.fs passes over an image of arbitrary size.
+// The source is uploaded into an own texture, then every pass renders a
+// full-screen quad into one of two offscreen targets, reading the other one.
+// Each pass uses the permutation of its filter from the program cache.
+class filter_pipeline {
+public:
+    explicit filter_pipeline(program_cache& programs);
+    ~filter_pipeline();
+
+    // (re)allocates the source texture and both targets
+    void resize(int width, int height);
+    int width() const { return cur_width; }
+    int height() const { return cur_height; }
+
+    // pixels are width x height, rows aligned by GL_UNPACK_ALIGNMENT
+    void load_source(GLenum format, void const* pixels);
+
+    // returns the texture holding the result of the last pass
+    GLuint apply(vector<filter> const& chain, filter_params const& params);
+    // same, every program is a pass with its parameters compiled in
+    GLuint apply(vector<GLuint> const& pass_programs);
+
+    // reads the result of the last apply() into dst, which is an offset
+    // when a GL_PIXEL_PACK_BUFFER is bound
+    void read_result(GLenum format, void* dst);
+    void read_result(GLenum format, int x, int y, int width, int height, void* dst);
+
+private:
+    program_cache& programs;
+    int cur_width;
+    int cur_height;
+
+    GLuint src_texture;
+    GLuint fbo[2];
+    GLuint target_texture[2];
+    GLuint result_fbo;
+
+    GLuint vx_buffer;
+    GLuint tex_buffer;
+
+    void release_targets();
+    void begin_passes();
+    GLuint run_pass(GLuint pass_program, size_t index, GLuint input);
+    void end_passes();
+    void draw_quad(GLuint pass_program);
+};
+
+#endif // FILTER_PIPELINE_H
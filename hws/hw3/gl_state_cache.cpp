@@ -0,0 +1,175 @@
+#include "gl_state_cache.h"
+
+gl_state_cache& gl_cache() {
+    static gl_state_cache cache;
+    return cache;
+}
+
+gl_state_cache::gl_state_cache()
+    : calls(0)
+    , elided(0)
+    , last_calls(0)
+    , last_elided(0)
+{
+    invalidate();
+}
+
+void gl_state_cache::invalidate() {
+    program = UNKNOWN;
+    // nothing here switches units behind the cache's back, the
+    // default one is taken for granted
+    texture_unit = GL_TEXTURE0;
+    for(size_t i = 0; i != TEXTURE_UNITS; ++i) {
+        textures[i] = UNKNOWN;
+    }
+    buffers.clear();
+    caps.clear();
+    for(size_t i = 0; i != VERTEX_ATTRIBS; ++i) {
+        attrib_arrays[i] = 2;
+    }
+    viewport_known = false;
+    scissor_known = false;
+    polygon = UNKNOWN;
+    clear_known = false;
+    depth = UNKNOWN;
+}
+
+bool gl_state_cache::changes(bool same) {
+    ++calls;
+    if(same) {
+        ++elided;
+    }
+    return !same;
+}
+
+void gl_state_cache::use_program(GLuint p) {
+    if(changes(p == program)) {
+        glUseProgram(p);
+        program = p;
+    }
+}
+
+void gl_state_cache::active_texture(GLenum unit) {
+    if(changes(unit == texture_unit)) {
+        glActiveTexture(unit);
+        texture_unit = unit;
+    }
+}
+
+void gl_state_cache::bind_texture(GLenum target, GLuint texture) {
+    size_t const unit = texture_unit - GL_TEXTURE0;
+    if(target != GL_TEXTURE_2D || unit >= TEXTURE_UNITS) {
+        changes(false);
+        glBindTexture(target, texture);
+        return;
+    }
+    if(changes(textures[unit] == texture)) {
+        glBindTexture(target, texture);
+        textures[unit] = texture;
+    }
+}
+
+void gl_state_cache::bind_buffer(GLenum target, GLuint buffer) {
+    if(target != GL_ARRAY_BUFFER && target != GL_ELEMENT_ARRAY_BUFFER && target != GL_DRAW_INDIRECT_BUFFER) {
+        changes(false);
+        glBindBuffer(target, buffer);
+        return;
+    }
+    std::map<GLenum, GLuint>::iterator const it = buffers.find(target);
+    if(changes(it != buffers.end() && it->second == buffer)) {
+        glBindBuffer(target, buffer);
+        buffers[target] = buffer;
+    }
+}
+
+void gl_state_cache::set_cap(GLenum cap, bool on) {
+    std::map<GLenum, bool>::iterator const it = caps.find(cap);
+    if(changes(it != caps.end() && it->second == on)) {
+        if(on) {
+            glEnable(cap);
+        } else {
+            glDisable(cap);
+        }
+        caps[cap] = on;
+    }
+}
+
+void gl_state_cache::enable(GLenum cap) { set_cap(cap, true); }
+void gl_state_cache::disable(GLenum cap) { set_cap(cap, false); }
+
+void gl_state_cache::set_attrib_array(GLuint index, bool on) {
+    bool const tracked = index < VERTEX_ATTRIBS;
+    if(changes(tracked && attrib_arrays[index] == int(on))) {
+        if(on) {
+            glEnableVertexAttribArray(index);
+        } else {
+            glDisableVertexAttribArray(index);
+        }
+        if(tracked) {
+            attrib_arrays[index] = int(on);
+        }
+    }
+}
+
+void gl_state_cache::enable_vertex_attrib_array(GLuint index) { set_attrib_array(index, true); }
+void gl_state_cache::disable_vertex_attrib_array(GLuint index) { set_attrib_array(index, false); }
+
+void gl_state_cache::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    bool const same = viewport_known && viewport_box[0] == x && viewport_box[1] == y
+                   && viewport_box[2] == width && viewport_box[3] == height;
+    if(changes(same)) {
+        glViewport(x, y, width, height);
+        viewport_box[0] = x;
+        viewport_box[1] = y;
+        viewport_box[2] = width;
+        viewport_box[3] = height;
+        viewport_known = true;
+    }
+}
+
+void gl_state_cache::scissor(GLint x, GLint y, GLsizei width, GLsizei height) {
+    bool const same = scissor_known && scissor_box[0] == x && scissor_box[1] == y
+                   && scissor_box[2] == width && scissor_box[3] == height;
+    if(changes(same)) {
+        glScissor(x, y, width, height);
+        scissor_box[0] = x;
+        scissor_box[1] = y;
+        scissor_box[2] = width;
+        scissor_box[3] = height;
+        scissor_known = true;
+    }
+}
+
+void gl_state_cache::polygon_mode(GLenum mode) {
+    if(changes(mode == polygon)) {
+        glPolygonMode(GL_FRONT_AND_BACK, mode);
+        polygon = mode;
+    }
+}
+
+void gl_state_cache::clear_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+    bool const same = clear_known && clear_rgba[0] == r && clear_rgba[1] == g
+                   && clear_rgba[2] == b && clear_rgba[3] == a;
+    if(changes(same)) {
+        glClearColor(r, g, b, a);
+        clear_rgba[0] = r;
+        clear_rgba[1] = g;
+        clear_rgba[2] = b;
+        clear_rgba[3] = a;
+        clear_known = true;
+    }
+}
+
+void gl_state_cache::depth_func(GLenum func) {
+    if(changes(func == depth)) {
+        glDepthFunc(func);
+        depth = func;
+    }
+}
+
+void gl_state_cache::end_frame() {
+    last_calls = calls;
+    last_elided = elided;
+    calls = 0;
+    elided = 0;
+}
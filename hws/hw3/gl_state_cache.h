@@ -0,0 +1,79 @@
+#ifndef GL_STATE_CACHE_H
+#define GL_STATE_CACHE_H
+
+#include "common.h"
+
+#include <map>
+
+// Shadow copy of the GL state the apps set most often. A call that would
+// set what is already set is dropped and counted. Everything starts
+// unknown, so the first call of each kind always reaches GL.
+//
+// Code that changes the same state around the cache (AntTweakBar,
+// glPopAttrib, deleting a bound buffer) has to call invalidate() after.
+class gl_state_cache {
+public:
+    gl_state_cache();
+
+    void use_program(GLuint program);
+    void active_texture(GLenum unit);
+    // 2D textures are tracked per unit, other targets go straight to GL
+    void bind_texture(GLenum target, GLuint texture);
+    // array, element array and draw indirect buffers are tracked
+    void bind_buffer(GLenum target, GLuint buffer);
+    void enable(GLenum cap);
+    void disable(GLenum cap);
+    void enable_vertex_attrib_array(GLuint index);
+    void disable_vertex_attrib_array(GLuint index);
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    void scissor(GLint x, GLint y, GLsizei width, GLsizei height);
+    // front and back
+    void polygon_mode(GLenum mode);
+    void clear_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a);
+    void depth_func(GLenum func);
+
+    void invalidate();
+
+    // closes the frame's counters
+    void end_frame();
+    size_t frame_calls() const { return last_calls; }
+    size_t frame_elided() const { return last_elided; }
+
+private:
+    static size_t const TEXTURE_UNITS = 16;
+    static size_t const VERTEX_ATTRIBS = 16;
+
+    // GLuint state nobody can have set
+    static GLuint const UNKNOWN = GLuint(-1);
+
+    GLuint program;
+    GLenum texture_unit;
+    GLuint textures[TEXTURE_UNITS];
+    std::map<GLenum, GLuint> buffers;
+    std::map<GLenum, bool> caps;
+    // 0 disabled, 1 enabled, 2 unknown
+    int attrib_arrays[VERTEX_ATTRIBS];
+    GLint viewport_box[4];
+    bool viewport_known;
+    GLint scissor_box[4];
+    bool scissor_known;
+    GLenum polygon;
+    GLfloat clear_rgba[4];
+    bool clear_known;
+    GLenum depth;
+
+    size_t calls;
+    size_t elided;
+    size_t last_calls;
+    size_t last_elided;
+
+    // counts the call, true if it has to reach GL
+    bool changes(bool same);
+    void set_cap(GLenum cap, bool on);
+    void set_attrib_array(GLuint index, bool on);
+};
+
+// the one cache of the app's context
+gl_state_cache& gl_cache();
+
+#endif // GL_STATE_CACHE_H
@@ -0,0 +1,141 @@
+#include "gpu_culling.h"
+#include "gl_state_cache.h"
+#include "scene_bvh.h"
+#include "shader.h"
+
+#include <cstddef>
+
+static char const* const CULL_VERTEX_SHADER_PATH = "..//shaders//cull_instances.vs";
+static char const* const CULL_GEOMETRY_SHADER_PATH = "..//shaders//cull_instances.gs";
+
+gpu_culling::gpu_culling()
+    : vs(create_shader(GL_VERTEX_SHADER, CULL_VERTEX_SHADER_PATH))
+    , gs(create_shader(GL_GEOMETRY_SHADER, CULL_GEOMETRY_SHADER_PATH))
+    , program(0)
+    , indirect(indirect_supported())
+    , slot(0)
+    , command_buffer(0)
+    , previous_count(0)
+    , last_survivors(0)
+{
+    vector<char const*> varyings;
+    varyings.push_back("culled_model");
+    varyings.push_back("culled_tint");
+    program = create_feedback_program(vs, gs, varyings);
+    glGenBuffers(2, compacted);
+    glGenQueries(2, written_queries);
+    for(size_t i = 0; i != 2; ++i) {
+        capacity[i] = 0;
+        culled[i] = false;
+    }
+    if(indirect) {
+        glGenBuffers(1, &command_buffer);
+        gl_cache().bind_buffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(draw_elements_command), NULL, GL_DYNAMIC_DRAW);
+        gl_cache().bind_buffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+}
+
+gpu_culling::~gpu_culling() {
+    if(command_buffer) {
+        glDeleteBuffers(1, &command_buffer);
+    }
+    glDeleteQueries(2, written_queries);
+    glDeleteBuffers(2, compacted);
+    glDeleteProgram(program);
+    glDeleteShader(gs);
+    glDeleteShader(vs);
+}
+
+bool gpu_culling::supported() {
+    return GLEW_VERSION_3_2 && instance_buffer::supported();
+}
+
+bool gpu_culling::indirect_supported() {
+    return GLEW_VERSION_4_4 || (GLEW_ARB_query_buffer_object && (GLEW_VERSION_4_0 || GLEW_ARB_draw_indirect));
+}
+
+void gpu_culling::cull(instance_buffer const& source, mat4 const& view_proj, mat4 const& model,
+                       vec4 const& sphere_modelspace, mesh_range const& range)
+{
+    // the pass of the previous frame is the one drawn without the indirect
+    // draw; its count is read before the slot is reused, it has been done
+    // for a frame, so this does not stall
+    size_t const previous = slot;
+    slot = (slot + 1) % 2;
+    if(!indirect && culled[previous]) {
+        GLuint written = 0;
+        glGetQueryObjectuiv(written_queries[previous], GL_QUERY_RESULT, &written);
+        previous_count = GLsizei(written);
+        last_survivors = previous_count;
+    } else if(culled[previous]) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(written_queries[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available) {
+            GLuint written = 0;
+            glGetQueryObjectuiv(written_queries[previous], GL_QUERY_RESULT, &written);
+            last_survivors = GLsizei(written);
+        }
+    }
+
+    if(source.size() > capacity[slot]) {
+        capacity[slot] = source.size();
+        gl_cache().bind_buffer(GL_ARRAY_BUFFER, compacted[slot]);
+        glBufferData(GL_ARRAY_BUFFER, capacity[slot] * sizeof(instance_data), NULL, GL_DYNAMIC_COPY);
+        gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    gl_cache().use_program(program);
+    frustum const f(view_proj);
+    glUniform4fv(glGetUniformLocation(program, "planes"), 6, &f.planes[0][0]);
+    glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, &model[0][0]);
+    glUniform4fv(glGetUniformLocation(program, "sphere_modelspace"), 1, &sphere_modelspace[0]);
+
+    gl_cache().enable(GL_RASTERIZER_DISCARD);
+    bind_instance_attributes(program, source.buffer_id(), 0);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, compacted[slot]);
+    glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, written_queries[slot]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, GLsizei(source.size()));
+    glEndTransformFeedback();
+    glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    unbind_instance_attributes(program);
+    gl_cache().disable(GL_RASTERIZER_DISCARD);
+    culled[slot] = true;
+    ranges[slot] = range;
+
+    if(indirect) {
+        draw_elements_command const command = { range.index_count, 0, range.first_index, range.base_vertex, 0 };
+        gl_cache().bind_buffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(command), &command);
+        gl_cache().bind_buffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        // with a query buffer bound the result goes to that offset on the
+        // GPU, after the cull pass and without the CPU
+        gl_cache().bind_buffer(GL_QUERY_BUFFER, command_buffer);
+        glGetQueryObjectuiv(written_queries[slot], GL_QUERY_RESULT,
+                            (GLuint*)offsetof(draw_elements_command, instance_count));
+        gl_cache().bind_buffer(GL_QUERY_BUFFER, 0);
+    }
+}
+
+void gpu_culling::draw(GLuint program) {
+    if(indirect) {
+        bind_instance_attributes(program, compacted[slot], 1);
+        gl_cache().bind_buffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+        glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0);
+        gl_cache().bind_buffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    } else {
+        size_t const previous = (slot + 1) % 2;
+        if(!culled[previous] || previous_count == 0) {
+            return;
+        }
+        // the survivors are instances of the mesh that slot was culled for
+        mesh_range const& drawn = ranges[previous];
+        bind_instance_attributes(program, compacted[previous], 1);
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, GLsizei(drawn.index_count), GL_UNSIGNED_INT,
+                                          (GLvoid*)(drawn.first_index * sizeof(uint32_t)), previous_count,
+                                          drawn.base_vertex);
+    }
+    unbind_instance_attributes(program);
+}
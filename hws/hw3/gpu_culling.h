@@ -0,0 +1,65 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include "common.h"
+#include "instance_buffer.h"
+#include "mesh_arena.h"
+
+// Frustum culling of instances without touching them on the CPU. Every
+// instance is drawn as a point with rasterization off; the vertex shader
+// tests the bounding sphere of the mesh placed by the instance transform,
+// the geometry shader emits only the survivors, and transform feedback
+// packs them into a buffer that the scene then draws instanced from.
+//
+// The CPU never waits for the count of survivors. With query buffer
+// objects the transform feedback query writes it straight into the
+// instance count of an indirect draw. Without them the passes alternate
+// between two buffers and the scene draws the one culled a frame before,
+// whose count the GPU has long finished; visibility lags by that frame.
+class gpu_culling {
+public:
+    gpu_culling();
+    ~gpu_culling();
+
+    // geometry shaders (GL 3.2) on top of instancing
+    static bool supported();
+    // the count as an indirect draw's instance count: GL 4.4, or query
+    // buffer objects with draw indirect
+    static bool indirect_supported();
+
+    // culls the instances of source drawn as the arena mesh range
+    void cull(instance_buffer const& source, mat4 const& view_proj, mat4 const& model,
+              vec4 const& sphere_modelspace, mesh_range const& range);
+    // draws the survivors of the last cull, the arena has to be bound
+    void draw(GLuint program);
+
+    // the latest count that reached the CPU without a wait, for the stats
+    GLsizei survivors() const { return last_survivors; }
+
+private:
+    // layout fixed by GL_DRAW_INDIRECT_BUFFER
+    struct draw_elements_command {
+        GLuint count;
+        GLuint instance_count;
+        GLuint first_index;
+        GLint base_vertex;
+        GLuint base_instance;
+    };
+
+    GLuint vs;
+    GLuint gs;
+    GLuint program;
+    bool indirect;
+    GLuint compacted[2];
+    size_t capacity[2];
+    GLuint written_queries[2];
+    bool culled[2];
+    size_t slot;
+    GLuint command_buffer;
+    // mesh each slot was culled for, drawn from it a frame later
+    mesh_range ranges[2];
+    GLsizei previous_count;
+    GLsizei last_survivors;
+};
+
+#endif // GPU_CULLING_H
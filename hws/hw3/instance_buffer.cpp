@@ -0,0 +1,140 @@
+#include "instance_buffer.h"
+
+#include "gl_state_cache.h"
+
+#include <cmath>
+
+// objects are about 2 units across
+static float const GRID_SPACING = 2.5f;
+// the back layer stays in front of the scene's far plane (100) seen from
+// the camera at z = 6, with room for the object's radius
+static float const GRID_MAX_DEPTH = 90.0f;
+
+static void set_divisor(GLuint index, GLuint divisor) {
+    if(GLEW_VERSION_3_3) {
+        glVertexAttribDivisor(index, divisor);
+    } else {
+        glVertexAttribDivisorARB(index, divisor);
+    }
+}
+
+// 0, 1, -1, 2, -2, ...
+static int centered(int k) {
+    return k % 2 ? (k + 1) / 2 : -(k / 2);
+}
+
+// cheap deterministic colors, so the copies can be told apart
+static vec3 tint_of(size_t i) {
+    uint32_t h = uint32_t(i) * 2654435761u;
+    h ^= h >> 15;
+    return vec3(0.5f + float(h & 0xff) / 510, 0.5f + float((h >> 8) & 0xff) / 510,
+                0.5f + float((h >> 16) & 0xff) / 510);
+}
+
+instance_buffer::instance_buffer()
+    : buffer(0)
+    , subset_uploaded(false)
+{
+    glGenBuffers(1, &buffer);
+}
+
+instance_buffer::~instance_buffer() {
+    glDeleteBuffers(1, &buffer);
+}
+
+bool instance_buffer::supported() {
+    return GLEW_VERSION_3_3 || (GLEW_ARB_instanced_arrays && (GLEW_VERSION_3_1 || GLEW_ARB_draw_instanced));
+}
+
+void grid_instances(size_t count, vector<instance_data>& instances) {
+    instances.resize(count);
+    // a cube while it fits in depth, past that the layers grow wider
+    int const max_layers = int(GRID_MAX_DEPTH / GRID_SPACING) + 1;
+    int const side = std::max(1, std::max(int(std::ceil(std::cbrt(float(count)))),
+                                          int(std::ceil(std::sqrt(float(count) / max_layers)))));
+    for(size_t i = 0; i != count; ++i) {
+        // layers of side x side objects around the view axis
+        int const x = centered(int(i % side));
+        int const y = centered(int(i / side % side));
+        int const z = int(i / (side * side));
+        instances[i].model = translate(mat4(), vec3(x, y, -z) * GRID_SPACING);
+        instances[i].tint = i == 0 ? vec3(1, 1, 1) : tint_of(i);
+    }
+}
+
+void instance_buffer::resize(size_t count) {
+    if(count == instances.size()) {
+        return;
+    }
+    grid_instances(count, instances);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(instance_data), instances.data(), GL_DYNAMIC_DRAW);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+    subset_uploaded = false;
+}
+
+void instance_buffer::upload_subset(vector<uint32_t> const& indices) {
+    packed.resize(indices.size());
+    for(size_t i = 0; i != indices.size(); ++i) {
+        packed[i] = instances[indices[i]];
+    }
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, packed.size() * sizeof(instance_data), packed.data());
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+    subset_uploaded = true;
+}
+
+void instance_buffer::upload_all() {
+    if(!subset_uploaded) {
+        return;
+    }
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(instance_data), instances.data());
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+    subset_uploaded = false;
+}
+
+void bind_instance_attributes(GLuint program, GLuint buffer, GLuint divisor) {
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, buffer);
+    GLint const model = glGetAttribLocation(program, "instance_model");
+    if(model >= 0) {
+        // a mat4 attribute takes four consecutive vec4 locations
+        for(GLuint column = 0; column != 4; ++column) {
+            gl_cache().enable_vertex_attrib_array(model + column);
+            glVertexAttribPointer(model + column, 4, GL_FLOAT, GL_FALSE, sizeof(instance_data),
+                                  (GLvoid*)(column * sizeof(vec4)));
+            set_divisor(model + column, divisor);
+        }
+    }
+    GLint const tint = glGetAttribLocation(program, "instance_tint");
+    if(tint >= 0) {
+        gl_cache().enable_vertex_attrib_array(tint);
+        glVertexAttribPointer(tint, 3, GL_FLOAT, GL_FALSE, sizeof(instance_data),
+                              (GLvoid*)(sizeof(mat4)));
+        set_divisor(tint, divisor);
+    }
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+void unbind_instance_attributes(GLuint program) {
+    GLint const model = glGetAttribLocation(program, "instance_model");
+    if(model >= 0) {
+        for(GLuint column = 0; column != 4; ++column) {
+            set_divisor(model + column, 0);
+            gl_cache().disable_vertex_attrib_array(model + column);
+        }
+    }
+    GLint const tint = glGetAttribLocation(program, "instance_tint");
+    if(tint >= 0) {
+        set_divisor(tint, 0);
+        gl_cache().disable_vertex_attrib_array(tint);
+    }
+}
+
+void instance_buffer::bind(GLuint program) {
+    bind_instance_attributes(program, buffer, 1);
+}
+
+void instance_buffer::unbind(GLuint program) {
+    unbind_instance_attributes(program);
+}
@@ -0,0 +1,57 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include "common.h"
+
+#include <cstdint>
+
+struct instance_data {
+    mat4 model;
+    vec3 tint;
+};
+
+// points instance_model and instance_tint of program at a buffer of
+// instance_data; divisor 0 reads one instance per vertex
+void bind_instance_attributes(GLuint program, GLuint buffer, GLuint divisor);
+void unbind_instance_attributes(GLuint program);
+
+// count copies on a grid spreading away from the camera, instance 0
+// stays at the origin untinted, so one instance looks like no instancing;
+// the grid never goes past the far plane, large counts widen it instead
+void grid_instances(size_t count, vector<instance_data>& instances);
+
+// Per-instance transforms and material tints for drawing many copies of
+// one mesh with a single instanced draw. for_scene.vs compiled with
+// INSTANCED reads them as instance_model and instance_tint.
+class instance_buffer {
+public:
+    instance_buffer();
+    ~instance_buffer();
+
+    // instanced draws and attribute divisors
+    static bool supported();
+
+    // grid_instances() of count
+    void resize(size_t count);
+    size_t size() const { return instances.size(); }
+    GLuint buffer_id() const { return buffer; }
+    vector<instance_data> const& data() const { return instances; }
+
+    // packs the listed instances at the start of the buffer, so drawing
+    // indices.size() instances draws just those
+    void upload_subset(vector<uint32_t> const& indices);
+    // restores every instance after upload_subset()
+    void upload_all();
+
+    // points the instance attributes of program at the buffer
+    void bind(GLuint program);
+    void unbind(GLuint program);
+
+private:
+    GLuint buffer;
+    vector<instance_data> instances;
+    vector<instance_data> packed;
+    bool subset_uploaded;
+};
+
+#endif // INSTANCE_BUFFER_H
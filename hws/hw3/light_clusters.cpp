@@ -0,0 +1,290 @@
+#include "light_clusters.h"
+#include "gl_state_cache.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define LIGHT_CLUSTERS_SSE
+#endif
+
+static size_t const SLICE_CLUSTERS = CLUSTER_TILES_X * CLUSTER_TILES_Y;
+
+static int tile_of(float ndc, size_t tiles) {
+    int const tile = int(std::floor((ndc + 1) * 0.5f * tiles));
+    return std::max(0, std::min(int(tiles) - 1, tile));
+}
+
+light_binner::light_binner(size_t workers)
+    : pool(new worker_pool(workers))
+    , bounds_scale(0)
+    , bounds_near(0)
+    , bounds_far(0)
+    , slice_scale(0)
+    , slice_bias(0)
+    , last_bin_ms(0)
+    , max_lights(0)
+{}
+
+void light_binner::set_workers(size_t workers) {
+    pool.reset(new worker_pool(workers));
+}
+
+void light_binner::update_bounds(vec2 const& scale, float near, float far) {
+    if(scale == bounds_scale && near == bounds_near && far == bounds_far) {
+        return;
+    }
+    bounds_scale = scale;
+    bounds_near = near;
+    bounds_far = far;
+    float const ratio = std::log(far / near);
+    slice_scale = CLUSTER_SLICES / ratio;
+    slice_bias = -slice_scale * std::log(near);
+    for(size_t s = 0; s != CLUSTER_SLICES; ++s) {
+        slice_bounds& bounds = slices[s];
+        bounds.near_depth = near * std::exp(ratio * s / CLUSTER_SLICES);
+        bounds.far_depth = s + 1 == CLUSTER_SLICES ? far : near * std::exp(ratio * (s + 1) / CLUSTER_SLICES);
+        // a tile widens with depth, its box spans both ends of the slice
+        for(size_t x = 0; x != CLUSTER_TILES_X; ++x) {
+            float const left = -1 + 2.0f * x / CLUSTER_TILES_X;
+            float const right = -1 + 2.0f * (x + 1) / CLUSTER_TILES_X;
+            bounds.min_x[x] = std::min(left * bounds.near_depth, left * bounds.far_depth) * scale.x;
+            bounds.max_x[x] = std::max(right * bounds.near_depth, right * bounds.far_depth) * scale.x;
+        }
+        for(size_t y = 0; y != CLUSTER_TILES_Y; ++y) {
+            float const bottom = -1 + 2.0f * y / CLUSTER_TILES_Y;
+            float const top = -1 + 2.0f * (y + 1) / CLUSTER_TILES_Y;
+            bounds.min_y[y] = std::min(bottom * bounds.near_depth, bottom * bounds.far_depth) * scale.y;
+            bounds.max_y[y] = std::max(top * bounds.near_depth, top * bounds.far_depth) * scale.y;
+        }
+    }
+}
+
+int light_binner::slice_of(float depth) const {
+    int const slice = int(std::floor(std::log(depth) * slice_scale + slice_bias));
+    return std::max(0, std::min(int(CLUSTER_SLICES) - 1, slice));
+}
+
+void light_binner::bin(point_light_set const& lights, mat4 const& proj, mat4 const& view, float near, float far) {
+    chrono::high_resolution_clock::time_point const start = chrono::high_resolution_clock::now();
+    vec2 const scale(1 / proj[0][0], 1 / proj[1][1]);
+    update_bounds(scale, near, far);
+
+    // the screen rectangle and slices of every light, bounded by the
+    // corners of its box in camera space
+    size_t const count = std::min(lights.size(), MAX_CLUSTERED_LIGHTS);
+    camera_lights.resize(2 * count);
+    extents.resize(count);
+    slice_first.assign(CLUSTER_SLICES + 1, 0);
+    for(size_t i = 0; i != count; ++i) {
+        point_light const& light = lights.data()[i];
+        vec3 const center = vec3(view * vec4(vec3(light.sphere), 1));
+        float const radius = light.sphere.w;
+        camera_lights[2 * i] = vec4(center, radius);
+        camera_lights[2 * i + 1] = light.color;
+
+        light_extent& extent = extents[i];
+        extent.s0 = 1;
+        extent.s1 = 0;
+        float const depth = -center.z;
+        if(depth + radius < near || depth - radius > far) {
+            continue;
+        }
+        float const depths[2] = { std::max(depth - radius, near), std::min(depth + radius, far) };
+        vec2 lo(FLT_MAX, FLT_MAX);
+        vec2 hi(-FLT_MAX, -FLT_MAX);
+        for(int d = 0; d != 2; ++d) {
+            for(int side = -1; side <= 1; side += 2) {
+                float const x = (center.x + side * radius) / (depths[d] * scale.x);
+                float const y = (center.y + side * radius) / (depths[d] * scale.y);
+                lo = vec2(std::min(lo.x, x), std::min(lo.y, y));
+                hi = vec2(std::max(hi.x, x), std::max(hi.y, y));
+            }
+        }
+        if(hi.x < -1 || lo.x > 1 || hi.y < -1 || lo.y > 1) {
+            continue;
+        }
+        extent.x0 = uint8_t(tile_of(lo.x, CLUSTER_TILES_X));
+        extent.x1 = uint8_t(tile_of(hi.x, CLUSTER_TILES_X));
+        extent.y0 = uint8_t(tile_of(lo.y, CLUSTER_TILES_Y));
+        extent.y1 = uint8_t(tile_of(hi.y, CLUSTER_TILES_Y));
+        extent.s0 = uint8_t(slice_of(depths[0]));
+        extent.s1 = uint8_t(slice_of(depths[1]));
+        for(int s = extent.s0; s <= extent.s1; ++s) {
+            ++slice_first[s + 1];
+        }
+    }
+    for(size_t s = 0; s != CLUSTER_SLICES; ++s) {
+        slice_first[s + 1] += slice_first[s];
+    }
+    slice_lights.resize(slice_first[CLUSTER_SLICES]);
+    vector<uint32_t> filled(slice_first.begin(), slice_first.end() - 1);
+    for(size_t i = 0; i != count; ++i) {
+        for(int s = extents[i].s0; s <= extents[i].s1; ++s) {
+            slice_lights[filled[s]++] = uint16_t(i);
+        }
+    }
+
+    pool->run(CLUSTER_SLICES, [this](size_t slice, size_t) { bin_slice(slice); });
+
+    // the slices one after another
+    cluster_ranges.resize(2 * CLUSTERS_COUNT);
+    size_t total = 0;
+    for(size_t s = 0; s != CLUSTER_SLICES; ++s) {
+        total += bins[s].indices.size();
+    }
+    light_indices.resize(total);
+    uint32_t first = 0;
+    max_lights = 0;
+    for(size_t s = 0; s != CLUSTER_SLICES; ++s) {
+        slice_bins const& slice = bins[s];
+        if(!slice.indices.empty()) {
+            memcpy(&light_indices[first], slice.indices.data(), slice.indices.size() * sizeof(uint16_t));
+        }
+        for(size_t c = 0; c != SLICE_CLUSTERS; ++c) {
+            size_t const cluster = s * SLICE_CLUSTERS + c;
+            cluster_ranges[2 * cluster] = first;
+            cluster_ranges[2 * cluster + 1] = slice.counts[c];
+            first += slice.counts[c];
+            max_lights = std::max(max_lights, size_t(slice.counts[c]));
+        }
+    }
+    last_bin_ms = chrono::duration<float, std::milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+// Squared distances from the light to the cluster boxes add up per axis:
+// z is the same for the whole slice, y for a row, so only x is computed
+// per cluster.
+void light_binner::bin_slice(size_t s) {
+    slice_bins& slice = bins[s];
+    slice_bounds const& bounds = slices[s];
+    memset(slice.counts, 0, sizeof(slice.counts));
+    // a light hits at most every cluster of the slice, room for that is
+    // made before each one so the loops below write without checks
+    size_t used = 0;
+    for(uint32_t j = slice_first[s]; j != slice_first[s + 1]; ++j) {
+        if(slice.hits.size() < used + SLICE_CLUSTERS) {
+            slice.hits.resize(2 * (used + SLICE_CLUSTERS));
+        }
+        uint32_t* const hits = slice.hits.data();
+        uint32_t const light = slice_lights[j];
+        vec4 const& sphere = camera_lights[2 * light];
+        float const radius2 = sphere.w * sphere.w;
+        float const depth = -sphere.z;
+        float const dz = std::max(0.0f, std::max(bounds.near_depth - depth, depth - bounds.far_depth));
+        if(dz * dz > radius2) {
+            continue;
+        }
+        light_extent const& extent = extents[light];
+        int const columns = ((2 << extent.x1) - 1) & ~((1 << extent.x0) - 1);
+        for(int y = extent.y0; y <= extent.y1; ++y) {
+            float const dy = std::max(0.0f, std::max(bounds.min_y[y] - sphere.y, sphere.y - bounds.max_y[y]));
+            float const dyz2 = dy * dy + dz * dz;
+            if(dyz2 > radius2) {
+                continue;
+            }
+            uint32_t const row = uint32_t(y * CLUSTER_TILES_X);
+#ifdef LIGHT_CLUSTERS_SSE
+            __m128 const zero = _mm_setzero_ps();
+            __m128 const cx = _mm_set1_ps(sphere.x);
+            __m128 const rest = _mm_set1_ps(dyz2);
+            __m128 const r2 = _mm_set1_ps(radius2);
+            for(int x = extent.x0 & ~3; x <= extent.x1; x += 4) {
+                __m128 const lo = _mm_loadu_ps(bounds.min_x + x);
+                __m128 const hi = _mm_loadu_ps(bounds.max_x + x);
+                __m128 const dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lo, cx), _mm_sub_ps(cx, hi)), zero);
+                __m128 const d2 = _mm_add_ps(_mm_mul_ps(dx, dx), rest);
+                int inside = _mm_movemask_ps(_mm_cmple_ps(d2, r2)) & (columns >> x);
+                for(uint32_t cluster = row + x; inside != 0; ++cluster, inside >>= 1) {
+                    if(inside & 1) {
+                        hits[used++] = cluster << 16 | light;
+                        ++slice.counts[cluster];
+                    }
+                }
+            }
+#else
+            for(int x = extent.x0; x <= extent.x1; ++x) {
+                float const dx = std::max(0.0f, std::max(bounds.min_x[x] - sphere.x, sphere.x - bounds.max_x[x]));
+                if(dx * dx + dyz2 <= radius2) {
+                    hits[used++] = (row + x) << 16 | light;
+                    ++slice.counts[row + x];
+                }
+            }
+#endif
+        }
+    }
+
+    // counting sort by cluster, lights stay in order within one
+    uint32_t offsets[SLICE_CLUSTERS];
+    uint32_t first = 0;
+    for(size_t c = 0; c != SLICE_CLUSTERS; ++c) {
+        offsets[c] = first;
+        first += slice.counts[c];
+    }
+    slice.indices.resize(used);
+    for(size_t i = 0; i != used; ++i) {
+        slice.indices[offsets[slice.hits[i] >> 16]++] = uint16_t(slice.hits[i] & 0xffff);
+    }
+}
+
+light_clusters::light_clusters(size_t workers)
+    : bins(workers)
+{
+    glGenBuffers(3, buffers);
+    glGenTextures(3, textures);
+    GLenum const formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+    GLfloat const empty[4] = { 0, 0, 0, 0 };
+    for(int i = 0; i != 3; ++i) {
+        gl_cache().bind_buffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(empty), empty, GL_STREAM_DRAW);
+        gl_cache().bind_texture(GL_TEXTURE_BUFFER, textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+    }
+    gl_cache().bind_texture(GL_TEXTURE_BUFFER, 0);
+    gl_cache().bind_buffer(GL_TEXTURE_BUFFER, 0);
+}
+
+light_clusters::~light_clusters() {
+    glDeleteTextures(3, textures);
+    glDeleteBuffers(3, buffers);
+}
+
+bool light_clusters::supported() {
+    return GLEW_VERSION_3_1 != 0;
+}
+
+void light_clusters::update(point_light_set const& lights, mat4 const& proj, mat4 const& view, float near, float far) {
+    bins.bin(lights, proj, view, near, far);
+    void const* data[3] = { bins.lights_data().data(), bins.ranges().data(), bins.indices().data() };
+    size_t const sizes[3] = {
+        bins.lights_data().size() * sizeof(vec4),
+        bins.ranges().size() * sizeof(uint32_t),
+        bins.indices().size() * sizeof(uint16_t)
+    };
+    for(int i = 0; i != 3; ++i) {
+        // new storage every frame, the last one may still be read
+        gl_cache().bind_buffer(GL_TEXTURE_BUFFER, buffers[i]);
+        if(sizes[i] != 0) {
+            glBufferData(GL_TEXTURE_BUFFER, sizes[i], data[i], GL_STREAM_DRAW);
+        }
+    }
+    gl_cache().bind_buffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void light_clusters::bind(GLuint program, GLuint first_unit, vec2 const& viewport) {
+    char const* const samplers[3] = { "cluster_lights", "cluster_ranges", "cluster_light_indices" };
+    for(int i = 0; i != 3; ++i) {
+        gl_cache().active_texture(GL_TEXTURE0 + first_unit + i);
+        gl_cache().bind_texture(GL_TEXTURE_BUFFER, textures[i]);
+        glUniform1i(glGetUniformLocation(program, samplers[i]), GLint(first_unit + i));
+    }
+    gl_cache().active_texture(GL_TEXTURE0);
+    glUniform3i(glGetUniformLocation(program, "cluster_grid"),
+                GLint(CLUSTER_TILES_X), GLint(CLUSTER_TILES_Y), GLint(CLUSTER_SLICES));
+    glUniform2f(glGetUniformLocation(program, "cluster_tile_size"),
+                viewport.x / CLUSTER_TILES_X, viewport.y / CLUSTER_TILES_Y);
+    glUniform2f(glGetUniformLocation(program, "cluster_depth_scale_bias"), bins.depth_scale(), bins.depth_bias());
+}
@@ -0,0 +1,123 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include "common.h"
+#include "point_lights.h"
+#include "worker_pool.h"
+
+#include <cstdint>
+
+// the view frustum is cut into CLUSTER_TILES_X x CLUSTER_TILES_Y screen
+// tiles and CLUSTER_SLICES depth slices, spaced exponentially from near to far
+static size_t const CLUSTER_TILES_X = 16;
+static size_t const CLUSTER_TILES_Y = 16;
+static size_t const CLUSTER_SLICES = 24;
+static size_t const CLUSTERS_COUNT = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+// light indices are 16 bit
+static size_t const MAX_CLUSTERED_LIGHTS = 65536;
+
+// Bins point lights into the clusters of the view frustum on the CPU.
+// The lights overlapping a depth slice are found first, then every slice
+// is a task of the pool: each light of the slice is tested against the
+// box of every cluster in its screen rectangle, four tiles of a row at a
+// time with SSE, and the hits are sorted by cluster.
+class light_binner {
+public:
+    explicit light_binner(size_t workers);
+
+    size_t workers_count() const { return pool->workers_count(); }
+    void set_workers(size_t workers);
+
+    // proj is a symmetric perspective with these near and far planes;
+    // at most MAX_CLUSTERED_LIGHTS lights
+    void bin(point_light_set const& lights, mat4 const& proj, mat4 const& view, float near, float far);
+
+    // two texels a light: camera space position and radius, then color
+    vector<vec4> const& lights_data() const { return camera_lights; }
+    // first index and count of every cluster, slice by slice, row by row
+    vector<uint32_t> const& ranges() const { return cluster_ranges; }
+    vector<uint16_t> const& indices() const { return light_indices; }
+
+    // slice of a camera space depth is log(depth) * scale + bias
+    float depth_scale() const { return slice_scale; }
+    float depth_bias() const { return slice_bias; }
+
+    float bin_ms() const { return last_bin_ms; }
+    size_t max_cluster_lights() const { return max_lights; }
+
+private:
+    // clusters of a slice as camera space boxes: x bounds by tile column,
+    // y bounds by tile row, and the slice's depth range
+    struct slice_bounds {
+        float min_x[CLUSTER_TILES_X];
+        float max_x[CLUSTER_TILES_X];
+        float min_y[CLUSTER_TILES_Y];
+        float max_y[CLUSTER_TILES_Y];
+        float near_depth;
+        float far_depth;
+    };
+    // screen rectangle of tiles and the slices a light may touch
+    struct light_extent {
+        uint8_t x0, x1, y0, y1;
+        uint8_t s0, s1;
+    };
+    // output of a slice task
+    struct slice_bins {
+        vector<uint32_t> hits;
+        uint32_t counts[CLUSTER_TILES_X * CLUSTER_TILES_Y];
+        vector<uint16_t> indices;
+    };
+
+    unique_ptr<worker_pool> pool;
+
+    vec2 bounds_scale;
+    float bounds_near;
+    float bounds_far;
+    slice_bounds slices[CLUSTER_SLICES];
+    float slice_scale;
+    float slice_bias;
+
+    vector<vec4> camera_lights;
+    vector<light_extent> extents;
+    // lights of every slice, counting sorted
+    vector<uint32_t> slice_first;
+    vector<uint16_t> slice_lights;
+    slice_bins bins[CLUSTER_SLICES];
+
+    vector<uint32_t> cluster_ranges;
+    vector<uint16_t> light_indices;
+
+    float last_bin_ms;
+    size_t max_lights;
+
+    void update_bounds(vec2 const& scale, float near, float far);
+    int slice_of(float depth) const;
+    void bin_slice(size_t slice);
+};
+
+// The binned lights in texture buffers for for_scene.fs compiled with
+// CLUSTERED: a fragment finds its cluster from gl_FragCoord and its depth
+// and loops over that cluster's lights only.
+class light_clusters {
+public:
+    explicit light_clusters(size_t workers);
+    ~light_clusters();
+
+    // texture buffers (GL 3.1)
+    static bool supported();
+
+    light_binner& binner() { return bins; }
+
+    // bins and uploads the lights
+    void update(point_light_set const& lights, mat4 const& proj, mat4 const& view, float near, float far);
+    // binds the buffers to texture units first_unit and the two after it
+    // and points the program at them; viewport is the one drawn to
+    void bind(GLuint program, GLuint first_unit, vec2 const& viewport);
+
+private:
+    light_binner bins;
+    GLuint buffers[3];
+    GLuint textures[3];
+};
+
+#endif // LIGHT_CLUSTERS_H
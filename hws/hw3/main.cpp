@@ -1,15 +1,62 @@
 ﻿#include "common.h"
 #include "shader.h"
 #include "utils.h"
+#include "filter_pipeline.h"
+#include "batch_filter.h"
+#include "tiled_filter.h"
+#include "shader_watcher.h"
+#include "instance_buffer.h"
+#include "scene_bvh.h"
+#include "gpu_culling.h"
+#include "occlusion_culler.h"
+#include "deferred_renderer.h"
+#include "light_clusters.h"
+#include "depth_prepass.h"
+#include "mesh_arena.h"
+#include "render_queue.h"
+#include "command_recorder.h"
+#include "transform_hierarchy.h"
+#include "soft_rasterizer.h"
+#include "soft_filter.h"
 #include <FreeImage.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+#ifndef _WIN32
+#include <X11/Xlib.h>
+#endif
+
 // Размеры окна по-умолчанию
 size_t const DEFAULT_WINDOW_WIDTH  = 800;
 size_t const DEFAULT_WINDOW_HEIGHT = 800;
 
+// depth range of the scene's projection
+float const SCENE_NEAR_PLANE = 0.1f;
+float const SCENE_FAR_PLANE = 100.0f;
+
+// upper bound of the "Gaussian kernel radius" control
+int const MAX_GAUSSIAN_KERNEL_RADIUS = 10;
+
+// linked programs saved by earlier runs, see program_cache::use_binaries
+char const* const PROGRAM_BINARY_DIR = "..//shader_cache";
+
+// the software rasterizer against GL: a channel may be off by
+// SOFT_COMPARE_TOLERANCE on at most SOFT_COMPARE_PIXELS of the pixels, the
+// edges and texel boundaries GL rounds its own way
+int const SOFT_COMPARE_TOLERANCE = 8;
+float const SOFT_COMPARE_PIXELS = 0.01f;
+
+// storage of the geometry arena, allocated once: 8 MB of vertices, 4 MB of indices
+size_t const ARENA_VERTEX_CAPACITY = 1 << 18;
+size_t const ARENA_INDEX_CAPACITY = 1 << 20;
+
 enum geom_obj { QUAD, CYLINDER, SPHERE, BACK_QUAD };
 enum tex_filtering_mode { NEAREST, LINEAR, MIPMAP };
-enum filter { NO_FILTER = 0, BOX_BLUR, GAUSSIAN_HORIZONTAL_BLUR, GAUSSIAN_VERTICAL_BLUR, SOBEL_FILTER };
+// how the scene program lights: its own light only, into the G-buffer for
+// the deferred passes, or its own light plus the clustered point lights
+enum scene_lighting { FORWARD_LIGHTING, GBUFFER_LIGHTING, CLUSTERED_LIGHTING };
 
 struct draw_data {
     vector<GLfloat> vertices;
@@ -28,6 +75,27 @@ struct draw_data {
     size_t normals_data_size() const { return normals.size() * sizeof(GLfloat); }
 };
 
+// --software <output.ppm> [options]: the scene drawn and filtered by the
+// software rasterizer, no GL context needed
+struct software_options {
+    string output_path;
+    geom_obj figure;
+    int objects;
+    bool wireframe;
+    tex_filtering_mode tex_filtering;
+    vector<filter> chain;
+    filter_params params;
+    int threads;
+
+    software_options()
+        : figure(SPHERE)
+        , objects(1)
+        , wireframe(false)
+        , tex_filtering(NEAREST)
+        , threads(int(worker_pool::hardware_workers()))
+    {}
+};
+
 struct program_state {
     quat rotation_by_control;
 
@@ -43,6 +111,66 @@ struct program_state {
 
     float sobel_threshold;
 
+    bool program_binaries;
+    chrono::system_clock::time_point launch_time;
+
+    // copies of the current object drawn with one instanced draw
+    int instance_count;
+    // averaged over the last second
+    float frame_ms;
+
+    // instances outside of the view frustum are not submitted
+    bool frustum_culling;
+    // bounding spheres tested in a transform feedback pass instead of the BVH
+    bool cull_on_gpu;
+    // quad, cylinder and sphere in turn over the instance grid, all in
+    // one multi-draw-indirect call
+    bool mixed_meshes;
+    // every instance as its own draw with one of four materials, recorded
+    // into a render queue and submitted sorted
+    bool queued_draws;
+    int state_changes_unsorted;
+    int state_changes_sorted;
+    // threads recording the queued draws, this one included
+    int record_threads;
+    float record_ms;
+    float submit_ms;
+    int drawn_instances;
+    int culled_instances;
+    float cull_ms;
+    // state calls of the last frame and how many of them set nothing new
+    int state_calls;
+    int state_calls_elided;
+    // queued draws of objects hidden last frame wait on an occlusion query
+    bool occlusion_culling;
+    int occlusion_queries;
+    // draws the GPU dropped in the last frame
+    int occlusion_skipped;
+    float occlusion_gpu_ms;
+    float occlusion_saved_ms;
+    // the scene goes through a G-buffer and is lit by light_count point
+    // lights on top of its own light
+    bool deferred_shading;
+    int light_count;
+    float lighting_ms;
+    // the scene program loops over the point lights binned to the cluster
+    // of the fragment, deferred shading goes first if both are on
+    bool clustered_shading;
+    float cluster_bin_ms;
+    int cluster_max_lights;
+    // depth-only pass first, so the lit one shades every pixel once; auto
+    // turns it on when the overdraw counter says it pays off, on forces it
+    bool depth_prepass_auto;
+    bool depth_prepass_on;
+    bool depth_prepass_active;
+    float overdraw;
+    float shaded_per_pixel;
+    // the scene drawn on the CPU and uploaded instead of drawn with GL
+    bool software_backend;
+    int software_threads;
+    float software_ms;
+    int software_triangles;
+
     program_state()
         : wireframe_mode(false)
         , cur_obj(QUAD)
@@ -56,66 +184,144 @@ struct program_state {
         , gaussian_kernel_radius(4)
         , gaussian_variance(4)
         , sobel_threshold(0.25)
+        , program_binaries(true)
+        , instance_count(1)
+        , frame_ms(0)
+        , frustum_culling(true)
+        , cull_on_gpu(false)
+        , mixed_meshes(false)
+        , queued_draws(false)
+        , state_changes_unsorted(0)
+        , state_changes_sorted(0)
+        , record_threads(int(worker_pool::hardware_workers()))
+        , record_ms(0)
+        , submit_ms(0)
+        , drawn_instances(0)
+        , culled_instances(0)
+        , cull_ms(0)
+        , state_calls(0)
+        , state_calls_elided(0)
+        , occlusion_culling(false)
+        , occlusion_queries(0)
+        , occlusion_skipped(0)
+        , occlusion_gpu_ms(0)
+        , occlusion_saved_ms(0)
+        , deferred_shading(false)
+        , light_count(256)
+        , lighting_ms(0)
+        , clustered_shading(false)
+        , cluster_bin_ms(0)
+        , cluster_max_lights(0)
+        , depth_prepass_auto(true)
+        , depth_prepass_on(false)
+        , depth_prepass_active(false)
+        , overdraw(0)
+        , shaded_per_pixel(0)
+        , software_backend(false)
+        , software_threads(int(worker_pool::hardware_workers()))
+        , software_ms(0)
+        , software_triangles(0)
+        , first_frame_drawn(false)
+        , all_programs_ready(false)
+        , stats_frames(0)
+        , model_node(0)
     {}
 
     // this function must be called before main loop but after
     // gl libs init functions
     void init() {
-        utils::read_obj_file(QUAD_MODEL_PATH, quad.vertices, quad.tex_mapping, quad.normals);
-        utils::read_obj_file(CYLINDER_MODEL_PATH, cylinder.vertices, cylinder.tex_mapping, cylinder.normals);
-        utils::read_obj_file(SPHERE_MODEL_PATH, sphere.vertices, sphere.tex_mapping, sphere.normals);
+        load_models();
         init_background_quad();
         init_framebuffer(fbo_depth1, fbo_texture1, fbo1);
         init_framebuffer(fbo_depth2, fbo_texture2, fbo2);
+        if(deferred_renderer::supported()) {
+            // lights straight into the texture fbo1 renders to
+            deferred.reset(new deferred_renderer(GLsizei(cur_window_width()), GLsizei(cur_window_height()), fbo_texture1));
+        }
+        if(light_clusters::supported()) {
+            clusters.reset(new light_clusters(worker_pool::hardware_workers()));
+        }
+        prepass.reset(new depth_prepass());
+        if(program_binaries) {
+            programs.use_binaries(PROGRAM_BINARY_DIR);
+        }
+        if(instance_buffer::supported()) {
+            instances.reset(new instance_buffer());
+        }
+        if(gpu_culling::supported()) {
+            gpu_culler.reset(new gpu_culling());
+        }
+        if(occlusion_culler::supported()) {
+            occlusion.reset(new occlusion_culler());
+        }
+        init_mesh_arena();
+        recorder.reset(new command_recorder(record_threads));
+        model_node = scene_graph.add(transform_hierarchy::NO_PARENT, mat4_cast(rotation_by_control));
+        applied_rotation = rotation_by_control;
         set_shaders();
+        watcher.reset(new shader_watcher(SHADERS_DIR));
+        stats_start = chrono::system_clock::now();
         set_draw_configs();
         init_textures();
         set_texture_filtration();
-        set_data_buffer();
+        init_software();
+    }
+
+    // what the software rasterizer draws, loaded without GL
+    void init_software() {
+        if(quad.vertices.empty()) {
+            load_models();
+        }
+        draw_data const* const figures[3] = { &quad, &cylinder, &sphere };
+        for(int obj = QUAD; obj <= SPHERE; ++obj) {
+            draw_data const& data = *figures[obj];
+            weld_mesh(data.vertices, data.tex_mapping, data.normals, soft_meshes[obj].vertices, soft_meshes[obj].indices);
+        }
+        texture_data const tex_data = utils::load_texture(TEXTURE_PATH);
+        soft_wall.reset(new soft_texture(tex_data.width, tex_data.height, GLenum(tex_data.format), tex_data.data_ptr));
+        soft.reset(new soft_rasterizer(software_threads));
+        soft->resize(int(DEFAULT_WINDOW_WIDTH), int(DEFAULT_WINDOW_HEIGHT));
+        soft_filters.reset(new soft_filter(software_threads));
     }
 
     void on_display_event() {
+        reload_changed_shaders();
+        programs.poll();
+        if(!all_programs_ready && programs.pending_count() == 0) {
+            all_programs_ready = true;
+            float const ms = chrono::duration<float, std::milli>(chrono::system_clock::now() - launch_time).count();
+            utils::debug(std::to_string(programs.programs_count()) + " programs ready "
+                         + std::to_string(ms) + " ms after launch");
+        }
+
         float const window_width = cur_window_width();
         float const window_height = cur_window_height();
         float const subwindow_width = window_width / 2 - 5;
         float const right_x = window_width / 2 + 5;
 
-        glPolygonMode(GL_FRONT_AND_BACK, wireframe_mode ? GL_LINE : GL_FILL);
-        glEnable(GL_SCISSOR_TEST);
+        gl_cache().polygon_mode(scene_polygon_mode());
+        gl_cache().enable(GL_SCISSOR_TEST);
 
-        glViewport(0, 0, window_width, window_height);
-        glScissor(0, 0, window_width, window_height);
-        glClearColor(0.0f, 1.0f, 0.0f, 0.0f);
+        gl_cache().viewport(0, 0, window_width, window_height);
+        gl_cache().scissor(0, 0, window_width, window_height);
+        gl_cache().clear_color(0.0f, 1.0f, 0.0f, 0.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        bind_offscreen_buffer(fbo1);
+        render_offscreen(window_width, window_height);
 
-        glScissor(0, 0, window_width, window_height);
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glBindTexture(GL_TEXTURE_2D, texture_id);
-        render_scene(window_width, window_height);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind any textures
+        gl_cache().polygon_mode(GL_FILL);
 
-        unbind_offscreen_buffer();
-
-        geom_obj prev_obj = cur_obj;
-        cur_obj = BACK_QUAD;
-        set_data_buffer();
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-        glViewport(0, 0, subwindow_width, window_height);
-        glScissor(0, 0, subwindow_width, window_height);
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        gl_cache().viewport(0, 0, subwindow_width, window_height);
+        gl_cache().scissor(0, 0, subwindow_width, window_height);
+        gl_cache().clear_color(0.0f, 0.0f, 0.0f, 0.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         filter cur = cur_filter;
         cur_filter = NO_FILTER;
 
-        glBindTexture(GL_TEXTURE_2D, fbo_texture1); // Bind our frame buffer texture
+        gl_cache().bind_texture(GL_TEXTURE_2D, fbo_texture1); // Bind our frame buffer texture
         render_with_filter(subwindow_width, window_height);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind any textures
+        gl_cache().bind_texture(GL_TEXTURE_2D, 0); // Unbind any textures
 
         cur_filter = cur;
 
@@ -123,40 +329,227 @@ struct program_state {
             cur = cur_filter;
             cur_filter = GAUSSIAN_VERTICAL_BLUR;
 
-            glViewport(0, 0, window_width, window_height);
-            glScissor(0, 0, window_width, window_height);
+            gl_cache().viewport(0, 0, window_width, window_height);
+            gl_cache().scissor(0, 0, window_width, window_height);
 
             bind_offscreen_buffer(fbo2);
 
-            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            gl_cache().clear_color(0.0f, 0.0f, 0.0f, 0.0f);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-            glBindTexture(GL_TEXTURE_2D, fbo_texture1); // Bind our frame buffer texture
+            gl_cache().bind_texture(GL_TEXTURE_2D, fbo_texture1); // Bind our frame buffer texture
             render_with_filter(window_width, window_height);
-            glBindTexture(GL_TEXTURE_2D, 0); // Unbind any textures
+            gl_cache().bind_texture(GL_TEXTURE_2D, 0); // Unbind any textures
 
             unbind_offscreen_buffer();
 
             cur_filter = cur;
 
-            glBindTexture(GL_TEXTURE_2D, fbo_texture2); // Bind our frame buffer texture
+            gl_cache().bind_texture(GL_TEXTURE_2D, fbo_texture2); // Bind our frame buffer texture
         } else {
-            glBindTexture(GL_TEXTURE_2D, fbo_texture1); // Bind our frame buffer texture
+            gl_cache().bind_texture(GL_TEXTURE_2D, fbo_texture1); // Bind our frame buffer texture
         }
 
-        glViewport(right_x, 0, subwindow_width, window_height);
-        glScissor(right_x, 0, subwindow_width, window_height);
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        gl_cache().viewport(right_x, 0, subwindow_width, window_height);
+        gl_cache().scissor(right_x, 0, subwindow_width, window_height);
+        gl_cache().clear_color(0.0f, 0.0f, 0.0f, 0.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         render_with_filter(subwindow_width, window_height);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind any textures
-
-        cur_obj = prev_obj;
-        set_data_buffer();
+        gl_cache().bind_texture(GL_TEXTURE_2D, 0); // Unbind any textures
 
         TwDraw();
+        // the bar sets its own program, buffers, textures and states
+        gl_cache().invalidate();
+        gl_cache().end_frame();
+        state_calls = int(gl_cache().frame_calls());
+        state_calls_elided = int(gl_cache().frame_elided());
         glutSwapBuffers();
+        update_frame_stats();
+
+        if(!first_frame_drawn) {
+            first_frame_drawn = true;
+            report_first_frame();
+        }
+    }
+
+    // the scene into fbo_texture1, lit forward, deferred or clustered, or
+    // forward by the software rasterizer
+    void render_offscreen(float window_width, float window_height) {
+        if(software_backend && soft) {
+            render_software(window_width, window_height);
+            soft->read_pixels(software_pixels);
+            gl_cache().bind_texture(GL_TEXTURE_2D, fbo_texture1);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT,
+                            GL_RGBA, GL_UNSIGNED_BYTE, software_pixels.data());
+            gl_cache().bind_texture(GL_TEXTURE_2D, 0);
+            return;
+        }
+        bind_offscreen_buffer(fbo1);
+
+        gl_cache().scissor(0, 0, window_width, window_height);
+        gl_cache().clear_color(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        scene_lighting const lighting = current_lighting();
+        bool const deferred_pass = lighting == GBUFFER_LIGHTING;
+        if(deferred_pass) {
+            deferred->begin_geometry();
+        } else if(lighting == CLUSTERED_LIGHTING) {
+            update_point_lights();
+            clusters->update(point_lights, scene_proj(window_width, window_height), scene_view(),
+                             SCENE_NEAR_PLANE, SCENE_FAR_PLANE);
+            cluster_bin_ms = clusters->binner().bin_ms();
+            cluster_max_lights = int(clusters->binner().max_cluster_lights());
+        }
+
+        gl_cache().bind_texture(GL_TEXTURE_2D, texture_id);
+        render_scene(window_width, window_height);
+        gl_cache().bind_texture(GL_TEXTURE_2D, 0); // Unbind any textures
+
+        if(deferred_pass) {
+            shade_point_lights(window_width, window_height);
+        }
+
+        unbind_offscreen_buffer();
+    }
+
+    // Forward frame time with the scene light alone, then deferred and
+    // clustered frame time by the number of point lights, over
+    // instances_count objects.
+    void report_light_scaling(int instances_count) {
+        if(!deferred || !clusters) {
+            throw msg_exception("deferred and clustered shading need GL 3.3");
+        }
+        instance_count = instances_count;
+        bool const instanced = instances && instance_count > 1;
+        // the lit programs are waited for, the stand-ins would skew the times
+        scene_lighting const lightings[3] = { FORWARD_LIGHTING, GBUFFER_LIGHTING, CLUSTERED_LIGHTING };
+        for(int i = 0; i != 3; ++i) {
+            programs.program(SCENE_VERTEX_SHADER_PATH, SCENE_FRAGMENT_SHADER_PATH,
+                             scene_defines(instanced, lightings[i]));
+        }
+
+        float const width = cur_window_width();
+        float const height = cur_window_height();
+        cout << instance_count << " objects, " << width << "x" << height << ", binning on "
+             << clusters->binner().workers_count() << " threads" << endl;
+        deferred_shading = false;
+        clustered_shading = false;
+        cout << "forward, scene light only: " << time_offscreen_frames(width, height) << " ms per frame" << endl;
+        for(int count = 0; count <= 16384; count = count ? count * 4 : 1) {
+            light_count = count;
+            deferred_shading = true;
+            float const deferred_ms = time_offscreen_frames(width, height);
+            cout << count << " point lights: deferred " << deferred_ms << " ms per frame, "
+                 << deferred->lighting_ms() << " ms of it lighting";
+            deferred_shading = false;
+            clustered_shading = true;
+            float const clustered_ms = time_offscreen_frames(width, height);
+            cout << "; clustered " << clustered_ms << " ms per frame, " << cluster_bin_ms << " ms binning, "
+                 << cluster_max_lights << " lights at most in a cluster" << endl;
+            clustered_shading = false;
+        }
+    }
+
+    // Every figure, shaded and in wireframe, drawn with GL and with the
+    // software rasterizer, and each filter run over both images. Prints how
+    // far the pairs are apart, false if one is past the tolerance.
+    bool report_software_difference() {
+        float const width = cur_window_width();
+        float const height = cur_window_height();
+        filter_pipeline pipeline(programs);
+        pipeline.resize(DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT);
+        filter_params params;
+        params.gaussian_kernel_radius = gaussian_kernel_radius;
+        params.gaussian_variance = gaussian_variance;
+        params.sobel_threshold = sobel_threshold;
+        char const* const chain_names[4] = { "no filter", "box", "gaussian", "sobel" };
+        vector<filter> chains[4];
+        chains[1].push_back(BOX_BLUR);
+        chains[2].push_back(GAUSSIAN_HORIZONTAL_BLUR);
+        chains[2].push_back(GAUSSIAN_VERTICAL_BLUR);
+        chains[3].push_back(SOBEL_FILTER);
+        char const* const figure_names[3] = { "quad", "cylinder", "sphere" };
+
+        cout << "software rasterizer (" << soft_rasterizer::simd_name() << ", " << soft->workers_count()
+             << " threads) against GL, " << SOFT_COMPARE_TOLERANCE << " levels on "
+             << SOFT_COMPARE_PIXELS * 100 << "% of the pixels at most" << endl;
+        bool passed = true;
+        // the rasterizer draws the single pass wireframe, GL_LINE is not compared
+        int const wire_modes = GLEW_VERSION_3_2 ? 2 : 1;
+        for(int wire = 0; wire != wire_modes; ++wire) {
+            wireframe_mode = wire != 0;
+            for(int obj = QUAD; obj <= SPHERE; ++obj) {
+                cur_obj = geom_obj(obj);
+                // the lit program is waited for, the stand-in would not match
+                shader_defines const defines = scene_defines(false, FORWARD_LIGHTING, wireframe_overlay());
+                programs.program(SCENE_VERTEX_SHADER_PATH, scene_geometry_shader(defines), SCENE_FRAGMENT_SHADER_PATH,
+                                 defines);
+                gl_cache().polygon_mode(scene_polygon_mode());
+                software_backend = false;
+                render_offscreen(width, height);
+                vector<uint8_t> gl_pixels(DEFAULT_WINDOW_WIDTH * DEFAULT_WINDOW_HEIGHT * 4);
+                glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo1);
+                glReadPixels(0, 0, DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, gl_pixels.data());
+                glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+
+                render_software(width, height);
+                vector<uint8_t> soft_pixels;
+                soft->read_pixels(soft_pixels);
+
+                for(int c = 0; c != 4; ++c) {
+                    vector<uint8_t> gl_filtered = gl_pixels;
+                    if(!chains[c].empty()) {
+                        pipeline.load_source(GL_RGBA, gl_pixels.data());
+                        pipeline.apply(chains[c], params);
+                        pipeline.read_result(GL_RGBA, gl_filtered.data());
+                    }
+                    vector<uint8_t> soft_filtered = soft_pixels;
+                    soft_filters->apply(soft_filtered, DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT, chains[c], params);
+                    image_difference const diff = compare_rgba(gl_filtered, soft_filtered, SOFT_COMPARE_TOLERANCE);
+                    bool const within = diff.pixels_over <= SOFT_COMPARE_PIXELS;
+                    passed = passed && within;
+                    cout << figure_names[obj] << (wireframe_mode ? " wireframe, " : ", ") << chain_names[c]
+                         << ": max " << diff.max_channel << ", mean " << diff.mean_channel << ", "
+                         << diff.pixels_over * 100 << "% past the tolerance" << (within ? "" : " FAILED") << endl;
+                }
+            }
+        }
+        return passed;
+    }
+
+    // the --software mode, the scene drawn and filtered on the CPU into a PPM
+    void write_software_image(software_options const& options) {
+        cur_obj = options.figure;
+        instance_count = options.objects;
+        wireframe_mode = options.wireframe;
+        cur_tex_filtering = options.tex_filtering;
+        software_threads = options.threads;
+        init_software();
+
+        int const width = int(DEFAULT_WINDOW_WIDTH);
+        int const height = int(DEFAULT_WINDOW_HEIGHT);
+        render_software(float(width), float(height));
+        vector<uint8_t> pixels;
+        soft->read_pixels(pixels);
+        chrono::high_resolution_clock::time_point const start = chrono::high_resolution_clock::now();
+        soft_filters->apply(pixels, width, height, options.chain, options.params);
+        float const filter_ms = chrono::duration<float, std::milli>(chrono::high_resolution_clock::now() - start).count();
+
+        std::ofstream out(options.output_path.c_str(), std::ios::binary);
+        out << "P6\n" << width << " " << height << "\n255\n";
+        // PPM rows go from the top
+        for(int y = height - 1; y >= 0; --y) {
+            for(int x = 0; x != width; ++x) {
+                out.write(reinterpret_cast<char const*>(&pixels[(size_t(y) * width + x) * 4]), 3);
+            }
+        }
+        if(!out.good()) {
+            throw msg_exception("can't write " + options.output_path);
+        }
+        cout << software_triangles << " triangles drawn in " << software_ms << " ms, filtered in " << filter_ms
+             << " ms on " << software_threads << " threads (" << soft_rasterizer::simd_name() << ")" << endl;
     }
 
     void next_figure() {
@@ -165,7 +558,6 @@ struct program_state {
         case CYLINDER: cur_obj = SPHERE; break;
         case SPHERE: cur_obj = QUAD; break;
         }
-        set_data_buffer();
     }
 
     void switch_polygon_mode() { wireframe_mode = !wireframe_mode; }
@@ -176,13 +568,18 @@ struct program_state {
         case LINEAR: cur_tex_filtering = MIPMAP; break;
         case MIPMAP: cur_tex_filtering = NEAREST; break;
         }
-        glBindTexture(GL_TEXTURE_2D, texture_id);
+        gl_cache().bind_texture(GL_TEXTURE_2D, texture_id);
         set_texture_filtration();
-        glBindTexture(GL_TEXTURE_2D, 0);
+        gl_cache().bind_texture(GL_TEXTURE_2D, 0);
     }
 
     void on_resize_event() {
         init_background_quad();
+        if(arena) {
+            // same storage, the arena reuses the freed range
+            arena->remove(arena_meshes[BACK_QUAD]);
+            arena_meshes[BACK_QUAD] = arena->add(back_quad.vertices, back_quad.tex_mapping, back_quad.normals, false);
+        }
     }
 
     void on_apply_filter_event(filter f) {
@@ -190,17 +587,11 @@ struct program_state {
     }
 
     ~program_state() {
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glDeleteProgram(scene_program);
-        glDeleteShader(scene_vx_shader);
-        glDeleteShader(scene_frag_shader);
-        glDeleteProgram(filtered_program);
-        glDeleteShader(filtered_vx_shader);
-        glDeleteShader(filtered_frag_shader);
-
-        glDeleteBuffers(1, &vx_buffer);
-        glDeleteBuffers(1, &tex_buffer);
-        glDeleteBuffers(1, &norms_buffer);
+        // the modes without a window never made GL objects
+        if(!arena) {
+            return;
+        }
+        gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
 
         glDeleteBuffers(1, &fbo1);
         glDeleteBuffers(1, &fbo_depth1);
@@ -211,23 +602,51 @@ struct program_state {
     }
 
 private:
+    bool first_frame_drawn;
+    bool all_programs_ready;
+    size_t stats_frames;
+    chrono::system_clock::time_point stats_start;
     bool wireframe_mode;
     geom_obj cur_obj;
     tex_filtering_mode cur_tex_filtering;
 
-    GLuint scene_vx_shader;
-    GLuint scene_frag_shader;
-    GLuint scene_program;
-    GLuint filtered_vx_shader;
-    GLuint filtered_frag_shader;
-    GLuint filtered_program;
-
-    GLuint vx_buffer;
-    GLuint tex_buffer;
-    GLuint norms_buffer;
+    program_cache programs;
+    unique_ptr<shader_watcher> watcher;
+    unique_ptr<instance_buffer> instances;
+    scene_objects culled_objects;
+    unique_ptr<gpu_culling> gpu_culler;
+    unique_ptr<occlusion_culler> occlusion;
+    unique_ptr<deferred_renderer> deferred;
+    unique_ptr<light_clusters> clusters;
+    point_light_set point_lights;
+    unique_ptr<depth_prepass> prepass;
+    unique_ptr<mesh_arena> arena;
+    unique_ptr<multi_draw_batch> batch;
+    // arena ids and bounds by geom_obj
+    size_t arena_meshes[4];
+    aabb mesh_bounds[4];
+    geom_obj batch_first_obj;
+    size_t batch_layout;
+
+    // records the queued draws on record_threads threads
+    unique_ptr<command_recorder> recorder;
+
+    // the object turned by the tweakbar, as a node of the scene graph
+    transform_hierarchy scene_graph;
+    uint32_t model_node;
+    quat applied_rotation;
+
+    // the software rasterizer's scene by geom_obj, its texture and target
+    soft_mesh soft_meshes[3];
+    unique_ptr<soft_texture> soft_wall;
+    unique_ptr<soft_rasterizer> soft;
+    unique_ptr<soft_filter> soft_filters;
+    vector<instance_data> soft_instances;
+    vector<uint8_t> software_pixels;
 
-    GLuint texture_sampler;
     GLuint texture_id;
+    // second material of the queued draws
+    GLuint checker_texture_id;
 
     GLuint fbo1; // The frame buffer object
     GLuint fbo_depth1; // The depth buffer for the frame buffer object
@@ -251,54 +670,261 @@ private:
 
     const char* TEXTURE_PATH = "..//resources//wall3.jpg";
 
+    const char* SHADERS_DIR = "..//shaders";
     const char* SCENE_VERTEX_SHADER_PATH = "..//shaders//for_scene.vs";
     const char* SCENE_FRAGMENT_SHADER_PATH = "..//shaders//for_scene.fs";
-    const char* FILTERED_VERTEX_SHADER_PATH = "..//shaders//for_filtered.vs";
-    const char* FILTERED_FRAGMENT_SHADER_PATH = "..//shaders//for_filtered.fs";
+    const char* FALLBACK_FRAGMENT_SHADER_PATH = "..//shaders//fallback.fs";
+    const char* WIREFRAME_GEOMETRY_SHADER_PATH = "..//shaders//wireframe.gs";
+    const char* DEPTH_FRAGMENT_SHADER_PATH = "..//shaders//depth_only.fs";
 
     vertex_attr const IN_POS = { "vert_pos_modelspace", 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0 };
     vertex_attr const VERTEX_UV = { "vert_uv", 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), 0 };
     vertex_attr const IN_NORM = { "vert_normal_modelspace", 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0 };
 
-    draw_data& cur_draw_data() {
-        switch(cur_obj) {
-        case QUAD: return quad;
-        case CYLINDER: return cylinder;
-        case SPHERE: return sphere;
-        case BACK_QUAD: return back_quad;
-        default: throw msg_exception("cur_obj is undefined");
-        }
+    void load_models() {
+        utils::read_obj_file(QUAD_MODEL_PATH, quad.vertices, quad.tex_mapping, quad.normals);
+        utils::read_obj_file(CYLINDER_MODEL_PATH, cylinder.vertices, cylinder.tex_mapping, cylinder.normals);
+        utils::read_obj_file(SPHERE_MODEL_PATH, sphere.vertices, sphere.tex_mapping, sphere.normals);
     }
 
     void set_shaders() {
-        scene_vx_shader = create_shader(GL_VERTEX_SHADER, SCENE_VERTEX_SHADER_PATH);
-        scene_frag_shader = create_shader(GL_FRAGMENT_SHADER, SCENE_FRAGMENT_SHADER_PATH);
-        scene_program = create_program(scene_vx_shader, scene_frag_shader);
+        programs.use_background_compile();
+        // the small stand-ins are waited for, everything else is only submitted
+        programs.program(SCENE_VERTEX_SHADER_PATH, FALLBACK_FRAGMENT_SHADER_PATH);
+        programs.program(FILTERED_VERTEX_SHADER_PATH, FILTERED_FRAGMENT_SHADER_PATH,
+                         filter_defines(NO_FILTER, filter_params()));
+        programs.request(SCENE_VERTEX_SHADER_PATH, SCENE_FRAGMENT_SHADER_PATH);
+        depth_program(false);
+        if(instances) {
+            depth_program(true);
+            programs.program(SCENE_VERTEX_SHADER_PATH, FALLBACK_FRAGMENT_SHADER_PATH, scene_defines(true, FORWARD_LIGHTING));
+            programs.request(SCENE_VERTEX_SHADER_PATH, SCENE_FRAGMENT_SHADER_PATH, scene_defines(true, FORWARD_LIGHTING));
+        }
+        for(int instanced = 0; instanced != (instances ? 2 : 1); ++instanced) {
+            if(deferred) {
+                programs.program(SCENE_VERTEX_SHADER_PATH, FALLBACK_FRAGMENT_SHADER_PATH,
+                                 scene_defines(instanced != 0, GBUFFER_LIGHTING));
+                programs.request(SCENE_VERTEX_SHADER_PATH, SCENE_FRAGMENT_SHADER_PATH,
+                                 scene_defines(instanced != 0, GBUFFER_LIGHTING));
+            }
+            if(clusters) {
+                programs.program(SCENE_VERTEX_SHADER_PATH, FALLBACK_FRAGMENT_SHADER_PATH,
+                                 scene_defines(instanced != 0, CLUSTERED_LIGHTING));
+                programs.request(SCENE_VERTEX_SHADER_PATH, SCENE_FRAGMENT_SHADER_PATH,
+                                 scene_defines(instanced != 0, CLUSTERED_LIGHTING));
+            }
+        }
 
-        filtered_vx_shader = create_shader(GL_VERTEX_SHADER, FILTERED_VERTEX_SHADER_PATH);
-        filtered_frag_shader = create_shader(GL_FRAGMENT_SHADER, FILTERED_FRAGMENT_SHADER_PATH);
-        filtered_program = create_program(filtered_vx_shader, filtered_frag_shader);
+        // every filter permutation the controls can select
+        filter_params params;
+        programs.request(FILTERED_VERTEX_SHADER_PATH, FILTERED_FRAGMENT_SHADER_PATH,
+                         filter_defines(BOX_BLUR, params));
+        programs.request(FILTERED_VERTEX_SHADER_PATH, FILTERED_FRAGMENT_SHADER_PATH,
+                         filter_defines(SOBEL_FILTER, params));
+        for(int r = 1; r <= MAX_GAUSSIAN_KERNEL_RADIUS; ++r) {
+            params.gaussian_kernel_radius = r;
+            programs.request(FILTERED_VERTEX_SHADER_PATH, FILTERED_FRAGMENT_SHADER_PATH,
+                             filter_defines(GAUSSIAN_HORIZONTAL_BLUR, params));
+            programs.request(FILTERED_VERTEX_SHADER_PATH, FILTERED_FRAGMENT_SHADER_PATH,
+                             filter_defines(GAUSSIAN_VERTICAL_BLUR, params));
+        }
+    }
+
+    void report_first_frame() {
+        glFinish();
+        float const ms = chrono::duration<float, std::milli>(chrono::system_clock::now() - launch_time).count();
+        string cache = "program binary cache off";
+        if(programs.binaries_enabled()) {
+            cache = "program binary cache: " + std::to_string(programs.binary_hits()) + " hits, "
+                    + std::to_string(programs.binary_misses()) + " misses";
+        } else if(program_binaries) {
+            cache = "program binaries are not supported";
+        }
+        cout << "first frame in " << ms << " ms, " << cache << endl;
+    }
+
+    // edited shaders are rebuilt in the background, the frames in between
+    // are drawn with the programs built from the previous version
+    void reload_changed_shaders() {
+        vector<string> const changed = watcher->changed_files();
+        for(size_t i = 0; i != changed.size(); ++i) {
+            size_t const count = programs.reload(changed[i]);
+            if(count != 0) {
+                utils::debug(changed[i] + " changed, rebuilding " + std::to_string(count) + " programs");
+            }
+        }
+    }
+
+    void update_frame_stats() {
+        ++stats_frames;
+        chrono::system_clock::time_point const now = chrono::system_clock::now();
+        float const seconds = chrono::duration<float>(now - stats_start).count();
+        if(seconds < 1) {
+            return;
+        }
+        frame_ms = seconds * 1000 / stats_frames;
+        if(instance_count > 1) {
+            cout << instance_count << " instances: " << frame_ms << " ms per frame";
+            if(frustum_culling) {
+                cout << ", " << drawn_instances << " drawn, " << culled_instances << " culled in "
+                     << cull_ms << " ms";
+            }
+            if(queued_draws) {
+                cout << ", " << state_changes_unsorted << " state changes unsorted, "
+                     << state_changes_sorted << " sorted, recorded on " << record_threads << " threads in "
+                     << record_ms << " ms, submitted in " << submit_ms << " ms";
+                if(occlusion_culling && occlusion) {
+                    cout << ", " << occlusion_queries << " occlusion queries, " << occlusion_skipped
+                         << " draws skipped, " << occlusion_saved_ms << " of " << occlusion_gpu_ms
+                         << " GPU ms saved";
+                }
+            }
+            cout << ", " << state_calls_elided << " of " << state_calls << " state calls elided";
+            if(overdraw > 0) {
+                cout << ", overdraw " << overdraw << ", " << shaded_per_pixel << " shaded per pixel"
+                     << (depth_prepass_active ? " with depth prepass" : "");
+            }
+            cout << endl;
+        }
+        if(software_backend && soft) {
+            cout << "software rasterizer: " << frame_ms << " ms per frame, " << software_triangles
+                 << " triangles drawn in " << software_ms << " ms on " << software_threads << " threads ("
+                 << soft_rasterizer::simd_name() << ")" << endl;
+        } else if(current_lighting() == GBUFFER_LIGHTING) {
+            cout << light_count << " point lights: " << frame_ms << " ms per frame, " << lighting_ms
+                 << " GPU ms lighting" << endl;
+        } else if(current_lighting() == CLUSTERED_LIGHTING) {
+            cout << light_count << " clustered point lights: " << frame_ms << " ms per frame, binned in "
+                 << cluster_bin_ms << " ms, at most " << cluster_max_lights << " in a cluster" << endl;
+        }
+        stats_start = now;
+        stats_frames = 0;
+    }
+
+    // wireframe draws the edges over the surface in the same pass, the
+    // program then has wireframe.gs between the stages
+    static shader_defines scene_defines(bool instanced, scene_lighting lighting, bool wireframe = false) {
+        shader_defines defines;
+        if(instanced) {
+            defines["INSTANCED"] = "1";
+        }
+        if(wireframe) {
+            defines["WIREFRAME"] = "1";
+        }
+        if(lighting == GBUFFER_LIGHTING) {
+            defines["GBUFFER"] = "1";
+        } else if(lighting == CLUSTERED_LIGHTING) {
+            defines["CLUSTERED"] = "1";
+        }
+        return defines;
+    }
+
+    char const* scene_geometry_shader(shader_defines const& defines) const {
+        return defines.count("WIREFRAME") ? WIREFRAME_GEOMETRY_SHADER_PATH : NULL;
+    }
+
+    // single pass wireframe needs geometry shaders (GL 3.2), without them
+    // the scene is drawn in lines instead
+    bool wireframe_overlay() const { return wireframe_mode && GLEW_VERSION_3_2; }
+    GLenum scene_polygon_mode() const { return wireframe_mode && !wireframe_overlay() ? GL_LINE : GL_FILL; }
+
+    // the depth prepass program, for_scene.vs as the lit programs run it
+    GLuint depth_program(bool instanced) {
+        return programs.program(SCENE_VERTEX_SHADER_PATH, DEPTH_FRAGMENT_SHADER_PATH,
+                                scene_defines(instanced, FORWARD_LIGHTING));
+    }
+
+    depth_prepass::mode prepass_mode() const {
+        if(depth_prepass_auto) {
+            return depth_prepass::AUTO;
+        }
+        return depth_prepass_on ? depth_prepass::ON : depth_prepass::OFF;
+    }
+
+    scene_lighting current_lighting() const {
+        if(deferred_shading && deferred) {
+            return GBUFFER_LIGHTING;
+        }
+        return clustered_shading && clusters ? CLUSTERED_LIGHTING : FORWARD_LIGHTING;
+    }
+
+    static soft_texture::filtering soft_filtering(tex_filtering_mode mode) {
+        switch(mode) {
+        case LINEAR: return soft_texture::LINEAR;
+        case MIPMAP: return soft_texture::MIPMAP;
+        default: return soft_texture::NEAREST;
+        }
+    }
+
+    // the scene as render_scene() draws it forward lit: one figure, or the
+    // instance grid of one figure or of all three in turn
+    void render_software(float window_width, float window_height) {
+        if(size_t(software_threads) != soft->workers_count()) {
+            soft->set_workers(software_threads);
+        }
+        soft_frame frame;
+        frame.proj = scene_proj(window_width, window_height);
+        frame.view = scene_view();
+        frame.light.position_worldspace = scene_light_position();
+        frame.light.color = light_color;
+        frame.light.power = light_power;
+        frame.light.ambient = vec3(ambient);
+        frame.light.specular = vec3(specular);
+        frame.tex_coords_scale = tex_coords_scale;
+        frame.wireframe = wireframe_mode;
+        frame.clear_color = vec4(0.0f);
+        soft_wall->set_filtering(soft_filtering(cur_tex_filtering));
+
+        mat4 const model = scene_model();
+        soft->begin_frame(frame);
+        if(instance_count > 1) {
+            if(soft_instances.size() != size_t(instance_count)) {
+                grid_instances(size_t(instance_count), soft_instances);
+            }
+            for(size_t i = 0; i != soft_instances.size(); ++i) {
+                size_t const obj = mixed_meshes ? (cur_obj + i) % 3 : size_t(cur_obj);
+                soft->draw(soft_meshes[obj], *soft_wall, soft_instances[i].model * model, soft_instances[i].tint);
+            }
+        } else {
+            soft->draw(soft_meshes[cur_obj], *soft_wall, model);
+        }
+        soft->end_frame();
+        software_ms = soft->frame_ms();
+        software_triangles = int(soft->triangles_count());
     }
 
     void set_draw_configs() {
-        glClearColor(0.0f, 0.0f, 0.4f, 0.0f);
-        glEnable(GL_TEXTURE_2D);
-        glEnable(GL_DEPTH_TEST);
-        glDepthFunc(GL_LESS);
+        gl_cache().clear_color(0.0f, 0.0f, 0.4f, 0.0f);
+        gl_cache().enable(GL_TEXTURE_2D);
+        gl_cache().enable(GL_DEPTH_TEST);
+        gl_cache().depth_func(GL_LESS);
     }
 
     void init_textures() {
         texture_data tex_data = utils::load_texture(TEXTURE_PATH);
         glGenTextures(1, &texture_id);
-        glBindTexture(GL_TEXTURE_2D, texture_id);
+        gl_cache().bind_texture(GL_TEXTURE_2D, texture_id);
 
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, tex_data.width, tex_data.height,
                      0, tex_data.format, GL_UNSIGNED_BYTE, tex_data.data_ptr);
         set_texture_filtration();
-        texture_sampler  = glGetUniformLocation(scene_program, "texture_sampler");
-        glUniform1i(texture_sampler, 0);
 
-        glBindTexture(GL_TEXTURE_2D, 0);
+        // 8x8 cells of 8 texels
+        vector<GLubyte> checker(64 * 64 * 3);
+        for(int y = 0; y != 64; ++y) {
+            for(int x = 0; x != 64; ++x) {
+                GLubyte const value = ((x / 8 + y / 8) % 2) ? 230 : 60;
+                checker[(y * 64 + x) * 3] = value;
+                checker[(y * 64 + x) * 3 + 1] = value;
+                checker[(y * 64 + x) * 3 + 2] = value;
+            }
+        }
+        glGenTextures(1, &checker_texture_id);
+        gl_cache().bind_texture(GL_TEXTURE_2D, checker_texture_id);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 64, 64, 0, GL_RGB, GL_UNSIGNED_BYTE, checker.data());
+        set_texture_filtration();
+
+        gl_cache().bind_texture(GL_TEXTURE_2D, 0);
     }
 
     void set_texture_filtration() {
@@ -321,65 +947,405 @@ private:
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     }
 
-    void set_data_buffer() {
-        draw_data& data = cur_draw_data();
-        glDeleteBuffers(1, &vx_buffer);
-        glGenBuffers(1, &vx_buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, vx_buffer);
-        glBufferData(GL_ARRAY_BUFFER, data.vertices_data_size(),
-                     data.vertices_data(), GL_STATIC_DRAW);
-
-        glDeleteBuffers(1, &tex_buffer);
-        glGenBuffers(1, &tex_buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, tex_buffer);
-        glBufferData(GL_ARRAY_BUFFER, data.tex_mapping_data_size(),
-                     data.tex_mapping_data(), GL_STATIC_DRAW);
+    void init_mesh_arena() {
+        arena.reset(new mesh_arena(ARENA_VERTEX_CAPACITY, ARENA_INDEX_CAPACITY));
+        draw_data* const figures[4] = { &quad, &cylinder, &sphere, &back_quad };
+        for(int obj = QUAD; obj <= BACK_QUAD; ++obj) {
+            draw_data const& data = *figures[obj];
+            // the background quad is drawn with GL_QUADS
+            arena_meshes[obj] = arena->add(data.vertices, data.tex_mapping, data.normals, obj != BACK_QUAD);
+            mesh_bounds[obj] = vertices_bounds(data.vertices);
+        }
+        if(instances && multi_draw_batch::supported()) {
+            batch.reset(new multi_draw_batch());
+        }
+    }
 
-        glDeleteBuffers(1, &norms_buffer);
-        glGenBuffers(1, &norms_buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, norms_buffer);
-        glBufferData(GL_ARRAY_BUFFER, data.normals_data_size(),
-                     data.normals_data(), GL_STATIC_DRAW);
+    // the draws only change with the instance count, the first figure or
+    // when the arena moves meshes
+    void update_batch() {
+        if(batch->size() == size_t(instance_count) && batch_first_obj == cur_obj
+           && batch_layout == arena->layout_version()) {
+            return;
+        }
+        vector<size_t> meshes(instance_count);
+        for(int i = 0; i != instance_count; ++i) {
+            meshes[i] = arena_meshes[(cur_obj + i) % 3];
+        }
+        batch->set_draws(*arena, meshes, instances->data());
+        batch_first_obj = cur_obj;
+        batch_layout = arena->layout_version();
     }
 
     void render_scene(float window_width, float window_height) {
-        glUseProgram(scene_program);
+        bool const multi_draw = mixed_meshes && batch;
+        bool const instanced = instances && (instance_count > 1 || multi_draw);
+        if(instanced) {
+            instances->resize(instance_count);
+        }
+        shader_defines const defines = scene_defines(instanced, current_lighting(), wireframe_overlay());
+        char const* const gs = scene_geometry_shader(defines);
+        GLuint program = programs.ready_program(SCENE_VERTEX_SHADER_PATH, gs, SCENE_FRAGMENT_SHADER_PATH, defines);
+        if(!program) {
+            // unlit stand-in while the scene program is being compiled,
+            // only the wireframe ones are not built up front
+            program = programs.program(SCENE_VERTEX_SHADER_PATH, gs, FALLBACK_FRAGMENT_SHADER_PATH, defines);
+        }
+
+        mat4 const proj = scene_proj(window_width, window_height);
+        mat4 const model = scene_model();
+        mat4 const view = scene_view();
+
+        // occlusion culling has its own queries on the samples passed, and
+        // already keeps the hidden objects from being shaded
+        bool const counted = !(queued_draws && instances && occlusion_culling && occlusion);
+        bool const with_prepass = counted && prepass->begin_frame(prepass_mode());
+        depth_prepass_active = with_prepass;
+        overdraw = counted ? prepass->overdraw() : 0;
+        shaded_per_pixel = counted ? prepass->shaded_per_pixel() : 0;
+
+        if(queued_draws && instances) {
+            instances->resize(instance_count);
+            render_queued(proj, view, model, with_prepass);
+            return;
+        }
+
+        // the GPU cull pass uses its own program and attributes
+        bool const culled_on_gpu = instanced && !multi_draw && frustum_culling && cull_on_gpu && gpu_culler;
+        GLsizei instances_to_draw = 1;
+        if(multi_draw) {
+            update_batch();
+            drawn_instances = instance_count;
+            culled_instances = 0;
+        } else if(instanced) {
+            instances_to_draw = prepare_instances(proj * view, model, culled_on_gpu);
+        }
+
+        size_t const mesh = arena_meshes[cur_obj];
+        auto draw_geometry = [&](GLuint program) {
+            gl_cache().use_program(program);
+            set_scene_uniforms(program, proj, view, model);
+            arena->bind(program, IN_POS, VERTEX_UV, IN_NORM);
+            if(multi_draw) {
+                batch->draw(program);
+            } else if(culled_on_gpu) {
+                gpu_culler->draw(program);
+            } else if(instanced) {
+                instances->bind(program);
+                arena->draw_instanced(mesh, GL_TRIANGLES, instances_to_draw);
+                instances->unbind(program);
+            } else {
+                arena->draw(mesh, GL_TRIANGLES);
+            }
+            arena->unbind(program, IN_POS, VERTEX_UV, IN_NORM);
+        };
+        if(with_prepass) {
+            prepass->begin_depth();
+            draw_geometry(depth_program(instanced));
+            prepass->end_depth();
+        }
+        prepass->begin_shading();
+        draw_geometry(program);
+        prepass->end_shading();
+    }
+
+    static mat4 scene_proj(float window_width, float window_height) {
+        return perspective(45.0f, window_width / window_height, SCENE_NEAR_PLANE, SCENE_FAR_PLANE);
+    }
+
+    static mat4 scene_view() {
+        return lookAt(vec3(0, 0, 6), vec3(0, 0, 0), vec3(0, 1, 0));
+    }
+
+    vec3 scene_light_position() const {
+        return vec3(mat4_cast(light_src_rotation) * vec4(13, 13, 8, 1));
+    }
+
+    // the point lights wander over the objects drawn, the instance grid or
+    // the one object
+    aabb point_lights_area() {
+        aabb area = mesh_bounds[cur_obj];
+        if(instances && instance_count > 1) {
+            instances->resize(instance_count);
+            vector<instance_data> const& placed = instances->data();
+            vec3 lo(placed[0].model[3]);
+            vec3 hi = lo;
+            for(size_t i = 1; i != placed.size(); ++i) {
+                lo = min(lo, vec3(placed[i].model[3]));
+                hi = max(hi, vec3(placed[i].model[3]));
+            }
+            area.min += lo;
+            area.max += hi;
+        }
+        // lights hang a little off the surfaces
+        area.min -= vec3(1);
+        area.max += vec3(1);
+        return area;
+    }
+
+    void update_point_lights() {
+        point_lights.set(size_t(std::max(0, light_count)), point_lights_area());
+        point_lights.update(chrono::duration<float>(chrono::system_clock::now() - launch_time).count());
+    }
+
+    void shade_point_lights(float window_width, float window_height) {
+        update_point_lights();
+        deferred_renderer::scene_light light;
+        light.position_worldspace = scene_light_position();
+        light.color = light_color;
+        light.power = light_power;
+        light.ambient = vec3(ambient);
+        light.specular = vec3(specular);
+        deferred->shade(scene_proj(window_width, window_height), scene_view(), light, point_lights);
+        lighting_ms = deferred->lighting_ms();
+    }
+
+    float time_offscreen_frames(float window_width, float window_height) {
+        size_t const WARMUP_FRAMES = 5;
+        size_t const TIMED_FRAMES = 50;
+        for(size_t i = 0; i != WARMUP_FRAMES; ++i) {
+            render_offscreen(window_width, window_height);
+        }
+        glFinish();
+        chrono::high_resolution_clock::time_point const start = chrono::high_resolution_clock::now();
+        for(size_t i = 0; i != TIMED_FRAMES; ++i) {
+            render_offscreen(window_width, window_height);
+        }
+        glFinish();
+        return chrono::duration<float, std::milli>(chrono::high_resolution_clock::now() - start).count() / TIMED_FRAMES;
+    }
+
+    // the scene graph only recomputes the matrix once the control turns
+    mat4 const& scene_model() {
+        quat const& q = rotation_by_control;
+        quat const& applied = applied_rotation;
+        if(q.x != applied.x || q.y != applied.y || q.z != applied.z || q.w != applied.w) {
+            scene_graph.set_local(model_node, mat4_cast(q));
+            applied_rotation = q;
+        }
+        scene_graph.update();
+        return scene_graph.world(model_node);
+    }
+
+    // everything but the per-object transforms
+    void set_scene_uniforms(GLuint program, mat4 const& proj, mat4 const& view, mat4 const& model) {
+        glUniform1i(glGetUniformLocation(program, "texture_sampler"), 0);
 
-        mat4 const proj = perspective(45.0f, window_width / window_height, 0.1f, 100.0f);
-        mat4 const model = mat4_cast(rotation_by_control);
-        mat4 const view = lookAt(vec3(0, 0, 6), vec3(0, 0, 0), vec3(0, 1, 0));
         mat4 const modelview = view * model;
         mat4 const mvp = proj * modelview;
 
-        GLuint location = glGetUniformLocation(scene_program, "mvp");
+        GLuint location = glGetUniformLocation(program, "mvp");
         glUniformMatrix4fv(location, 1, GL_FALSE, &mvp[0][0]);
-        location = glGetUniformLocation(scene_program, "model");
+        location = glGetUniformLocation(program, "model");
         glUniformMatrix4fv(location, 1, GL_FALSE, &model[0][0]);
-        location = glGetUniformLocation(scene_program, "view");
+        location = glGetUniformLocation(program, "view");
         glUniformMatrix4fv(location, 1, GL_FALSE, &view[0][0]);
+        location = glGetUniformLocation(program, "proj");
+        glUniformMatrix4fv(location, 1, GL_FALSE, &proj[0][0]);
 
-        vec3 const lightPos = vec3(mat4_cast(light_src_rotation) * vec4(13, 13, 8, 1));
-        glUniform3f(glGetUniformLocation(scene_program, "lightpos_worldspace"),
+        vec3 const lightPos = scene_light_position();
+        glUniform3f(glGetUniformLocation(program, "lightpos_worldspace"),
                     lightPos[0], lightPos[1], lightPos[2]);
-        glUniform1f(glGetUniformLocation(scene_program, "tex_coords_scale"),
+        glUniform1f(glGetUniformLocation(program, "tex_coords_scale"),
                     tex_coords_scale);
-        glUniform3f(glGetUniformLocation(scene_program, "light_color"),
+        glUniform3f(glGetUniformLocation(program, "light_color"),
                     light_color[0], light_color[1], light_color[2]);
-        glUniform1f(glGetUniformLocation(scene_program, "light_power"), light_power);
-        glUniform3f(glGetUniformLocation(scene_program, "ambient"), ambient, ambient, ambient);
-        glUniform3f(glGetUniformLocation(scene_program, "specular"), specular, specular, specular);
+        glUniform1f(glGetUniformLocation(program, "light_power"), light_power);
+        glUniform3f(glGetUniformLocation(program, "ambient"), ambient, ambient, ambient);
+        glUniform3f(glGetUniformLocation(program, "specular"), specular, specular, specular);
+        if(current_lighting() == CLUSTERED_LIGHTING) {
+            // units after the scene texture; offscreen buffers have the default viewport
+            clusters->bind(program, 1, vec2(DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT));
+        }
+    }
 
-        glBindBuffer(GL_ARRAY_BUFFER, vx_buffer);
-        utils::set_vertex_attr_ptr(scene_program, IN_POS);
-        glBindBuffer(GL_ARRAY_BUFFER, tex_buffer);
-        utils::set_vertex_attr_ptr(scene_program, VERTEX_UV);
-        glBindBuffer(GL_ARRAY_BUFFER, norms_buffer);
-        utils::set_vertex_attr_ptr(scene_program, IN_NORM);
+    // Instances cycle through the figures like the multi-draw mode and pick
+    // one of four materials (lit or unlit, wall or checker texture), so the
+    // recording order changes state on almost every draw. Transforms,
+    // culling and sort keys are recorded on the worker threads, this thread
+    // only replays the sorted commands.
+    void render_queued(mat4 const& proj, mat4 const& view, mat4 const& model, bool with_prepass) {
+        if(size_t(record_threads) != recorder->workers_count()) {
+            recorder->set_workers(record_threads);
+        }
+        record_params params;
+        params.proj = proj;
+        params.view = view;
+        params.model = model;
+        params.far_plane = SCENE_FAR_PLANE;
+        params.cull = frustum_culling;
+        for(size_t i = 0; i != 3; ++i) {
+            params.meshes[i] = unsigned(arena_meshes[i]);
+            params.bounds[i] = mesh_bounds[i];
+        }
+        params.first_figure = unsigned(cur_obj);
+
+        chrono::high_resolution_clock::time_point const start = chrono::high_resolution_clock::now();
+        recorder->record(instances->data(), params);
+        chrono::high_resolution_clock::time_point const recorded = chrono::high_resolution_clock::now();
+        record_ms = chrono::duration<float, std::milli>(recorded - start).count();
+        state_changes_unsorted = int(recorder->unsorted_state_changes());
+        state_changes_sorted = int(render_queue::state_changes(recorder->queue().items()));
+
+        shader_defines const defines = scene_defines(false, current_lighting(), wireframe_overlay());
+        char const* const gs = scene_geometry_shader(defines);
+        GLuint program = programs.ready_program(SCENE_VERTEX_SHADER_PATH, gs, SCENE_FRAGMENT_SHADER_PATH, defines);
+        GLuint const unlit = programs.program(SCENE_VERTEX_SHADER_PATH, gs, FALLBACK_FRAGMENT_SHADER_PATH, defines);
+        GLuint const queue_programs[2] = { program ? program : unlit, unlit };
+        GLuint const queue_textures[2] = { texture_id, checker_texture_id };
+        int cur_program = -1;
+        int cur_texture = -1;
+        GLint mvp_location = -1;
+        GLint model_location = -1;
+        vector<render_item> const& items = recorder->queue().items();
+        auto draw_item = [&](render_item const& item) {
+            int const p = int(render_queue::key_program(item.key));
+            int const t = int(render_queue::key_texture(item.key));
+            if(p != cur_program) {
+                if(cur_program >= 0) {
+                    arena->unbind(queue_programs[cur_program], IN_POS, VERTEX_UV, IN_NORM);
+                }
+                gl_cache().use_program(queue_programs[p]);
+                set_scene_uniforms(queue_programs[p], proj, view, model);
+                arena->bind(queue_programs[p], IN_POS, VERTEX_UV, IN_NORM);
+                mvp_location = glGetUniformLocation(queue_programs[p], "mvp");
+                model_location = glGetUniformLocation(queue_programs[p], "model");
+                cur_program = p;
+            }
+            if(t != cur_texture) {
+                gl_cache().bind_texture(GL_TEXTURE_2D, queue_textures[t]);
+                cur_texture = t;
+            }
+            draw_command const& command = recorder->command(item.payload);
+            glUniformMatrix4fv(mvp_location, 1, GL_FALSE, &command.mvp[0][0]);
+            glUniformMatrix4fv(model_location, 1, GL_FALSE, &command.model[0][0]);
+            arena->draw(render_queue::key_mesh(item.key), GL_TRIANGLES);
+        };
+        auto unbind_program = [&]() {
+            if(cur_program >= 0) {
+                arena->unbind(queue_programs[cur_program], IN_POS, VERTEX_UV, IN_NORM);
+                cur_program = -1;
+            }
+        };
 
-        glDrawArrays(GL_TRIANGLES, 0, cur_draw_data().vertices_num());
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
-        glDisableVertexAttribArray(2);
+        if(!occlusion_culling || !occlusion) {
+            if(with_prepass) {
+                prepass->begin_depth();
+                render_queued_depth(items, proj, view, model);
+                prepass->end_depth();
+            }
+            prepass->begin_shading();
+            for(size_t i = 0; i != items.size(); ++i) {
+                draw_item(items[i]);
+            }
+            unbind_program();
+            prepass->end_shading();
+        } else {
+            render_occlusion_culled(items, draw_item, unbind_program);
+        }
+        submit_ms = chrono::duration<float, std::milli>(chrono::high_resolution_clock::now() - recorded).count();
+        drawn_instances = int(items.size());
+        culled_instances = int(recorder->culled_count());
+    }
+
+    // the queued draws with the depth prepass program, in queue order
+    void render_queued_depth(vector<render_item> const& items, mat4 const& proj, mat4 const& view, mat4 const& model) {
+        GLuint const program = depth_program(false);
+        gl_cache().use_program(program);
+        set_scene_uniforms(program, proj, view, model);
+        arena->bind(program, IN_POS, VERTEX_UV, IN_NORM);
+        GLint const mvp_location = glGetUniformLocation(program, "mvp");
+        GLint const model_location = glGetUniformLocation(program, "model");
+        for(size_t i = 0; i != items.size(); ++i) {
+            draw_command const& command = recorder->command(items[i].payload);
+            glUniformMatrix4fv(mvp_location, 1, GL_FALSE, &command.mvp[0][0]);
+            glUniformMatrix4fv(model_location, 1, GL_FALSE, &command.model[0][0]);
+            arena->draw(render_queue::key_mesh(items[i].key), GL_TRIANGLES);
+        }
+        arena->unbind(program, IN_POS, VERTEX_UV, IN_NORM);
+    }
+
+    // The objects visible last frame are drawn first, in queue order, and
+    // make the depth the boxes of the rest are queried against; those are
+    // drawn last, each under conditional render on its box.
+    template<typename draw_func, typename unbind_func>
+    void render_occlusion_culled(vector<render_item> const& items, draw_func& draw_item, unbind_func& unbind_program) {
+        occlusion->begin_frame(instances->size());
+        vector<size_t> hidden;
+        for(size_t i = 0; i != items.size(); ++i) {
+            uint32_t const object = recorder->command(items[i].payload).object;
+            if(!occlusion->was_visible(object)) {
+                hidden.push_back(i);
+            } else if(occlusion->wants_query(object)) {
+                occlusion->begin_query(object);
+                draw_item(items[i]);
+                occlusion->end_query();
+            } else {
+                draw_item(items[i]);
+            }
+        }
+        unbind_program();
+
+        if(!hidden.empty()) {
+            vector<bool> queried(hidden.size());
+            // a wireframe box would let samples through its faces
+            gl_cache().polygon_mode(GL_FILL);
+            occlusion->begin_boxes();
+            for(size_t i = 0; i != hidden.size(); ++i) {
+                render_item const& item = items[hidden[i]];
+                draw_command const& command = recorder->command(item.payload);
+                unsigned const figure = (unsigned(cur_obj) + command.object) % 3;
+                queried[i] = occlusion->query_box(command.object, command.mvp, mesh_bounds[figure]);
+            }
+            occlusion->end_boxes();
+            gl_cache().polygon_mode(scene_polygon_mode());
+
+            for(size_t i = 0; i != hidden.size(); ++i) {
+                render_item const& item = items[hidden[i]];
+                if(!queried[i]) {
+                    draw_item(item);
+                    continue;
+                }
+                occlusion->begin_conditional(recorder->command(item.payload).object);
+                draw_item(item);
+                occlusion->end_conditional();
+            }
+            unbind_program();
+        }
+        occlusion->end_frame(items.size());
+
+        occlusion_queries = int(occlusion->queries_issued());
+        occlusion_skipped = int(occlusion->skipped_objects());
+        occlusion_gpu_ms = occlusion->gpu_ms();
+        occlusion_saved_ms = occlusion->time_saved_ms();
+    }
+
+    // same view_proj and model as the instanced draw, returns how many to draw
+    GLsizei prepare_instances(mat4 const& view_proj, mat4 const& model, bool on_gpu) {
+        aabb const& bounds = mesh_bounds[cur_obj];
+        if(!frustum_culling) {
+            instances->upload_all();
+            return instance_count;
+        }
+        chrono::high_resolution_clock::time_point const start = chrono::high_resolution_clock::now();
+        GLsizei visible_count = 0;
+        if(on_gpu) {
+            // the cull pass reads every instance
+            instances->upload_all();
+            vec4 const sphere((bounds.min + bounds.max) * 0.5f, length(bounds.max - bounds.min) * 0.5f);
+            gpu_culler->cull(*instances, view_proj, model, sphere, arena->range(arena_meshes[cur_obj]));
+            // the count of an earlier pass, the CPU does not wait for this one
+            visible_count = gpu_culler->survivors();
+        } else {
+            culled_objects.update(bounds, instances->data(), model);
+            vector<uint32_t> const& visible = culled_objects.cull(view_proj);
+            instances->upload_subset(visible);
+            visible_count = GLsizei(visible.size());
+        }
+        cull_ms = chrono::duration<float, std::milli>(chrono::high_resolution_clock::now() - start).count();
+        drawn_instances = int(visible_count);
+        culled_instances = instance_count - drawn_instances;
+        return visible_count;
     }
 
     float cur_window_width() { return glutGet(GLUT_WINDOW_WIDTH); }
@@ -399,14 +1365,14 @@ private:
 
     void init_framebuffer_texture(GLuint& fbo_texture_id) {
         glGenTextures(1, &fbo_texture_id); // Generate one texture
-        glBindTexture(GL_TEXTURE_2D, fbo_texture_id); // Bind the texture fbo_texture
+        gl_cache().bind_texture(GL_TEXTURE_2D, fbo_texture_id); // Bind the texture fbo_texture
 
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, cur_window_width(),
                      cur_window_height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
         set_texture_filtration();
 
         // Unbind the texture
-        glBindTexture(GL_TEXTURE_2D, 0);
+        gl_cache().bind_texture(GL_TEXTURE_2D, 0);
     }
 
     void init_framebuffer(GLuint& fbo_depth_id, GLuint &fbo_texture_id, GLuint& fbo_id) {
@@ -432,16 +1398,27 @@ private:
     void bind_offscreen_buffer(GLuint& fbo_id) {
         glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo_id); // Bind our frame buffer for rendering
         glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT); // Push our glEnable and glViewport states
-        glViewport(0, 0, DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT); // Set the size of the frame buffer view port
+        gl_cache().viewport(0, 0, DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT); // Set the size of the frame buffer view port
     }
 
     void unbind_offscreen_buffer() {
         glPopAttrib(); // Restore our glEnable and glViewport states
+        gl_cache().invalidate();
         glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0); // Unbind our texture
     }
 
     void render_with_filter(float window_width, float window_height) {
-        glUseProgram(filtered_program);
+        filter_params params;
+        params.gaussian_kernel_radius = gaussian_kernel_radius;
+        params.gaussian_variance = gaussian_variance;
+        params.sobel_threshold = sobel_threshold;
+        GLuint program = programs.ready_program(FILTERED_VERTEX_SHADER_PATH, FILTERED_FRAGMENT_SHADER_PATH,
+                                               filter_defines(cur_filter, params));
+        if(!program) {
+            program = programs.ready_program(FILTERED_VERTEX_SHADER_PATH, FILTERED_FRAGMENT_SHADER_PATH,
+                                             filter_defines(NO_FILTER, params));
+        }
+        gl_cache().use_program(program);
 
         mat4 const proj = perspective(45.0f, window_width / window_height, 0.1f, 100.0f);
         mat4 const model;
@@ -449,40 +1426,28 @@ private:
         mat4 const modelview = view * model;
         mat4 const mvp = proj * modelview;
 
-        GLuint location = glGetUniformLocation(filtered_program, "mvp");
+        GLuint location = glGetUniformLocation(program, "mvp");
         glUniformMatrix4fv(location, 1, GL_FALSE, &mvp[0][0]);
+        // offscreen buffers are always rendered with the default viewport
+        glUniform2f(glGetUniformLocation(program, "texel_size"),
+                    1.0f / DEFAULT_WINDOW_WIDTH, 1.0f / DEFAULT_WINDOW_HEIGHT);
 
+        // filter type and kernel radius are compiled into the permutation
         switch (cur_filter) {
-        case BOX_BLUR:
-            glUniform1i(glGetUniformLocation(filtered_program, "filter_type"), BOX_BLUR);
-            break;
         case GAUSSIAN_HORIZONTAL_BLUR:
-            glUniform1i(glGetUniformLocation(filtered_program, "filter_type"), GAUSSIAN_HORIZONTAL_BLUR);
-            glUniform1i(glGetUniformLocation(filtered_program, "gaus_radius"), gaussian_kernel_radius);
-            glUniform1f(glGetUniformLocation(filtered_program, "gaus_variance"), gaussian_variance);
-            break;
         case GAUSSIAN_VERTICAL_BLUR:
-            glUniform1i(glGetUniformLocation(filtered_program, "filter_type"), GAUSSIAN_VERTICAL_BLUR);
-            glUniform1i(glGetUniformLocation(filtered_program, "gaus_radius"), gaussian_kernel_radius);
-            glUniform1f(glGetUniformLocation(filtered_program, "gaus_variance"), gaussian_variance);
+            glUniform1f(glGetUniformLocation(program, "gaus_variance"), gaussian_variance);
             break;
         case SOBEL_FILTER:
-            glUniform1i(glGetUniformLocation(filtered_program, "filter_type"), SOBEL_FILTER);
-            glUniform1f(glGetUniformLocation(filtered_program, "sobel_threshold"), sobel_threshold);
+            glUniform1f(glGetUniformLocation(program, "sobel_threshold"), sobel_threshold);
             break;
         default:
-            glUniform1i(glGetUniformLocation(filtered_program, "filter_type"), 0);
             break;
         }
 
-        glBindBuffer(GL_ARRAY_BUFFER, vx_buffer);
-        utils::set_vertex_attr_ptr(scene_program, IN_POS);
-        glBindBuffer(GL_ARRAY_BUFFER, tex_buffer);
-        utils::set_vertex_attr_ptr(scene_program, VERTEX_UV);
-
-        glDrawArrays(GL_QUADS, 0, cur_draw_data().vertices_num());
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
+        arena->bind(program, IN_POS, VERTEX_UV, IN_NORM);
+        arena->draw(arena_meshes[BACK_QUAD], GL_QUADS);
+        arena->unbind(program, IN_POS, VERTEX_UV, IN_NORM);
     }
 
     void init_background_quad() {
@@ -542,7 +1507,13 @@ void basic_init(int argc, char ** argv) {
 // == callbacks ==
 // отрисовка кадра
 void display_func() {
-    prog_state.on_display_event();
+    // GLUT has no way to pass an exception on
+    try {
+        prog_state.on_display_event();
+    } catch(std::exception const & except) {
+        cout << except.what() << endl;
+        exit(1);
+    }
 }
 
 // Переисовка кадра в отсутствии других сообщений
@@ -562,7 +1533,7 @@ void keyboard_func(unsigned char button, int x, int y) {
 void reshape_func(int width, int height) {
    if (width <= 0 || height <= 0)
       return;
-   glViewport(0, 0, width, height);
+   gl_cache().viewport(0, 0, width, height);
    prog_state.on_resize_event();
    TwWindowSize(width, height);
 }
@@ -627,7 +1598,7 @@ void create_controls(program_state& prog_state) {
     TwInit(TW_OPENGL, NULL);
 
     TwBar *bar = TwNewBar("Parameters");
-    TwDefine("Parameters size='400 470' color='70 100 120' valueswidth=220 iconpos=topleft");
+    TwDefine("Parameters size='400 700' color='70 100 120' valueswidth=220 iconpos=topleft");
     TwAddButton(bar, "Fullscreen toggle", toggle_fullscreen_callback, NULL,
                 "label='Toggle fullscreen mode' key=f");
     TwAddVarRW(bar, "ObjRotation", TW_TYPE_QUAT4F, &prog_state.rotation_by_control,
@@ -655,6 +1626,49 @@ void create_controls(program_state& prog_state) {
                "min=0 max=1 step=0.1");
     TwAddVarRW(bar, "Specular", TW_TYPE_FLOAT, &prog_state.specular,
                "min=0 max=1 step=0.1");
+    TwAddVarRW(bar, "Instances", TW_TYPE_INT32, &prog_state.instance_count,
+               "min=1 max=200000 step=1000 help='Copies of the object drawn with one instanced draw.'");
+    TwAddVarRO(bar, "Frame time, ms", TW_TYPE_FLOAT, &prog_state.frame_ms, "");
+    TwAddVarRW(bar, "Mixed meshes (MDI)", TW_TYPE_BOOLCPP, &prog_state.mixed_meshes, "");
+    TwAddVarRW(bar, "Queued draws", TW_TYPE_BOOLCPP, &prog_state.queued_draws, "");
+    TwAddVarRO(bar, "State changes unsorted", TW_TYPE_INT32, &prog_state.state_changes_unsorted, "");
+    TwAddVarRO(bar, "State changes sorted", TW_TYPE_INT32, &prog_state.state_changes_sorted, "");
+    TwAddVarRW(bar, "Record threads", TW_TYPE_INT32, &prog_state.record_threads, "min=1 max=64");
+    TwAddVarRO(bar, "Record time, ms", TW_TYPE_FLOAT, &prog_state.record_ms, "");
+    TwAddVarRO(bar, "Submit time, ms", TW_TYPE_FLOAT, &prog_state.submit_ms, "");
+    TwAddVarRW(bar, "Frustum culling", TW_TYPE_BOOLCPP, &prog_state.frustum_culling, "");
+    TwAddVarRW(bar, "Cull on GPU", TW_TYPE_BOOLCPP, &prog_state.cull_on_gpu, "");
+    TwAddVarRO(bar, "Drawn instances", TW_TYPE_INT32, &prog_state.drawn_instances, "");
+    TwAddVarRO(bar, "Culled instances", TW_TYPE_INT32, &prog_state.culled_instances, "");
+    TwAddVarRO(bar, "Cull time, ms", TW_TYPE_FLOAT, &prog_state.cull_ms, "");
+    TwAddVarRO(bar, "State calls", TW_TYPE_INT32, &prog_state.state_calls, "");
+    TwAddVarRO(bar, "State calls elided", TW_TYPE_INT32, &prog_state.state_calls_elided, "");
+    TwAddVarRW(bar, "Occlusion culling", TW_TYPE_BOOLCPP, &prog_state.occlusion_culling,
+               " help='Queued draws only.' ");
+    TwAddVarRO(bar, "Occlusion queries", TW_TYPE_INT32, &prog_state.occlusion_queries, "");
+    TwAddVarRO(bar, "Occluded draws skipped", TW_TYPE_INT32, &prog_state.occlusion_skipped, "");
+    TwAddVarRO(bar, "Scene GPU time, ms", TW_TYPE_FLOAT, &prog_state.occlusion_gpu_ms, "");
+    TwAddVarRO(bar, "Occlusion saved, ms", TW_TYPE_FLOAT, &prog_state.occlusion_saved_ms, "");
+    TwAddVarRW(bar, "Auto depth prepass", TW_TYPE_BOOLCPP, &prog_state.depth_prepass_auto,
+               " help='Depth-only pass first while the overdraw is high enough to pay for it.' ");
+    TwAddVarRW(bar, "Depth prepass", TW_TYPE_BOOLCPP, &prog_state.depth_prepass_on,
+               " help='Always draw the depth-only pass, unless auto is on.' ");
+    TwAddVarRO(bar, "Depth prepass drawn", TW_TYPE_BOOLCPP, &prog_state.depth_prepass_active, "");
+    TwAddVarRO(bar, "Overdraw", TW_TYPE_FLOAT, &prog_state.overdraw, "");
+    TwAddVarRO(bar, "Shaded per pixel", TW_TYPE_FLOAT, &prog_state.shaded_per_pixel, "");
+    TwAddVarRW(bar, "Deferred shading", TW_TYPE_BOOLCPP, &prog_state.deferred_shading, "");
+    TwAddVarRW(bar, "Point lights", TW_TYPE_INT32, &prog_state.light_count,
+               "min=0 max=16384 step=64 help='Lights of the deferred shading.'");
+    TwAddVarRO(bar, "Lighting GPU time, ms", TW_TYPE_FLOAT, &prog_state.lighting_ms, "");
+    TwAddVarRW(bar, "Clustered shading", TW_TYPE_BOOLCPP, &prog_state.clustered_shading,
+               " help='Forward shading of the point lights binned into view frustum clusters.' ");
+    TwAddVarRO(bar, "Light binning, ms", TW_TYPE_FLOAT, &prog_state.cluster_bin_ms, "");
+    TwAddVarRO(bar, "Max lights in a cluster", TW_TYPE_INT32, &prog_state.cluster_max_lights, "");
+    TwAddVarRW(bar, "Software rasterizer", TW_TYPE_BOOLCPP, &prog_state.software_backend,
+               " help='The scene drawn forward lit on the CPU instead of with GL.' ");
+    TwAddVarRW(bar, "Software threads", TW_TYPE_INT32, &prog_state.software_threads, "min=1 max=64");
+    TwAddVarRO(bar, "Software frame, ms", TW_TYPE_FLOAT, &prog_state.software_ms, "");
+    TwAddVarRO(bar, "Software triangles", TW_TYPE_INT32, &prog_state.software_triangles, "");
 
     TwAddButton(bar, "No filter", apply_no_filter_callback, &prog_state,
                 "label='No filter' key=o");
@@ -663,7 +1677,7 @@ void create_controls(program_state& prog_state) {
     TwAddButton(bar, "Gaussian blur", apply_gaussian_filter_callback, &prog_state,
                 "label='Gaussian blur' key=g");
     TwAddVarRW(bar, "Gaussian kernel radius", TW_TYPE_UINT8, &prog_state.gaussian_kernel_radius,
-               "min=1 max=10 step=1");
+               ("min=1 max=" + std::to_string(MAX_GAUSSIAN_KERNEL_RADIUS) + " step=1").c_str());
     TwAddVarRW(bar, "Gaussian variance", TW_TYPE_FLOAT, &prog_state.gaussian_variance,
                "min=0.1 max=5 step=0.1");
     TwAddButton(bar, "Sobel filter", apply_sobel_filter_callback, &prog_state,
@@ -677,7 +1691,160 @@ void remove_controls() {
     TwTerminate();
 }
 
+software_options parse_software_options(int argc, char** argv) {
+    if(argc < 1) {
+        throw msg_exception("usage: main --software <output.ppm> [--figure quad|cylinder|sphere] [--objects n] "
+                            "[--wireframe 0|1] [--texture nearest|linear|mipmap] [--filters filter,filter,...] "
+                            "[--threads n] [--radius n] [--variance v] [--sobel-threshold t] [--threshold t] "
+                            "[--exposure e] [--gamma g]");
+    }
+    software_options options;
+    options.output_path = argv[0];
+    size_t fuse_taps = 0;
+    for(int i = 1; i < argc; i += 2) {
+        string const key = argv[i];
+        if(i + 1 >= argc) {
+            throw msg_exception("missing value for " + key);
+        }
+        string const value = argv[i + 1];
+        if(parse_filter_option(key, value.c_str(), options.params, fuse_taps)) {
+            continue;
+        } else if(key == "--figure") {
+            if(value == "quad") {
+                options.figure = QUAD;
+            } else if(value == "cylinder") {
+                options.figure = CYLINDER;
+            } else if(value == "sphere") {
+                options.figure = SPHERE;
+            } else {
+                throw msg_exception("unknown figure: '" + value + "'");
+            }
+        } else if(key == "--objects") {
+            options.objects = std::max(1, std::atoi(value.c_str()));
+        } else if(key == "--wireframe") {
+            options.wireframe = std::atoi(value.c_str()) != 0;
+        } else if(key == "--texture") {
+            if(value == "nearest") {
+                options.tex_filtering = NEAREST;
+            } else if(value == "linear") {
+                options.tex_filtering = LINEAR;
+            } else if(value == "mipmap") {
+                options.tex_filtering = MIPMAP;
+            } else {
+                throw msg_exception("unknown texture filtering: '" + value + "'");
+            }
+        } else if(key == "--filters") {
+            options.chain = parse_filter_chain(value);
+        } else if(key == "--threads") {
+            options.threads = std::max(1, std::atoi(value.c_str()));
+        } else {
+            throw msg_exception("unknown option: " + key);
+        }
+    }
+    return options;
+}
+
+// --batch and --tiled image processing, no scene and no controls
+int run_headless_mode(int argc, char ** argv) {
+    string const mode = argv[1];
+    try {
+        batch_options batch;
+        tiled_options tiled;
+        if(mode == "--batch") {
+            batch = parse_batch_options(argc - 2, argv + 2);
+        } else {
+            tiled = parse_tiled_options(argc - 2, argv + 2);
+        }
+        basic_init(argc, argv);
+        glutHideWindow();
+        program_cache programs;
+        programs.use_binaries(PROGRAM_BINARY_DIR);
+        if(mode == "--batch") {
+            run_batch_filter(batch, programs);
+        } else {
+            run_tiled_filter(tiled, programs);
+        }
+    } catch(std::exception const & except) {
+        cout << except.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
 int main( int argc, char ** argv ) {
+#ifndef _WIN32
+    // the shader compile worker talks to the X server from its own thread
+    XInitThreads();
+#endif
+    prog_state.launch_time = chrono::system_clock::now();
+    if(argc > 1 && (string(argv[1]) == "--batch" || string(argv[1]) == "--tiled")) {
+        return run_headless_mode(argc, argv);
+    }
+    // the scene on the CPU, for machines without a GPU
+    if(argc > 1 && string(argv[1]) == "--software") {
+        try {
+            software_options const options = parse_software_options(argc - 2, argv + 2);
+            prog_state.write_software_image(options);
+        } catch(std::exception const & except) {
+            cout << except.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    // the software rasterizer and filters against GL, fails past the tolerance
+    if(argc > 1 && string(argv[1]) == "--software-compare") {
+        try {
+            basic_init(argc, argv);
+            glutHideWindow();
+            prog_state.init();
+            return prog_state.report_software_difference() ? 0 : 1;
+        } catch(std::exception const & except) {
+            cout << except.what() << endl;
+            return 1;
+        }
+    }
+    // CPU cost of recording a large scene by the number of threads, no window
+    if(argc > 1 && string(argv[1]) == "--record-scaling") {
+        size_t const objects = argc > 2 ? std::max(1, std::atoi(argv[2])) : 100000;
+        report_record_scaling(objects, worker_pool::hardware_workers());
+        return 0;
+    }
+    // scene graph update time for [nodes] with [percent] of them changed a frame
+    if(argc > 1 && string(argv[1]) == "--hierarchy-update") {
+        size_t const nodes = argc > 2 ? std::max(1, std::atoi(argv[2])) : 100000;
+        float const percent = argc > 3 ? float(std::atof(argv[3])) : 3;
+        report_hierarchy_update(nodes, percent / 100);
+        return 0;
+    }
+    // ACMR and ATVR of the listed obj files before and after mesh optimization
+    if(argc > 1 && string(argv[1]) == "--mesh-stats") {
+        vector<string> paths(argv + 2, argv + argc);
+        if(paths.empty()) {
+            paths.push_back("..//resources//sphere.obj");
+            paths.push_back("..//resources//cylinder.obj");
+            paths.push_back("..//..//hw1//input//model.obj");
+        }
+        report_mesh_optimization(paths);
+        return 0;
+    }
+    // frame time by the number of deferred and clustered point lights over [objects]
+    if(argc > 1 && string(argv[1]) == "--light-scaling") {
+        int const objects = argc > 2 ? std::max(1, std::atoi(argv[2])) : 400;
+        try {
+            basic_init(argc, argv);
+            glutHideWindow();
+            prog_state.init();
+            prog_state.report_light_scaling(objects);
+        } catch(std::exception const & except) {
+            cout << except.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    // compiles every program from source, to compare the time to first frame
+    if(argc > 1 && string(argv[1]) == "--no-program-cache") {
+        prog_state.program_binaries = false;
+    }
     try {
         basic_init(argc, argv);
         utils::debug("libs are initialized");
@@ -0,0 +1,346 @@
+#include "mesh_arena.h"
+#include "gl_state_cache.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+
+// scattered free space past this share triggers compaction
+static float const COMPACTION_THRESHOLD = 0.5f;
+
+range_allocator::range_allocator(size_t capacity)
+    : capacity(capacity)
+    , free_total(0)
+{
+    reset(0);
+}
+
+size_t range_allocator::allocate(size_t count) {
+    for(std::map<size_t, size_t>::iterator it = free_blocks.begin(); it != free_blocks.end(); ++it) {
+        if(it->second < count) {
+            continue;
+        }
+        size_t const offset = it->first;
+        size_t const rest = it->second - count;
+        free_blocks.erase(it);
+        if(rest != 0) {
+            free_blocks[offset + count] = rest;
+        }
+        free_total -= count;
+        return offset;
+    }
+    return NO_SPACE;
+}
+
+void range_allocator::free(size_t offset, size_t count) {
+    if(count == 0) {
+        return;
+    }
+    free_total += count;
+    std::map<size_t, size_t>::iterator next = free_blocks.lower_bound(offset);
+    if(next != free_blocks.end() && offset + count == next->first) {
+        count += next->second;
+        next = free_blocks.erase(next);
+    }
+    if(next != free_blocks.begin()) {
+        std::map<size_t, size_t>::iterator prev = next;
+        --prev;
+        if(prev->first + prev->second == offset) {
+            prev->second += count;
+            return;
+        }
+    }
+    free_blocks[offset] = count;
+}
+
+void range_allocator::reset(size_t used) {
+    free_blocks.clear();
+    free_total = capacity - used;
+    if(free_total != 0) {
+        free_blocks[used] = free_total;
+    }
+}
+
+size_t range_allocator::largest_free_block() const {
+    size_t largest = 0;
+    for(std::map<size_t, size_t>::const_iterator it = free_blocks.begin(); it != free_blocks.end(); ++it) {
+        largest = std::max(largest, it->second);
+    }
+    return largest;
+}
+
+mesh_arena::mesh_arena(size_t vertex_capacity, size_t index_capacity)
+    : vertex_buffer(0)
+    , index_buffer(0)
+    , vertices(vertex_capacity)
+    , indices(index_capacity)
+    , vertex_space(vertex_capacity)
+    , index_space(index_capacity)
+    , version(0)
+    , base_vertex(supported())
+{
+    glGenBuffers(1, &vertex_buffer);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, vertex_capacity * sizeof(mesh_vertex), NULL, GL_STATIC_DRAW);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+    glGenBuffers(1, &index_buffer);
+    gl_cache().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_capacity * sizeof(uint32_t), NULL, GL_STATIC_DRAW);
+    gl_cache().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+mesh_arena::~mesh_arena() {
+    glDeleteBuffers(1, &index_buffer);
+    glDeleteBuffers(1, &vertex_buffer);
+}
+
+bool mesh_arena::supported() {
+    return GLEW_VERSION_3_2 || GLEW_ARB_draw_elements_base_vertex;
+}
+
+size_t mesh_arena::add(vector<GLfloat> const& positions, vector<GLfloat> const& tex_mapping,
+                       vector<GLfloat> const& normals, bool triangles)
+{
+    vector<mesh_vertex> mesh_vertices;
+    vector<uint32_t> mesh_indices;
+    weld_mesh(positions, tex_mapping, normals, mesh_vertices, mesh_indices);
+    if(triangles) {
+        optimize_mesh(mesh_vertices, mesh_indices);
+    }
+
+    mesh_slot slot;
+    if(!place(mesh_vertices, mesh_indices, slot)) {
+        compact();
+        if(!place(mesh_vertices, mesh_indices, slot)) {
+            throw std::runtime_error("mesh_arena::add(): out of space");
+        }
+    }
+    if(free_ids.empty()) {
+        meshes.push_back(slot);
+        return meshes.size() - 1;
+    }
+    size_t const id = free_ids.back();
+    free_ids.pop_back();
+    meshes[id] = slot;
+    return id;
+}
+
+bool mesh_arena::place(vector<mesh_vertex> const& mesh_vertices, vector<uint32_t> const& mesh_indices,
+                       mesh_slot& slot)
+{
+    size_t const first_vertex = vertex_space.allocate(mesh_vertices.size());
+    if(first_vertex == range_allocator::NO_SPACE) {
+        return false;
+    }
+    size_t const first_index = index_space.allocate(mesh_indices.size());
+    if(first_index == range_allocator::NO_SPACE) {
+        vertex_space.free(first_vertex, mesh_vertices.size());
+        return false;
+    }
+    std::copy(mesh_vertices.begin(), mesh_vertices.end(), vertices.begin() + first_vertex);
+    std::copy(mesh_indices.begin(), mesh_indices.end(), indices.begin() + first_index);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, first_vertex * sizeof(mesh_vertex), mesh_vertices.size() * sizeof(mesh_vertex),
+                    mesh_vertices.data());
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+
+    slot.range.first_index = GLuint(first_index);
+    slot.range.index_count = GLuint(mesh_indices.size());
+    slot.range.base_vertex = GLint(first_vertex);
+    slot.vertex_count = mesh_vertices.size();
+    slot.live = true;
+    upload_indices(slot.range);
+    return true;
+}
+
+// indices stays relative to the mesh, what goes to the buffer is rebased
+// when draws cannot pass the base vertex
+void mesh_arena::upload_indices(mesh_range const& range) {
+    uint32_t const* data = indices.data() + range.first_index;
+    vector<uint32_t> rebased;
+    if(!base_vertex) {
+        rebased.assign(data, data + range.index_count);
+        for(size_t i = 0; i != rebased.size(); ++i) {
+            rebased[i] += uint32_t(range.base_vertex);
+        }
+        data = rebased.data();
+    }
+    gl_cache().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, range.first_index * sizeof(uint32_t), range.index_count * sizeof(uint32_t),
+                    data);
+    gl_cache().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void mesh_arena::remove(size_t mesh) {
+    mesh_slot& slot = meshes[mesh];
+    vertex_space.free(slot.range.base_vertex, slot.vertex_count);
+    index_space.free(slot.range.first_index, slot.range.index_count);
+    slot.live = false;
+    free_ids.push_back(mesh);
+    if(fragmentation() > COMPACTION_THRESHOLD) {
+        compact();
+    }
+}
+
+float mesh_arena::fragmentation() const {
+    float worst = 0;
+    range_allocator const* const spaces[2] = { &vertex_space, &index_space };
+    for(int i = 0; i != 2; ++i) {
+        if(spaces[i]->free_units() != 0) {
+            worst = std::max(worst, 1 - float(spaces[i]->largest_free_block()) / spaces[i]->free_units());
+        }
+    }
+    return worst;
+}
+
+// slides every live mesh down to the start of its storage, in place:
+// visiting them by offset never overwrites data that is still to move
+void mesh_arena::compact() {
+    vector<size_t> by_vertex;
+    for(size_t i = 0; i != meshes.size(); ++i) {
+        if(meshes[i].live) {
+            by_vertex.push_back(i);
+        }
+    }
+    vector<size_t> by_index = by_vertex;
+    std::sort(by_vertex.begin(), by_vertex.end(), [this](size_t a, size_t b) {
+        return meshes[a].range.base_vertex < meshes[b].range.base_vertex;
+    });
+    std::sort(by_index.begin(), by_index.end(), [this](size_t a, size_t b) {
+        return meshes[a].range.first_index < meshes[b].range.first_index;
+    });
+
+    size_t vertex_end = 0;
+    for(size_t i = 0; i != by_vertex.size(); ++i) {
+        mesh_slot& slot = meshes[by_vertex[i]];
+        std::copy(vertices.begin() + slot.range.base_vertex,
+                  vertices.begin() + slot.range.base_vertex + slot.vertex_count, vertices.begin() + vertex_end);
+        slot.range.base_vertex = GLint(vertex_end);
+        vertex_end += slot.vertex_count;
+    }
+    size_t index_end = 0;
+    for(size_t i = 0; i != by_index.size(); ++i) {
+        mesh_slot& slot = meshes[by_index[i]];
+        std::copy(indices.begin() + slot.range.first_index,
+                  indices.begin() + slot.range.first_index + slot.range.index_count, indices.begin() + index_end);
+        slot.range.first_index = GLuint(index_end);
+        index_end += slot.range.index_count;
+    }
+    vertex_space.reset(vertex_end);
+    index_space.reset(index_end);
+
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, vertex_end * sizeof(mesh_vertex), vertices.data());
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+    if(base_vertex) {
+        gl_cache().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, index_end * sizeof(uint32_t), indices.data());
+        gl_cache().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    } else {
+        for(size_t i = 0; i != by_index.size(); ++i) {
+            upload_indices(meshes[by_index[i]].range);
+        }
+    }
+    ++version;
+}
+
+static void set_interleaved_attr(GLuint program, vertex_attr attr, size_t stride, size_t offset) {
+    attr.stride = GLsizei(stride);
+    attr.pointer = (GLvoid*)offset;
+    utils::set_vertex_attr_ptr(program, attr);
+}
+
+static void disable_attr(GLuint program, vertex_attr const& attr) {
+    GLint const location = glGetAttribLocation(program, attr.name);
+    if(location >= 0) {
+        gl_cache().disable_vertex_attrib_array(location);
+    }
+}
+
+void mesh_arena::bind(GLuint program, vertex_attr const& pos, vertex_attr const& uv, vertex_attr const& normal) {
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, vertex_buffer);
+    set_interleaved_attr(program, pos, sizeof(mesh_vertex), offsetof(mesh_vertex, pos));
+    set_interleaved_attr(program, uv, sizeof(mesh_vertex), offsetof(mesh_vertex, uv));
+    set_interleaved_attr(program, normal, sizeof(mesh_vertex), offsetof(mesh_vertex, normal));
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+    gl_cache().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+}
+
+void mesh_arena::unbind(GLuint program, vertex_attr const& pos, vertex_attr const& uv, vertex_attr const& normal) {
+    disable_attr(program, pos);
+    disable_attr(program, uv);
+    disable_attr(program, normal);
+    gl_cache().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void mesh_arena::draw(size_t mesh, GLenum mode) const {
+    mesh_range const& r = meshes[mesh].range;
+    GLvoid* const offset = (GLvoid*)(r.first_index * sizeof(uint32_t));
+    if(!base_vertex) {
+        glDrawElements(mode, GLsizei(r.index_count), GL_UNSIGNED_INT, offset);
+        return;
+    }
+    glDrawElementsBaseVertex(mode, GLsizei(r.index_count), GL_UNSIGNED_INT, offset, r.base_vertex);
+}
+
+void mesh_arena::draw_instanced(size_t mesh, GLenum mode, GLsizei instances) const {
+    mesh_range const& r = meshes[mesh].range;
+    GLvoid* const offset = (GLvoid*)(r.first_index * sizeof(uint32_t));
+    if(!base_vertex) {
+        glDrawElementsInstanced(mode, GLsizei(r.index_count), GL_UNSIGNED_INT, offset, instances);
+        return;
+    }
+    glDrawElementsInstancedBaseVertex(mode, GLsizei(r.index_count), GL_UNSIGNED_INT, offset, instances, r.base_vertex);
+}
+
+multi_draw_batch::multi_draw_batch()
+    : command_buffer(0)
+    , per_draw_buffer(0)
+    , commands_count(0)
+{
+    glGenBuffers(1, &command_buffer);
+    glGenBuffers(1, &per_draw_buffer);
+}
+
+multi_draw_batch::~multi_draw_batch() {
+    glDeleteBuffers(1, &per_draw_buffer);
+    glDeleteBuffers(1, &command_buffer);
+}
+
+bool multi_draw_batch::supported() {
+    return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+}
+
+void multi_draw_batch::set_draws(mesh_arena const& arena, vector<size_t> const& meshes,
+                                 vector<instance_data> const& per_draw)
+{
+    commands.resize(meshes.size());
+    for(size_t i = 0; i != meshes.size(); ++i) {
+        mesh_range const& range = arena.range(meshes[i]);
+        commands[i].count = range.index_count;
+        commands[i].instance_count = 1;
+        commands[i].first_index = range.first_index;
+        commands[i].base_vertex = range.base_vertex;
+        commands[i].base_instance = GLuint(i);
+    }
+    commands_count = commands.size();
+
+    gl_cache().bind_buffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(draw_elements_command),
+                 commands.data(), GL_DYNAMIC_DRAW);
+    gl_cache().bind_buffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, per_draw_buffer);
+    glBufferData(GL_ARRAY_BUFFER, per_draw.size() * sizeof(instance_data), per_draw.data(), GL_DYNAMIC_DRAW);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+void multi_draw_batch::draw(GLuint program) {
+    if(commands_count == 0) {
+        return;
+    }
+    bind_instance_attributes(program, per_draw_buffer, 1);
+    gl_cache().bind_buffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, GLsizei(commands_count), 0);
+    gl_cache().bind_buffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    unbind_instance_attributes(program);
+}
@@ -0,0 +1,146 @@
+#ifndef MESH_ARENA_H
+#define MESH_ARENA_H
+
+#include "common.h"
+#include "instance_buffer.h"
+#include "mesh_optimizer.h"
+#include "utils.h"
+
+#include <cstdint>
+#include <map>
+
+// First-fit free list over [0, capacity) units. Freed blocks merge with
+// their free neighbours.
+class range_allocator {
+public:
+    static size_t const NO_SPACE = size_t(-1);
+
+    explicit range_allocator(size_t capacity);
+
+    // offset of count free units, NO_SPACE if no block is large enough
+    size_t allocate(size_t count);
+    void free(size_t offset, size_t count);
+    // after compaction: [0, used) is taken, the rest is one free block
+    void reset(size_t used);
+
+    size_t free_units() const { return free_total; }
+    size_t largest_free_block() const;
+
+private:
+    size_t capacity;
+    size_t free_total;
+    // offset -> size
+    std::map<size_t, size_t> free_blocks;
+};
+
+// where a mesh lives inside the arena; base_vertex is where its vertices
+// start, already added to the indices in the buffer without base-vertex
+// draws
+struct mesh_range {
+    GLuint first_index;
+    GLuint index_count;
+    GLint base_vertex;
+};
+
+// All meshes of the app in one interleaved vertex buffer and one index
+// buffer, both allocated once. Meshes get sub-ranges from free lists, so
+// adding and removing them costs glBufferSubData calls and no GL
+// allocations. Indices are relative to the mesh and draws pass its base
+// vertex, which lets compaction move a mesh without rewriting indices.
+// Compaction runs when free space gets too scattered, and also before
+// an add that finds no large enough block; it bumps layout_version(), so
+// anything that copied ranges knows to fetch them again. Without
+// base-vertex draws the indices are rebased on upload and drawn with plain
+// glDrawElements; compaction then rewrites the indices of meshes it moves.
+//
+// Meshes come in as the unindexed vertex lists read_obj_file() produces;
+// equal vertices are welded on the way in and the triangles and vertices
+// reordered for the post-transform cache, overdraw and vertex fetch.
+class mesh_arena {
+public:
+    mesh_arena(size_t vertex_capacity, size_t index_capacity);
+    ~mesh_arena();
+
+    // base-vertex draws, the arena rebases indices without them
+    static bool supported();
+
+    // returns the mesh id; normals may be empty. Triangle lists are
+    // reordered by optimize_mesh(), other primitives are stored as given
+    size_t add(vector<GLfloat> const& vertices, vector<GLfloat> const& tex_mapping,
+               vector<GLfloat> const& normals, bool triangles = true);
+    // the id may be handed out again by add()
+    void remove(size_t mesh);
+    mesh_range const& range(size_t mesh) const { return meshes[mesh].range; }
+
+    size_t layout_version() const { return version; }
+    // share of the free space outside of the largest free block, the worse
+    // of the vertex and the index storage
+    float fragmentation() const;
+
+    // attribute names come from pos, uv and normal, the layout from the arena
+    void bind(GLuint program, vertex_attr const& pos, vertex_attr const& uv, vertex_attr const& normal);
+    void unbind(GLuint program, vertex_attr const& pos, vertex_attr const& uv, vertex_attr const& normal);
+    // the arena has to be bound
+    void draw(size_t mesh, GLenum mode) const;
+    void draw_instanced(size_t mesh, GLenum mode, GLsizei instances) const;
+
+private:
+    struct mesh_slot {
+        mesh_range range;
+        size_t vertex_count;
+        bool live;
+    };
+
+    GLuint vertex_buffer;
+    GLuint index_buffer;
+    // what the buffers hold, compaction moves meshes here and re-uploads
+    vector<mesh_vertex> vertices;
+    vector<uint32_t> indices;
+    range_allocator vertex_space;
+    range_allocator index_space;
+    vector<mesh_slot> meshes;
+    vector<size_t> free_ids;
+    size_t version;
+    bool base_vertex;
+
+    void upload_indices(mesh_range const& range);
+    bool place(vector<mesh_vertex> const& mesh_vertices, vector<uint32_t> const& mesh_indices, mesh_slot& slot);
+    void compact();
+};
+
+// Any number of arena meshes drawn with one glMultiDrawElementsIndirect.
+// Each command draws one instance whose base instance is its draw id, so
+// the instance attributes fetch the transform and tint of that draw.
+class multi_draw_batch {
+public:
+    multi_draw_batch();
+    ~multi_draw_batch();
+
+    // GL 4.3, or multi-draw-indirect with base instances
+    static bool supported();
+
+    // draw i is meshes[i] placed by per_draw[i]
+    void set_draws(mesh_arena const& arena, vector<size_t> const& meshes,
+                   vector<instance_data> const& per_draw);
+    size_t size() const { return commands_count; }
+
+    // the arena has to be bound
+    void draw(GLuint program);
+
+private:
+    // layout fixed by GL_DRAW_INDIRECT_BUFFER
+    struct draw_elements_command {
+        GLuint count;
+        GLuint instance_count;
+        GLuint first_index;
+        GLint base_vertex;
+        GLuint base_instance;
+    };
+
+    GLuint command_buffer;
+    GLuint per_draw_buffer;
+    size_t commands_count;
+    vector<draw_elements_command> commands;
+};
+
+#endif // MESH_ARENA_H
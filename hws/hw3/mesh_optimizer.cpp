@@ -0,0 +1,341 @@
+#include "mesh_optimizer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+// cache Forsyth's scores model, LRU
+static size_t const SCORED_CACHE_SIZE = 32;
+static float const CACHE_DECAY_POWER = 1.5f;
+static float const LAST_TRIANGLE_SCORE = 0.75f;
+static float const VALENCE_BOOST_SCALE = 2.0f;
+static float const VALENCE_BOOST_POWER = 0.5f;
+// FIFO cache the overdraw pass and the report simulate
+static size_t const SIMULATED_CACHE_SIZE = 16;
+// how much worse than the whole mesh's ACMR a cluster may get
+static float const OVERDRAW_THRESHOLD = 1.05f;
+static uint32_t const NO_TRIANGLE = uint32_t(-1);
+
+void weld_mesh(vector<GLfloat> const& positions, vector<GLfloat> const& tex_mapping,
+               vector<GLfloat> const& normals, vector<mesh_vertex>& vertices, vector<uint32_t>& indices)
+{
+    // bitwise equality, the same obj index always gives the same floats
+    struct vertex_less {
+        bool operator()(mesh_vertex const& a, mesh_vertex const& b) const {
+            return std::memcmp(&a, &b, sizeof(mesh_vertex)) < 0;
+        }
+    };
+    std::map<mesh_vertex, uint32_t, vertex_less> welded;
+
+    vertices.clear();
+    indices.clear();
+    for(size_t i = 0; i != positions.size() / 3; ++i) {
+        // three tightly packed vectors, no padding for memcmp to trip on
+        mesh_vertex v;
+        v.pos = vec3(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+        v.uv = vec2(tex_mapping[2 * i], tex_mapping[2 * i + 1]);
+        v.normal = normals.empty() ? vec3(0, 0, 1)
+                                   : vec3(normals[3 * i], normals[3 * i + 1], normals[3 * i + 2]);
+        std::map<mesh_vertex, uint32_t, vertex_less>::const_iterator const it = welded.find(v);
+        if(it != welded.end()) {
+            indices.push_back(it->second);
+        } else {
+            uint32_t const index = uint32_t(vertices.size());
+            welded[v] = index;
+            vertices.push_back(v);
+            indices.push_back(index);
+        }
+    }
+}
+
+// vertex shader runs of indices[first, last) starting from an empty cache
+static size_t cache_misses(vector<uint32_t> const& indices, size_t first, size_t last,
+                           vector<size_t>& stamps, size_t& time)
+{
+    // a vertex is cached while fewer than cache size misses happened since its own
+    time += SIMULATED_CACHE_SIZE + 1;
+    size_t misses = 0;
+    for(size_t i = first; i != last; ++i) {
+        if(time - stamps[indices[i]] > SIMULATED_CACHE_SIZE) {
+            stamps[indices[i]] = time++;
+            ++misses;
+        }
+    }
+    return misses;
+}
+
+vertex_cache_stats analyze_vertex_cache(vector<uint32_t> const& indices, size_t vertex_count,
+                                        size_t cache_size)
+{
+    vector<size_t> stamps(vertex_count, 0);
+    vector<bool> used(vertex_count, false);
+    size_t time = cache_size + 1;
+    size_t misses = 0;
+    size_t unique = 0;
+    for(size_t i = 0; i != indices.size(); ++i) {
+        uint32_t const v = indices[i];
+        if(!used[v]) {
+            used[v] = true;
+            ++unique;
+        }
+        if(time - stamps[v] > cache_size) {
+            stamps[v] = time++;
+            ++misses;
+        }
+    }
+    vertex_cache_stats stats;
+    stats.acmr = indices.empty() ? 0 : float(misses) / (indices.size() / 3);
+    stats.atvr = unique == 0 ? 0 : float(misses) / unique;
+    return stats;
+}
+
+static float vertex_score(int cache_position, unsigned triangles_left) {
+    if(triangles_left == 0) {
+        return -1;
+    }
+    float score = 0;
+    if(cache_position >= 0) {
+        // the triangle just drawn gets a fixed score, so its neighbours
+        // are not preferred over the rest of the cache too strongly
+        score = cache_position < 3
+              ? LAST_TRIANGLE_SCORE
+              : std::pow(1 - float(cache_position - 3) / (SCORED_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+    }
+    return score + VALENCE_BOOST_SCALE * std::pow(float(triangles_left), -VALENCE_BOOST_POWER);
+}
+
+void optimize_vertex_cache(vector<uint32_t>& indices, size_t vertex_count) {
+    size_t const triangles_count = indices.size() / 3;
+
+    // triangles of each vertex, the ones not emitted yet first
+    vector<unsigned> triangles_left(vertex_count, 0);
+    for(size_t i = 0; i != indices.size(); ++i) {
+        ++triangles_left[indices[i]];
+    }
+    vector<size_t> first_triangle(vertex_count + 1, 0);
+    for(size_t v = 0; v != vertex_count; ++v) {
+        first_triangle[v + 1] = first_triangle[v] + triangles_left[v];
+    }
+    vector<uint32_t> vertex_triangles(indices.size());
+    vector<size_t> filled(first_triangle.begin(), first_triangle.end() - 1);
+    for(size_t i = 0; i != indices.size(); ++i) {
+        vertex_triangles[filled[indices[i]]++] = uint32_t(i / 3);
+    }
+
+    vector<int> cache_position(vertex_count, -1);
+    vector<float> scores(vertex_count);
+    for(size_t v = 0; v != vertex_count; ++v) {
+        scores[v] = vertex_score(-1, triangles_left[v]);
+    }
+    vector<float> triangle_scores(triangles_count);
+    for(size_t t = 0; t != triangles_count; ++t) {
+        triangle_scores[t] = scores[indices[3 * t]] + scores[indices[3 * t + 1]] + scores[indices[3 * t + 2]];
+    }
+    vector<bool> emitted(triangles_count, false);
+
+    vector<uint32_t> cache;
+    vector<uint32_t> next_cache;
+    vector<uint32_t> result;
+    result.reserve(indices.size());
+    uint32_t best = NO_TRIANGLE;
+    for(size_t drawn = 0; drawn != triangles_count; ++drawn) {
+        if(best == NO_TRIANGLE) {
+            // nothing left around the cache, restart from the best triangle anywhere
+            float best_score = -1;
+            for(size_t t = 0; t != triangles_count; ++t) {
+                if(!emitted[t] && triangle_scores[t] > best_score) {
+                    best_score = triangle_scores[t];
+                    best = uint32_t(t);
+                }
+            }
+        }
+        emitted[best] = true;
+        next_cache.clear();
+        for(int corner = 0; corner != 3; ++corner) {
+            uint32_t const v = indices[3 * best + corner];
+            result.push_back(v);
+            next_cache.push_back(v);
+            // drop the triangle from the not emitted part of the vertex's list
+            size_t const first = first_triangle[v];
+            size_t const last = first + triangles_left[v] - 1;
+            for(size_t i = first; i <= last; ++i) {
+                if(vertex_triangles[i] == best) {
+                    std::swap(vertex_triangles[i], vertex_triangles[last]);
+                    break;
+                }
+            }
+            --triangles_left[v];
+        }
+        for(size_t i = 0; i != cache.size(); ++i) {
+            uint32_t const v = cache[i];
+            if(v != next_cache[0] && v != next_cache[1] && v != next_cache[2]) {
+                next_cache.push_back(v);
+            }
+        }
+
+        // vertices pushed out keep a score without the cache part
+        for(size_t i = 0; i != next_cache.size(); ++i) {
+            uint32_t const v = next_cache[i];
+            cache_position[v] = i < SCORED_CACHE_SIZE ? int(i) : -1;
+            scores[v] = vertex_score(cache_position[v], triangles_left[v]);
+        }
+        best = NO_TRIANGLE;
+        float best_score = -1;
+        for(size_t i = 0; i != next_cache.size(); ++i) {
+            uint32_t const v = next_cache[i];
+            for(size_t j = first_triangle[v]; j != first_triangle[v] + triangles_left[v]; ++j) {
+                uint32_t const t = vertex_triangles[j];
+                triangle_scores[t] = scores[indices[3 * t]] + scores[indices[3 * t + 1]] + scores[indices[3 * t + 2]];
+                if(triangle_scores[t] > best_score) {
+                    best_score = triangle_scores[t];
+                    best = t;
+                }
+            }
+        }
+        if(next_cache.size() > SCORED_CACHE_SIZE) {
+            next_cache.resize(SCORED_CACHE_SIZE);
+        }
+        cache.swap(next_cache);
+    }
+    indices.swap(result);
+}
+
+void optimize_overdraw(vector<uint32_t>& indices, vector<mesh_vertex> const& vertices, float threshold) {
+    size_t const triangles_count = indices.size() / 3;
+    if(triangles_count == 0) {
+        return;
+    }
+    vector<size_t> stamps(vertices.size(), 0);
+    size_t time = 0;
+    float const mesh_acmr = float(cache_misses(indices, 0, indices.size(), stamps, time)) / triangles_count;
+
+    // every cluster is the shortest run that, drawn from an empty cache,
+    // is within threshold of the mesh, so the clusters can go in any order
+    vector<size_t> clusters(1, 0);
+    time += SIMULATED_CACHE_SIZE + 1;
+    size_t misses = 0;
+    for(size_t t = 0; t != triangles_count; ++t) {
+        for(size_t i = 3 * t; i != 3 * t + 3; ++i) {
+            if(time - stamps[indices[i]] > SIMULATED_CACHE_SIZE) {
+                stamps[indices[i]] = time++;
+                ++misses;
+            }
+        }
+        if(t + 1 != triangles_count && float(misses) / (t + 1 - clusters.back()) <= threshold * mesh_acmr) {
+            clusters.push_back(t + 1);
+            time += SIMULATED_CACHE_SIZE + 1;
+            misses = 0;
+        }
+    }
+    clusters.push_back(triangles_count);
+
+    // area weighted centre of the mesh and centre and normal of every cluster
+    vector<vec3> centres(clusters.size() - 1);
+    vector<vec3> normals(clusters.size() - 1);
+    vec3 mesh_centre(0);
+    float mesh_area = 0;
+    for(size_t c = 0; c + 1 != clusters.size(); ++c) {
+        vec3 centre(0);
+        vec3 normal(0);
+        float area = 0;
+        for(size_t t = clusters[c]; t != clusters[c + 1]; ++t) {
+            vec3 const& a = vertices[indices[3 * t]].pos;
+            vec3 const& b = vertices[indices[3 * t + 1]].pos;
+            vec3 const& d = vertices[indices[3 * t + 2]].pos;
+            vec3 const n = cross(b - a, d - a);
+            float const triangle_area = length(n);
+            centre += (a + b + d) * (triangle_area / 3);
+            normal += n;
+            area += triangle_area;
+        }
+        mesh_centre += centre;
+        mesh_area += area;
+        centres[c] = area > 0 ? centre / area : centre;
+        normals[c] = normal;
+    }
+    if(mesh_area > 0) {
+        mesh_centre /= mesh_area;
+    }
+
+    // clusters far out along their own normal occlude the rest, draw them first
+    vector<float> keys(centres.size());
+    vector<size_t> order(centres.size());
+    for(size_t c = 0; c != centres.size(); ++c) {
+        float const normal_length = length(normals[c]);
+        keys[c] = normal_length > 0 ? dot(centres[c] - mesh_centre, normals[c] / normal_length) : 0;
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&keys](size_t a, size_t b) {
+        return keys[a] > keys[b];
+    });
+
+    vector<uint32_t> result;
+    result.reserve(indices.size());
+    for(size_t i = 0; i != order.size(); ++i) {
+        size_t const c = order[i];
+        result.insert(result.end(), indices.begin() + 3 * clusters[c], indices.begin() + 3 * clusters[c + 1]);
+    }
+    indices.swap(result);
+}
+
+void optimize_vertex_fetch(vector<mesh_vertex>& vertices, vector<uint32_t>& indices) {
+    uint32_t const UNUSED = uint32_t(-1);
+    vector<uint32_t> remap(vertices.size(), UNUSED);
+    vector<mesh_vertex> result;
+    result.reserve(vertices.size());
+    for(size_t i = 0; i != indices.size(); ++i) {
+        uint32_t& index = indices[i];
+        if(remap[index] == UNUSED) {
+            remap[index] = uint32_t(result.size());
+            result.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(result);
+}
+
+void optimize_mesh(vector<mesh_vertex>& vertices, vector<uint32_t>& indices) {
+    if(indices.size() % 3 != 0) {
+        throw std::invalid_argument("optimize_mesh(): indices are not a triangle list");
+    }
+    optimize_vertex_cache(indices, vertices.size());
+    optimize_overdraw(indices, vertices, OVERDRAW_THRESHOLD);
+    optimize_vertex_fetch(vertices, indices);
+}
+
+static void print_stats(char const* pass, vector<uint32_t> const& indices, size_t vertex_count) {
+    vertex_cache_stats const stats = analyze_vertex_cache(indices, vertex_count, SIMULATED_CACHE_SIZE);
+    char line[128];
+    std::snprintf(line, sizeof(line), "  %-14s ACMR %.3f  ATVR %.3f", pass, stats.acmr, stats.atvr);
+    cout << line << endl;
+}
+
+void report_mesh_optimization(vector<string> const& paths) {
+    cout << "post-transform cache of " << SIMULATED_CACHE_SIZE << " vertices, FIFO:" << endl;
+    for(size_t i = 0; i != paths.size(); ++i) {
+        vector<GLfloat> positions;
+        vector<GLfloat> tex_mapping;
+        vector<GLfloat> normals;
+        utils::read_obj_file(paths[i].c_str(), positions, tex_mapping, normals);
+        vector<mesh_vertex> vertices;
+        vector<uint32_t> indices;
+        weld_mesh(positions, tex_mapping, normals, vertices, indices);
+        cout << paths[i] << ": " << indices.size() / 3 << " triangles, " << vertices.size() << " vertices"
+             << endl;
+
+        print_stats("as loaded", indices, vertices.size());
+        chrono::high_resolution_clock::time_point const start = chrono::high_resolution_clock::now();
+        optimize_vertex_cache(indices, vertices.size());
+        print_stats("vertex cache", indices, vertices.size());
+        optimize_overdraw(indices, vertices, OVERDRAW_THRESHOLD);
+        print_stats("overdraw", indices, vertices.size());
+        optimize_vertex_fetch(vertices, indices);
+        float const ms = chrono::duration<float, std::milli>(chrono::high_resolution_clock::now() - start).count();
+        print_stats("vertex fetch", indices, vertices.size());
+        cout << "  optimized in " << ms << " ms" << endl;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include "common.h"
+
+#include <cstdint>
+
+struct mesh_vertex {
+    vec3 pos;
+    vec2 uv;
+    vec3 normal;
+};
+
+// Merges equal vertices of the unindexed lists read_obj_file() produces into
+// an indexed mesh, in the order the file lists them. normals may be empty.
+void weld_mesh(vector<GLfloat> const& positions, vector<GLfloat> const& tex_mapping,
+               vector<GLfloat> const& normals, vector<mesh_vertex>& vertices, vector<uint32_t>& indices);
+
+// How well an index order reuses a FIFO post-transform cache of cache_size
+// vertices: ACMR is vertex shader runs per triangle (0.5 is the ideal for
+// a large regular mesh, 3 no reuse at all), ATVR runs per unique vertex
+// (1 is the ideal).
+struct vertex_cache_stats {
+    float acmr;
+    float atvr;
+};
+
+vertex_cache_stats analyze_vertex_cache(vector<uint32_t> const& indices, size_t vertex_count,
+                                        size_t cache_size);
+
+// Forsyth's linear-speed reorder: greedily emits the triangle whose
+// vertices score highest, favouring vertices recently used and ones with
+// few triangles left, so the mesh is walked in cache-sized patches.
+void optimize_vertex_cache(vector<uint32_t>& indices, size_t vertex_count);
+
+// Tipsify-style overdraw pass over a cache-optimized order: cuts it into
+// clusters whose ACMR on their own stays within threshold of the whole
+// mesh's and sorts the clusters so the ones facing out from the centre
+// come first and hide what is behind them.
+void optimize_overdraw(vector<uint32_t>& indices, vector<mesh_vertex> const& vertices, float threshold);
+
+// renumbers vertices in the order the indices first use them, so vertex
+// fetch walks the buffer forward
+void optimize_vertex_fetch(vector<mesh_vertex>& vertices, vector<uint32_t>& indices);
+
+// the three passes above, in that order; indices are a triangle list,
+// std::invalid_argument otherwise
+void optimize_mesh(vector<mesh_vertex>& vertices, vector<uint32_t>& indices);
+
+// prints ACMR and ATVR of each obj file as loaded and after every pass
+void report_mesh_optimization(vector<string> const& paths);
+
+#endif // MESH_OPTIMIZER_H
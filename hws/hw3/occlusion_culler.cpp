@@ -0,0 +1,180 @@
+#include "occlusion_culler.h"
+#include "gl_state_cache.h"
+#include "shader.h"
+
+static char const* const BOX_VERTEX_SHADER_PATH = "..//shaders//occlusion_box.vs";
+static char const* const BOX_FRAGMENT_SHADER_PATH = "..//shaders//occlusion_box.fs";
+static GLsizei const BOX_VERTICES = 36;
+
+// the unit cube as 12 triangles, corners in [0, 1]
+static void unit_cube(vector<GLfloat>& corners) {
+    static int const faces[6][4] = {
+        { 0, 1, 3, 2 }, { 4, 6, 7, 5 }, { 0, 4, 5, 1 }, { 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 5, 7, 3 }
+    };
+    static int const triangles[6] = { 0, 1, 2, 0, 2, 3 };
+    for(int face = 0; face != 6; ++face) {
+        for(int i = 0; i != 6; ++i) {
+            int const corner = faces[face][triangles[i]];
+            corners.push_back(GLfloat(corner & 1));
+            corners.push_back(GLfloat((corner >> 1) & 1));
+            corners.push_back(GLfloat((corner >> 2) & 1));
+        }
+    }
+}
+
+occlusion_culler::occlusion_culler()
+    : vs(create_shader(GL_VERTEX_SHADER, BOX_VERTEX_SHADER_PATH))
+    , fs(create_shader(GL_FRAGMENT_SHADER, BOX_FRAGMENT_SHADER_PATH))
+    , program(create_program(vs, fs))
+    , box_buffer(0)
+    , corner_location(glGetAttribLocation(program, "box_corner"))
+    , mvp_location(glGetUniformLocation(program, "mvp"))
+    , min_location(glGetUniformLocation(program, "box_min"))
+    , max_location(glGetUniformLocation(program, "box_max"))
+    , frame(0)
+    , frame_queries(0)
+    , frame_draws(0)
+    , last_draws(0)
+    , skipped(0)
+    , last_gpu_ms(0)
+    , saved_ms(0)
+{
+    vector<GLfloat> corners;
+    unit_cube(corners);
+    glGenBuffers(1, &box_buffer);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, box_buffer);
+    glBufferData(GL_ARRAY_BUFFER, corners.size() * sizeof(GLfloat), corners.data(), GL_STATIC_DRAW);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+    glGenQueries(2, timers);
+    timer_pending[0] = timer_pending[1] = false;
+}
+
+occlusion_culler::~occlusion_culler() {
+    if(!queries.empty()) {
+        glDeleteQueries(GLsizei(queries.size()), queries.data());
+    }
+    glDeleteQueries(2, timers);
+    glDeleteBuffers(1, &box_buffer);
+    glDeleteProgram(program);
+    glDeleteShader(fs);
+    glDeleteShader(vs);
+}
+
+bool occlusion_culler::supported() {
+    return GLEW_VERSION_3_3 != 0;
+}
+
+void occlusion_culler::begin_frame(size_t objects) {
+    ++frame;
+    if(queries.size() < objects) {
+        size_t const old_size = queries.size();
+        queries.resize(objects);
+        glGenQueries(GLsizei(objects - old_size), &queries[old_size]);
+        visible.resize(objects, 1);
+        box_queried.resize(objects, 0);
+    }
+
+    // a result still in flight is lost, the object is drawn and asked again
+    skipped = 0;
+    for(size_t i = 0; i != pending.size(); ++i) {
+        uint32_t const object = pending[i];
+        GLuint available = 0;
+        glGetQueryObjectuiv(queries[object], GL_QUERY_RESULT_AVAILABLE, &available);
+        GLuint samples = 1;
+        if(available) {
+            glGetQueryObjectuiv(queries[object], GL_QUERY_RESULT, &samples);
+        }
+        visible[object] = samples != 0;
+        if(box_queried[object] && samples == 0) {
+            ++skipped;
+        }
+    }
+    pending.clear();
+
+    size_t const previous = (frame + 1) % 2;
+    if(timer_pending[previous]) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(timers[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(timers[previous], GL_QUERY_RESULT, &ns);
+            last_gpu_ms = float(ns) / 1e6f;
+            timer_pending[previous] = false;
+        }
+    }
+    last_draws = frame_draws;
+    saved_ms = last_draws > skipped ? skipped * last_gpu_ms / (last_draws - skipped) : 0;
+
+    frame_queries = 0;
+    frame_draws = 0;
+    glBeginQuery(GL_TIME_ELAPSED, timers[frame % 2]);
+}
+
+void occlusion_culler::end_frame(size_t draws) {
+    glEndQuery(GL_TIME_ELAPSED);
+    timer_pending[frame % 2] = true;
+    frame_draws = draws;
+}
+
+bool occlusion_culler::wants_query(uint32_t object) const {
+    // spread over the interval, so the queries of a frame stay few
+    return (frame + object) % VISIBLE_QUERY_INTERVAL == 0;
+}
+
+void occlusion_culler::begin_query(uint32_t object) {
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[object]);
+    pending.push_back(object);
+    box_queried[object] = 0;
+    ++frame_queries;
+}
+
+void occlusion_culler::end_query() {
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+}
+
+void occlusion_culler::begin_boxes() {
+    gl_cache().use_program(program);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, box_buffer);
+    gl_cache().enable_vertex_attrib_array(corner_location);
+    glVertexAttribPointer(corner_location, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    gl_cache().bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+bool occlusion_culler::query_box(uint32_t object, mat4 const& mvp, aabb const& bounds) {
+    // a box clipped by the near plane would hide the object the camera is in
+    for(int corner = 0; corner != 8; ++corner) {
+        vec4 const p = mvp * vec4(corner & 1 ? bounds.max.x : bounds.min.x, corner & 2 ? bounds.max.y : bounds.min.y,
+                                  corner & 4 ? bounds.max.z : bounds.min.z, 1);
+        if(p.z < -p.w) {
+            visible[object] = 1;
+            return false;
+        }
+    }
+    glUniformMatrix4fv(mvp_location, 1, GL_FALSE, &mvp[0][0]);
+    glUniform3fv(min_location, 1, &bounds.min[0]);
+    glUniform3fv(max_location, 1, &bounds.max[0]);
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[object]);
+    glDrawArrays(GL_TRIANGLES, 0, BOX_VERTICES);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+    pending.push_back(object);
+    box_queried[object] = 1;
+    ++frame_queries;
+    return true;
+}
+
+void occlusion_culler::end_boxes() {
+    gl_cache().disable_vertex_attrib_array(corner_location);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void occlusion_culler::begin_conditional(uint32_t object) {
+    // the GPU waits for the box, the CPU does not
+    glBeginConditionalRender(queries[object], GL_QUERY_WAIT);
+}
+
+void occlusion_culler::end_conditional() {
+    glEndConditionalRender();
+}
@@ -0,0 +1,90 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include "common.h"
+#include "scene_bvh.h"
+
+#include <cstdint>
+
+// Occlusion culling of per-object draws with hardware queries, after
+// CHC++: the CPU only ever reads results of the previous frame, so it
+// never waits for the GPU.
+//
+// A frame draws the objects visible last frame as usual, those are the
+// occluders. Every VISIBLE_QUERY_INTERVAL frames each of them has its own
+// draw wrapped in a GL_ANY_SAMPLES_PASSED query to notice it getting
+// hidden. Then the objects hidden last frame get their bounding boxes
+// queried against that depth, and each is drawn under conditional render
+// on its box query, so the GPU drops it if the box showed nothing. The
+// query results decide who counts as visible in the next frame.
+class occlusion_culler {
+public:
+    occlusion_culler();
+    ~occlusion_culler();
+
+    // occlusion queries with any samples passed and timer queries (GL 3.3)
+    static bool supported();
+
+    // reads the results of the last frame that are ready and starts timing
+    // the GPU; objects are numbered [0, objects)
+    void begin_frame(size_t objects);
+    // draws counts every object submitted, conditional or not
+    void end_frame(size_t draws);
+
+    // objects not seen yet count as visible
+    bool was_visible(uint32_t object) const { return visible[object] != 0; }
+    // the object's own draw goes between these
+    bool wants_query(uint32_t object) const;
+    void begin_query(uint32_t object);
+    void end_query();
+
+    // box queries, with color and depth writes off and the box program in use
+    void begin_boxes();
+    // false if the box reaches the near plane, the object then has to be
+    // drawn unconditionally
+    bool query_box(uint32_t object, mat4 const& mvp, aabb const& bounds);
+    void end_boxes();
+
+    // the object's draw between these is dropped if its box was hidden
+    void begin_conditional(uint32_t object);
+    void end_conditional();
+
+    size_t queries_issued() const { return frame_queries; }
+    // objects of the last frame whose box was hidden, so their draw was dropped
+    size_t skipped_objects() const { return skipped; }
+    float gpu_ms() const { return last_gpu_ms; }
+    // skipped objects times the GPU time an object drawn in that frame took
+    float time_saved_ms() const { return saved_ms; }
+
+private:
+    static size_t const VISIBLE_QUERY_INTERVAL = 8;
+
+    GLuint vs;
+    GLuint fs;
+    GLuint program;
+    GLuint box_buffer;
+    GLint corner_location;
+    GLint mvp_location;
+    GLint min_location;
+    GLint max_location;
+
+    vector<GLuint> queries;
+    vector<uint8_t> visible;
+    // objects queried in the frame before, their results are read next
+    vector<uint32_t> pending;
+    // the query is a box query, not the draw itself
+    vector<uint8_t> box_queried;
+    // GPU time of consecutive frames, the one being drawn and the one before
+    GLuint timers[2];
+    bool timer_pending[2];
+    size_t frame;
+
+    size_t frame_queries;
+    size_t frame_draws;
+    size_t last_draws;
+    size_t skipped;
+    float last_gpu_ms;
+    float saved_ms;
+};
+
+#endif // OCCLUSION_CULLER_H
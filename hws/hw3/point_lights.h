@@ -0,0 +1,45 @@
+#ifndef POINT_LIGHTS_H
+#define POINT_LIGHTS_H
+
+#include "common.h"
+#include "scene_bvh.h"
+
+#include <cstdint>
+
+// a point light lights up to its radius, fading out before it
+struct point_light {
+    // world position and radius
+    vec4 sphere;
+    vec4 color;
+};
+
+// Point lights of random color and radius wandering around an area of
+// the scene, for the deferred and clustered lighting paths.
+class point_light_set {
+public:
+    point_light_set();
+
+    // count lights around area, the same lights for the same count and
+    // area; nothing changes if neither did
+    void set(size_t count, aabb const& area);
+    // moves the lights to where they are seconds after they were set
+    void update(float seconds);
+
+    size_t size() const { return lights.size(); }
+    bool empty() const { return lights.empty(); }
+    vector<point_light> const& data() const { return lights; }
+
+private:
+    // where a light wanders around, its orbit and phase
+    struct light_path {
+        vec3 center;
+        float orbit;
+        float speed;
+        float phase;
+    };
+    vector<point_light> lights;
+    vector<light_path> paths;
+    aabb area;
+};
+
+#endif // POINT_LIGHTS_H
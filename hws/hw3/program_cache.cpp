@@ -0,0 +1,699 @@
+#include "program_cache.h"
+#include "gl_state_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <GL/glx.h>
+#include "blocking_queue.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+static string defines_key(shader_defines const& defines) {
+    string key;
+    for(shader_defines::const_iterator it = defines.begin(); it != defines.end(); ++it) {
+        key += it->first + "=" + it->second + "\n";
+    }
+    return key;
+}
+
+// FNV-1a
+static uint64_t hash_string(string const& text) {
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i != text.size(); ++i) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static string gl_string(GLenum name) {
+    char const* value = (char const*)glGetString(name);
+    return value ? value : "";
+}
+
+// file layout: magic, key hash, binary format, binary length, binary
+static char const BINARY_MAGIC[4] = { 'G', 'L', 'P', 'B' };
+
+static GLuint load_program_binary(string const& path, uint64_t key) {
+    ifstream in(path.c_str(), std::ios::binary);
+    if(!in.good()) {
+        return 0;
+    }
+
+    char magic[4];
+    uint64_t stored_key = 0;
+    GLenum format = 0;
+    uint32_t length = 0;
+    in.read(magic, sizeof(magic));
+    in.read((char*)&stored_key, sizeof(stored_key));
+    in.read((char*)&format, sizeof(format));
+    in.read((char*)&length, sizeof(length));
+    if(!in.good() || std::memcmp(magic, BINARY_MAGIC, sizeof(magic)) != 0 || stored_key != key) {
+        return 0;
+    }
+
+    vector<char> binary(length);
+    in.read(binary.data(), length);
+    if(!in.good()) {
+        return 0;
+    }
+
+    GLuint const program = glCreateProgram();
+    glProgramBinary(program, format, binary.data(), length);
+    GLint result;
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
+    if(!result) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+static void save_program_binary(string const& path, uint64_t key, GLuint program) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0) {
+        return;
+    }
+
+    vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, NULL, &format, binary.data());
+
+    // written under another name and renamed, a crash never leaves half a file
+    string const tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path.c_str(), std::ios::binary);
+        uint32_t const size = uint32_t(length);
+        out.write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+        out.write((char const*)&key, sizeof(key));
+        out.write((char const*)&format, sizeof(format));
+        out.write((char const*)&size, sizeof(size));
+        out.write(binary.data(), length);
+        if(!out.good()) {
+            out.close();
+            std::remove(tmp_path.c_str());
+            return;
+        }
+    }
+    std::remove(path.c_str());
+    std::rename(tmp_path.c_str(), path.c_str());
+}
+
+static string info_log(GLuint object, bool is_program) {
+    GLint length = 0;
+    if(is_program) {
+        glGetProgramiv(object, GL_INFO_LOG_LENGTH, &length);
+    } else {
+        glGetShaderiv(object, GL_INFO_LOG_LENGTH, &length);
+    }
+    if(length <= 0) {
+        return "";
+    }
+    string log(length, 0);
+    if(is_program) {
+        glGetProgramInfoLog(object, length, NULL, &log[0]);
+    } else {
+        glGetShaderInfoLog(object, length, NULL, &log[0]);
+    }
+    return log;
+}
+
+static void copy_uniform(GLuint from, GLuint to, string const& name, GLenum type) {
+    GLint const src = glGetUniformLocation(from, name.c_str());
+    GLint const dst = glGetUniformLocation(to, name.c_str());
+    if(src < 0 || dst < 0) {
+        return;
+    }
+    GLfloat f[16];
+    GLint i[4];
+    switch(type) {
+    case GL_FLOAT:        glGetUniformfv(from, src, f); glUniform1fv(dst, 1, f); break;
+    case GL_FLOAT_VEC2:   glGetUniformfv(from, src, f); glUniform2fv(dst, 1, f); break;
+    case GL_FLOAT_VEC3:   glGetUniformfv(from, src, f); glUniform3fv(dst, 1, f); break;
+    case GL_FLOAT_VEC4:   glGetUniformfv(from, src, f); glUniform4fv(dst, 1, f); break;
+    case GL_FLOAT_MAT3:   glGetUniformfv(from, src, f); glUniformMatrix3fv(dst, 1, GL_FALSE, f); break;
+    case GL_FLOAT_MAT4:   glGetUniformfv(from, src, f); glUniformMatrix4fv(dst, 1, GL_FALSE, f); break;
+    case GL_INT_VEC2:
+    case GL_BOOL_VEC2:    glGetUniformiv(from, src, i); glUniform2iv(dst, 1, i); break;
+    case GL_INT_VEC3:
+    case GL_BOOL_VEC3:    glGetUniformiv(from, src, i); glUniform3iv(dst, 1, i); break;
+    case GL_INT_VEC4:
+    case GL_BOOL_VEC4:    glGetUniformiv(from, src, i); glUniform4iv(dst, 1, i); break;
+    case GL_INT:
+    case GL_BOOL:
+    case GL_SAMPLER_2D:
+    case GL_SAMPLER_2D_SHADOW:
+    case GL_SAMPLER_2D_ARRAY:
+    case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_BUFFER:
+    case GL_INT_SAMPLER_BUFFER:
+    case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+                          glGetUniformiv(from, src, i); glUniform1iv(dst, 1, i); break;
+    default:
+        break;
+    }
+}
+
+// every uniform both programs have gets the value it has in from
+static void copy_uniforms(GLuint from, GLuint to) {
+    GLint count = 0;
+    GLint max_length = 0;
+    glGetProgramiv(from, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(from, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+    GLint current = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+    glUseProgram(to);
+    vector<GLchar> name(max_length + 1);
+    for(GLint u = 0; u != count; ++u) {
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(from, u, GLsizei(name.size()), NULL, &size, &type, name.data());
+        string base = name.data();
+        if(base.compare(0, 3, "gl_") == 0) {
+            continue;
+        }
+        // arrays are reported as name[0]
+        size_t const bracket = base.find('[');
+        if(bracket != string::npos) {
+            base.resize(bracket);
+        }
+        for(GLint k = 0; k != size; ++k) {
+            copy_uniform(from, to, size > 1 ? base + "[" + std::to_string(k) + "]" : base, type);
+        }
+    }
+    glUseProgram(current);
+}
+
+static string file_name_part(string const& path) {
+    size_t const slash = path.find_last_of("/\\");
+    return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+// compile logs of the stages of a program, gs is 0 without a geometry shader
+static string shaders_log(GLuint vs, GLuint gs, GLuint fs) {
+    return info_log(vs, false) + (gs ? info_log(gs, false) : string()) + info_log(fs, false);
+}
+
+// no status queries, those would wait for the driver's compiler threads
+static GLuint start_compile(GLenum shader_type, string const& source) {
+    GLchar const* text = source.c_str();
+    GLuint const shader = glCreateShader(shader_type);
+    glShaderSource(shader, 1, &text, NULL);
+    glCompileShader(shader);
+    return shader;
+}
+
+#ifndef _WIN32
+// Builds programs in an own context that shares objects with the one
+// current when it is created, so they can be used there once done.
+class program_cache::compile_worker {
+public:
+    struct job {
+        string key;
+        string vs_source;
+        // empty without a geometry shader
+        string gs_source;
+        string fs_source;
+        bool binary_retrievable;
+    };
+
+    struct result {
+        GLuint program;
+        string error;
+    };
+
+    compile_worker()
+        : display(glXGetCurrentDisplay())
+        , context(0)
+        , pbuffer(0)
+        , jobs(JOB_CAPACITY)
+    {
+        GLXContext const shared = glXGetCurrentContext();
+        if(!display || !shared) {
+            throw std::runtime_error("no current GLX context to share with");
+        }
+        int const config_attribs[] = {
+            GLX_DRAWABLE_TYPE, GLX_PBUFFER_BIT,
+            GLX_RENDER_TYPE, GLX_RGBA_BIT,
+            None
+        };
+        int count = 0;
+        GLXFBConfig* configs = glXChooseFBConfig(display, DefaultScreen(display), config_attribs, &count);
+        if(!configs || count == 0) {
+            if(configs) {
+                XFree(configs);
+            }
+            throw std::runtime_error("no GLX config with pbuffer support");
+        }
+        // the context is never drawn with, but has to be current on something
+        int const pbuffer_attribs[] = { GLX_PBUFFER_WIDTH, 1, GLX_PBUFFER_HEIGHT, 1, None };
+        pbuffer = glXCreatePbuffer(display, configs[0], pbuffer_attribs);
+        context = glXCreateNewContext(display, configs[0], GLX_RGBA_TYPE, shared, True);
+        XFree(configs);
+        if(!context) {
+            glXDestroyPbuffer(display, pbuffer);
+            throw std::runtime_error("can't create a shared GLX context");
+        }
+        worker = std::thread([this] { run(); });
+    }
+
+    ~compile_worker() {
+        jobs.close();
+        worker.join();
+        for(std::map<string, result>::const_iterator it = done.begin(); it != done.end(); ++it) {
+            glDeleteProgram(it->second.program);
+        }
+        glXDestroyContext(display, context);
+        glXDestroyPbuffer(display, pbuffer);
+    }
+
+    void submit(job const& j) {
+        jobs.push(j);
+    }
+
+    // false while the job of key is still queued or running
+    bool take(string const& key, result& r, bool wait) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if(wait) {
+            done_changed.wait(lock, [&] { return done.count(key) != 0; });
+        }
+        std::map<string, result>::iterator const it = done.find(key);
+        if(it == done.end()) {
+            return false;
+        }
+        r = it->second;
+        done.erase(it);
+        return true;
+    }
+
+private:
+    // more than any scene submits at once, so submit() does not block
+    static size_t const JOB_CAPACITY = 1024;
+
+    Display* display;
+    GLXContext context;
+    GLXPbuffer pbuffer;
+
+    blocking_queue<job> jobs;
+    std::thread worker;
+
+    std::mutex mutex;
+    std::condition_variable done_changed;
+    std::map<string, result> done;
+
+    void run() {
+        glXMakeContextCurrent(display, pbuffer, pbuffer, context);
+        job j;
+        while(jobs.pop(j)) {
+            result const r = build(j);
+            // the main context may only use what has completed here
+            glFinish();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done[j.key] = r;
+            }
+            done_changed.notify_all();
+        }
+        glXMakeContextCurrent(display, None, None, NULL);
+    }
+
+    static result build(job const& j) {
+        result r;
+        r.program = 0;
+        GLuint const vs = start_compile(GL_VERTEX_SHADER, j.vs_source);
+        GLuint const gs = j.gs_source.empty() ? 0 : start_compile(GL_GEOMETRY_SHADER, j.gs_source);
+        GLuint const fs = start_compile(GL_FRAGMENT_SHADER, j.fs_source);
+        GLuint const program = glCreateProgram();
+        if(j.binary_retrievable) {
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        glAttachShader(program, vs);
+        if(gs) {
+            glAttachShader(program, gs);
+        }
+        glAttachShader(program, fs);
+        glLinkProgram(program);
+
+        GLint linked = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if(linked) {
+            r.program = program;
+        } else {
+            r.error = shaders_log(vs, gs, fs) + info_log(program, true);
+            glDeleteProgram(program);
+        }
+        glDeleteShader(vs);
+        glDeleteShader(gs);
+        glDeleteShader(fs);
+        return r;
+    }
+};
+#else
+// no shared context setup for WGL yet, use_background_compile() falls
+// back to blocking compiles without the parallel compile extension
+class program_cache::compile_worker {};
+#endif
+
+program_cache::program_cache()
+    : mode(BLOCKING)
+    , hits(0)
+    , misses(0)
+{}
+
+program_cache::~program_cache() {
+    worker.reset();
+    for(std::map<string, entry>::const_iterator it = programs.begin(); it != programs.end(); ++it) {
+        entry const& e = it->second;
+        glDeleteProgram(e.program);
+        glDeleteProgram(e.pending_program);
+        glDeleteShader(e.pending_vs);
+        glDeleteShader(e.pending_gs);
+        glDeleteShader(e.pending_fs);
+    }
+    for(std::map<string, GLuint>::const_iterator it = shaders.begin(); it != shaders.end(); ++it) {
+        glDeleteShader(it->second);
+    }
+}
+
+void program_cache::use_binaries(string const& dir) {
+    GLint formats = 0;
+    if(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    }
+    if(formats == 0) {
+        return;
+    }
+
+#ifdef _WIN32
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0755);
+#endif
+    binary_dir = dir;
+    driver = gl_string(GL_VENDOR) + "\n" + gl_string(GL_RENDERER) + "\n" + gl_string(GL_VERSION);
+}
+
+void program_cache::use_background_compile() {
+    if(GLEW_KHR_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        mode = DRIVER_THREADS;
+        return;
+    }
+    if(GLEW_ARB_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+        mode = DRIVER_THREADS;
+        return;
+    }
+#ifndef _WIN32
+    try {
+        worker.reset(new compile_worker());
+        mode = WORKER_THREAD;
+    } catch(std::runtime_error const& e) {
+        cout << "shaders are compiled on the render thread: " << e.what() << endl;
+    }
+#endif
+}
+
+string program_cache::binary_path(uint64_t key) const {
+    std::ostringstream path;
+    path << binary_dir << "/" << std::hex << key << ".bin";
+    return path.str();
+}
+
+program_cache::entry_map::iterator program_cache::find_or_submit(char const* vs_file, char const* gs_file,
+                                                                 char const* fs_file, shader_defines const& defines)
+{
+    string const gs = gs_file ? gs_file : "";
+    string const key = string(vs_file) + "\n" + gs + "\n" + fs_file + "\n" + defines_key(defines);
+    entry_map::iterator it = programs.find(key);
+    if(it != programs.end()) {
+        return it;
+    }
+    it = programs.insert(std::make_pair(key, entry())).first;
+    entry& e = it->second;
+    e.vs_file = vs_file;
+    e.gs_file = gs;
+    e.fs_file = fs_file;
+    e.defines = defines;
+    try {
+        submit(key, e);
+    } catch(...) {
+        programs.erase(it);
+        throw;
+    }
+    return it;
+}
+
+void program_cache::submit(string const& key, entry& e) {
+    string const vs_source = add_defines(read_shader_source(e.vs_file.c_str()), e.defines);
+    string const gs_source = e.gs_file.empty() ? string()
+                                               : add_defines(read_shader_source(e.gs_file.c_str()), e.defines);
+    string const fs_source = add_defines(read_shader_source(e.fs_file.c_str()), e.defines);
+    if(binaries_enabled()) {
+        e.binary_key = hash_string(vs_source + '\0' + gs_source + '\0' + fs_source + '\0' + driver);
+        GLuint const program = load_program_binary(binary_path(e.binary_key), e.binary_key);
+        if(program) {
+            ++hits;
+            install(e, program);
+            return;
+        }
+        ++misses;
+    }
+
+    switch(mode) {
+    case BLOCKING: {
+        GLuint const vs = create_shader_from_source(GL_VERTEX_SHADER, vs_source);
+        GLuint const gs = gs_source.empty() ? 0 : create_shader_from_source(GL_GEOMETRY_SHADER, gs_source);
+        GLuint const fs = create_shader_from_source(GL_FRAGMENT_SHADER, fs_source);
+        GLuint const program = create_program(vs, gs, fs, binaries_enabled());
+        glDeleteShader(vs);
+        glDeleteShader(gs);
+        glDeleteShader(fs);
+        built(e, program);
+        break;
+    }
+    case DRIVER_THREADS:
+        e.pending_vs = start_compile(GL_VERTEX_SHADER, vs_source);
+        e.pending_gs = gs_source.empty() ? 0 : start_compile(GL_GEOMETRY_SHADER, gs_source);
+        e.pending_fs = start_compile(GL_FRAGMENT_SHADER, fs_source);
+        e.pending_program = glCreateProgram();
+        if(binaries_enabled()) {
+            glProgramParameteri(e.pending_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        glAttachShader(e.pending_program, e.pending_vs);
+        if(e.pending_gs) {
+            glAttachShader(e.pending_program, e.pending_gs);
+        }
+        glAttachShader(e.pending_program, e.pending_fs);
+        glLinkProgram(e.pending_program);
+        e.building = true;
+        break;
+    case WORKER_THREAD: {
+#ifndef _WIN32
+        compile_worker::job j;
+        j.key = key;
+        j.vs_source = vs_source;
+        j.gs_source = gs_source;
+        j.fs_source = fs_source;
+        j.binary_retrievable = binaries_enabled();
+        worker->submit(j);
+        e.building = true;
+#endif
+        break;
+    }
+    }
+}
+
+bool program_cache::try_finish(entry_map::iterator it, bool wait) {
+    entry& e = it->second;
+    if(!e.building) {
+        return true;
+    }
+
+    string error;
+    if(mode == DRIVER_THREADS) {
+        if(!wait) {
+            GLint done = 0;
+            glGetProgramiv(e.pending_program, GL_COMPLETION_STATUS_KHR, &done);
+            if(!done) {
+                return false;
+            }
+        }
+        GLint linked = 0;
+        glGetProgramiv(e.pending_program, GL_LINK_STATUS, &linked);
+        GLuint const program = e.pending_program;
+        if(!linked) {
+            error = shaders_log(e.pending_vs, e.pending_gs, e.pending_fs) + info_log(program, true);
+            glDeleteProgram(program);
+        }
+        glDeleteShader(e.pending_vs);
+        glDeleteShader(e.pending_gs);
+        glDeleteShader(e.pending_fs);
+        e.pending_program = e.pending_vs = e.pending_gs = e.pending_fs = 0;
+        e.building = false;
+        if(linked) {
+            e.error.clear();
+            built(e, program);
+        }
+    } else {
+#ifndef _WIN32
+        compile_worker::result r;
+        if(!worker->take(it->first, r, wait)) {
+            return false;
+        }
+        e.building = false;
+        if(r.program) {
+            e.error.clear();
+            built(e, r.program);
+        } else {
+            error = r.error;
+        }
+#endif
+    }
+
+    if(!error.empty()) {
+        string const gs = e.gs_file.empty() ? string() : e.gs_file + " + ";
+        string const what = e.vs_file + " + " + gs + e.fs_file + ":\n" + error;
+        if(!e.program && wait) {
+            programs.erase(it);
+            throw std::runtime_error(what);
+        }
+        if(!e.program) {
+            // ready_program() and poll() run every frame, the entry stays so
+            // the stand-in is drawn and nothing is rebuilt until a reload
+            e.error = what;
+            cout << "shader build failed, the stand-in stays: " << what << endl;
+        } else {
+            cout << "shader reload failed, the previous program stays: " << what << endl;
+        }
+    }
+    if(e.rebuild_pending) {
+        e.rebuild_pending = false;
+        rebuild(it);
+    }
+    return true;
+}
+
+void program_cache::rebuild(entry_map::iterator it) {
+    entry& e = it->second;
+    if(e.building) {
+        e.rebuild_pending = true;
+        return;
+    }
+    try {
+        submit(it->first, e);
+    } catch(std::exception const& except) {
+        // the file may also be caught half written, the next write retries
+        cout << "shader reload failed, the previous program stays: " << except.what() << endl;
+    }
+}
+
+size_t program_cache::reload(string const& file_name) {
+    size_t count = 0;
+    for(entry_map::iterator it = programs.begin(); it != programs.end(); ++it) {
+        entry const& e = it->second;
+        if(file_name_part(e.vs_file) == file_name || file_name_part(e.fs_file) == file_name
+           || (!e.gs_file.empty() && file_name_part(e.gs_file) == file_name)) {
+            rebuild(it);
+            ++count;
+        }
+    }
+    return count;
+}
+
+void program_cache::install(entry& e, GLuint program) {
+    if(e.program) {
+        copy_uniforms(e.program, program);
+        glDeleteProgram(e.program);
+        // the name can come back for another program while this one stays bound
+        gl_cache().invalidate();
+    }
+    e.program = program;
+}
+
+void program_cache::built(entry& e, GLuint program) {
+    install(e, program);
+    if(binaries_enabled()) {
+        save_program_binary(binary_path(e.binary_key), e.binary_key, program);
+    }
+}
+
+void program_cache::request(char const* vs_file, char const* fs_file, shader_defines const& defines) {
+    request(vs_file, NULL, fs_file, defines);
+}
+
+GLuint program_cache::ready_program(char const* vs_file, char const* fs_file, shader_defines const& defines) {
+    return ready_program(vs_file, NULL, fs_file, defines);
+}
+
+GLuint program_cache::program(char const* vs_file, char const* fs_file, shader_defines const& defines) {
+    return program(vs_file, NULL, fs_file, defines);
+}
+
+void program_cache::request(char const* vs_file, char const* gs_file, char const* fs_file,
+                            shader_defines const& defines)
+{
+    find_or_submit(vs_file, gs_file, fs_file, defines);
+}
+
+GLuint program_cache::ready_program(char const* vs_file, char const* gs_file, char const* fs_file,
+                                    shader_defines const& defines)
+{
+    entry_map::iterator const it = find_or_submit(vs_file, gs_file, fs_file, defines);
+    try_finish(it, false);
+    // 0 only before the first build is done, a rebuild keeps the old program
+    return it->second.program;
+}
+
+GLuint program_cache::program(char const* vs_file, char const* gs_file, char const* fs_file,
+                              shader_defines const& defines)
+{
+    entry_map::iterator const it = find_or_submit(vs_file, gs_file, fs_file, defines);
+    if(!it->second.building && !it->second.program && !it->second.error.empty()) {
+        string const what = it->second.error;
+        programs.erase(it);
+        throw std::runtime_error(what);
+    }
+    try_finish(it, true);
+    return it->second.program;
+}
+
+GLuint program_cache::shader(GLenum shader_type, char const* file_name, shader_defines const& defines) {
+    string const key = std::to_string(shader_type) + " " + file_name + "\n" + defines_key(defines);
+    std::map<string, GLuint>::const_iterator const it = shaders.find(key);
+    if(it != shaders.end()) {
+        return it->second;
+    }
+
+    GLuint const shader = create_shader(shader_type, file_name, defines);
+    shaders[key] = shader;
+    return shader;
+}
+
+void program_cache::poll() {
+    for(entry_map::iterator it = programs.begin(); it != programs.end();) {
+        try_finish(it, false);
+        ++it;
+    }
+}
+
+size_t program_cache::pending_count() const {
+    size_t pending = 0;
+    for(entry_map::const_iterator it = programs.begin(); it != programs.end(); ++it) {
+        if(it->second.building) {
+            ++pending;
+        }
+    }
+    return pending;
+}
@@ -0,0 +1,135 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include "common.h"
+#include "shader.h"
+
+#include <cstdint>
+#include <map>
+
+// Shader permutations: a program is built the first time its files and
+// defines are asked for and lives as long as the cache. Defines are kept
+// sorted, so the same set always maps to the same program.
+//
+// With use_binaries() linked programs are also saved to dir with
+// glGetProgramBinary and loaded back with glProgramBinary by later runs.
+// Files are named by a hash of both sources (defines included) and the GL
+// vendor, renderer and version, so edited shaders and driver updates miss
+// the old entries. An entry the driver rejects is compiled and rewritten.
+//
+// With use_background_compile() request() only submits the work. The
+// driver compiles on its own threads when it has KHR_parallel_shader_compile
+// (or the ARB one), otherwise a worker thread builds programs in a GLX
+// context sharing objects with the current one. poll() and ready_program()
+// never wait for a compiler, program() does.
+//
+// reload() rebuilds the programs of an edited file the same way. Until the
+// new program is linked the old one is handed out; then it takes the old
+// one's uniform values and replaces it. A program that fails to build is
+// logged and the old one stays; one that never built is logged by poll()
+// and ready_program(), which leave the caller on its stand-in, and thrown
+// by program().
+//
+// A program may have a geometry shader between the two stages; the
+// overloads without gs_file build programs without one.
+class program_cache {
+public:
+    program_cache();
+    ~program_cache();
+
+    // both need a current context
+    void use_binaries(string const& dir);
+    void use_background_compile();
+
+    bool binaries_enabled() const { return !binary_dir.empty(); }
+    size_t binary_hits() const { return hits; }
+    size_t binary_misses() const { return misses; }
+
+    // starts building the program unless it is known already
+    void request(char const* vs_file, char const* fs_file,
+                 shader_defines const& defines = shader_defines());
+    // the program once it is linked, 0 while it is being built
+    GLuint ready_program(char const* vs_file, char const* fs_file,
+                         shader_defines const& defines = shader_defines());
+    // waits until the program is linked
+    GLuint program(char const* vs_file, char const* fs_file,
+                   shader_defines const& defines = shader_defines());
+    // the same with a geometry shader, none if gs_file is NULL
+    void request(char const* vs_file, char const* gs_file, char const* fs_file, shader_defines const& defines);
+    GLuint ready_program(char const* vs_file, char const* gs_file, char const* fs_file,
+                         shader_defines const& defines);
+    GLuint program(char const* vs_file, char const* gs_file, char const* fs_file, shader_defines const& defines);
+    GLuint shader(GLenum shader_type, char const* file_name,
+                  shader_defines const& defines = shader_defines());
+
+    // collects finished programs; one that failed to build is logged and
+    // ready_program() keeps returning 0 for it until a reload
+    void poll();
+    // rebuilds the programs using file_name (compared without directory),
+    // returns how many
+    size_t reload(string const& file_name);
+    size_t programs_count() const { return programs.size(); }
+    size_t pending_count() const;
+
+private:
+    enum compile_mode { BLOCKING, DRIVER_THREADS, WORKER_THREAD };
+
+    struct entry {
+        string vs_file;
+        // empty without a geometry shader
+        string gs_file;
+        string fs_file;
+        shader_defines defines;
+        uint64_t binary_key;
+
+        GLuint program;
+        bool building;
+        // changed again while building
+        bool rebuild_pending;
+        // why the build failed while there is no program yet
+        string error;
+        // DRIVER_THREADS: objects whose status is not queried yet
+        GLuint pending_program;
+        GLuint pending_vs;
+        GLuint pending_gs;
+        GLuint pending_fs;
+
+        entry()
+            : binary_key(0)
+            , program(0)
+            , building(false)
+            , rebuild_pending(false)
+            , pending_program(0)
+            , pending_vs(0)
+            , pending_gs(0)
+            , pending_fs(0)
+        {}
+    };
+
+    typedef std::map<string, entry> entry_map;
+    class compile_worker;
+
+    std::map<string, GLuint> shaders;
+    entry_map programs;
+
+    compile_mode mode;
+    unique_ptr<compile_worker> worker;
+
+    string binary_dir;
+    string driver;
+    size_t hits;
+    size_t misses;
+
+    entry_map::iterator find_or_submit(char const* vs_file, char const* gs_file, char const* fs_file,
+                                       shader_defines const& defines);
+    void submit(string const& key, entry& e);
+    // false while still building; a failed first build throws and forgets
+    // the entry when waiting, otherwise it is logged and kept in error
+    bool try_finish(entry_map::iterator it, bool wait);
+    void rebuild(entry_map::iterator it);
+    void install(entry& e, GLuint program);
+    void built(entry& e, GLuint program);
+    string binary_path(uint64_t key) const;
+};
+
+#endif // PROGRAM_CACHE_H
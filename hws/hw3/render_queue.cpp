@@ -0,0 +1,76 @@
+#include "render_queue.h"
+
+#include <algorithm>
+
+static unsigned const MESH_SHIFT = 0;
+static unsigned const DEPTH_SHIFT = MESH_SHIFT + render_queue::MESH_BITS;
+static unsigned const TEXTURE_SHIFT = DEPTH_SHIFT + render_queue::DEPTH_BITS;
+static unsigned const PROGRAM_SHIFT = TEXTURE_SHIFT + render_queue::TEXTURE_BITS;
+static unsigned const PASS_SHIFT = PROGRAM_SHIFT + render_queue::PROGRAM_BITS;
+
+static uint64_t field(uint64_t value, unsigned bits, unsigned shift) {
+    return (value & ((uint64_t(1) << bits) - 1)) << shift;
+}
+
+static unsigned extract(uint64_t key, unsigned bits, unsigned shift) {
+    return unsigned((key >> shift) & ((uint64_t(1) << bits) - 1));
+}
+
+uint64_t render_queue::make_key(unsigned pass, unsigned program, unsigned texture, float depth, unsigned mesh) {
+    uint64_t const max_depth = (uint64_t(1) << DEPTH_BITS) - 1;
+    uint64_t const depth_bucket = uint64_t(std::min(std::max(depth, 0.0f), 1.0f) * max_depth);
+    return field(pass, PASS_BITS, PASS_SHIFT) | field(program, PROGRAM_BITS, PROGRAM_SHIFT)
+         | field(texture, TEXTURE_BITS, TEXTURE_SHIFT) | field(depth_bucket, DEPTH_BITS, DEPTH_SHIFT)
+         | field(mesh, MESH_BITS, MESH_SHIFT);
+}
+
+unsigned render_queue::key_pass(uint64_t key) { return extract(key, PASS_BITS, PASS_SHIFT); }
+unsigned render_queue::key_program(uint64_t key) { return extract(key, PROGRAM_BITS, PROGRAM_SHIFT); }
+unsigned render_queue::key_texture(uint64_t key) { return extract(key, TEXTURE_BITS, TEXTURE_SHIFT); }
+unsigned render_queue::key_mesh(uint64_t key) { return extract(key, MESH_BITS, MESH_SHIFT); }
+
+void render_queue::push(uint64_t key, uint32_t payload) {
+    render_item const item = { key, payload };
+    recorded.push_back(item);
+}
+
+void render_queue::append(vector<render_item> const& items) {
+    recorded.insert(recorded.end(), items.begin(), items.end());
+}
+
+void render_queue::sort() {
+    scratch.resize(recorded.size());
+    for(unsigned shift = 0; shift != 64; shift += 8) {
+        size_t counts[256] = {};
+        for(size_t i = 0; i != recorded.size(); ++i) {
+            ++counts[(recorded[i].key >> shift) & 0xff];
+        }
+        if(recorded.empty() || counts[(recorded[0].key >> shift) & 0xff] == recorded.size()) {
+            continue;
+        }
+        size_t offset = 0;
+        for(int digit = 0; digit != 256; ++digit) {
+            size_t const count = counts[digit];
+            counts[digit] = offset;
+            offset += count;
+        }
+        for(size_t i = 0; i != recorded.size(); ++i) {
+            scratch[counts[(recorded[i].key >> shift) & 0xff]++] = recorded[i];
+        }
+        recorded.swap(scratch);
+    }
+}
+
+size_t render_queue::state_changes(vector<render_item> const& items) {
+    size_t changes = 0;
+    for(size_t i = 0; i != items.size(); ++i) {
+        if(i == 0 || key_pass(items[i].key) != key_pass(items[i - 1].key)
+           || key_program(items[i].key) != key_program(items[i - 1].key)) {
+            ++changes;
+        }
+        if(i == 0 || key_texture(items[i].key) != key_texture(items[i - 1].key)) {
+            ++changes;
+        }
+    }
+    return changes;
+}
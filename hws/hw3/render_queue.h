@@ -0,0 +1,51 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include "common.h"
+
+#include <cstdint>
+
+struct render_item {
+    uint64_t key;
+    // index into whatever the recorder keeps per draw
+    uint32_t payload;
+};
+
+// Draws recorded as 64-bit sort keys and submitted in key order. From
+// the most significant bits down the key holds the pass, the program,
+// the texture, the depth bucket and the mesh, so sorting groups draws by
+// the costliest state first and draws opaque geometry front to back
+// within a material.
+class render_queue {
+public:
+    static unsigned const PASS_BITS = 4;
+    static unsigned const PROGRAM_BITS = 10;
+    static unsigned const TEXTURE_BITS = 12;
+    static unsigned const DEPTH_BITS = 24;
+    static unsigned const MESH_BITS = 14;
+
+    // depth is 0 at the near plane and 1 at the far one
+    static uint64_t make_key(unsigned pass, unsigned program, unsigned texture, float depth, unsigned mesh);
+    static unsigned key_pass(uint64_t key);
+    static unsigned key_program(uint64_t key);
+    static unsigned key_texture(uint64_t key);
+    static unsigned key_mesh(uint64_t key);
+
+    void clear() { recorded.clear(); }
+    void push(uint64_t key, uint32_t payload);
+    void append(vector<render_item> const& items);
+    size_t size() const { return recorded.size(); }
+
+    // least significant byte first; bytes every key shares are skipped
+    void sort();
+    vector<render_item> const& items() const { return recorded; }
+
+    // program and texture binds needed to submit items in their order
+    static size_t state_changes(vector<render_item> const& items);
+
+private:
+    vector<render_item> recorded;
+    vector<render_item> scratch;
+};
+
+#endif // RENDER_QUEUE_H
@@ -0,0 +1,273 @@
+#include "scene_bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SCENE_BVH_SSE
+#endif
+
+// empty slots get an inverted box, which is outside of every plane;
+// finite, so that a zero plane component never multiplies an infinity
+static float const EMPTY_MIN = 1e30f;
+static float const EMPTY_MAX = -1e30f;
+
+aabb vertices_bounds(vector<GLfloat> const& vertices) {
+    aabb box = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+    for(size_t i = 0; i + 2 < vertices.size(); i += 3) {
+        vec3 const v(vertices[i], vertices[i + 1], vertices[i + 2]);
+        box.min = glm::min(box.min, v);
+        box.max = glm::max(box.max, v);
+    }
+    return box;
+}
+
+aabb transform_bounds(aabb const& box, mat4 const& transform) {
+    // Arvo: every output extent sums the extremes of the matrix entries
+    vec3 const translation(transform[3]);
+    aabb result = { translation, translation };
+    for(int column = 0; column != 3; ++column) {
+        for(int row = 0; row != 3; ++row) {
+            float const a = transform[column][row] * box.min[column];
+            float const b = transform[column][row] * box.max[column];
+            result.min[row] += std::min(a, b);
+            result.max[row] += std::max(a, b);
+        }
+    }
+    return result;
+}
+
+static aabb merge(aabb const& a, aabb const& b) {
+    aabb const box = { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+    return box;
+}
+
+frustum::frustum(mat4 const& view_proj) {
+    vec4 rows[4];
+    for(int i = 0; i != 4; ++i) {
+        rows[i] = vec4(view_proj[0][i], view_proj[1][i], view_proj[2][i], view_proj[3][i]);
+    }
+    planes[0] = rows[3] + rows[0];
+    planes[1] = rows[3] - rows[0];
+    planes[2] = rows[3] + rows[1];
+    planes[3] = rows[3] - rows[1];
+    planes[4] = rows[3] + rows[2];
+    planes[5] = rows[3] - rows[2];
+    for(int i = 0; i != 6; ++i) {
+        planes[i] = planes[i] * (1.0f / length(vec3(planes[i])));
+    }
+}
+
+bool frustum::intersects(aabb const& box) const {
+    for(int i = 0; i != 6; ++i) {
+        vec4 const& p = planes[i];
+        vec3 const far_corner(p.x > 0 ? box.max.x : box.min.x, p.y > 0 ? box.max.y : box.min.y,
+                              p.z > 0 ? box.max.z : box.min.z);
+        if(dot(vec3(p), far_corner) + p.w < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+scene_bvh::scene_bvh() {}
+
+void scene_bvh::build(vector<aabb> const& bounds) {
+    nodes.clear();
+    order.resize(bounds.size());
+    for(size_t i = 0; i != order.size(); ++i) {
+        order[i] = uint32_t(i);
+    }
+    if(!order.empty()) {
+        nodes.reserve(order.size() / 3 + 1);
+        build_node(bounds, 0, uint32_t(order.size()));
+    }
+}
+
+void scene_bvh::set_child_box(node& n, int slot, aabb const& box) {
+    n.min_x[slot] = box.min.x;
+    n.min_y[slot] = box.min.y;
+    n.min_z[slot] = box.min.z;
+    n.max_x[slot] = box.max.x;
+    n.max_y[slot] = box.max.y;
+    n.max_z[slot] = box.max.z;
+}
+
+aabb scene_bvh::node_bounds(node const& n) const {
+    aabb box = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+    for(int slot = 0; slot != 4; ++slot) {
+        if(n.count[slot] != 0) {
+            aabb const child = { vec3(n.min_x[slot], n.min_y[slot], n.min_z[slot]),
+                                 vec3(n.max_x[slot], n.max_y[slot], n.max_z[slot]) };
+            box = merge(box, child);
+        }
+    }
+    return box;
+}
+
+// Splits the range in four along the longest axis of the centroids.
+// Nodes are stored parents first, refit() relies on it.
+int32_t scene_bvh::build_node(vector<aabb> const& bounds, uint32_t first, uint32_t count) {
+    int32_t const index = int32_t(nodes.size());
+    nodes.push_back(node());
+
+    uint32_t part_first[4];
+    uint32_t part_count[4];
+    if(count <= 4) {
+        for(uint32_t i = 0; i != 4; ++i) {
+            part_first[i] = first + i;
+            part_count[i] = i < count ? 1 : 0;
+        }
+    } else {
+        aabb centroids = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+        for(uint32_t i = first; i != first + count; ++i) {
+            vec3 const c = (bounds[order[i]].min + bounds[order[i]].max) * 0.5f;
+            centroids.min = glm::min(centroids.min, c);
+            centroids.max = glm::max(centroids.max, c);
+        }
+        vec3 const extent = centroids.max - centroids.min;
+        int const axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        auto less = [&](uint32_t a, uint32_t b) {
+            return bounds[a].min[axis] + bounds[a].max[axis] < bounds[b].min[axis] + bounds[b].max[axis];
+        };
+        uint32_t* const begin = order.data() + first;
+        uint32_t const half = count / 2;
+        std::nth_element(begin, begin + half, begin + count, less);
+        std::nth_element(begin, begin + half / 2, begin + half, less);
+        std::nth_element(begin + half, begin + half + (count - half) / 2, begin + count, less);
+        uint32_t const splits[5] = { 0, half / 2, half, half + (count - half) / 2, count };
+        for(int i = 0; i != 4; ++i) {
+            part_first[i] = first + splits[i];
+            part_count[i] = splits[i + 1] - splits[i];
+        }
+    }
+
+    for(int slot = 0; slot != 4; ++slot) {
+        int32_t child = -1;
+        aabb box = { vec3(EMPTY_MIN), vec3(EMPTY_MAX) };
+        if(part_count[slot] == 1) {
+            box = bounds[order[part_first[slot]]];
+        } else if(part_count[slot] > 1) {
+            child = build_node(bounds, part_first[slot], part_count[slot]);
+            box = node_bounds(nodes[child]);
+        }
+        // nodes may have moved while the child was built
+        node& n = nodes[index];
+        n.child[slot] = child;
+        n.first[slot] = part_first[slot];
+        n.count[slot] = part_count[slot];
+        set_child_box(n, slot, box);
+    }
+    return index;
+}
+
+void scene_bvh::refit(vector<aabb> const& bounds) {
+    // children come after their parents
+    for(size_t i = nodes.size(); i-- != 0;) {
+        node& n = nodes[i];
+        for(int slot = 0; slot != 4; ++slot) {
+            if(n.child[slot] >= 0) {
+                set_child_box(n, slot, node_bounds(nodes[n.child[slot]]));
+            } else if(n.count[slot] == 1) {
+                set_child_box(n, slot, bounds[order[n.first[slot]]]);
+            }
+        }
+    }
+}
+
+void scene_bvh::cull(frustum const& f, vector<uint32_t>& visible) const {
+    if(!nodes.empty()) {
+        cull_node(f, 0, visible);
+    }
+}
+
+void scene_bvh::cull_node(frustum const& f, int32_t index, vector<uint32_t>& visible) const {
+    node const& n = nodes[index];
+    int outside = 0;
+    int partial = 0;
+#ifdef SCENE_BVH_SSE
+    __m128 const zero = _mm_setzero_ps();
+    __m128 outside_mask = zero;
+    __m128 partial_mask = zero;
+    for(int p = 0; p != 6; ++p) {
+        vec4 const& plane = f.planes[p];
+        __m128 const nx = _mm_set1_ps(plane.x);
+        __m128 const ny = _mm_set1_ps(plane.y);
+        __m128 const nz = _mm_set1_ps(plane.z);
+        __m128 const d = _mm_set1_ps(plane.w);
+        // the corner furthest along the normal decides if a box is outside,
+        // the nearest one if it is entirely inside
+        __m128 const far_x = _mm_loadu_ps(plane.x > 0 ? n.max_x : n.min_x);
+        __m128 const far_y = _mm_loadu_ps(plane.y > 0 ? n.max_y : n.min_y);
+        __m128 const far_z = _mm_loadu_ps(plane.z > 0 ? n.max_z : n.min_z);
+        __m128 const near_x = _mm_loadu_ps(plane.x > 0 ? n.min_x : n.max_x);
+        __m128 const near_y = _mm_loadu_ps(plane.y > 0 ? n.min_y : n.max_y);
+        __m128 const near_z = _mm_loadu_ps(plane.z > 0 ? n.min_z : n.max_z);
+        __m128 const far_dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(far_x, nx), _mm_mul_ps(far_y, ny)),
+                                           _mm_add_ps(_mm_mul_ps(far_z, nz), d));
+        __m128 const near_dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(near_x, nx), _mm_mul_ps(near_y, ny)),
+                                            _mm_add_ps(_mm_mul_ps(near_z, nz), d));
+        outside_mask = _mm_or_ps(outside_mask, _mm_cmplt_ps(far_dist, zero));
+        partial_mask = _mm_or_ps(partial_mask, _mm_cmplt_ps(near_dist, zero));
+    }
+    outside = _mm_movemask_ps(outside_mask);
+    partial = _mm_movemask_ps(partial_mask);
+#else
+    for(int p = 0; p != 6; ++p) {
+        vec4 const& plane = f.planes[p];
+        for(int slot = 0; slot != 4; ++slot) {
+            float const far_dist = plane.x * (plane.x > 0 ? n.max_x : n.min_x)[slot]
+                                 + plane.y * (plane.y > 0 ? n.max_y : n.min_y)[slot]
+                                 + plane.z * (plane.z > 0 ? n.max_z : n.min_z)[slot] + plane.w;
+            float const near_dist = plane.x * (plane.x > 0 ? n.min_x : n.max_x)[slot]
+                                  + plane.y * (plane.y > 0 ? n.min_y : n.max_y)[slot]
+                                  + plane.z * (plane.z > 0 ? n.min_z : n.max_z)[slot] + plane.w;
+            outside |= far_dist < 0 ? 1 << slot : 0;
+            partial |= near_dist < 0 ? 1 << slot : 0;
+        }
+    }
+#endif
+    for(int slot = 0; slot != 4; ++slot) {
+        if(n.count[slot] == 0 || (outside & (1 << slot))) {
+            continue;
+        }
+        if(n.child[slot] >= 0 && (partial & (1 << slot))) {
+            cull_node(f, n.child[slot], visible);
+        } else {
+            visible.insert(visible.end(), order.begin() + n.first[slot],
+                           order.begin() + n.first[slot] + n.count[slot]);
+        }
+    }
+}
+
+scene_objects::scene_objects() {
+    cur_mesh_bounds.min = cur_mesh_bounds.max = vec3(0);
+}
+
+void scene_objects::update(aabb const& mesh_bounds, vector<instance_data> const& instances, mat4 const& model) {
+    bool const rebuild = instances.size() != bvh.objects_count();
+    if(!rebuild && model == cur_model && mesh_bounds.min == cur_mesh_bounds.min
+       && mesh_bounds.max == cur_mesh_bounds.max) {
+        return;
+    }
+    world_bounds.resize(instances.size());
+    for(size_t i = 0; i != instances.size(); ++i) {
+        world_bounds[i] = transform_bounds(mesh_bounds, instances[i].model * model);
+    }
+    if(rebuild) {
+        bvh.build(world_bounds);
+    } else {
+        bvh.refit(world_bounds);
+    }
+    cur_mesh_bounds = mesh_bounds;
+    cur_model = model;
+}
+
+vector<uint32_t> const& scene_objects::cull(mat4 const& view_proj) {
+    visible.clear();
+    bvh.cull(frustum(view_proj), visible);
+    // instances keep their buffer order, near ones first
+    std::sort(visible.begin(), visible.end());
+    return visible;
+}
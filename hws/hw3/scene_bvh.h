@@ -0,0 +1,87 @@
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include "common.h"
+#include "instance_buffer.h"
+
+#include <cstdint>
+
+struct aabb {
+    vec3 min;
+    vec3 max;
+};
+
+// bounds of x, y, z triples as stored in draw_data::vertices
+aabb vertices_bounds(vector<GLfloat> const& vertices);
+aabb transform_bounds(aabb const& box, mat4 const& transform);
+
+// Planes of the clip volume of view_proj, normals pointing inwards,
+// taken straight from the matrix rows (Gribb and Hartmann).
+struct frustum {
+    vec4 planes[6];
+
+    explicit frustum(mat4 const& view_proj);
+    // false only for boxes entirely outside one of the planes
+    bool intersects(aabb const& box) const;
+};
+
+// Four-wide bounding volume hierarchy over world-space object bounds.
+// Every node keeps the boxes of its four children as structure of arrays,
+// so one SSE test checks all of them against a plane. A child is either
+// another node or a single object. Objects are reordered so that every
+// subtree covers a contiguous range, a child entirely inside the frustum
+// is accepted without descending.
+class scene_bvh {
+public:
+    scene_bvh();
+
+    // builds the tree for a new set of objects
+    void build(vector<aabb> const& bounds);
+    // same objects, moved: updates the node boxes bottom-up, keeps the tree
+    void refit(vector<aabb> const& bounds);
+    size_t objects_count() const { return order.size(); }
+
+    // appends the indices of the objects intersecting f
+    void cull(frustum const& f, vector<uint32_t>& visible) const;
+
+private:
+    struct node {
+        float min_x[4], min_y[4], min_z[4];
+        float max_x[4], max_y[4], max_z[4];
+        // node index, or -1 for an object or an empty slot
+        int32_t child[4];
+        // objects under the child, in order[]
+        uint32_t first[4];
+        uint32_t count[4];
+    };
+
+    vector<node> nodes;
+    vector<uint32_t> order;
+
+    int32_t build_node(vector<aabb> const& bounds, uint32_t first, uint32_t count);
+    void set_child_box(node& n, int slot, aabb const& box);
+    aabb node_bounds(node const& n) const;
+    void cull_node(frustum const& f, int32_t index, vector<uint32_t>& visible) const;
+};
+
+// The objects of the instanced scene: copies of one mesh, each placed by
+// its instance transform times the shared model matrix. World bounds are
+// recomputed only when the mesh or the model matrix change, then the tree
+// is refit; a new instance count rebuilds it.
+class scene_objects {
+public:
+    scene_objects();
+
+    void update(aabb const& mesh_bounds, vector<instance_data> const& instances, mat4 const& model);
+    // indices of the instances intersecting the clip volume of view_proj
+    vector<uint32_t> const& cull(mat4 const& view_proj);
+
+private:
+    scene_bvh bvh;
+    vector<aabb> world_bounds;
+    vector<uint32_t> visible;
+    aabb cur_mesh_bounds;
+    mat4 cur_model;
+};
+
+#endif // SCENE_BVH_H
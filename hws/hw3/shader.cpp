@@ -1,6 +1,8 @@
 #include "shader.h"
 
-GLuint create_shader( GLenum shader_type, char const * file_name ) {
+#include <cstdlib>
+
+string read_shader_source( char const * file_name ) {
    ifstream f_in(file_name, std::ios::binary);
 
    if (!f_in.good())
@@ -9,11 +11,21 @@ GLuint create_shader( GLenum shader_type, char const * file_name ) {
    f_in.seekg(0, std::ios_base::end);
    size_t const size = (size_t)f_in.tellg();
    f_in.seekg(0, std::ios_base::beg);
-   unique_ptr<char[]> text(new char[size + 1]);
-   f_in.read(text.get(), size);
+   string text(size, 0);
+   f_in.read(&text[0], size);
+   return text;
+}
+
+GLuint create_shader( GLenum shader_type, char const * file_name ) {
+   return create_shader_from_source(shader_type, read_shader_source(file_name));
+}
+
+GLuint create_shader( GLenum shader_type, char const * file_name, shader_defines const & defines ) {
+   return create_shader_from_source(shader_type, add_defines(read_shader_source(file_name), defines));
+}
 
-   text[size] = 0;
-   GLchar const * gl_text = text.get();
+GLuint create_shader_from_source( GLenum shader_type, string const & source ) {
+   GLchar const * gl_text = source.c_str();
    GLuint const shader = glCreateShader(shader_type);
 
    glShaderSource(shader, 1, &gl_text, NULL);
@@ -37,10 +49,7 @@ GLuint create_shader( GLenum shader_type, char const * file_name ) {
    return shader;
 }
 
-GLuint create_program( GLuint vs, GLuint fs ) {
-   GLuint const program = glCreateProgram();
-   glAttachShader(program, vs);
-   glAttachShader(program, fs);
+static void link_program( GLuint program ) {
    glLinkProgram(program);
 
    GLint result;
@@ -57,5 +66,64 @@ GLuint create_program( GLuint vs, GLuint fs ) {
          throw std::runtime_error(Buffer);
       }
    }
+}
+
+GLuint create_program( GLuint vs, GLuint fs, bool binary_retrievable ) {
+   return create_program(vs, 0, fs, binary_retrievable);
+}
+
+GLuint create_program( GLuint vs, GLuint gs, GLuint fs, bool binary_retrievable ) {
+   GLuint const program = glCreateProgram();
+   if (binary_retrievable)
+      glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+   glAttachShader(program, vs);
+   if (gs)
+      glAttachShader(program, gs);
+   glAttachShader(program, fs);
+   link_program(program);
+   return program;
+}
+
+GLuint create_feedback_program( GLuint vs, GLuint gs, vector<char const *> const & varyings ) {
+   GLuint const program = glCreateProgram();
+   glAttachShader(program, vs);
+   glAttachShader(program, gs);
+   // the varyings are picked before linking
+   glTransformFeedbackVaryings(program, GLsizei(varyings.size()), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+   link_program(program);
    return program;
 }
+
+static string defines_block( shader_defines const & defines ) {
+   string block;
+   for (shader_defines::const_iterator it = defines.begin(); it != defines.end(); ++it)
+      block += "#define " + it->first + " " + it->second + "\n";
+   return block;
+}
+
+string add_defines( string const & source, shader_defines const & defines ) {
+   if (defines.empty())
+      return source;
+
+   // #version has to stay the first statement
+   size_t insert_at = 0;
+   size_t line = 1;
+   // a shader without #version is GLSL 1.10
+   long glsl_version = 110;
+   size_t const version = source.find("#version");
+   if (version != string::npos)
+   {
+      size_t const eol = source.find('\n', version);
+      insert_at = eol == string::npos ? source.size() : eol + 1;
+      line = 2;
+      glsl_version = std::strtol(source.c_str() + version + 8, NULL, 10);
+   }
+   // compile errors keep pointing at the lines of the file; before GLSL
+   // 3.30 #line N numbers the line after it N + 1
+   if (glsl_version < 330)
+      --line;
+   string block = defines_block(defines) + "#line " + std::to_string(line) + "\n";
+   if (insert_at == source.size() && insert_at != 0 && source[insert_at - 1] != '\n')
+      block = "\n" + block;
+   return source.substr(0, insert_at) + block + source.substr(insert_at);
+}
@@ -2,5 +2,22 @@
 
 #include "common.h"
 
+#include <map>
+
+// name -> value, every pair becomes "#define name value" right after the
+// #version line of the source
+typedef std::map<string, string> shader_defines;
+
+string read_shader_source( char const * file_name );
 GLuint create_shader( GLenum shader_type, char const * file_name );
-GLuint create_program( GLuint vs, GLuint fs );
+GLuint create_shader( GLenum shader_type, char const * file_name, shader_defines const & defines );
+GLuint create_shader_from_source( GLenum shader_type, string const & source );
+// binary_retrievable asks the driver to keep the binary for glGetProgramBinary
+GLuint create_program( GLuint vs, GLuint fs, bool binary_retrievable = false );
+// gs may be 0 for none
+GLuint create_program( GLuint vs, GLuint gs, GLuint fs, bool binary_retrievable );
+// no rasterization: the geometry shader outputs named by varyings are
+// captured interleaved into the bound transform feedback buffer
+GLuint create_feedback_program( GLuint vs, GLuint gs, vector<char const *> const & varyings );
+
+string add_defines( string const & source, shader_defines const & defines );
@@ -0,0 +1,64 @@
+#include "shader_watcher.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+shader_watcher::shader_watcher(string const& dir)
+    : fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+    , watch(-1)
+{
+    if(fd < 0) {
+        cout << "can't watch " << dir << ", shaders won't be reloaded" << endl;
+        return;
+    }
+    // editors either write in place or write a copy and rename it over
+    watch = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if(watch < 0) {
+        cout << "can't watch " << dir << ", shaders won't be reloaded" << endl;
+    }
+}
+
+shader_watcher::~shader_watcher() {
+    if(fd >= 0) {
+        close(fd);
+    }
+}
+
+vector<string> shader_watcher::changed_files() {
+    vector<string> names;
+    if(watch < 0) {
+        return names;
+    }
+    char buffer[4096] __attribute__((aligned(__alignof__(inotify_event))));
+    for(;;) {
+        ssize_t const length = read(fd, buffer, sizeof(buffer));
+        if(length <= 0) {
+            break;
+        }
+        for(char const* p = buffer; p < buffer + length;) {
+            inotify_event const* event = reinterpret_cast<inotify_event const*>(p);
+            if(event->len != 0 && std::find(names.begin(), names.end(), event->name) == names.end()) {
+                names.push_back(event->name);
+            }
+            p += sizeof(inotify_event) + event->len;
+        }
+    }
+    return names;
+}
+#else
+shader_watcher::shader_watcher(string const&)
+    : fd(-1)
+    , watch(-1)
+{}
+
+shader_watcher::~shader_watcher() {}
+
+vector<string> shader_watcher::changed_files() {
+    return vector<string>();
+}
+#endif
@@ -0,0 +1,21 @@
+#ifndef SHADER_WATCHER_H
+#define SHADER_WATCHER_H
+
+#include "common.h"
+
+// Reports the files of a directory that were written or moved in, without
+// blocking. Uses inotify; elsewhere nothing is ever reported.
+class shader_watcher {
+public:
+    explicit shader_watcher(string const& dir);
+    ~shader_watcher();
+
+    // names (without directory) changed since the last call, each once
+    vector<string> changed_files();
+
+private:
+    int fd;
+    int watch;
+};
+
+#endif // SHADER_WATCHER_H
@@ -0,0 +1,21 @@
+#version 150
+
+layout(points) in;
+layout(points, max_vertices = 1) out;
+
+in mat4 vs_model[];
+in vec3 vs_tint[];
+flat in int vs_visible[];
+
+// captured by transform feedback in the layout of instance_data
+out mat4 culled_model;
+out vec3 culled_tint;
+
+void main() {
+    if (vs_visible[0] != 0) {
+        culled_model = vs_model[0];
+        culled_tint = vs_tint[0];
+        EmitVertex();
+        EndPrimitive();
+    }
+}
@@ -0,0 +1,31 @@
+#version 150
+
+// one point per instance, the instance attributes come in per vertex
+in mat4 instance_model;
+in vec3 instance_tint;
+
+out mat4 vs_model;
+out vec3 vs_tint;
+flat out int vs_visible;
+
+uniform mat4 model;
+// view frustum, normals pointing inwards
+uniform vec4 planes[6];
+// bounding sphere of the mesh: center, radius
+uniform vec4 sphere_modelspace;
+
+void main() {
+    mat4 world = instance_model * model;
+    vec3 center = (world * vec4(sphere_modelspace.xyz, 1)).xyz;
+    float scale = max(length(world[0].xyz), max(length(world[1].xyz), length(world[2].xyz)));
+    float radius = sphere_modelspace.w * scale;
+
+    vs_visible = 1;
+    for (int i = 0; i != 6; ++i) {
+        if (dot(planes[i].xyz, center) + planes[i].w < -radius) {
+            vs_visible = 0;
+        }
+    }
+    vs_model = instance_model;
+    vs_tint = instance_tint;
+}
@@ -0,0 +1,47 @@
+#version 130
+
+// ambient and the scene light of for_scene.fs, from the G-buffer
+
+out vec3 color;
+
+uniform sampler2D albedo_sampler;
+// camera space normal, linear depth in w, 0 where nothing lit was drawn
+uniform sampler2D normal_sampler;
+uniform vec2 gbuffer_size;
+// x and y of a camera space point at depth 1 on the screen edges
+uniform vec2 view_ray_scale;
+
+uniform vec3 lightpos_cameraspace;
+uniform vec3 light_color;
+uniform float light_power;
+uniform vec3 ambient;
+uniform vec3 specular;
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec3 MaterialDiffuseColor = texelFetch(albedo_sampler, texel, 0).rgb;
+    vec4 normal_depth = texelFetch(normal_sampler, texel, 0);
+    if(normal_depth.w == 0) {
+        color = MaterialDiffuseColor;
+        return;
+    }
+    vec2 ndc = gl_FragCoord.xy / gbuffer_size * 2 - 1;
+    vec3 position = vec3(ndc * view_ray_scale, -1) * normal_depth.w;
+
+    vec3 MaterialAmbientColor = ambient * MaterialDiffuseColor;
+    vec3 MaterialSpecularColor = specular;
+
+    float distance = length(lightpos_cameraspace - position);
+
+    vec3 n = normalize(normal_depth.xyz);
+    vec3 l = normalize(lightpos_cameraspace - position);
+    float cosTheta = clamp(dot(n, l), 0, 1);
+
+    vec3 E = normalize(-position);
+    vec3 R = reflect(-l,n);
+    float cosAlpha = clamp(dot(E, R), 0, 1);
+
+    color = MaterialAmbientColor +
+            MaterialDiffuseColor * light_color * light_power * cosTheta / (distance*distance) +
+            MaterialSpecularColor * light_color * light_power * pow(cosAlpha,5) / (distance*distance);
+}
@@ -0,0 +1,9 @@
+#version 130
+
+// fullscreen quad of the deferred shading passes
+
+in vec2 corner;
+
+void main() {
+    gl_Position = vec4(corner, 0, 1);
+}
@@ -0,0 +1,47 @@
+#version 130
+
+// one point light added to the pixels its volume covers
+
+flat in vec3 LightPosition_cameraspace;
+flat in float LightRadius;
+flat in vec3 LightColor;
+
+out vec3 color;
+
+uniform sampler2D albedo_sampler;
+// camera space normal, linear depth in w, 0 where nothing lit was drawn
+uniform sampler2D normal_sampler;
+uniform vec2 gbuffer_size;
+// x and y of a camera space point at depth 1 on the screen edges
+uniform vec2 view_ray_scale;
+uniform vec3 specular;
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 normal_depth = texelFetch(normal_sampler, texel, 0);
+    if(normal_depth.w == 0) {
+        discard;
+    }
+    vec2 ndc = gl_FragCoord.xy / gbuffer_size * 2 - 1;
+    vec3 position = vec3(ndc * view_ray_scale, -1) * normal_depth.w;
+
+    vec3 to_light = LightPosition_cameraspace - position;
+    float distance = length(to_light);
+    if(distance >= LightRadius) {
+        discard;
+    }
+    // inverse square, brought smoothly to 0 at the radius
+    float window = clamp(1 - pow(distance / LightRadius, 4), 0, 1);
+    float attenuation = window * window / (distance * distance + 1);
+
+    vec3 n = normalize(normal_depth.xyz);
+    vec3 l = to_light / distance;
+    float cosTheta = clamp(dot(n, l), 0, 1);
+
+    vec3 E = normalize(-position);
+    vec3 R = reflect(-l,n);
+    float cosAlpha = clamp(dot(E, R), 0, 1);
+
+    vec3 albedo = texelFetch(albedo_sampler, texel, 0).rgb;
+    color = (albedo * cosTheta + specular * pow(cosAlpha,5)) * LightColor * attenuation;
+}
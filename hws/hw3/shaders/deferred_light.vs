@@ -0,0 +1,23 @@
+#version 130
+
+// bounding sphere of a point light, instanced over the lights
+
+in vec3 sphere_pos;
+// world position and radius
+in vec4 light_sphere;
+in vec3 light_color;
+
+flat out vec3 LightPosition_cameraspace;
+flat out float LightRadius;
+flat out vec3 LightColor;
+
+uniform mat4 proj;
+uniform mat4 view;
+
+void main() {
+    vec3 world = light_sphere.xyz + light_sphere.w * sphere_pos;
+    gl_Position = proj * view * vec4(world, 1);
+    LightPosition_cameraspace = (view * vec4(light_sphere.xyz, 1)).xyz;
+    LightRadius = light_sphere.w;
+    LightColor = light_color;
+}
@@ -0,0 +1,6 @@
+#version 130
+
+// depth prepass: color writes are off, only the depth of for_scene.vs counts
+
+void main() {
+}
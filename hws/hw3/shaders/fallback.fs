@@ -0,0 +1,40 @@
+#version 130
+
+// unlit stand-in for for_scene.fs while that one is still compiling
+
+in vec2 UV;
+
+#ifdef WIREFRAME
+in vec3 Barycentric;
+
+const vec3 WIRE_COLOR = vec3(1);
+// in pixels, the same at any distance
+const float WIRE_WIDTH = 1.5;
+
+// 1 on the edges of the triangle, fading out over a pixel for anti-aliasing
+float wire_coverage() {
+    vec3 pixels = Barycentric / fwidth(Barycentric);
+    float distance = min(pixels.x, min(pixels.y, pixels.z));
+    return 1 - smoothstep(0.5 * WIRE_WIDTH - 0.5, 0.5 * WIRE_WIDTH + 0.5, distance);
+}
+#endif
+
+#ifndef GBUFFER
+out vec3 color;
+#endif
+
+uniform sampler2D texture_sampler;
+
+void main() {
+    vec4 albedo = texture2D(texture_sampler, UV);
+#ifdef WIREFRAME
+    albedo.rgb = mix(albedo.rgb, WIRE_COLOR, wire_coverage());
+#endif
+#ifdef GBUFFER
+    // depth 0 leaves it unlit
+    gl_FragData[0] = albedo;
+    gl_FragData[1] = vec4(0);
+#else
+    color = albedo.rgb;
+#endif
+}
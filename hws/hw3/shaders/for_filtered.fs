@@ -6,17 +6,31 @@ out vec3 color;
 
 uniform sampler2D texture_sampler;
 
-uniform int filter_type;
 const int NO_FILTER = 0;
 const int BOX_BLUR = 1;
 const int GAUSSIAN_HORIZONTAL_BLUR = 2;
 const int GAUSSIAN_VERTICAL_BLUR = 3;
 const int SOBEL_FILTER = 4;
+const int GRAYSCALE = 5;
+const int THRESHOLD = 6;
+const int TONE_ADJUST = 7;
+
+// FILTER_TYPE and GAUS_RADIUS compile a permutation for a single filter,
+// without them both are uniforms
+#ifdef FILTER_TYPE
+const int filter_type = FILTER_TYPE;
+#else
+uniform int filter_type;
+#endif
 
-const float step_factor = 800;
+uniform vec2 texel_size;
 
 uniform float gaus_variance;
+#ifdef GAUS_RADIUS
+const int gaus_radius = GAUS_RADIUS;
+#else
 uniform int gaus_radius;
+#endif
 
 const float PI = 3.14159265358979323846264;
 
@@ -24,12 +38,16 @@ const int SOBEL_KERNEL_RADIUS = 1;
 const int SOBEL_KERNEL_SIZE = 3;
 uniform float sobel_threshold;
 
+uniform float threshold;
+uniform float tone_exposure;
+uniform float tone_gamma;
+
 // box blur
 void box_blur() {
     vec3 sum = vec3(0, 0, 0);
     for(int i = -1; i <= 1; ++i) {
         for(int j = -1; j <= 1; ++j) {
-            sum += texture2D(texture_sampler, vec2(UV.x + i / step_factor, UV.y + j / step_factor)).rgb;
+            sum += texture2D(texture_sampler, vec2(UV.x + i * texel_size.x, UV.y + j * texel_size.y)).rgb;
         }
     }
     color = sum / 9.0f;
@@ -52,7 +70,7 @@ void gaussian_horizontal_blur() {
     vec3 sum = vec3(0, 0, 0);
     float kernel_sum = 0;
     for(int i = -gaus_radius; i <= gaus_radius; ++i) {
-        vec3 tex_color = texture2D(texture_sampler, vec2(UV.x + i / step_factor, UV.y)).rgb;
+        vec3 tex_color = texture2D(texture_sampler, vec2(UV.x + i * texel_size.x, UV.y)).rgb;
         float weight = gaussian_function(i);
         kernel_sum += weight;
         sum += tex_color * weight;
@@ -64,7 +82,7 @@ void gaussian_vertical_blur() {
     vec3 sum = vec3(0, 0, 0);
     float kernel_sum = 0;
     for(int i = -gaus_radius; i <= gaus_radius; ++i) {
-        vec3 tex_color = texture2D(texture_sampler, vec2(UV.x, UV.y + i / step_factor)).rgb;
+        vec3 tex_color = texture2D(texture_sampler, vec2(UV.x, UV.y + i * texel_size.y)).rgb;
         float weight = gaussian_function(i);
         kernel_sum += weight;
         sum += tex_color * weight;
@@ -105,8 +123,8 @@ void sobel_filter() {
     vec3 sum_y = vec3(0, 0, 0);
     for(int i = -1; i <= 1; ++i) {
         for(int j = -1; j <= 1; ++j) {
-            vec3 tex_color = texture2D(texture_sampler, vec2(UV.x + i / step_factor, UV.y + j / step_factor)).rgb;
-            int index = (i + SOBEL_KERNEL_RADIUS) * SOBEL_KERNEL_SIZE + (i + SOBEL_KERNEL_RADIUS);
+            vec3 tex_color = texture2D(texture_sampler, vec2(UV.x + i * texel_size.x, UV.y + j * texel_size.y)).rgb;
+            int index = (i + SOBEL_KERNEL_RADIUS) * SOBEL_KERNEL_SIZE + (j + SOBEL_KERNEL_RADIUS);
             sum_x += tex_color * sobel_x_weight[index];
             sum_y += tex_color * sobel_y_weight[index];
         }
@@ -116,6 +134,26 @@ void sobel_filter() {
     apply_threshold(rgb_color);
 }
 
+// point-wise filters
+void grayscale() {
+    float brightness = rgb_to_brightness(texture2D(texture_sampler, UV).rgb);
+    color = vec3(brightness, brightness, brightness);
+}
+
+void threshold_filter() {
+    vec3 rgb = texture2D(texture_sampler, UV).rgb;
+    if(rgb_to_brightness(rgb) < threshold) {
+        color = vec3(0, 0, 0);
+    } else {
+        color = rgb;
+    }
+}
+
+void tone_adjust() {
+    vec3 rgb = clamp(texture2D(texture_sampler, UV).rgb * tone_exposure, 0, 1);
+    color = pow(rgb, vec3(1 / tone_gamma));
+}
+
 void main() {
     if(filter_type == BOX_BLUR) {
         box_blur();
@@ -125,6 +163,12 @@ void main() {
         gaussian_vertical_blur();
     } else if (filter_type == SOBEL_FILTER) {
         sobel_filter();
+    } else if (filter_type == GRAYSCALE) {
+        grayscale();
+    } else if (filter_type == THRESHOLD) {
+        threshold_filter();
+    } else if (filter_type == TONE_ADJUST) {
+        tone_adjust();
     } else {
         color = texture2D(texture_sampler, UV).rgb;
     }
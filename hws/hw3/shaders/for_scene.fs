@@ -1,4 +1,8 @@
 #version 130
+#ifdef CLUSTERED
+// texture buffers are core from GLSL 1.40
+#extension GL_ARB_texture_buffer_object : require
+#endif
 
 in vec2 UV;
 in vec3 Position_worldspace;
@@ -6,8 +10,30 @@ in vec3 Normal_cameraspace;
 in vec3 Tangent_cameraspace;
 in vec3 EyeDirection_cameraspace;
 in vec3 LightDirection_cameraspace;
+#ifdef INSTANCED
+in vec3 Tint;
+#endif
 
+#ifdef WIREFRAME
+in vec3 Barycentric;
+
+const vec3 WIRE_COLOR = vec3(1);
+// in pixels, the same at any distance
+const float WIRE_WIDTH = 1.5;
+
+// 1 on the edges of the triangle, fading out over a pixel for anti-aliasing
+float wire_coverage() {
+    vec3 pixels = Barycentric / fwidth(Barycentric);
+    float distance = min(pixels.x, min(pixels.y, pixels.z));
+    return 1 - smoothstep(0.5 * WIRE_WIDTH - 0.5, 0.5 * WIRE_WIDTH + 0.5, distance);
+}
+#endif
+
+#ifdef GBUFFER
+// albedo, then camera space normal with the linear depth, see deferred_renderer.h
+#else
 out vec3 color;
+#endif
 
 uniform vec3 lightpos_worldspace;
 uniform sampler2D texture_sampler;
@@ -16,8 +42,61 @@ uniform float light_power;
 uniform vec3 ambient;
 uniform vec3 specular;
 
+#ifdef CLUSTERED
+// point lights binned into clusters of the view frustum, see light_clusters.h:
+// two texels a light, camera space position and radius, then color
+uniform samplerBuffer cluster_lights;
+// first index and count of the lights of every cluster
+uniform usamplerBuffer cluster_ranges;
+uniform usamplerBuffer cluster_light_indices;
+uniform ivec3 cluster_grid;
+uniform vec2 cluster_tile_size;
+// slice of a depth is log(depth) * x + y
+uniform vec2 cluster_depth_scale_bias;
+
+vec3 clustered_lights(vec3 albedo, vec3 n, vec3 E) {
+    vec3 position = -EyeDirection_cameraspace;
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / cluster_tile_size), ivec2(0), cluster_grid.xy - 1);
+    int slice = int(floor(log(-position.z) * cluster_depth_scale_bias.x + cluster_depth_scale_bias.y));
+    slice = clamp(slice, 0, cluster_grid.z - 1);
+    uvec2 range = texelFetch(cluster_ranges, (slice * cluster_grid.y + tile.y) * cluster_grid.x + tile.x).xy;
+
+    vec3 sum = vec3(0);
+    for(uint i = range.x; i != range.x + range.y; ++i) {
+        int light = int(texelFetch(cluster_light_indices, int(i)).x);
+        vec4 sphere = texelFetch(cluster_lights, 2 * light);
+        vec3 to_light = sphere.xyz - position;
+        float distance = length(to_light);
+        if(distance >= sphere.w) {
+            continue;
+        }
+        // inverse square, brought smoothly to 0 at the radius
+        float window = clamp(1 - pow(distance / sphere.w, 4), 0, 1);
+        float attenuation = window * window / (distance * distance + 1);
+
+        vec3 l = to_light / distance;
+        float cosTheta = clamp(dot(n, l), 0, 1);
+        vec3 R = reflect(-l,n);
+        float cosAlpha = clamp(dot(E, R), 0, 1);
+        vec3 point_color = texelFetch(cluster_lights, 2 * light + 1).rgb;
+        sum += (albedo * cosTheta + specular * pow(cosAlpha,5)) * point_color * attenuation;
+    }
+    return sum;
+}
+#endif
+
 void main() {
     vec3 MaterialDiffuseColor = texture2D(texture_sampler, UV).rgb;
+#ifdef INSTANCED
+    MaterialDiffuseColor *= Tint;
+#endif
+#ifdef GBUFFER
+#ifdef WIREFRAME
+    MaterialDiffuseColor = mix(MaterialDiffuseColor, WIRE_COLOR, wire_coverage());
+#endif
+    gl_FragData[0] = vec4(MaterialDiffuseColor, 1);
+    gl_FragData[1] = vec4(normalize(Normal_cameraspace), EyeDirection_cameraspace.z);
+#else
     vec3 MaterialAmbientColor = ambient * MaterialDiffuseColor;
     vec3 MaterialSpecularColor = specular;
 
@@ -34,4 +113,11 @@ void main() {
     color = MaterialAmbientColor +
             MaterialDiffuseColor * light_color * light_power * cosTheta / (distance*distance) +
             MaterialSpecularColor * light_color * light_power * pow(cosAlpha,5) / (distance*distance);
+#ifdef CLUSTERED
+    color += clustered_lights(MaterialDiffuseColor, n, E);
+#endif
+#ifdef WIREFRAME
+    color = mix(color, WIRE_COLOR, wire_coverage());
+#endif
+#endif
 }
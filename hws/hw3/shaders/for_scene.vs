@@ -1,5 +1,15 @@
 #version 130
 
+#ifdef WIREFRAME
+// wireframe.gs sits in between and hands these on under their own names
+#define UV vs_UV
+#define Position_worldspace vs_Position_worldspace
+#define Normal_cameraspace vs_Normal_cameraspace
+#define EyeDirection_cameraspace vs_EyeDirection_cameraspace
+#define LightDirection_cameraspace vs_LightDirection_cameraspace
+#define Tint vs_Tint
+#endif
+
 in vec3 vert_pos_modelspace;
 in vec2 vert_uv;
 in vec3 vert_normal_modelspace;
@@ -10,19 +20,38 @@ out vec3 Normal_cameraspace;
 out vec3 EyeDirection_cameraspace;
 out vec3 LightDirection_cameraspace;
 
+// the depth prepass runs this shader in another program, the lit pass
+// then tests GL_EQUAL against its depths
+invariant gl_Position;
+
 uniform mat4 mvp;
 uniform mat4 view;
 uniform mat4 model;
 
+#ifdef INSTANCED
+// placement of the copy, applied after the object's own rotation
+in mat4 instance_model;
+in vec3 instance_tint;
+out vec3 Tint;
+uniform mat4 proj;
+#endif
+
 uniform vec3 lightpos_worldspace;
 uniform float tex_coords_scale;
 
 void main() {
+#ifdef INSTANCED
+    mat4 world = instance_model * model;
+    gl_Position = proj * view * world * vec4(vert_pos_modelspace, 1);
+    Tint = instance_tint;
+#else
+    mat4 world = model;
     gl_Position =  mvp * vec4(vert_pos_modelspace, 1);
+#endif
 
-    Position_worldspace = (model * vec4(vert_pos_modelspace, 1)).xyz;
+    Position_worldspace = (world * vec4(vert_pos_modelspace, 1)).xyz;
 
-    mat4 modelview = view * model;
+    mat4 modelview = view * world;
     vec3 vertexPosition_cameraspace = (modelview * vec4(vert_pos_modelspace, 1)).xyz;
     EyeDirection_cameraspace = vec3(0,0,0) - vertexPosition_cameraspace;
 
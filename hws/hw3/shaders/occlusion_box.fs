@@ -0,0 +1,6 @@
+#version 130
+
+// the box only counts samples, color and depth writes are off
+
+void main() {
+}
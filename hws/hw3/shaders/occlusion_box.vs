@@ -0,0 +1,13 @@
+#version 130
+
+// bounding box of a queued object for its occlusion query
+
+in vec3 box_corner;
+
+uniform mat4 mvp;
+uniform vec3 box_min;
+uniform vec3 box_max;
+
+void main() {
+    gl_Position = mvp * vec4(mix(box_min, box_max, box_corner), 1);
+}
@@ -0,0 +1,45 @@
+#version 150
+
+// Passes the triangles of for_scene.vs on unchanged and gives each corner
+// its barycentric coordinates, so the fragment shader can draw the edges
+// over the shaded surface in the same pass. The scene's #version 130 stages
+// link with it on the drivers that have geometry shaders (GL 3.2).
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec2 vs_UV[];
+in vec3 vs_Position_worldspace[];
+in vec3 vs_Normal_cameraspace[];
+in vec3 vs_EyeDirection_cameraspace[];
+in vec3 vs_LightDirection_cameraspace[];
+#ifdef INSTANCED
+in vec3 vs_Tint[];
+#endif
+
+out vec2 UV;
+out vec3 Position_worldspace;
+out vec3 Normal_cameraspace;
+out vec3 EyeDirection_cameraspace;
+out vec3 LightDirection_cameraspace;
+#ifdef INSTANCED
+out vec3 Tint;
+#endif
+out vec3 Barycentric;
+
+void main() {
+    for(int i = 0; i != 3; ++i) {
+        gl_Position = gl_in[i].gl_Position;
+        UV = vs_UV[i];
+        Position_worldspace = vs_Position_worldspace[i];
+        Normal_cameraspace = vs_Normal_cameraspace[i];
+        EyeDirection_cameraspace = vs_EyeDirection_cameraspace[i];
+        LightDirection_cameraspace = vs_LightDirection_cameraspace[i];
+#ifdef INSTANCED
+        Tint = vs_Tint[i];
+#endif
+        Barycentric = vec3(i == 0, i == 1, i == 2);
+        EmitVertex();
+    }
+    EndPrimitive();
+}
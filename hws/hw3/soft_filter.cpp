@@ -0,0 +1,153 @@
+#include "soft_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+// rows a task filters
+int const ROWS_PER_TASK = 16;
+
+float const PI = 3.14159265358979323846264f;
+
+// texture2D of a clamped texel of the source pass
+struct clamped_image {
+    uint8_t const* pixels;
+    int width;
+    int height;
+
+    vec3 at(int x, int y) const {
+        x = std::min(std::max(x, 0), width - 1);
+        y = std::min(std::max(y, 0), height - 1);
+        uint8_t const* p = pixels + (size_t(y) * width + x) * 4;
+        return vec3(p[0], p[1], p[2]) / 255.0f;
+    }
+};
+
+float rgb_to_brightness(vec3 const& rgb) {
+    return std::min(1.0f, rgb[0] * 0.2989f + rgb[1] * 0.5870f + rgb[2] * 0.1140f);
+}
+
+float gaussian_function(int x, float variance) {
+    float const numer = std::exp(-1 * x * x / (2 * variance * variance));
+    float const denom = variance * std::sqrt(2 * PI);
+    return numer / denom;
+}
+
+// sobel_x_weight and sobel_y_weight, indexed by (i + 1) * 3 + (j + 1)
+int const SOBEL_X_WEIGHT[9] = { -1, 0, 1, -2, 0, 2, -1, 0, 1 };
+int const SOBEL_Y_WEIGHT[9] = { -1, -2, -1, 0, 0, 0, 1, 2, 1 };
+
+vec3 filter_pixel(filter f, filter_params const& params, clamped_image const& src, int x, int y) {
+    switch(f) {
+    case BOX_BLUR: {
+        vec3 sum(0);
+        for(int i = -1; i <= 1; ++i) {
+            for(int j = -1; j <= 1; ++j) {
+                sum += src.at(x + i, y + j);
+            }
+        }
+        return sum / 9.0f;
+    }
+    case GAUSSIAN_HORIZONTAL_BLUR:
+    case GAUSSIAN_VERTICAL_BLUR: {
+        bool const horizontal = f == GAUSSIAN_HORIZONTAL_BLUR;
+        vec3 sum(0);
+        float kernel_sum = 0;
+        for(int i = -params.gaussian_kernel_radius; i <= params.gaussian_kernel_radius; ++i) {
+            float const weight = gaussian_function(i, params.gaussian_variance);
+            kernel_sum += weight;
+            sum += src.at(horizontal ? x + i : x, horizontal ? y : y + i) * weight;
+        }
+        return sum / kernel_sum;
+    }
+    case SOBEL_FILTER: {
+        vec3 sum_x(0);
+        vec3 sum_y(0);
+        for(int i = -1; i <= 1; ++i) {
+            for(int j = -1; j <= 1; ++j) {
+                vec3 const texel = src.at(x + i, y + j);
+                int const index = (i + 1) * 3 + (j + 1);
+                sum_x += texel * float(SOBEL_X_WEIGHT[index]);
+                sum_y += texel * float(SOBEL_Y_WEIGHT[index]);
+            }
+        }
+        float const brightness = rgb_to_brightness(abs(sum_x) + abs(sum_y));
+        return brightness < params.sobel_threshold ? vec3(0) : vec3(brightness);
+    }
+    case GRAYSCALE:
+        return vec3(rgb_to_brightness(src.at(x, y)));
+    case THRESHOLD: {
+        vec3 const rgb = src.at(x, y);
+        return rgb_to_brightness(rgb) < params.threshold ? vec3(0) : rgb;
+    }
+    case TONE_ADJUST: {
+        vec3 const rgb = clamp(src.at(x, y) * params.tone_exposure, 0.0f, 1.0f);
+        float const power = 1 / params.tone_gamma;
+        return vec3(std::pow(rgb.x, power), std::pow(rgb.y, power), std::pow(rgb.z, power));
+    }
+    default:
+        return src.at(x, y);
+    }
+}
+
+uint8_t to_unorm8(float c) {
+    return uint8_t(std::lrint(std::min(std::max(c, 0.0f), 1.0f) * 255));
+}
+
+} // namespace
+
+soft_filter::soft_filter(size_t workers)
+    : pool(new worker_pool(workers))
+{}
+
+void soft_filter::apply(vector<uint8_t>& rgba, int width, int height, vector<filter> const& chain,
+                        filter_params const& params) {
+    size_t const tasks = size_t((height + ROWS_PER_TASK - 1) / ROWS_PER_TASK);
+    for(size_t pass = 0; pass != chain.size(); ++pass) {
+        filter const f = chain[pass];
+        if(f == NO_FILTER) {
+            continue;
+        }
+        source = rgba;
+        clamped_image const src = { source.data(), width, height };
+        pool->run(tasks, [&](size_t task, size_t) {
+            int const first = int(task) * ROWS_PER_TASK;
+            int const last = std::min(height, first + ROWS_PER_TASK);
+            for(int y = first; y != last; ++y) {
+                uint8_t* dst = &rgba[size_t(y) * width * 4];
+                for(int x = 0; x != width; ++x, dst += 4) {
+                    vec3 const c = filter_pixel(f, params, src, x, y);
+                    dst[0] = to_unorm8(c.x);
+                    dst[1] = to_unorm8(c.y);
+                    dst[2] = to_unorm8(c.z);
+                    dst[3] = 255;
+                }
+            }
+        });
+    }
+}
+
+image_difference compare_rgba(vector<uint8_t> const& a, vector<uint8_t> const& b, int tolerance) {
+    image_difference diff = { 0, 0, 0 };
+    size_t const pixels = std::min(a.size(), b.size()) / 4;
+    if(pixels == 0) {
+        return diff;
+    }
+    double sum = 0;
+    size_t over = 0;
+    for(size_t i = 0; i != pixels; ++i) {
+        int pixel_max = 0;
+        for(size_t c = 0; c != 3; ++c) {
+            int const d = std::abs(int(a[i * 4 + c]) - int(b[i * 4 + c]));
+            pixel_max = std::max(pixel_max, d);
+            sum += d;
+        }
+        diff.max_channel = std::max(diff.max_channel, pixel_max);
+        over += pixel_max > tolerance ? 1 : 0;
+    }
+    diff.mean_channel = float(sum / (pixels * 3));
+    diff.pixels_over = float(over) / pixels;
+    return diff;
+}
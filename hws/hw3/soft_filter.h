@@ -0,0 +1,37 @@
+#ifndef SOFT_FILTER_H
+#define SOFT_FILTER_H
+
+#include "common.h"
+#include "filter_pipeline.h"
+#include "worker_pool.h"
+
+#include <cstdint>
+
+// The for_filtered.fs filters on the CPU, for images of the software
+// rasterizer. Images are RGBA8 with rows from the bottom, as
+// filter_pipeline reads its results back, and every pass reads the 8 bit
+// result of the one before with the border clamped, like the GL passes
+// sample their targets. Rows are split over the pool.
+class soft_filter {
+public:
+    explicit soft_filter(size_t workers);
+
+    void apply(vector<uint8_t>& rgba, int width, int height, vector<filter> const& chain,
+               filter_params const& params);
+
+private:
+    unique_ptr<worker_pool> pool;
+    vector<uint8_t> source;
+};
+
+// how far two RGBA8 images of the same size are apart, alpha aside
+struct image_difference {
+    int max_channel;
+    float mean_channel;
+    // share of the pixels with a channel off by more than the tolerance
+    float pixels_over;
+};
+
+image_difference compare_rgba(vector<uint8_t> const& a, vector<uint8_t> const& b, int tolerance);
+
+#endif // SOFT_FILTER_H
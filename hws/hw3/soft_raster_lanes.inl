@@ -0,0 +1,169 @@
+// Included by soft_rasterizer.cpp once for each set of lanes, inside the
+// namespace that defines f8, m8 and their operations for it, with
+// SOFT_LANES_TARGET the instruction set the functions are compiled for.
+
+struct v8 {
+    f8 x, y, z;
+};
+
+SOFT_LANES_TARGET inline f8 dot8(v8 const& a, v8 const& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+SOFT_LANES_TARGET inline v8 normalize8(v8 const& a) {
+    f8 const inv = f8(1) / sqrt8(dot8(a, a));
+    v8 const r = { a.x * inv, a.y * inv, a.z * inv };
+    return r;
+}
+
+SOFT_LANES_TARGET inline f8 clamp8(f8 const& x, float lo, float hi) { return min8(max8(x, f8(lo)), f8(hi)); }
+
+SOFT_LANES_TARGET inline f8 smoothstep8(float edge0, float edge1, f8 const& x) {
+    f8 const t = clamp8((x - f8(edge0)) / f8(edge1 - edge0), 0, 1);
+    return t * t * (f8(3) - f8(2) * t);
+}
+
+// a plane of the triangle at pixels rx to the right of its box and ry up
+template<typename plane_type>
+SOFT_LANES_TARGET inline f8 at(plane_type const& p, f8 const& rx, float ry) {
+    return f8(p.value + p.dy * ry) + f8(p.dx) * rx;
+}
+
+// the change of a perspective interpolated value by one pixel, from its
+// plane over w, the 1/w plane and w at the pixel
+template<typename plane_type>
+SOFT_LANES_TARGET inline void derivatives(plane_type const& value_plane, plane_type const& inv_w_plane, f8 const& value, f8 const& w,
+                        f8& dx, f8& dy) {
+    dx = (f8(value_plane.dx) - value * f8(inv_w_plane.dx)) * w;
+    dy = (f8(value_plane.dy) - value * f8(inv_w_plane.dy)) * w;
+}
+
+// perspective correct varyings at the pixels, w is at the pixels too
+template<typename plane_type>
+SOFT_LANES_TARGET inline f8 varying_at(plane_type const* planes, int i, f8 const& rx, float ry, f8 const& w) {
+    return at(planes[i], rx, ry) * w;
+}
+
+template<typename plane_type>
+SOFT_LANES_TARGET inline v8 varying3_at(plane_type const* planes, int i, f8 const& rx, float ry, f8 const& w) {
+    v8 const r = { varying_at(planes, i, rx, ry, w), varying_at(planes, i + 1, rx, ry, w),
+                   varying_at(planes, i + 2, rx, ry, w) };
+    return r;
+}
+
+// The pixels [xa, xb] x [ya, yb] of a set up triangle, in spans of 8:
+// edge tests, the depth test, perspective correct varyings, the texture
+// and for_scene.fs lighting. Rows of color and depth are stride apart.
+template<typename triangle_type>
+SOFT_LANES_TARGET void raster_spans(triangle_type const& tri, int xa, int xb, int ya, int yb, soft_texture const& texture,
+                                    vec3 const& tint, soft_light const& light, bool wireframe, uint32_t* color,
+                                    float* depth, int stride)
+{
+    bool const mipmapped = texture.current_filtering() == soft_texture::MIPMAP;
+
+    f8 const lanes = lane_index();
+    // spans start 8-aligned, lanes outside [xa, xb] are masked off
+    int const first_span = xa & ~7;
+    for(int y = ya; y <= yb; ++y) {
+        float const ry = float(y - tri.y0);
+        for(int x = first_span; x <= xb; x += 8) {
+            f8 const px = f8(float(x)) + lanes;
+            f8 const rx = f8(float(x - tri.x0)) + lanes;
+            m8 covered = (px > f8(xa - 0.5f)) & (px < f8(xb + 0.5f));
+            for(int e = 0; e != 3; ++e) {
+                f8 const edge = at(tri.edges[e], rx, ry);
+                covered = covered & (tri.top_left[e] ? edge >= f8(0) : edge > f8(0));
+            }
+            if(!bits(covered)) {
+                continue;
+            }
+
+            size_t const offset = size_t(y) * stride + x;
+            f8 const z = at(tri.depth, rx, ry);
+            f8 const stored_z = load8(depth + offset);
+            m8 const passed = covered & (z < stored_z);
+            int const lanes_passed = bits(passed);
+            if(!lanes_passed) {
+                continue;
+            }
+            store8(depth + offset, select(passed, z, stored_z));
+
+            // perspective correct varyings
+            f8 const w = f8(1) / at(tri.inv_w, rx, ry);
+            f8 const u = varying_at(tri.varyings, UV, rx, ry, w);
+            f8 const v = varying_at(tri.varyings, UV + 1, rx, ry, w);
+
+            // texture2D(texture_sampler, UV), a texel at a time
+            float us[8], vs[8], rho[8];
+            store8(us, u);
+            store8(vs, v);
+            if(mipmapped) {
+                f8 dudx, dudy, dvdx, dvdy;
+                derivatives(tri.varyings[UV], tri.inv_w, u, w, dudx, dudy);
+                derivatives(tri.varyings[UV + 1], tri.inv_w, v, w, dvdx, dvdy);
+                f8 const tw(float(texture.width()));
+                f8 const th(float(texture.height()));
+                f8 const along_x = sqrt8(dudx * dudx * tw * tw + dvdx * dvdx * th * th);
+                f8 const along_y = sqrt8(dudy * dudy * tw * tw + dvdy * dvdy * th * th);
+                store8(rho, max8(along_x, along_y));
+            }
+            float rs[8], gs[8], bs[8];
+            for(int i = 0; i != 8; ++i) {
+                vec3 texel(0);
+                if(lanes_passed & (1 << i)) {
+                    texel = texture.sample(us[i], vs[i], mipmapped ? std::log2(rho[i]) : 0);
+                }
+                rs[i] = texel.x * tint.x;
+                gs[i] = texel.y * tint.y;
+                bs[i] = texel.z * tint.z;
+            }
+            v8 const diffuse = { load8(rs), load8(gs), load8(bs) };
+
+            // for_scene.fs forward lighting
+            v8 const world = varying3_at(tri.varyings, POSITION_WORLDSPACE, rx, ry, w);
+            v8 const to_light = {
+                f8(light.position_worldspace.x) - world.x,
+                f8(light.position_worldspace.y) - world.y,
+                f8(light.position_worldspace.z) - world.z
+            };
+            f8 const distance2 = dot8(to_light, to_light);
+            v8 const n = normalize8(varying3_at(tri.varyings, NORMAL_CAMERASPACE, rx, ry, w));
+            v8 const l = normalize8(varying3_at(tri.varyings, LIGHT_DIRECTION_CAMERASPACE, rx, ry, w));
+            f8 const n_dot_l = dot8(n, l);
+            f8 const cos_theta = clamp8(n_dot_l, 0, 1);
+            v8 const e = normalize8(varying3_at(tri.varyings, EYE_DIRECTION_CAMERASPACE, rx, ry, w));
+            // reflect(-l, n)
+            v8 const r = {
+                f8(2) * n_dot_l * n.x - l.x,
+                f8(2) * n_dot_l * n.y - l.y,
+                f8(2) * n_dot_l * n.z - l.z
+            };
+            f8 const cos_alpha = clamp8(dot8(e, r), 0, 1);
+            f8 const cos_alpha2 = cos_alpha * cos_alpha;
+            f8 const highlight = cos_alpha2 * cos_alpha2 * cos_alpha;
+            f8 const intensity = f8(light.power) / distance2;
+            f8 const diffuse_factor = intensity * cos_theta;
+            f8 const specular_factor = intensity * highlight;
+            f8 red = f8(light.ambient.x) * diffuse.x + diffuse.x * f8(light.color.x) * diffuse_factor
+                   + f8(light.specular.x * light.color.x) * specular_factor;
+            f8 green = f8(light.ambient.y) * diffuse.y + diffuse.y * f8(light.color.y) * diffuse_factor
+                     + f8(light.specular.y * light.color.y) * specular_factor;
+            f8 blue = f8(light.ambient.z) * diffuse.z + diffuse.z * f8(light.color.z) * diffuse_factor
+                    + f8(light.specular.z * light.color.z) * specular_factor;
+
+            if(wireframe) {
+                // wire_coverage(), fwidth from the planes instead of the 2x2 quad
+                f8 nearest(1e30f);
+                for(int i = 0; i != 3; ++i) {
+                    f8 const bary = varying_at(tri.varyings, BARYCENTRIC + i, rx, ry, w);
+                    f8 dx, dy;
+                    derivatives(tri.varyings[BARYCENTRIC + i], tri.inv_w, bary, w, dx, dy);
+                    nearest = min8(nearest, bary / (abs8(dx) + abs8(dy)));
+                }
+                f8 const coverage = f8(1) - smoothstep8(0.5f * WIRE_WIDTH - 0.5f, 0.5f * WIRE_WIDTH + 0.5f, nearest);
+                red = red + (f8(WIRE_COLOR) - red) * coverage;
+                green = green + (f8(WIRE_COLOR) - green) * coverage;
+                blue = blue + (f8(WIRE_COLOR) - blue) * coverage;
+            }
+            store_color(color + offset, passed, red, green, blue);
+        }
+    }
+}
@@ -0,0 +1,690 @@
+#include "soft_rasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// SOFT_RASTER_AVX2 comes from the build and adds AVX2 lanes next to the
+// scalar ones; the CPU decides which run. The file is compiled for the
+// baseline CPU and only the AVX2 lanes are marked for it, so no inline
+// function shared with the rest of the program (glm, the standard
+// library) is ever emitted with AVX2 encodings. MSVC needs no marking,
+// it emits intrinsics whatever /arch is.
+#if defined(SOFT_RASTER_AVX2)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SOFT_AVX2_TARGET
+#else
+#define SOFT_AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
+#else
+#define SOFT_AVX2_TARGET
+#endif
+
+namespace {
+
+// triangles reaching further out than this many half-viewports are cut,
+// so window coordinates stay small enough for float edge functions
+float const GUARD_BAND = 4;
+// window coordinates are snapped to 1/256 of a pixel like GL hardware does
+float const SUBPIXELS = 256;
+// work of a geometry task
+size_t const CHUNK_VERTICES = 4096;
+size_t const CHUNK_TRIANGLES = 1024;
+
+// for_scene.fs
+float const WIRE_COLOR = 1;
+float const WIRE_WIDTH = 1.5f;
+
+// offsets into the varyings, for_scene.vs outputs in order
+enum varying_offset {
+    UV = 0,
+    POSITION_WORLDSPACE = 2,
+    NORMAL_CAMERASPACE = 5,
+    EYE_DIRECTION_CAMERASPACE = 8,
+    LIGHT_DIRECTION_CAMERASPACE = 11,
+    BARYCENTRIC = 14
+};
+
+// 8 lanes of floats and of lane masks as plain arrays the compiler is
+// left to vectorize, for any CPU
+namespace scalar_lanes {
+
+#define SOFT_LANES_TARGET
+struct f8 {
+    float v[8];
+    f8() {}
+    f8(float s) { for(int i = 0; i != 8; ++i) v[i] = s; }
+};
+
+struct m8 {
+    bool v[8];
+};
+
+#define SOFT_F8_OPERATOR(op) \
+    inline f8 operator op(f8 const& a, f8 const& b) { \
+        f8 r; for(int i = 0; i != 8; ++i) r.v[i] = a.v[i] op b.v[i]; return r; \
+    }
+#define SOFT_M8_OPERATOR(op) \
+    inline m8 operator op(f8 const& a, f8 const& b) { \
+        m8 r; for(int i = 0; i != 8; ++i) r.v[i] = a.v[i] op b.v[i]; return r; \
+    }
+SOFT_F8_OPERATOR(+)
+SOFT_F8_OPERATOR(-)
+SOFT_F8_OPERATOR(*)
+SOFT_F8_OPERATOR(/)
+SOFT_M8_OPERATOR(<)
+SOFT_M8_OPERATOR(>)
+SOFT_M8_OPERATOR(>=)
+#undef SOFT_F8_OPERATOR
+#undef SOFT_M8_OPERATOR
+
+inline f8 min8(f8 const& a, f8 const& b) { f8 r; for(int i = 0; i != 8; ++i) r.v[i] = std::min(a.v[i], b.v[i]); return r; }
+inline f8 max8(f8 const& a, f8 const& b) { f8 r; for(int i = 0; i != 8; ++i) r.v[i] = std::max(a.v[i], b.v[i]); return r; }
+inline f8 sqrt8(f8 const& a) { f8 r; for(int i = 0; i != 8; ++i) r.v[i] = std::sqrt(a.v[i]); return r; }
+inline f8 abs8(f8 const& a) { f8 r; for(int i = 0; i != 8; ++i) r.v[i] = std::fabs(a.v[i]); return r; }
+
+inline m8 operator&(m8 const& a, m8 const& b) { m8 r; for(int i = 0; i != 8; ++i) r.v[i] = a.v[i] && b.v[i]; return r; }
+inline int bits(m8 const& m) { int r = 0; for(int i = 0; i != 8; ++i) r |= int(m.v[i]) << i; return r; }
+inline f8 select(m8 const& m, f8 const& a, f8 const& b) { f8 r; for(int i = 0; i != 8; ++i) r.v[i] = m.v[i] ? a.v[i] : b.v[i]; return r; }
+
+inline f8 load8(float const* p) { f8 r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+inline void store8(float* p, f8 const& a) { std::memcpy(p, a.v, sizeof(a.v)); }
+inline f8 lane_index() { f8 r; for(int i = 0; i != 8; ++i) r.v[i] = float(i); return r; }
+
+inline uint32_t to_unorm8(float c) { return uint32_t(std::lrint(std::min(std::max(c, 0.0f), 1.0f) * 255)); }
+
+inline void store_color(uint32_t* dst, m8 const& mask, f8 const& r, f8 const& g, f8 const& b) {
+    for(int i = 0; i != 8; ++i) {
+        if(mask.v[i]) {
+            dst[i] = to_unorm8(r.v[i]) | to_unorm8(g.v[i]) << 8 | to_unorm8(b.v[i]) << 16 | 0xff000000u;
+        }
+    }
+}
+
+#include "soft_raster_lanes.inl"
+#undef SOFT_LANES_TARGET
+
+} // namespace scalar_lanes
+
+#ifdef SOFT_RASTER_AVX2
+// the same lanes, one AVX register each
+namespace avx2_lanes {
+
+#define SOFT_LANES_TARGET SOFT_AVX2_TARGET
+struct f8 {
+    __m256 v;
+    SOFT_AVX2_TARGET f8() {}
+    SOFT_AVX2_TARGET f8(__m256 v) : v(v) {}
+    SOFT_AVX2_TARGET f8(float s) : v(_mm256_set1_ps(s)) {}
+};
+
+struct m8 {
+    __m256 v;
+    SOFT_AVX2_TARGET m8(__m256 v) : v(v) {}
+};
+
+SOFT_AVX2_TARGET inline f8 operator+(f8 a, f8 b) { return _mm256_add_ps(a.v, b.v); }
+SOFT_AVX2_TARGET inline f8 operator-(f8 a, f8 b) { return _mm256_sub_ps(a.v, b.v); }
+SOFT_AVX2_TARGET inline f8 operator*(f8 a, f8 b) { return _mm256_mul_ps(a.v, b.v); }
+SOFT_AVX2_TARGET inline f8 operator/(f8 a, f8 b) { return _mm256_div_ps(a.v, b.v); }
+SOFT_AVX2_TARGET inline f8 min8(f8 a, f8 b) { return _mm256_min_ps(a.v, b.v); }
+SOFT_AVX2_TARGET inline f8 max8(f8 a, f8 b) { return _mm256_max_ps(a.v, b.v); }
+SOFT_AVX2_TARGET inline f8 sqrt8(f8 a) { return _mm256_sqrt_ps(a.v); }
+SOFT_AVX2_TARGET inline f8 abs8(f8 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+
+SOFT_AVX2_TARGET inline m8 operator<(f8 a, f8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+SOFT_AVX2_TARGET inline m8 operator>(f8 a, f8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+SOFT_AVX2_TARGET inline m8 operator>=(f8 a, f8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+SOFT_AVX2_TARGET inline m8 operator&(m8 a, m8 b) { return _mm256_and_ps(a.v, b.v); }
+// lane i is bit i
+SOFT_AVX2_TARGET inline int bits(m8 m) { return _mm256_movemask_ps(m.v); }
+SOFT_AVX2_TARGET inline f8 select(m8 m, f8 a, f8 b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+
+SOFT_AVX2_TARGET inline f8 load8(float const* p) { return _mm256_loadu_ps(p); }
+SOFT_AVX2_TARGET inline void store8(float* p, f8 a) { _mm256_storeu_ps(p, a.v); }
+SOFT_AVX2_TARGET inline f8 lane_index() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+
+// RGBA8 with alpha 1, into the lanes of mask
+SOFT_AVX2_TARGET inline void store_color(uint32_t* dst, m8 mask, f8 r, f8 g, f8 b) {
+    __m256 const scale = _mm256_set1_ps(255);
+    __m256 const zero = _mm256_setzero_ps();
+    __m256 const one = _mm256_set1_ps(1);
+    __m256i const ri = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(r.v, zero), one), scale));
+    __m256i const gi = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(g.v, zero), one), scale));
+    __m256i const bi = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(b.v, zero), one), scale));
+    __m256i pixels = _mm256_or_si256(ri, _mm256_slli_epi32(gi, 8));
+    pixels = _mm256_or_si256(pixels, _mm256_slli_epi32(bi, 16));
+    pixels = _mm256_or_si256(pixels, _mm256_set1_epi32(int(0xff000000u)));
+    __m256i* const p = reinterpret_cast<__m256i*>(dst);
+    __m256i const old = _mm256_loadu_si256(p);
+    _mm256_storeu_si256(p, _mm256_blendv_epi8(old, pixels, _mm256_castps_si256(mask.v)));
+}
+
+#include "soft_raster_lanes.inl"
+#undef SOFT_LANES_TARGET
+
+} // namespace avx2_lanes
+
+// AVX2 and FMA, and the AVX state saved by the OS; asked once
+bool cpu_has_avx2() {
+    struct cpu_check {
+        static bool run() {
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if(info[0] < 7) {
+                return false;
+            }
+            __cpuidex(info, 1, 0);
+            bool const fma = (info[2] & (1 << 12)) != 0;
+            bool const osxsave = (info[2] & (1 << 27)) != 0;
+            bool const avx = (info[2] & (1 << 28)) != 0;
+            if(!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+                return false;
+            }
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+        }
+    };
+    static bool const supported = cpu_check::run();
+    return supported;
+}
+#endif
+
+inline int wrap(int i, int n) {
+    i %= n;
+    return i < 0 ? i + n : i;
+}
+
+inline float snap(float window_coordinate) {
+    return std::floor(window_coordinate * SUBPIXELS + 0.5f) / SUBPIXELS;
+}
+
+} // namespace
+
+soft_texture::soft_texture(int width, int height, GLenum format, void const* pixels)
+    : mode(NEAREST)
+{
+    int const pixel_size = format == GL_LUMINANCE ? 1 : 3;
+    // rows are aligned to 4 bytes, GL_UNPACK_ALIGNMENT
+    int const pitch = (width * pixel_size + 3) & ~3;
+    level base = { width, height, vector<uint32_t>(size_t(width) * height) };
+    unsigned char const* const src = static_cast<unsigned char const*>(pixels);
+    for(int y = 0; y != height; ++y) {
+        unsigned char const* row = src + size_t(y) * pitch;
+        for(int x = 0; x != width; ++x) {
+            uint32_t r = row[x * pixel_size];
+            uint32_t g = r;
+            uint32_t b = r;
+            if(format == GL_RGB) {
+                g = row[x * 3 + 1];
+                b = row[x * 3 + 2];
+            } else if(format == GL_BGR) {
+                b = r;
+                g = row[x * 3 + 1];
+                r = row[x * 3 + 2];
+            }
+            base.texels[size_t(y) * width + x] = r | g << 8 | b << 16 | 0xff000000u;
+        }
+    }
+    levels.push_back(base);
+}
+
+void soft_texture::set_filtering(filtering f) {
+    mode = f;
+    if(mode != MIPMAP || levels.size() > 1) {
+        return;
+    }
+    // 2x2 box filter down to 1x1, a dimension of 1 stays
+    while(levels.back().width > 1 || levels.back().height > 1) {
+        level const& src = levels.back();
+        level next = { std::max(1, src.width / 2), std::max(1, src.height / 2), vector<uint32_t>() };
+        next.texels.resize(size_t(next.width) * next.height);
+        for(int y = 0; y != next.height; ++y) {
+            int const y0 = std::min(2 * y, src.height - 1);
+            int const y1 = std::min(2 * y + 1, src.height - 1);
+            for(int x = 0; x != next.width; ++x) {
+                int const x0 = std::min(2 * x, src.width - 1);
+                int const x1 = std::min(2 * x + 1, src.width - 1);
+                uint32_t const quad[4] = {
+                    src.texels[size_t(y0) * src.width + x0], src.texels[size_t(y0) * src.width + x1],
+                    src.texels[size_t(y1) * src.width + x0], src.texels[size_t(y1) * src.width + x1]
+                };
+                uint32_t texel = 0xff000000u;
+                for(int shift = 0; shift != 24; shift += 8) {
+                    uint32_t sum = 2;
+                    for(int i = 0; i != 4; ++i) {
+                        sum += (quad[i] >> shift) & 0xff;
+                    }
+                    texel |= (sum / 4) << shift;
+                }
+                next.texels[size_t(y) * next.width + x] = texel;
+            }
+        }
+        levels.push_back(next);
+    }
+}
+
+vec3 soft_texture::texel(level const& l, int x, int y) const {
+    uint32_t const t = l.texels[size_t(wrap(y, l.height)) * l.width + wrap(x, l.width)];
+    return vec3(float(t & 0xff), float((t >> 8) & 0xff), float((t >> 16) & 0xff)) / 255.0f;
+}
+
+vec3 soft_texture::sample_nearest(level const& l, float u, float v) const {
+    return texel(l, int(std::floor(u * l.width)), int(std::floor(v * l.height)));
+}
+
+vec3 soft_texture::sample_linear(level const& l, float u, float v) const {
+    float const fx = u * l.width - 0.5f;
+    float const fy = v * l.height - 0.5f;
+    float const x0 = std::floor(fx);
+    float const y0 = std::floor(fy);
+    float const a = fx - x0;
+    float const b = fy - y0;
+    int const x = int(x0);
+    int const y = int(y0);
+    vec3 const bottom = mix(texel(l, x, y), texel(l, x + 1, y), a);
+    vec3 const top = mix(texel(l, x, y + 1), texel(l, x + 1, y + 1), a);
+    return mix(bottom, top, b);
+}
+
+vec3 soft_texture::sample(float u, float v, float lod) const {
+    if(mode == NEAREST) {
+        return sample_nearest(levels[0], u, v);
+    }
+    // magnified, or no levels: GL_LINEAR
+    if(mode == LINEAR || !(lod > 0)) {
+        return sample_linear(levels[0], u, v);
+    }
+    // GL_LINEAR_MIPMAP_LINEAR
+    float const top = float(levels.size() - 1);
+    lod = std::min(lod, top);
+    size_t const first = size_t(lod);
+    size_t const second = std::min(first + 1, levels.size() - 1);
+    return mix(sample_linear(levels[first], u, v), sample_linear(levels[second], u, v), lod - float(first));
+}
+
+soft_rasterizer::soft_rasterizer(size_t workers)
+    : pool(new worker_pool(workers))
+    , target_width(0)
+    , target_height(0)
+    , stride(0)
+    , tiles_x(0)
+    , tiles_y(0)
+    , frame_triangles(0)
+    , last_frame_ms(0)
+    , last_triangles(0)
+{}
+
+char const* soft_rasterizer::simd_name() {
+#ifdef SOFT_RASTER_AVX2
+    if(cpu_has_avx2()) {
+        return "AVX2";
+    }
+#endif
+    return "scalar";
+}
+
+void soft_rasterizer::set_workers(size_t workers) {
+    pool.reset(new worker_pool(workers));
+}
+
+void soft_rasterizer::resize(int width, int height) {
+    if(width == target_width && height == target_height) {
+        return;
+    }
+    target_width = width;
+    target_height = height;
+    tiles_x = (width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    tiles_y = (height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    stride = tiles_x * SOFT_TILE_SIZE;
+    color.assign(size_t(stride) * tiles_y * SOFT_TILE_SIZE, 0);
+    depth.assign(color.size(), 1.0f);
+}
+
+void soft_rasterizer::begin_frame(soft_frame const& f) {
+    frame = f;
+    draws.clear();
+}
+
+void soft_rasterizer::draw(soft_mesh const& mesh, soft_texture const& texture, mat4 const& model, vec3 const& tint) {
+    draw_call call;
+    call.mesh = &mesh;
+    call.texture = &texture;
+    call.model = model;
+    call.tint = tint;
+    call.first_vertex = 0;
+    call.first_triangle = 0;
+    draws.push_back(call);
+}
+
+void soft_rasterizer::end_frame() {
+    chrono::high_resolution_clock::time_point const start = chrono::high_resolution_clock::now();
+
+    // vertices, in tasks of at most CHUNK_VERTICES of one draw
+    struct vertex_task {
+        size_t draw;
+        size_t begin;
+        size_t end;
+    };
+    vector<vertex_task> vertex_tasks;
+    size_t vertices = 0;
+    frame_triangles = 0;
+    for(size_t d = 0; d != draws.size(); ++d) {
+        soft_mesh const& mesh = *draws[d].mesh;
+        draws[d].first_vertex = vertices;
+        draws[d].first_triangle = frame_triangles;
+        size_t const count = mesh.vertices.size();
+        for(size_t begin = 0; begin < count; begin += CHUNK_VERTICES) {
+            vertex_task const task = { d, begin, std::min(count, begin + CHUNK_VERTICES) };
+            vertex_tasks.push_back(task);
+        }
+        vertices += count;
+        frame_triangles += (mesh.indices.empty() ? count : mesh.indices.size()) / 3;
+    }
+    transformed.resize(vertices);
+    pool->run(vertex_tasks.size(), [&](size_t task, size_t) {
+        vertex_task const& t = vertex_tasks[task];
+        transform_vertices(t.draw, t.begin, t.end);
+    });
+
+    // triangles, binned by chunk so the tiles see them in submission order
+    size_t const tiles = size_t(tiles_x) * tiles_y;
+    chunks.resize((frame_triangles + CHUNK_TRIANGLES - 1) / CHUNK_TRIANGLES);
+    for(size_t i = 0; i != chunks.size(); ++i) {
+        geometry_chunk& chunk = chunks[i];
+        chunk.first_triangle = i * CHUNK_TRIANGLES;
+        chunk.end_triangle = std::min(frame_triangles, chunk.first_triangle + CHUNK_TRIANGLES);
+        chunk.triangles.clear();
+        chunk.tiles.resize(tiles);
+        for(size_t t = 0; t != tiles; ++t) {
+            chunk.tiles[t].clear();
+        }
+    }
+    pool->run(chunks.size(), [&](size_t chunk, size_t) {
+        process_chunk(chunks[chunk]);
+    });
+
+    pool->run(tiles, [&](size_t tile, size_t) {
+        raster_tile(tile);
+    });
+
+    last_triangles = 0;
+    for(size_t i = 0; i != chunks.size(); ++i) {
+        last_triangles += chunks[i].triangles.size();
+    }
+    last_frame_ms = chrono::duration<float, std::milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+void soft_rasterizer::read_pixels(vector<uint8_t>& rgba) const {
+    size_t const row_bytes = size_t(target_width) * 4;
+    rgba.resize(row_bytes * target_height);
+    for(int y = 0; y != target_height; ++y) {
+        std::memcpy(&rgba[y * row_bytes], &color[size_t(y) * stride], row_bytes);
+    }
+}
+
+// for_scene.vs without INSTANCED, world is the draw's model
+void soft_rasterizer::transform_vertices(size_t d, size_t begin, size_t end) {
+    draw_call const& call = draws[d];
+    mat4 const modelview = frame.view * call.model;
+    mat4 const mvp = frame.proj * modelview;
+    vec3 const light_cameraspace = vec3(frame.view * vec4(frame.light.position_worldspace, 1));
+    for(size_t i = begin; i != end; ++i) {
+        mesh_vertex const& src = call.mesh->vertices[i];
+        shaded_vertex& dst = transformed[call.first_vertex + i];
+        vec4 const position(src.pos, 1);
+        dst.clip = mvp * position;
+
+        vec3 const world = vec3(call.model * position);
+        vec3 const eye = -vec3(modelview * position);
+        vec3 const normal = vec3(modelview * vec4(src.normal, 0));
+        vec3 const light = light_cameraspace + eye;
+        float* const v = dst.varyings;
+        v[UV] = frame.tex_coords_scale * src.uv.x;
+        v[UV + 1] = frame.tex_coords_scale * src.uv.y;
+        for(int c = 0; c != 3; ++c) {
+            v[POSITION_WORLDSPACE + c] = world[c];
+            v[NORMAL_CAMERASPACE + c] = normal[c];
+            v[EYE_DIRECTION_CAMERASPACE + c] = eye[c];
+            v[LIGHT_DIRECTION_CAMERASPACE + c] = light[c];
+        }
+    }
+}
+
+void soft_rasterizer::process_chunk(geometry_chunk& chunk) {
+    size_t d = 0;
+    while(d + 1 < draws.size() && draws[d + 1].first_triangle <= chunk.first_triangle) {
+        ++d;
+    }
+    for(size_t t = chunk.first_triangle; t != chunk.end_triangle; ++t) {
+        while(d + 1 < draws.size() && draws[d + 1].first_triangle <= t) {
+            ++d;
+        }
+        draw_call const& call = draws[d];
+        vector<uint32_t> const& indices = call.mesh->indices;
+        size_t const first = (t - call.first_triangle) * 3;
+        shaded_vertex const* corners[3];
+        for(size_t k = 0; k != 3; ++k) {
+            size_t const index = indices.empty() ? first + k : indices[first + k];
+            corners[k] = &transformed[call.first_vertex + index];
+        }
+        clip_and_setup(uint32_t(d), corners, chunk);
+    }
+}
+
+void soft_rasterizer::clip_and_setup(uint32_t draw, shaded_vertex const* const corners[3], geometry_chunk& chunk) {
+    // signed distances to the near plane and the guard band, >= 0 is inside
+    int const PLANES = 5;
+    auto distance = [](vec4 const& p, int plane) {
+        switch(plane) {
+        case 0: return p.z + p.w;
+        case 1: return p.x + GUARD_BAND * p.w;
+        case 2: return GUARD_BAND * p.w - p.x;
+        case 3: return p.y + GUARD_BAND * p.w;
+        default: return GUARD_BAND * p.w - p.y;
+        }
+    };
+    vec4 const& a = corners[0]->clip;
+    vec4 const& b = corners[1]->clip;
+    vec4 const& c = corners[2]->clip;
+    // wholly outside the view volume
+    if((a.x > a.w && b.x > b.w && c.x > c.w) || (a.x < -a.w && b.x < -b.w && c.x < -c.w)
+       || (a.y > a.w && b.y > b.w && c.y > c.w) || (a.y < -a.w && b.y < -b.w && c.y < -c.w)
+       || (a.z > a.w && b.z > b.w && c.z > c.w) || (a.z < -a.w && b.z < -b.w && c.z < -c.w)) {
+        return;
+    }
+
+    // what wireframe.gs adds to every corner
+    shaded_vertex polygon[2][3 + PLANES];
+    for(int k = 0; k != 3; ++k) {
+        polygon[0][k] = *corners[k];
+        for(int j = 0; j != 3; ++j) {
+            polygon[0][k].varyings[BARYCENTRIC + j] = j == k ? 1.0f : 0.0f;
+        }
+    }
+    int count = 3;
+    int cur = 0;
+    for(int plane = 0; plane != PLANES; ++plane) {
+        if(distance(a, plane) >= 0 && distance(b, plane) >= 0 && distance(c, plane) >= 0) {
+            continue;
+        }
+        // Sutherland-Hodgman against the plane
+        shaded_vertex const* const in = polygon[cur];
+        shaded_vertex* const out = polygon[1 - cur];
+        int out_count = 0;
+        for(int i = 0; i != count; ++i) {
+            shaded_vertex const& p = in[i];
+            shaded_vertex const& q = in[(i + 1) % count];
+            float const dp = distance(p.clip, plane);
+            float const dq = distance(q.clip, plane);
+            if(dp >= 0) {
+                out[out_count++] = p;
+            }
+            if((dp >= 0) != (dq >= 0)) {
+                float const t = dp / (dp - dq);
+                shaded_vertex& cut = out[out_count++];
+                cut.clip = p.clip + (q.clip - p.clip) * t;
+                for(int v = 0; v != VARYINGS; ++v) {
+                    cut.varyings[v] = p.varyings[v] + (q.varyings[v] - p.varyings[v]) * t;
+                }
+            }
+        }
+        count = out_count;
+        cur = 1 - cur;
+        if(count < 3) {
+            return;
+        }
+    }
+    for(int i = 1; i + 1 < count; ++i) {
+        setup(draw, polygon[cur][0], polygon[cur][i], polygon[cur][i + 1], chunk);
+    }
+}
+
+void soft_rasterizer::setup(uint32_t draw, shaded_vertex const& a, shaded_vertex const& b, shaded_vertex const& c,
+                            geometry_chunk& chunk) {
+    shaded_vertex const* v[3] = { &a, &b, &c };
+    float x[3], y[3], z[3], inv_w[3];
+    for(int i = 0; i != 3; ++i) {
+        vec4 const& p = v[i]->clip;
+        inv_w[i] = 1 / p.w;
+        x[i] = snap((p.x * inv_w[i] * 0.5f + 0.5f) * target_width);
+        y[i] = snap((p.y * inv_w[i] * 0.5f + 0.5f) * target_height);
+        z[i] = p.z * inv_w[i] * 0.5f + 0.5f;
+    }
+    double area = double(x[1] - x[0]) * (y[2] - y[0]) - double(x[2] - x[0]) * (y[1] - y[0]);
+    if(area == 0) {
+        return;
+    }
+    // both facings are drawn, the edges go counter-clockwise
+    if(area < 0) {
+        std::swap(v[1], v[2]);
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(z[1], z[2]);
+        std::swap(inv_w[1], inv_w[2]);
+        area = -area;
+    }
+
+    // pixels whose centers may be in
+    setup_triangle tri;
+    tri.x0 = std::max(0, int(std::ceil(std::min(x[0], std::min(x[1], x[2])) - 0.5f)));
+    tri.y0 = std::max(0, int(std::ceil(std::min(y[0], std::min(y[1], y[2])) - 0.5f)));
+    tri.x1 = std::min(target_width - 1, int(std::floor(std::max(x[0], std::max(x[1], x[2])) - 0.5f)));
+    tri.y1 = std::min(target_height - 1, int(std::floor(std::max(y[0], std::max(y[1], y[2])) - 0.5f)));
+    if(tri.x0 > tri.x1 || tri.y0 > tri.y1) {
+        return;
+    }
+    tri.draw = draw;
+
+    // edge i faces corner i, it is the corner's barycentric coordinate times area
+    double const ref_x = tri.x0 + 0.5;
+    double const ref_y = tri.y0 + 0.5;
+    double lambda[3][3];
+    for(int i = 0; i != 3; ++i) {
+        int const from = (i + 1) % 3;
+        int const to = (i + 2) % 3;
+        float const dx = y[from] - y[to];
+        float const dy = x[to] - x[from];
+        double const value = dx * (ref_x - x[from]) + dy * (ref_y - y[from]);
+        tri.edges[i].value = float(value);
+        tri.edges[i].dx = dx;
+        tri.edges[i].dy = dy;
+        tri.top_left[i] = dx > 0 || (dx == 0 && dy < 0);
+        lambda[i][0] = value / area;
+        lambda[i][1] = dx / area;
+        lambda[i][2] = dy / area;
+    }
+    auto make_plane = [&](float f0, float f1, float f2) {
+        plane p;
+        p.value = float(f0 * lambda[0][0] + f1 * lambda[1][0] + f2 * lambda[2][0]);
+        p.dx = float(f0 * lambda[0][1] + f1 * lambda[1][1] + f2 * lambda[2][1]);
+        p.dy = float(f0 * lambda[0][2] + f1 * lambda[1][2] + f2 * lambda[2][2]);
+        return p;
+    };
+    tri.depth = make_plane(z[0], z[1], z[2]);
+    tri.inv_w = make_plane(inv_w[0], inv_w[1], inv_w[2]);
+    for(int i = 0; i != VARYINGS; ++i) {
+        tri.varyings[i] = make_plane(v[0]->varyings[i] * inv_w[0], v[1]->varyings[i] * inv_w[1],
+                                     v[2]->varyings[i] * inv_w[2]);
+    }
+
+    uint32_t const index = uint32_t(chunk.triangles.size());
+    chunk.triangles.push_back(tri);
+    bin(chunk.triangles.back(), index, chunk);
+}
+
+void soft_rasterizer::bin(setup_triangle const& tri, uint32_t index, geometry_chunk& chunk) {
+    int const tx0 = tri.x0 / SOFT_TILE_SIZE;
+    int const tx1 = tri.x1 / SOFT_TILE_SIZE;
+    int const ty0 = tri.y0 / SOFT_TILE_SIZE;
+    int const ty1 = tri.y1 / SOFT_TILE_SIZE;
+    for(int ty = ty0; ty <= ty1; ++ty) {
+        float const rows[2] = {
+            float(std::max(ty * SOFT_TILE_SIZE, tri.y0) - tri.y0),
+            float(std::min(ty * SOFT_TILE_SIZE + SOFT_TILE_SIZE - 1, tri.y1) - tri.y0)
+        };
+        for(int tx = tx0; tx <= tx1; ++tx) {
+            float const columns[2] = {
+                float(std::max(tx * SOFT_TILE_SIZE, tri.x0) - tri.x0),
+                float(std::min(tx * SOFT_TILE_SIZE + SOFT_TILE_SIZE - 1, tri.x1) - tri.x0)
+            };
+            // the tile's pixels are all outside an edge if its most inside corner is
+            bool outside = false;
+            for(int e = 0; e != 3 && !outside; ++e) {
+                plane const& p = tri.edges[e];
+                float const best = p.value + p.dx * columns[p.dx > 0 ? 1 : 0] + p.dy * rows[p.dy > 0 ? 1 : 0];
+                outside = best < 0;
+            }
+            if(!outside) {
+                chunk.tiles[size_t(ty) * tiles_x + tx].push_back(index);
+            }
+        }
+    }
+}
+
+void soft_rasterizer::raster_tile(size_t tile) {
+    int const tx0 = int(tile % tiles_x) * SOFT_TILE_SIZE;
+    int const ty0 = int(tile / tiles_x) * SOFT_TILE_SIZE;
+    // the clear is a part of the tile's work
+    uint32_t const clear = uint32_t(std::lrint(clamp(frame.clear_color.x, 0.0f, 1.0f) * 255))
+                         | uint32_t(std::lrint(clamp(frame.clear_color.y, 0.0f, 1.0f) * 255)) << 8
+                         | uint32_t(std::lrint(clamp(frame.clear_color.z, 0.0f, 1.0f) * 255)) << 16
+                         | uint32_t(std::lrint(clamp(frame.clear_color.w, 0.0f, 1.0f) * 255)) << 24;
+    for(int y = ty0; y != ty0 + SOFT_TILE_SIZE; ++y) {
+        size_t const row = size_t(y) * stride + tx0;
+        std::fill(color.begin() + row, color.begin() + row + SOFT_TILE_SIZE, clear);
+        std::fill(depth.begin() + row, depth.begin() + row + SOFT_TILE_SIZE, 1.0f);
+    }
+    int const tx1 = std::min(tx0 + SOFT_TILE_SIZE, target_width) - 1;
+    int const ty1 = std::min(ty0 + SOFT_TILE_SIZE, target_height) - 1;
+    for(size_t c = 0; c != chunks.size(); ++c) {
+        vector<uint32_t> const& binned = chunks[c].tiles[tile];
+        for(size_t i = 0; i != binned.size(); ++i) {
+            raster_triangle(chunks[c].triangles[binned[i]], tx0, ty0, tx1, ty1);
+        }
+    }
+}
+
+void soft_rasterizer::raster_triangle(setup_triangle const& tri, int tx0, int ty0, int tx1, int ty1) {
+    int const xa = std::max(tri.x0, tx0);
+    int const xb = std::min(tri.x1, tx1);
+    int const ya = std::max(tri.y0, ty0);
+    int const yb = std::min(tri.y1, ty1);
+    draw_call const& call = draws[tri.draw];
+#ifdef SOFT_RASTER_AVX2
+    if(cpu_has_avx2()) {
+        avx2_lanes::raster_spans(tri, xa, xb, ya, yb, *call.texture, call.tint, frame.light, frame.wireframe,
+                                 color.data(), depth.data(), stride);
+        return;
+    }
+#endif
+    scalar_lanes::raster_spans(tri, xa, xb, ya, yb, *call.texture, call.tint, frame.light, frame.wireframe,
+                               color.data(), depth.data(), stride);
+}
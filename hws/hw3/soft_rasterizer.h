@@ -0,0 +1,186 @@
+#ifndef SOFT_RASTERIZER_H
+#define SOFT_RASTERIZER_H
+
+#include "common.h"
+#include "mesh_optimizer.h"
+#include "worker_pool.h"
+
+#include <cstdint>
+
+// vertices as weld_mesh() makes them; without indices every three
+// vertices are a triangle
+struct soft_mesh {
+    vector<mesh_vertex> vertices;
+    vector<uint32_t> indices;
+};
+
+// RGB8 texture with GL_REPEAT wrapping, sampled the way the GL texture
+// filtering modes of the scene do
+class soft_texture {
+public:
+    enum filtering { NEAREST, LINEAR, MIPMAP };
+
+    // pixels as glTexImage2D takes them with GL_UNSIGNED_BYTE and the default
+    // unpack alignment of 4, format is GL_RGB, GL_BGR or GL_LUMINANCE
+    soft_texture(int width, int height, GLenum format, void const* pixels);
+
+    // MIPMAP builds the levels like glGenerateMipmap, once
+    void set_filtering(filtering f);
+    filtering current_filtering() const { return mode; }
+
+    // lod is log2 of the texels a pixel covers, only MIPMAP looks at it
+    vec3 sample(float u, float v, float lod) const;
+    int width() const { return levels[0].width; }
+    int height() const { return levels[0].height; }
+
+private:
+    struct level {
+        int width;
+        int height;
+        vector<uint32_t> texels;
+    };
+    vector<level> levels;
+    filtering mode;
+
+    vec3 texel(level const& l, int x, int y) const;
+    vec3 sample_nearest(level const& l, float u, float v) const;
+    vec3 sample_linear(level const& l, float u, float v) const;
+};
+
+// the scene's light and material, as for_scene.fs takes them
+struct soft_light {
+    vec3 position_worldspace;
+    vec3 color;
+    float power;
+    vec3 ambient;
+    vec3 specular;
+};
+
+// everything a frame's draws share
+struct soft_frame {
+    mat4 proj;
+    mat4 view;
+    soft_light light;
+    float tex_coords_scale;
+    // edges over the surface like for_scene.fs compiled with WIREFRAME
+    bool wireframe;
+    vec4 clear_color;
+};
+
+// Multithreaded tile-based rasterizer of the forward lit scene, a CPU
+// stand-in for for_scene.vs and for_scene.fs without GL.
+//
+// Draws are only recorded, end_frame() runs the frame on the pool in
+// three steps: vertices of every draw are transformed once, then chunks
+// of triangles are clipped against the near plane and a guard band, set
+// up and binned into SOFT_TILE_SIZE square tiles of the target, and last
+// every tile is a task that rasterizes its triangles in submission order.
+// A tile walks rows in spans of 8 pixels: edge functions, depth test
+// (GL_LESS) and shading run on all 8 at once, with AVX2 when built for it
+// and the CPU has it, and a scalar loop over the lanes otherwise.
+class soft_rasterizer {
+public:
+    explicit soft_rasterizer(size_t workers);
+
+    // the lanes this CPU runs: "AVX2" when built with them and the CPU has
+    // AVX2 and FMA, "scalar" otherwise
+    static char const* simd_name();
+
+    size_t workers_count() const { return pool->workers_count(); }
+    void set_workers(size_t workers);
+
+    void resize(int width, int height);
+    int width() const { return target_width; }
+    int height() const { return target_height; }
+
+    void begin_frame(soft_frame const& frame);
+    // mesh and texture have to outlive end_frame(), tint multiplies the
+    // texture like instance_tint does
+    void draw(soft_mesh const& mesh, soft_texture const& texture, mat4 const& model,
+              vec3 const& tint = vec3(1));
+    void end_frame();
+
+    // RGBA8 rows from the bottom, as glReadPixels gives them
+    void read_pixels(vector<uint8_t>& rgba) const;
+
+    float frame_ms() const { return last_frame_ms; }
+    // triangles left after clipping and binned
+    size_t triangles_count() const { return last_triangles; }
+
+    static int const SOFT_TILE_SIZE = 64;
+
+private:
+    // for_scene.vs outputs, in this order, and the barycentric
+    // coordinates wireframe.gs would add
+    static int const VARYINGS = 17;
+
+    struct draw_call {
+        soft_mesh const* mesh;
+        soft_texture const* texture;
+        mat4 model;
+        vec3 tint;
+        // first vertex in transformed, first triangle in the frame
+        size_t first_vertex;
+        size_t first_triangle;
+    };
+    struct shaded_vertex {
+        vec4 clip;
+        float varyings[VARYINGS];
+    };
+    // a plane over the pixels: value at the pixel (x0, y0) of the box,
+    // change by one pixel right and up
+    struct plane {
+        float value;
+        float dx;
+        float dy;
+    };
+    struct setup_triangle {
+        int x0, y0, x1, y1;
+        uint32_t draw;
+        plane edges[3];
+        // the pixel on an edge is in on top and left edges
+        bool top_left[3];
+        plane depth;
+        plane inv_w;
+        // varyings divided by w
+        plane varyings[VARYINGS];
+    };
+    // a triangle chunk's output, triangle indices by tile
+    struct geometry_chunk {
+        size_t first_triangle;
+        size_t end_triangle;
+        vector<setup_triangle> triangles;
+        vector<vector<uint32_t> > tiles;
+    };
+
+    unique_ptr<worker_pool> pool;
+
+    int target_width;
+    int target_height;
+    // rows are padded to whole tiles, so spans never leave the buffers
+    int stride;
+    int tiles_x;
+    int tiles_y;
+    vector<uint32_t> color;
+    vector<float> depth;
+
+    soft_frame frame;
+    vector<draw_call> draws;
+    vector<shaded_vertex> transformed;
+    size_t frame_triangles;
+    vector<geometry_chunk> chunks;
+
+    float last_frame_ms;
+    size_t last_triangles;
+
+    void transform_vertices(size_t draw, size_t begin, size_t end);
+    void process_chunk(geometry_chunk& chunk);
+    void clip_and_setup(uint32_t draw, shaded_vertex const* const corners[3], geometry_chunk& chunk);
+    void setup(uint32_t draw, shaded_vertex const& a, shaded_vertex const& b, shaded_vertex const& c,
+               geometry_chunk& chunk);
+    void bin(setup_triangle const& tri, uint32_t index, geometry_chunk& chunk);
+    void raster_tile(size_t tile);
+    void raster_triangle(setup_triangle const& tri, int tx0, int ty0, int tx1, int ty1);
+};
+
+#endif // SOFT_RASTERIZER_H
@@ -0,0 +1,238 @@
+#include "tiled_filter.h"
+#include "batch_filter.h"
+#include "filter_fusion.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+using std::ofstream;
+
+// Binary PPM, read one row at a time
+class ppm_reader {
+public:
+    explicit ppm_reader(string const& path)
+        : in(path.c_str(), std::ios::binary)
+    {
+        if(!in.good()) {
+            throw msg_exception("can't open " + path);
+        }
+        if(read_token() != "P6") {
+            throw msg_exception(path + " is not a binary PPM");
+        }
+        width = std::atoi(read_token().c_str());
+        height = std::atoi(read_token().c_str());
+        if(std::atoi(read_token().c_str()) != 255 || width <= 0 || height <= 0) {
+            throw msg_exception(path + ": only 8 bit PPM is supported");
+        }
+        // single whitespace character separates the header from the data
+        in.get();
+    }
+
+    void read_row(BYTE* dst) {
+        in.read(reinterpret_cast<char*>(dst), width * 3);
+        if(!in.good()) {
+            throw msg_exception("unexpected end of PPM data");
+        }
+    }
+
+    int width;
+    int height;
+
+private:
+    ifstream in;
+
+    string read_token() {
+        string token;
+        int c = in.get();
+        while(c != EOF && (std::isspace(c) || c == '#')) {
+            if(c == '#') {
+                while(c != EOF && c != '\n') {
+                    c = in.get();
+                }
+            }
+            c = in.get();
+        }
+        while(c != EOF && !std::isspace(c)) {
+            token += char(c);
+            c = in.get();
+        }
+        if(c != EOF) {
+            in.unget();
+        }
+        return token;
+    }
+};
+
+class ppm_writer {
+public:
+    ppm_writer(string const& path, int width, int height)
+        : out(path.c_str(), std::ios::binary)
+        , width(width)
+    {
+        if(!out.good()) {
+            throw msg_exception("can't create " + path);
+        }
+        out << "P6\n" << width << " " << height << "\n255\n";
+    }
+
+    void write_rows(BYTE const* src, int rows) {
+        out.write(reinterpret_cast<char const*>(src), std::streamsize(width) * 3 * rows);
+        if(!out.good()) {
+            throw msg_exception("PPM write error");
+        }
+    }
+
+private:
+    ofstream out;
+    int width;
+};
+
+tiled_options parse_tiled_options(int argc, char** argv) {
+    if(argc < 3) {
+        throw msg_exception("usage: main --tiled <input.ppm> <output.ppm> <filter,filter,...> "
+                            "[--radius n] [--variance v] [--sobel-threshold t] [--threshold t] "
+                            "[--exposure e] [--gamma g] [--fuse taps] [--tile n]");
+    }
+    tiled_options options;
+    options.input_path = argv[0];
+    options.output_path = argv[1];
+    options.chain = parse_filter_chain(argv[2]);
+    for(int i = 3; i < argc; i += 2) {
+        string const key = argv[i];
+        if(i + 1 >= argc) {
+            throw msg_exception("missing value for " + key);
+        }
+        char const* value = argv[i + 1];
+        if(parse_filter_option(key, value, options.params, options.fuse_taps)) {
+            continue;
+        } else if(key == "--tile") {
+            options.tile_size = std::atoi(value);
+        } else {
+            throw msg_exception("unknown option: " + key);
+        }
+    }
+    return options;
+}
+
+// copies an image row into a window row, replicating the edge pixels
+// into the halo on both sides
+static void fill_window_row(BYTE* dst, BYTE const* src, int width, int halo, int padded_width) {
+    std::memcpy(dst + halo * 3, src, width * 3);
+    for(int x = 0; x != halo; ++x) {
+        std::memcpy(dst + x * 3, src, 3);
+    }
+    for(int x = halo + width; x != padded_width; ++x) {
+        std::memcpy(dst + x * 3, src + (width - 1) * 3, 3);
+    }
+}
+
+void run_tiled_filter(tiled_options const& options, program_cache& programs) {
+    ppm_reader reader(options.input_path);
+    int const width = reader.width;
+    int const height = reader.height;
+
+    GLint max_texture_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    GLint max_viewport[2] = { 0, 0 };
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport);
+    int const tile_size = std::min(options.tile_size,
+                                   std::min<int>(max_texture_size, std::min(max_viewport[0], max_viewport[1])));
+
+    filter_support const halo = chain_support(options.chain, options.params);
+    int const tile_width = std::min(tile_size - 2 * halo.x, width);
+    int const tile_height = std::min(tile_size - 2 * halo.y, height);
+    if(tile_width <= 0 || tile_height <= 0) {
+        throw msg_exception("tile size " + std::to_string(tile_size) + " is too small for the filter support");
+    }
+    int const tiles_x = (width + tile_width - 1) / tile_width;
+
+    // The window holds the rows of one strip plus the halo rows above and
+    // below, and is wide enough for every tile of the strip to be full
+    // sized. Everything outside the image replicates the nearest edge.
+    int const padded_width = tiles_x * tile_width + 2 * halo.x;
+    int const window_height = tile_height + 2 * halo.y;
+    size_t const window_pitch = size_t(padded_width) * 3;
+    vector<BYTE> window(window_pitch * window_height);
+    vector<BYTE> row(size_t(width) * 3);
+    vector<BYTE> strip(size_t(width) * 3 * tile_height);
+
+    ppm_writer writer(options.output_path, width, height);
+    filter_pipeline pipeline(programs);
+    pipeline.resize(tile_width + 2 * halo.x, window_height);
+
+    bool const fuse = options.fuse_taps != 0;
+    vector<fused_pass> const passes = fuse_filter_chain(options.chain, options.params, options.fuse_taps);
+    GLuint const vx_shader = programs.shader(GL_VERTEX_SHADER, FILTERED_VERTEX_SHADER_PATH);
+    unique_ptr<fused_programs> fused(fuse ? new fused_programs(passes, vx_shader) : 0);
+    if(fuse) {
+        utils::debug(fusion_report(options.chain, passes, pipeline.width(), pipeline.height()));
+    }
+
+    utils::debug("tiled: " + std::to_string(width) + "x" + std::to_string(height)
+                 + " in tiles of " + std::to_string(tile_width) + "x" + std::to_string(tile_height)
+                 + ", halo " + std::to_string(halo.x) + "x" + std::to_string(halo.y)
+                 + ", " + std::to_string((window.size() + strip.size()) >> 20) + " MB of buffers");
+
+    chrono::system_clock::time_point const start = chrono::system_clock::now();
+    size_t tiles_done = 0;
+
+    for(int y0 = 0; y0 < height; y0 += tile_height) {
+        int first_new_row = 0;
+        if(y0 != 0) {
+            // halo rows of the previous strip are reused
+            std::memmove(window.data(), window.data() + tile_height * window_pitch, 2 * halo.y * window_pitch);
+            first_new_row = 2 * halo.y;
+        }
+        for(int i = first_new_row; i < window_height; ++i) {
+            int const r = y0 - halo.y + i;
+            BYTE* dst = window.data() + i * window_pitch;
+            if(r < 0) {
+                continue;
+            } else if(r < height) {
+                reader.read_row(row.data());
+                fill_window_row(dst, row.data(), width, halo.x, padded_width);
+            } else {
+                std::memcpy(dst, dst - window_pitch, window_pitch);
+            }
+        }
+        if(y0 == 0) {
+            for(int i = 0; i != halo.y; ++i) {
+                std::memcpy(window.data() + i * window_pitch, window.data() + halo.y * window_pitch, window_pitch);
+            }
+        }
+
+        int const rows = std::min(tile_height, height - y0);
+        for(int tx = 0; tx != tiles_x; ++tx) {
+            int const x0 = tx * tile_width;
+            int const columns = std::min(tile_width, width - x0);
+
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, padded_width);
+            pipeline.load_source(GL_RGB, window.data() + x0 * 3);
+
+            if(fuse) {
+                pipeline.apply(fused->programs());
+            } else {
+                pipeline.apply(options.chain, options.params);
+            }
+
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glPixelStorei(GL_PACK_ROW_LENGTH, width);
+            pipeline.read_result(GL_RGB, halo.x, halo.y, columns, rows, strip.data() + x0 * 3);
+            ++tiles_done;
+        }
+        writer.write_rows(strip.data(), rows);
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    float const seconds = chrono::duration<float>(chrono::system_clock::now() - start).count();
+    cout << "tiled: " << tiles_done << " tiles in " << seconds << " s, "
+         << (seconds > 0 ? float(width) * height / seconds / 1e6f : 0) << " Mpixels/s" << endl;
+}
@@ -0,0 +1,37 @@
+#ifndef TILED_FILTER_H
+#define TILED_FILTER_H
+
+#include "common.h"
+#include "filter_pipeline.h"
+
+// Filters images larger than GL_MAX_TEXTURE_SIZE. The source is streamed
+// in horizontal strips, every strip is cut into tiles padded with a halo
+// as wide as the support of the filter chain, and only the tile interiors
+// are written out. Memory use is O(image width * tile size).
+//
+//   main --tiled <input.ppm> <output.ppm> <filters> [options]
+//
+// Input and output are binary PPM (P6), which can be read and written
+// row by row. Options are the batch ones plus --tile <n>, the tile size
+// including the halo. Fused stencils have the same support as the
+// passes they replace, so fusion does not change the halo.
+struct tiled_options {
+    string input_path;
+    string output_path;
+    vector<filter> chain;
+    filter_params params;
+    size_t fuse_taps;
+    int tile_size;
+
+    tiled_options()
+        : fuse_taps(49)
+        , tile_size(2048)
+    {}
+};
+
+tiled_options parse_tiled_options(int argc, char** argv);
+
+// needs a current GL context
+void run_tiled_filter(tiled_options const& options, program_cache& programs);
+
+#endif // TILED_FILTER_H
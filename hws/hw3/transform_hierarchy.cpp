@@ -0,0 +1,207 @@
+#include "transform_hierarchy.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define TRANSFORM_HIERARCHY_SSE
+#endif
+
+// out = a * b, column-major like glm
+static void multiply(float const* a, float const* b, float* out) {
+#ifdef TRANSFORM_HIERARCHY_SSE
+    __m128 const a0 = _mm_loadu_ps(a);
+    __m128 const a1 = _mm_loadu_ps(a + 4);
+    __m128 const a2 = _mm_loadu_ps(a + 8);
+    __m128 const a3 = _mm_loadu_ps(a + 12);
+    for(int column = 0; column != 4; ++column) {
+        float const* const bc = b + column * 4;
+        __m128 const r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(bc[0])), _mm_mul_ps(a1, _mm_set1_ps(bc[1]))),
+                                    _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(bc[2])), _mm_mul_ps(a3, _mm_set1_ps(bc[3]))));
+        _mm_storeu_ps(out + column * 4, r);
+    }
+#else
+    for(int column = 0; column != 4; ++column) {
+        for(int row = 0; row != 4; ++row) {
+            out[column * 4 + row] = a[row] * b[column * 4] + a[4 + row] * b[column * 4 + 1]
+                                  + a[8 + row] * b[column * 4 + 2] + a[12 + row] * b[column * 4 + 3];
+        }
+    }
+#endif
+}
+
+uint32_t const transform_hierarchy::NO_PARENT;
+
+transform_hierarchy::transform_hierarchy()
+    : updated(0)
+    , unordered(false)
+{}
+
+uint32_t transform_hierarchy::add(uint32_t parent, mat4 const& local) {
+    uint32_t const id = uint32_t(slots.size());
+    // appended as is, reorder() finds its place
+    slots.push_back(uint32_t(locals.size()));
+    parent_ids.push_back(parent);
+    locals.push_back(local);
+    worlds.push_back(local);
+    unordered = true;
+    return id;
+}
+
+void transform_hierarchy::set_local(uint32_t node, mat4 const& local) {
+    uint32_t const slot = slots[node];
+    locals[slot] = local;
+    if(!unordered && !dirty[slot]) {
+        dirty[slot] = 1;
+        pending.push_back(node);
+    }
+}
+
+void transform_hierarchy::recompute(uint32_t slot) {
+    uint32_t const parent = parents[slot];
+    if(parent == NO_PARENT) {
+        worlds[slot] = locals[slot];
+    } else {
+        multiply(&worlds[parent][0][0], &locals[slot][0][0], &worlds[slot][0][0]);
+    }
+}
+
+// breadth first from the roots, children in id order
+void transform_hierarchy::reorder() {
+    size_t const count = slots.size();
+    vector<uint32_t> children_first(count + 1, 0);
+    for(size_t id = 0; id != count; ++id) {
+        if(parent_ids[id] != NO_PARENT) {
+            ++children_first[parent_ids[id] + 1];
+        }
+    }
+    for(size_t id = 0; id != count; ++id) {
+        children_first[id + 1] += children_first[id];
+    }
+    vector<uint32_t> children(children_first[count]);
+    vector<uint32_t> filled(children_first.begin(), children_first.end() - 1);
+    vector<uint32_t> order;
+    order.reserve(count);
+    for(size_t id = 0; id != count; ++id) {
+        if(parent_ids[id] == NO_PARENT) {
+            order.push_back(uint32_t(id));
+        } else {
+            children[filled[parent_ids[id]]++] = uint32_t(id);
+        }
+    }
+    for(size_t i = 0; i != order.size(); ++i) {
+        uint32_t const id = order[i];
+        order.insert(order.end(), children.begin() + children_first[id], children.begin() + children_first[id + 1]);
+    }
+
+    vector<mat4> new_locals(count);
+    parents.assign(count, NO_PARENT);
+    first_child.assign(count, 0);
+    child_count.assign(count, 0);
+    depths.assign(count, 0);
+    vector<uint32_t> new_slots(count);
+    for(size_t slot = 0; slot != count; ++slot) {
+        uint32_t const id = order[slot];
+        new_locals[slot] = locals[slots[id]];
+        new_slots[id] = uint32_t(slot);
+        if(parent_ids[id] != NO_PARENT) {
+            uint32_t const parent = new_slots[parent_ids[id]];
+            parents[slot] = parent;
+            depths[slot] = depths[parent] + 1;
+            if(child_count[parent]++ == 0) {
+                first_child[parent] = uint32_t(slot);
+            }
+        }
+    }
+    locals.swap(new_locals);
+    slots.swap(new_slots);
+    dirty.assign(count, 0);
+    levels.resize(count == 0 ? 0 : depths.back() + 1);
+    pending.clear();
+    unordered = false;
+}
+
+void transform_hierarchy::update() {
+    updated = 0;
+    if(unordered) {
+        reorder();
+        // parents come first
+        for(uint32_t slot = 0; slot != locals.size(); ++slot) {
+            recompute(slot);
+        }
+        updated = locals.size();
+        return;
+    }
+    if(pending.empty()) {
+        return;
+    }
+    size_t top = levels.size();
+    for(size_t i = 0; i != pending.size(); ++i) {
+        uint32_t const slot = slots[pending[i]];
+        levels[depths[slot]].push_back(slot);
+        top = std::min<size_t>(top, depths[slot]);
+    }
+    pending.clear();
+    // every level is final before the next one reads it
+    for(size_t depth = top; depth != levels.size(); ++depth) {
+        vector<uint32_t>& level = levels[depth];
+        if(level.empty()) {
+            continue;
+        }
+        for(size_t k = 0; k != level.size(); ++k) {
+            recompute(level[k]);
+        }
+        if(depth + 1 != levels.size()) {
+            vector<uint32_t>& next = levels[depth + 1];
+            for(size_t k = 0; k != level.size(); ++k) {
+                uint32_t const slot = level[k];
+                uint32_t const end = first_child[slot] + child_count[slot];
+                for(uint32_t child = first_child[slot]; child != end; ++child) {
+                    if(!dirty[child]) {
+                        dirty[child] = 1;
+                        next.push_back(child);
+                    }
+                }
+            }
+        }
+        for(size_t k = 0; k != level.size(); ++k) {
+            dirty[level[k]] = 0;
+        }
+        updated += level.size();
+        level.clear();
+    }
+}
+
+void report_hierarchy_update(size_t nodes, float dirty_fraction) {
+    size_t const FRAMES = 100;
+    size_t const FANOUT = 8;
+    std::mt19937 random(1);
+    transform_hierarchy hierarchy;
+    // wide and shallow like a scene of groups of objects, most nodes are leaves
+    for(size_t i = 0; i != nodes; ++i) {
+        uint32_t const parent = i == 0 ? transform_hierarchy::NO_PARENT : uint32_t((i - 1) / FANOUT);
+        hierarchy.add(parent, translate(mat4(), vec3(1, 0, 0)));
+    }
+    hierarchy.update();
+
+    size_t const changed = std::max<size_t>(1, size_t(nodes * dirty_fraction));
+    chrono::high_resolution_clock::duration total(0);
+    size_t updated = 0;
+    for(size_t frame = 0; frame != FRAMES; ++frame) {
+        mat4 const local = mat4_cast(angleAxis(float(frame), vec3(0, 1, 0)));
+        for(size_t i = 0; i != changed; ++i) {
+            hierarchy.set_local(uint32_t(random() % nodes), local);
+        }
+        chrono::high_resolution_clock::time_point const start = chrono::high_resolution_clock::now();
+        hierarchy.update();
+        total += chrono::high_resolution_clock::now() - start;
+        updated += hierarchy.updated_count();
+    }
+    float const ms = chrono::duration<float, std::milli>(total).count() / FRAMES;
+    char line[160];
+    std::snprintf(line, sizeof(line), "%zu nodes, %zu changed per frame, %zu recomputed with descendants: %.3f ms per update",
+                  nodes, changed, updated / FRAMES, ms);
+    cout << line << endl;
+}
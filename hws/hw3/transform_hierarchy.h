@@ -0,0 +1,69 @@
+#ifndef TRANSFORM_HIERARCHY_H
+#define TRANSFORM_HIERARCHY_H
+
+#include "common.h"
+
+#include <cstdint>
+
+// Parent/child transforms of a scene. Node data is kept as separate
+// arrays (local and world matrices, parents, children ranges, dirty flags)
+// in breadth-first order: sorted by depth, with the children of a node
+// next to each other. set_local() marks a node dirty; update() walks down
+// from the dirty nodes a level at a time and recomputes them and their
+// descendants with SSE matrix products, so its cost follows the number of
+// changed nodes, not the size of the scene.
+//
+// Node ids stay valid when the arrays are reordered.
+class transform_hierarchy {
+public:
+    static uint32_t const NO_PARENT = uint32_t(-1);
+
+    transform_hierarchy();
+
+    // parent is NO_PARENT or an existing node; the next update() reorders
+    // the arrays and recomputes every node
+    uint32_t add(uint32_t parent, mat4 const& local);
+    void set_local(uint32_t node, mat4 const& local);
+
+    mat4 const& local(uint32_t node) const { return locals[slots[node]]; }
+    // as of the last update()
+    mat4 const& world(uint32_t node) const { return worlds[slots[node]]; }
+    size_t size() const { return slots.size(); }
+
+    // recomputes what changed since the last call
+    void update();
+    // nodes the last update() recomputed
+    size_t updated_count() const { return updated; }
+
+private:
+    // by slot, breadth first
+    vector<mat4> locals;
+    vector<mat4> worlds;
+    // slot of the parent, NO_PARENT for roots
+    vector<uint32_t> parents;
+    vector<uint32_t> first_child;
+    vector<uint32_t> child_count;
+    vector<uint32_t> depths;
+    vector<uint8_t> dirty;
+
+    // by node id
+    vector<uint32_t> slots;
+    vector<uint32_t> parent_ids;
+
+    // ids passed to set_local() since the last update()
+    vector<uint32_t> pending;
+    // dirty slots of every depth
+    vector<vector<uint32_t> > levels;
+    size_t updated;
+    bool unordered;
+
+    void reorder();
+    void recompute(uint32_t slot);
+};
+
+// Builds a tree of nodes with eight children each, changes dirty_fraction
+// of them at random per frame and prints the time update() takes, no GL
+// needed.
+void report_hierarchy_update(size_t nodes, float dirty_fraction);
+
+#endif // TRANSFORM_HIERARCHY_H
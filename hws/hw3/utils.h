@@ -4,6 +4,7 @@
 #include <exception>
 #include <string>
 #include "common.h"
+#include "gl_state_cache.h"
 #include <FreeImage.h>
 #include "libs/tiny_obj_loader.h"
 
@@ -105,8 +106,12 @@ public:
     }
 
     static void set_vertex_attr_ptr(GLuint program, vertex_attr const& attr) {
-        GLuint location = glGetAttribLocation(program, attr.name);
-        glEnableVertexAttribArray(location);
+        GLint const location = glGetAttribLocation(program, attr.name);
+        // stand-in programs may not read every attribute
+        if(location < 0) {
+            return;
+        }
+        gl_cache().enable_vertex_attrib_array(location);
         glVertexAttribPointer(location, attr.size, attr.type,
                               attr.normalized, attr.stride, attr.pointer);
     }
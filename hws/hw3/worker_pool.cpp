@@ -0,0 +1,81 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+
+worker_pool::worker_pool(size_t workers)
+    : job(NULL)
+    , tasks_count(0)
+    , next_task(0)
+    , busy(0)
+    , generation(0)
+    , stopping(false)
+{
+    for(size_t i = 1; i < workers; ++i) {
+        threads.push_back(std::thread([this, i] { thread_main(i); }));
+    }
+}
+
+worker_pool::~worker_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    started.notify_all();
+    for(size_t i = 0; i != threads.size(); ++i) {
+        threads[i].join();
+    }
+}
+
+size_t worker_pool::hardware_workers() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void worker_pool::drain(size_t worker, std::unique_lock<std::mutex>& lock) {
+    // a thread waking up late finds the run over and job reset
+    while(job && next_task < tasks_count) {
+        task_function const& fn = *job;
+        size_t const task = next_task++;
+        ++busy;
+        lock.unlock();
+        fn(task, worker);
+        lock.lock();
+        --busy;
+    }
+}
+
+void worker_pool::run(size_t tasks, task_function const& fn) {
+    if(tasks == 0) {
+        return;
+    }
+    if(threads.empty() || tasks == 1) {
+        for(size_t task = 0; task != tasks; ++task) {
+            fn(task, 0);
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    job = &fn;
+    tasks_count = tasks;
+    next_task = 0;
+    ++generation;
+    started.notify_all();
+    drain(0, lock);
+    finished.wait(lock, [this] { return busy == 0; });
+    job = NULL;
+}
+
+void worker_pool::thread_main(size_t worker) {
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t seen = generation;
+    for(;;) {
+        started.wait(lock, [&] { return stopping || generation != seen; });
+        if(stopping) {
+            return;
+        }
+        seen = generation;
+        drain(worker, lock);
+        if(busy == 0) {
+            finished.notify_one();
+        }
+    }
+}